@@ -34,8 +34,9 @@
 #define __LIGHTHOUSE_H__
 
 #include "lighthouse_geometry.h"
+#include "pulse_processor.h"
 
-extern baseStationGeometry_t lighthouseBaseStationsGeometry[2];
+extern baseStationGeometry_t lighthouseBaseStationsGeometry[PULSE_PROCESSOR_N_BASE_STATIONS];
 
 /**
  * @brief Call when the lighthouseBaseStationsGeometry data has been updated
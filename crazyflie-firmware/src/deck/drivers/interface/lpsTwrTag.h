@@ -28,6 +28,11 @@
 #define LOCODECK_NR_OF_TWR_ANCHORS 8
 #endif
 
+// The ranging state reported to the locodeck is a 16 bit mask
+#if LOCODECK_NR_OF_TWR_ANCHORS > 16
+#error "TWR supports at most 16 anchors"
+#endif
+
 extern uwbAlgorithm_t uwbTwrTagAlgorithm;
 
 typedef struct {
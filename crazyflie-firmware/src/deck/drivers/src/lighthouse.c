@@ -50,6 +50,7 @@
 #include "lh_bootloader.h"
 
 #include "pulse_processor.h"
+#include "lighthouse_frame.h"
 #include "lighthouse.h"
 
 #include "estimator.h"
@@ -63,7 +64,9 @@
 //  #define DISABLE_LIGHTHOUSE_DRIVER 1
 //#endif
 
-baseStationGeometry_t lighthouseBaseStationsGeometry[2]  = {
+// Geometry of the base stations, set through the LH memory. A base station
+// without geometry (all zero rotation matrix) is not used by the estimator.
+baseStationGeometry_t lighthouseBaseStationsGeometry[PULSE_PROCESSOR_N_BASE_STATIONS]  = {
 {.origin = {-1.678933, -2.346900, 2.620084, }, .mat = {{0.547433, -0.821713, 0.158445, }, {0.741131, 0.563978, 0.364216, }, {-0.388641, -0.081955, 0.917737, }, }},
 {.origin = {1.693073, 2.412071, 2.668153, }, .mat = {{-0.490228, 0.843023, -0.221329, }, {-0.756728, -0.537672, -0.371848, }, {-0.432480, -0.014804, 0.901522, }, }},
 };
@@ -77,8 +80,11 @@ static bool isInit = false;
   void lightHouseGeometryDataUpdated() { /* Empty by design */ }
 #else
 
-baseStationEulerAngles_t lighthouseBaseStationAngles[2];
-static mat3d baseStationInvertedRotationMatrixes[2];
+baseStationEulerAngles_t lighthouseBaseStationAngles[PULSE_PROCESSOR_N_BASE_STATIONS];
+static mat3d baseStationInvertedRotationMatrixes[PULSE_PROCESSOR_N_BASE_STATIONS];
+static bool baseStationGeometryValid[PULSE_PROCESSOR_N_BASE_STATIONS];
+// Highest base station with a valid geometry, or -1 if none
+static int lastBaseStation = -1;
 
 // Sensor positions on the deck
 #define SENSOR_POS_W (0.015f / 2.0f)
@@ -129,41 +135,23 @@ static bool comSynchronized = false;
 #define ONE_SECOND 1000
 #define HALF_SECOND 500
 static STATS_CNT_RATE_DEFINE(serialFrameRate, ONE_SECOND);
+static STATS_CNT_RATE_DEFINE(resyncRate, ONE_SECOND);
 static STATS_CNT_RATE_DEFINE(frameRate, ONE_SECOND);
 static STATS_CNT_RATE_DEFINE(cycleRate, ONE_SECOND);
 static STATS_CNT_RATE_DEFINE(positionRate, ONE_SECOND);
 
-static STATS_CNT_RATE_DEFINE(estBs0Rate, HALF_SECOND);
-static STATS_CNT_RATE_DEFINE(estBs1Rate, HALF_SECOND);
-static statsCntRateLogger_t* bsEstRates[2] = {&estBs0Rate, &estBs1Rate};
-
-static STATS_CNT_RATE_DEFINE(bs0Rate, HALF_SECOND);
-static STATS_CNT_RATE_DEFINE(bs1Rate, HALF_SECOND);
-static statsCntRateLogger_t* bsRates[2] = {&bs0Rate, &bs1Rate};
+// Initialized in lighthouseInit()
+static statsCntRateLogger_t bsEstRates[PULSE_PROCESSOR_N_BASE_STATIONS];
+static statsCntRateLogger_t bsRates[PULSE_PROCESSOR_N_BASE_STATIONS];
 
 static uint16_t pulseWidth[PULSE_PROCESSOR_N_SENSORS];
 
-typedef union frame_u {
-  struct {
-    uint32_t timestamp:29;
-    uint32_t sensor:3;
-    uint16_t width;
-    uint8_t sync;
-  } __attribute__((packed));
-  char data[7];
-} __attribute__((packed)) frame_t;
-
-static bool getFrame(frame_t *frame)
-{
-  int syncCounter = 0;
-  for(int i=0; i<7; i++) {
-    uart1Getchar(&frame->data[i]);
-    if (frame->data[i] != 0) {
-      syncCounter += 1;
-    }
-  }
-  return (frame->sync == 0 || (syncCounter==7));
-}
+// Bytes received from the deck, read in blocks from the UART DMA buffer
+#define RX_BLOCK_SIZE (UART1_RX_DMA_BUFFER_SIZE / 2)
+static uint8_t rxBuffer[RX_BLOCK_SIZE + LIGHTHOUSE_FRAME_LENGTH];
+static uint32_t rxBufferLength = 0;
+static lighthouseFrameParser_t frameParser;
+static uint32_t resyncCount = 0;
 
 static vec3d position;
 static float deltaLog;
@@ -177,20 +165,34 @@ static float sweepStd = 0.0004;
 //     estimator as pre-calculated.
 // 1 = Sweep angles pushed into the estimator. Yaw error calculated outside the estimator
 //     and pushed to the estimator as a pre-calculated value.
-static uint8_t estimationMethod = 0;
+// 2 = Same as 1, but the sweep angles of all sensors from one base station frame are
+//     pushed as one batch, gated per angle and fused in one update by the estimator.
+static uint8_t estimationMethod = 2;
+
+#if PULSE_PROCESSOR_N_SENSORS > SWEEP_ANGLE_BATCH_MAX_SENSORS
+#error "A sweep angle batch can not hold the angles of all sensors"
+#endif
 
 static void estimatePositionCrossingBeams(pulseProcessorResult_t* angles, int baseStation) {
   memset(&ext_pos, 0, sizeof(ext_pos));
   int sensorsUsed = 0;
   float delta;
 
-  // Average over all sensors with valid data
+  // Average over all sensors and base station pairs with valid data
   for (size_t sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
-      pulseProcessorBaseStationMeasuremnt_t* bs0Measurement = &angles->sensorMeasurements[sensor].baseStatonMeasurements[0];
-      pulseProcessorBaseStationMeasuremnt_t* bs1Measurement = &angles->sensorMeasurements[sensor].baseStatonMeasurements[1];
+    for (int bs1 = 0; bs1 <= lastBaseStation; bs1++) {
+      pulseProcessorBaseStationMeasuremnt_t* bs1Measurement = &angles->sensorMeasurements[sensor].baseStatonMeasurements[bs1];
+      if (!baseStationGeometryValid[bs1] || bs1Measurement->validCount != PULSE_PROCESSOR_N_SWEEPS) {
+        continue;
+      }
 
-      if (bs0Measurement->validCount == PULSE_PROCESSOR_N_SWEEPS && bs1Measurement->validCount == PULSE_PROCESSOR_N_SWEEPS) {
-        lighthouseGeometryGetPositionFromRayIntersection(lighthouseBaseStationsGeometry, bs0Measurement->correctedAngles, bs1Measurement->correctedAngles, position, &delta);
+      for (int bs2 = bs1 + 1; bs2 <= lastBaseStation; bs2++) {
+        pulseProcessorBaseStationMeasuremnt_t* bs2Measurement = &angles->sensorMeasurements[sensor].baseStatonMeasurements[bs2];
+        if (!baseStationGeometryValid[bs2] || bs2Measurement->validCount != PULSE_PROCESSOR_N_SWEEPS) {
+          continue;
+        }
+
+        lighthouseGeometryGetPositionFromRayIntersection(&lighthouseBaseStationsGeometry[bs1], &lighthouseBaseStationsGeometry[bs2], bs1Measurement->correctedAngles, bs2Measurement->correctedAngles, position, &delta);
 
         deltaLog = delta;
 
@@ -201,6 +203,7 @@ static void estimatePositionCrossingBeams(pulseProcessorResult_t* angles, int ba
 
         STATS_CNT_RATE_EVENT(&positionRate);
       }
+    }
   }
 
   ext_pos.x /= sensorsUsed;
@@ -215,6 +218,10 @@ static void estimatePositionCrossingBeams(pulseProcessorResult_t* angles, int ba
 }
 
 static void estimatePositionSweeps(pulseProcessorResult_t* angles, int baseStation) {
+  if (!baseStationGeometryValid[baseStation]) {
+    return;
+  }
+
   for (size_t sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
     pulseProcessorBaseStationMeasuremnt_t* bsMeasurement = &angles->sensorMeasurements[sensor].baseStatonMeasurements[baseStation];
     if (bsMeasurement->validCount == PULSE_PROCESSOR_N_SWEEPS) {
@@ -233,10 +240,46 @@ static void estimatePositionSweeps(pulseProcessorResult_t* angles, int baseStati
         sweepAngles.baseStationRotInv = &baseStationInvertedRotationMatrixes[baseStation];
 
         estimatorEnqueueSweepAngles(&sweepAngles);
-        STATS_CNT_RATE_EVENT(bsEstRates[baseStation]);
+        STATS_CNT_RATE_EVENT(&bsEstRates[baseStation]);
+      }
+    }
+  }
+}
+
+static void estimatePositionSweepBatch(pulseProcessorResult_t* angles, int baseStation) {
+  static sweepAngleBatchMeasurement_t batch;
+
+  if (!baseStationGeometryValid[baseStation]) {
+    return;
+  }
+
+  batch.sensorCount = 0;
+  for (size_t sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+    pulseProcessorBaseStationMeasuremnt_t* bsMeasurement = &angles->sensorMeasurements[sensor].baseStatonMeasurements[baseStation];
+    if (bsMeasurement->validCount == PULSE_PROCESSOR_N_SWEEPS) {
+      float angleX = bsMeasurement->correctedAngles[0];
+      float angleY = bsMeasurement->correctedAngles[1];
+
+      if (angleX != 0 && angleY != 0) {
+        batch.sensors[batch.sensorCount].sensorPos = &sensorDeckPositions[sensor];
+        batch.sensors[batch.sensorCount].angleX = angleX;
+        batch.sensors[batch.sensorCount].angleY = angleY;
+        batch.sensorCount++;
+        STATS_CNT_RATE_EVENT(&bsEstRates[baseStation]);
       }
     }
   }
+
+  if (batch.sensorCount > 0) {
+    // The angles of the frame are complete as it is processed
+    batch.timestamp = xTaskGetTickCount();
+    batch.stdDev = sweepStd;
+    batch.baseStationPos = &lighthouseBaseStationsGeometry[baseStation].origin;
+    batch.baseStationRot = &lighthouseBaseStationsGeometry[baseStation].mat;
+    batch.baseStationRotInv = &baseStationInvertedRotationMatrixes[baseStation];
+
+    estimatorEnqueueSweepAngleBatch(&batch);
+  }
 }
 
 static bool estimateYawDeltaOneBaseStation(const int bs, const pulseProcessorResult_t* angles, baseStationGeometry_t baseStationGeometries[], const float cfPos[3], const float n[3], const arm_matrix_instance_f32 *RR, float *yawDelta) {
@@ -288,6 +331,10 @@ static void estimateYaw(pulseProcessorResult_t* angles, int baseStation) {
   // bit dirty to get the state from the kalman filer here and calculate the yaw error outside
   // the estimator, but it will do for now.
 
+  if (!baseStationGeometryValid[baseStation]) {
+    return;
+  }
+
   // Get data from the current estimated state
   point_t cfPosP;
   estimatorKalmanGetEstimatedPos(&cfPosP);
@@ -319,6 +366,11 @@ static void estimatePoseSweeps(pulseProcessorResult_t* angles, int baseStation)
   estimateYaw(angles, baseStation);
 }
 
+static void estimatePoseSweepBatch(pulseProcessorResult_t* angles, int baseStation) {
+  estimatePositionSweepBatch(angles, baseStation);
+  estimateYaw(angles, baseStation);
+}
+
 static void invertRotationMatrix(mat3d rot, mat3d inverted) {
   // arm_mat_inverse_f32() alters the original matrix in the process, must make a copy to work from
   float bs_r_tmp[3][3];
@@ -330,16 +382,19 @@ static void invertRotationMatrix(mat3d rot, mat3d inverted) {
 }
 
 static void usePulseResultCrossingBeams(pulseProcessor_t *appState, pulseProcessorResult_t* angles, int basestation, int axis) {
-  if (basestation == 1 && axis == sweepDirection_y) {
+  // Base stations sweep in order, all of them have been measured once the last one is done
+  if (basestation == lastBaseStation && axis == sweepDirection_y) {
     STATS_CNT_RATE_EVENT(&cycleRate);
 
-    pulseProcessorApplyCalibration(appState, angles, 0);
-    pulseProcessorApplyCalibration(appState, angles, 1);
+    for (int bs = 0; bs <= lastBaseStation; bs++) {
+      pulseProcessorApplyCalibration(appState, angles, bs);
+    }
 
-    estimatePoseCrossingBeams(angles, 1);
+    estimatePoseCrossingBeams(angles, basestation);
 
-    pulseProcessorClear(angles, 0);
-    pulseProcessorClear(angles, 1);
+    for (int bs = 0; bs <= lastBaseStation; bs++) {
+      pulseProcessorClear(angles, bs);
+    }
   }
 }
 
@@ -355,6 +410,18 @@ static void usePulseResultSweeps(pulseProcessor_t *appState, pulseProcessorResul
   }
 }
 
+static void usePulseResultSweepBatch(pulseProcessor_t *appState, pulseProcessorResult_t* angles, int basestation, int axis) {
+  if (axis == sweepDirection_y) {
+    STATS_CNT_RATE_EVENT(&cycleRate);
+
+    pulseProcessorApplyCalibration(appState, angles, basestation);
+
+    estimatePoseSweepBatch(angles, basestation);
+
+    pulseProcessorClear(angles, basestation);
+  }
+}
+
 static void usePulseResult(pulseProcessor_t *appState, pulseProcessorResult_t* angles, int basestation, int axis) {
   switch(estimationMethod) {
     case 0:
@@ -363,25 +430,43 @@ static void usePulseResult(pulseProcessor_t *appState, pulseProcessorResult_t* a
     case 1:
       usePulseResultSweeps(appState, angles, basestation, axis);
       break;
+    case 2:
+      usePulseResultSweepBatch(appState, angles, basestation, axis);
+      break;
     default:
       break;
   }
 }
 
+static bool isGeometryValid(const baseStationGeometry_t* geometry) {
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      if (geometry->mat[i][j] != 0.0f) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 void lightHouseGeometryDataUpdated() {
-  lighthouseGeometryCalculateAnglesFromRotationMatrix(&lighthouseBaseStationsGeometry[0],&lighthouseBaseStationAngles[0]);
-  lighthouseGeometryCalculateAnglesFromRotationMatrix(&lighthouseBaseStationsGeometry[1],&lighthouseBaseStationAngles[1]);
+  lastBaseStation = -1;
+
+  for (int bs = 0; bs < PULSE_PROCESSOR_N_BASE_STATIONS; bs++) {
+    baseStationGeometryValid[bs] = isGeometryValid(&lighthouseBaseStationsGeometry[bs]);
+    if (!baseStationGeometryValid[bs]) {
+      continue;
+    }
 
-  invertRotationMatrix(lighthouseBaseStationsGeometry[0].mat, baseStationInvertedRotationMatrixes[0]);
-  invertRotationMatrix(lighthouseBaseStationsGeometry[1].mat, baseStationInvertedRotationMatrixes[1]);
+    lighthouseGeometryCalculateAnglesFromRotationMatrix(&lighthouseBaseStationsGeometry[bs], &lighthouseBaseStationAngles[bs]);
+    invertRotationMatrix(lighthouseBaseStationsGeometry[bs].mat, baseStationInvertedRotationMatrixes[bs]);
+    lastBaseStation = bs;
+  }
 }
 
 static void lighthouseTask(void *param)
 {
-  bool synchronized = false;
-  int syncCounter = 0;
-  char c;
-  static frame_t frame;
+  static lighthouseFrame_t frame;
   static pulseProcessor_t ppState = {};
 
   int basestation;
@@ -400,28 +485,27 @@ static void lighthouseTask(void *param)
   // Boot the deck firmware
   checkVersionAndBoot();
 
+  uart1DmaRxInit();
+
   while(1) {
-    // Synchronize
-    syncCounter = 0;
-    while (!synchronized) {
-
-      uart1Getchar(&c);
-      if (c != 0) {
-        syncCounter += 1;
-      } else {
-        syncCounter = 0;
-      }
-      synchronized = syncCounter == 7;
-    }
+    uint32_t length = uart1DmaRxRead(&rxBuffer[rxBufferLength], RX_BLOCK_SIZE, portMAX_DELAY);
+    rxBufferLength += length;
 
-    comSynchronized = true;
-    DEBUG_PRINT("Synchronized!\n");
+    if (uart1DidOverrun()) {
+      // Bytes are missing, the frame boundaries can not be trusted anymore
+      lighthouseFrameParserReset(&frameParser);
+    }
 
-    // Receive data until being desynchronized
-    synchronized = getFrame(&frame);
-    while(synchronized) {
+    uint32_t index = 0;
+    while (lighthouseFrameParse(&frameParser, rxBuffer, rxBufferLength, &index, &frame)) {
       if (frame.sync != 0) {
-        synchronized = getFrame(&frame);
+        comSynchronized = true;
+        // Sync frames are also sent in the stream, only count the ones that
+        // synchronized the parser again
+        if (frameParser.resyncCount != resyncCount) {
+          resyncCount = frameParser.resyncCount;
+          STATS_CNT_RATE_EVENT(&resyncRate);
+        }
         memset(pulseWidth, 0, sizeof(pulseWidth[0])*PULSE_PROCESSOR_N_SENSORS);
         continue;
       }
@@ -432,16 +516,14 @@ static void lighthouseTask(void *param)
 
       if (pulseProcessorProcessPulse(&ppState, frame.sensor, frame.timestamp, frame.width, &angles, &basestation, &axis)) {
         STATS_CNT_RATE_EVENT(&frameRate);
-        STATS_CNT_RATE_EVENT(bsRates[basestation]);
+        STATS_CNT_RATE_EVENT(&bsRates[basestation]);
         usePulseResult(&ppState, &angles, basestation, axis);
       }
-
-      synchronized = getFrame(&frame);
-      if (frame.sync != 0) {
-        synchronized = getFrame(&frame);
-        continue;
-      }
     }
+
+    // Keep the incomplete frame for the next block
+    memmove(rxBuffer, &rxBuffer[index], rxBufferLength - index);
+    rxBufferLength -= index;
   }
 }
 
@@ -499,6 +581,11 @@ static void lighthouseInit(DeckInfo *info)
 {
   if (isInit) return;
 
+  for (int bs = 0; bs < PULSE_PROCESSOR_N_BASE_STATIONS; bs++) {
+    STATS_CNT_RATE_INIT(&bsEstRates[bs], HALF_SECOND);
+    STATS_CNT_RATE_INIT(&bsRates[bs], HALF_SECOND);
+  }
+
   uart1Init(230400);
   lhblInit(I2C1_DEV);
 
@@ -555,14 +642,27 @@ LOG_ADD(LOG_FLOAT, z, &position[2])
 LOG_ADD(LOG_FLOAT, delta, &deltaLog)
 
 STATS_CNT_RATE_LOG_ADD(serRt, &serialFrameRate)
+STATS_CNT_RATE_LOG_ADD(resyncRt, &resyncRate)
 STATS_CNT_RATE_LOG_ADD(frmRt, &frameRate)
 STATS_CNT_RATE_LOG_ADD(cycleRt, &cycleRate)
 STATS_CNT_RATE_LOG_ADD(posRt, &positionRate)
-STATS_CNT_RATE_LOG_ADD(estBs0Rt, &estBs0Rate)
-STATS_CNT_RATE_LOG_ADD(estBs1Rt, &estBs1Rate)
+STATS_CNT_RATE_LOG_ADD(estBs0Rt, &bsEstRates[0])
+STATS_CNT_RATE_LOG_ADD(estBs1Rt, &bsEstRates[1])
+#if PULSE_PROCESSOR_N_BASE_STATIONS > 2
+STATS_CNT_RATE_LOG_ADD(estBs2Rt, &bsEstRates[2])
+#endif
+#if PULSE_PROCESSOR_N_BASE_STATIONS > 3
+STATS_CNT_RATE_LOG_ADD(estBs3Rt, &bsEstRates[3])
+#endif
 
-STATS_CNT_RATE_LOG_ADD(bs0Rt, &bs0Rate)
-STATS_CNT_RATE_LOG_ADD(bs1Rt, &bs1Rate)
+STATS_CNT_RATE_LOG_ADD(bs0Rt, &bsRates[0])
+STATS_CNT_RATE_LOG_ADD(bs1Rt, &bsRates[1])
+#if PULSE_PROCESSOR_N_BASE_STATIONS > 2
+STATS_CNT_RATE_LOG_ADD(bs2Rt, &bsRates[2])
+#endif
+#if PULSE_PROCESSOR_N_BASE_STATIONS > 3
+STATS_CNT_RATE_LOG_ADD(bs3Rt, &bsRates[3])
+#endif
 
 
 LOG_ADD(LOG_UINT16, width0, &pulseWidth[0])
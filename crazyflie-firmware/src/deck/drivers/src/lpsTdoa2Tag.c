@@ -147,7 +147,9 @@ static void enqueueTDOA(uint8_t anchorA, uint8_t anchorB, double distanceDiff) {
     .distanceDiff = distanceDiff,
 
     .anchorPosition[0] = options->anchorPosition[anchorA],
-    .anchorPosition[1] = options->anchorPosition[anchorB]
+    .anchorPosition[1] = options->anchorPosition[anchorB],
+    .anchorId[0] = anchorA,
+    .anchorId[1] = anchorB,
   };
 
   if (options->combinedAnchorPositionOk ||
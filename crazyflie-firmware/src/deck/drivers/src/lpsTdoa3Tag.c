@@ -51,6 +51,7 @@ The implementation must handle
 #include "tdoaEngine.h"
 #include "tdoaStats.h"
 #include "estimator.h"
+#include "estimator_kalman.h"
 
 #include "libdw1000.h"
 #include "mac.h"
@@ -280,7 +281,7 @@ static bool getAnchorPosition(const uint8_t anchorId, point_t* position) {
   tdoaAnchorContext_t anchorCtx;
   uint32_t now_ms = T2M(xTaskGetTickCount());
 
-  bool contextFound = tdoaStorageGetAnchorCtx(engineState.anchorInfoArray, anchorId, now_ms, &anchorCtx);
+  bool contextFound = tdoaStorageGetAnchorCtx(&engineState.anchorStorage, anchorId, now_ms, &anchorCtx);
   if (contextFound) {
     tdoaStorageGetAnchorPosition(&anchorCtx, position);
     return true;
@@ -290,12 +291,12 @@ static bool getAnchorPosition(const uint8_t anchorId, point_t* position) {
 }
 
 static uint8_t getAnchorIdList(uint8_t unorderedAnchorList[], const int maxListSize) {
-  return tdoaStorageGetListOfAnchorIds(engineState.anchorInfoArray, unorderedAnchorList, maxListSize);
+  return tdoaStorageGetListOfAnchorIds(&engineState.anchorStorage, unorderedAnchorList, maxListSize);
 }
 
 static uint8_t getActiveAnchorIdList(uint8_t unorderedAnchorList[], const int maxListSize) {
   uint32_t now_ms = T2M(xTaskGetTickCount());
-  return tdoaStorageGetListOfActiveAnchorIds(engineState.anchorInfoArray, unorderedAnchorList, maxListSize, now_ms);
+  return tdoaStorageGetListOfActiveAnchorIds(&engineState.anchorStorage, unorderedAnchorList, maxListSize, now_ms);
 }
 
 #pragma GCC diagnostic push
@@ -303,6 +304,7 @@ static uint8_t getActiveAnchorIdList(uint8_t unorderedAnchorList[], const int ma
 static void Initialize(dwDevice_t *dev) {
   uint32_t now_ms = T2M(xTaskGetTickCount());
   tdoaEngineInit(&engineState, now_ms, sendTdoaToEstimatorCallback, LOCODECK_TS_FREQ);
+  engineState.getEstimatedPosition = estimatorKalmanGetEstimatedPos;
 
   #ifdef LPS_2D_POSITION_HEIGHT
   DEBUG_PRINT("2D positioning enabled at %f m height\n", LPS_2D_POSITION_HEIGHT);
@@ -343,9 +345,16 @@ STATS_CNT_RATE_LOG_ADD(stMiss, &engineState.stats.contextMissCount)
 LOG_ADD(LOG_FLOAT, cc, &engineState.stats.clockCorrection)
 LOG_ADD(LOG_UINT16, tof, &engineState.stats.tof)
 LOG_ADD(LOG_FLOAT, tdoa, &engineState.stats.tdoa)
+
+LOG_ADD(LOG_UINT16, rdUsed, &engineState.anchorStorage.remoteAnchorDataInUse)
+LOG_ADD(LOG_UINT32, rdReclaim, &engineState.anchorStorage.remoteAnchorDataReclaimCount)
+LOG_ADD(LOG_UINT32, rdDrop, &engineState.anchorStorage.remoteAnchorDataDropCount)
+LOG_ADD(LOG_UINT32, tofEvict, &engineState.anchorStorage.tofEvictionCount)
 LOG_GROUP_STOP(tdoa3)
 
 PARAM_GROUP_START(tdoa3)
 PARAM_ADD(PARAM_UINT8, logId, &engineState.stats.newAnchorId)
 PARAM_ADD(PARAM_UINT8, logOthrId, &engineState.stats.newRemoteAnchorId)
+PARAM_ADD(PARAM_UINT8, match, &engineState.matchingAlgorithm)
+PARAM_ADD(PARAM_UINT8, maxPerPkt, &engineState.maxMeasurementsPerPacket)
 PARAM_GROUP_STOP(tdoa3)
@@ -35,10 +35,12 @@
 #include "task.h"
 
 #include "log.h"
+#include "param.h"
 #include "crtp_localization_service.h"
 
 #include "stabilizer_types.h"
 #include "estimator.h"
+#include "estimator_kalman.h"
 #include "cf_math.h"
 
 #include "physicalConstants.h"
@@ -62,6 +64,30 @@ static lpsTwrAlgoOptions_t defaultOptions = {
  #endif
  #if LOCODECK_NR_OF_TWR_ANCHORS > 7
      0xbccf000000000007,
+ #endif
+ #if LOCODECK_NR_OF_TWR_ANCHORS > 8
+     0xbccf000000000008,
+ #endif
+ #if LOCODECK_NR_OF_TWR_ANCHORS > 9
+     0xbccf000000000009,
+ #endif
+ #if LOCODECK_NR_OF_TWR_ANCHORS > 10
+     0xbccf00000000000a,
+ #endif
+ #if LOCODECK_NR_OF_TWR_ANCHORS > 11
+     0xbccf00000000000b,
+ #endif
+ #if LOCODECK_NR_OF_TWR_ANCHORS > 12
+     0xbccf00000000000c,
+ #endif
+ #if LOCODECK_NR_OF_TWR_ANCHORS > 13
+     0xbccf00000000000d,
+ #endif
+ #if LOCODECK_NR_OF_TWR_ANCHORS > 14
+     0xbccf00000000000e,
+ #endif
+ #if LOCODECK_NR_OF_TWR_ANCHORS > 15
+     0xbccf00000000000f,
  #endif
    },
    .antennaDelay = (ANTENNA_OFFSET*499.2e6*128)/299792458.0, // In radio tick
@@ -135,6 +161,22 @@ static dwTime_t frameStart;
 
 static bool rangingOk;
 
+// Adaptive scheduling
+// Instead of ranging the anchors in turn, the next anchor is the one that
+// adds the most information to the position given the ranges done lately.
+// Anchors that keep failing are skipped for an increasing number of rounds.
+#define SCHEDULE_INFO_TIME_CONSTANT_MS 200.0f // Ranges carry less information as they get older
+#define SCHEDULE_INFO_REGULARIZATION 0.01f
+#define SCHEDULE_MAX_AGE_MS 1000              // Max time between ranges to a healthy anchor
+#define SCHEDULE_MAX_BACKOFF 32               // Max number of rounds a failing anchor is skipped
+static uint8_t useAdaptiveScheduling = 1;
+static struct {
+  uint32_t lastRangingTime; // In ticks, 0 if never ranged
+  uint8_t backoff;
+  uint8_t roundsToSkip;
+} anchorSchedule[LOCODECK_NR_OF_TWR_ANCHORS];
+static int roundsSinceSyncAnchor = 0;
+
 static void lpsHandleLppShortPacket(const uint8_t srcId, const uint8_t *data);
 
 static void txcallback(dwDevice_t *dev)
@@ -278,6 +320,158 @@ static uint32_t rxcallback(dwDevice_t *dev) {
   return MAX_TIMEOUT;
 }
 
+static bool hasAnchorPosition(const int anchor) {
+  return options->combinedAnchorPositionOk || options->anchorPosition[anchor].timestamp;
+}
+
+// Information matrix of the latest ranges, in the directions from the
+// estimated position to the anchors
+static void calcInformationMatrix(const point_t* estimatedPosition, const uint32_t now, float info[3][3]) {
+  memset(info, 0, sizeof(float) * 9);
+  for (int i = 0; i < 3; i++) {
+    info[i][i] = SCHEDULE_INFO_REGULARIZATION;
+  }
+
+  for (int anchor = 0; anchor < LOCODECK_NR_OF_TWR_ANCHORS; anchor++) {
+    float u[3];
+    if (anchorSchedule[anchor].lastRangingTime == 0 || !hasAnchorPosition(anchor)) {
+      continue;
+    }
+
+    const point_t* anchorPosition = &options->anchorPosition[anchor];
+    u[0] = anchorPosition->x - estimatedPosition->x;
+    u[1] = anchorPosition->y - estimatedPosition->y;
+    u[2] = anchorPosition->z - estimatedPosition->z;
+    const float distSq = u[0] * u[0] + u[1] * u[1] + u[2] * u[2];
+    if (distSq < 1e-6f) {
+      continue;
+    }
+
+    const float age = T2M(now - anchorSchedule[anchor].lastRangingTime);
+    const float weight = 1.0f / (distSq * (1.0f + age / SCHEDULE_INFO_TIME_CONSTANT_MS));
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) {
+        info[i][j] += weight * u[i] * u[j];
+      }
+    }
+  }
+}
+
+// The variance of the position in the direction of the anchor. Ranging the
+// anchor with the largest value reduces the dilution of precision the most.
+static float calcAnchorScore(const int anchor, const point_t* estimatedPosition, const float info[3][3]) {
+  const point_t* anchorPosition = &options->anchorPosition[anchor];
+  float u[3] = {
+    anchorPosition->x - estimatedPosition->x,
+    anchorPosition->y - estimatedPosition->y,
+    anchorPosition->z - estimatedPosition->z,
+  };
+  const float dist = sqrtf(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+  if (dist < 1e-3f) {
+    return 0.0f;
+  }
+  for (int i = 0; i < 3; i++) {
+    u[i] /= dist;
+  }
+
+  // u' * inv(info) * u, using the adjugate of the symmetric info matrix
+  const float a = info[0][0], b = info[0][1], c = info[0][2];
+  const float d = info[1][1], e = info[1][2], f = info[2][2];
+  const float A = d * f - e * e;
+  const float B = c * e - b * f;
+  const float C = b * e - c * d;
+  const float D = a * f - c * c;
+  const float E = b * c - a * e;
+  const float F = a * d - b * b;
+  const float det = a * A + b * B + c * C;
+  if (det <= 0.0f) {
+    return 0.0f;
+  }
+
+  const float q = u[0] * (A * u[0] + B * u[1] + C * u[2]) +
+                  u[1] * (B * u[0] + D * u[1] + E * u[2]) +
+                  u[2] * (C * u[0] + E * u[1] + F * u[2]);
+  return q / det;
+}
+
+static int selectNextAnchor() {
+  const int roundRobinAnchor = (current_anchor + 1) % LOCODECK_NR_OF_TWR_ANCHORS;
+
+  for (int i = 0; i < LOCODECK_NR_OF_TWR_ANCHORS; i++) {
+    if (anchorSchedule[i].roundsToSkip > 0) {
+      anchorSchedule[i].roundsToSkip--;
+    }
+  }
+
+  if (!useAdaptiveScheduling) {
+    return roundRobinAnchor;
+  }
+
+  // Anchor 0 is the time reference in TDMA mode
+  roundsSinceSyncAnchor++;
+  if (options->useTdma && roundsSinceSyncAnchor >= LOCODECK_NR_OF_TWR_ANCHORS) {
+    return 0;
+  }
+
+  point_t estimatedPosition;
+  estimatorKalmanGetEstimatedPos(&estimatedPosition);
+  const uint32_t now = xTaskGetTickCount();
+
+  float info[3][3];
+  calcInformationMatrix(&estimatedPosition, now, info);
+
+  int bestAnchor = -1;
+  float bestScore = -1.0f;
+  for (int i = 0; i < LOCODECK_NR_OF_TWR_ANCHORS; i++) {
+    const int anchor = (roundRobinAnchor + i) % LOCODECK_NR_OF_TWR_ANCHORS;
+    if (anchorSchedule[anchor].roundsToSkip > 0) {
+      continue;
+    }
+
+    // Anchors without position must be ranged to get their position in the
+    // answer, and all anchors must be ranged now and then to follow their health
+    const uint32_t age = now - anchorSchedule[anchor].lastRangingTime;
+    if (!hasAnchorPosition(anchor) || age > M2T(SCHEDULE_MAX_AGE_MS)) {
+      return anchor;
+    }
+
+    const float score = calcAnchorScore(anchor, &estimatedPosition, info);
+    if (score > bestScore) {
+      bestScore = score;
+      bestAnchor = anchor;
+    }
+  }
+
+  if (bestAnchor < 0) {
+    // All anchors are failing
+    return roundRobinAnchor;
+  }
+
+  return bestAnchor;
+}
+
+static void updateAnchorSchedule(const int anchor, const bool rangingSucceeded) {
+  if (anchor == 0) {
+    roundsSinceSyncAnchor = 0;
+  }
+
+  if (rangingSucceeded) {
+    anchorSchedule[anchor].lastRangingTime = xTaskGetTickCount();
+    anchorSchedule[anchor].backoff = 0;
+    anchorSchedule[anchor].roundsToSkip = 0;
+  } else if (state.failedRanging[anchor] >= options->rangingFailedThreshold) {
+    uint8_t backoff = anchorSchedule[anchor].backoff * 2;
+    if (backoff == 0) {
+      backoff = 1;
+    }
+    if (backoff > SCHEDULE_MAX_BACKOFF) {
+      backoff = SCHEDULE_MAX_BACKOFF;
+    }
+    anchorSchedule[anchor].backoff = backoff;
+    anchorSchedule[anchor].roundsToSkip = backoff;
+  }
+}
+
 /* Adjust time for schedule transfer by DW1000 radio. Set 9 LSB to 0 */
 static uint32_t adjustTxRxTime(dwTime_t *time)
 {
@@ -306,10 +500,7 @@ static void initiateRanging(dwDevice_t *dev)
       frameStart.full += TDMA_FRAME_LEN;
     }
 
-    current_anchor ++;
-    if (current_anchor >= LOCODECK_NR_OF_TWR_ANCHORS) {
-      current_anchor = 0;
-    }
+    current_anchor = selectNextAnchor();
   } else {
     current_anchor = 0;
   }
@@ -385,12 +576,14 @@ static uint32_t twrTagOnEvent(dwDevice_t *dev, uwbEvent_t event)
 
           locSrvSendRangeFloat(current_anchor, NAN);
           failedRanging[current_anchor]++;
+          updateAnchorSchedule(current_anchor, false);
         } else {
           rangingState |= (1<<current_anchor);
           state.failedRanging[current_anchor] = 0;
 
           locSrvSendRangeFloat(current_anchor, state.distance[current_anchor]);
           succededRanging[current_anchor]++;
+          updateAnchorSchedule(current_anchor, true);
         }
         locoDeckSetRangingState(rangingState);
       }
@@ -492,6 +685,9 @@ static void twrTagInit(dwDevice_t *dev)
   memset(state.pressures, 0, sizeof(state.pressures));
   memset(state.failedRanging, 0, sizeof(state.failedRanging));
 
+  memset(anchorSchedule, 0, sizeof(anchorSchedule));
+  roundsSinceSyncAnchor = 0;
+
   dwSetReceiveWaitTimeout(dev, TWR_RECEIVE_TIMEOUT);
 
   dwCommitConfiguration(dev);
@@ -564,6 +760,46 @@ LOG_ADD(LOG_UINT8, rangingSuccessRate4, &rangingSuccessRate[4])
 LOG_ADD(LOG_UINT8, rangingPerSec4, &rangingPerSec[4])
 LOG_ADD(LOG_UINT8, rangingSuccessRate5, &rangingSuccessRate[5])
 LOG_ADD(LOG_UINT8, rangingPerSec5, &rangingPerSec[5])
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 6)
+LOG_ADD(LOG_UINT8, rangingSuccessRate6, &rangingSuccessRate[6])
+LOG_ADD(LOG_UINT8, rangingPerSec6, &rangingPerSec[6])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 7)
+LOG_ADD(LOG_UINT8, rangingSuccessRate7, &rangingSuccessRate[7])
+LOG_ADD(LOG_UINT8, rangingPerSec7, &rangingPerSec[7])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 8)
+LOG_ADD(LOG_UINT8, rangingSuccessRate8, &rangingSuccessRate[8])
+LOG_ADD(LOG_UINT8, rangingPerSec8, &rangingPerSec[8])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 9)
+LOG_ADD(LOG_UINT8, rangingSuccessRate9, &rangingSuccessRate[9])
+LOG_ADD(LOG_UINT8, rangingPerSec9, &rangingPerSec[9])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 10)
+LOG_ADD(LOG_UINT8, rangingSuccessRate10, &rangingSuccessRate[10])
+LOG_ADD(LOG_UINT8, rangingPerSec10, &rangingPerSec[10])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 11)
+LOG_ADD(LOG_UINT8, rangingSuccessRate11, &rangingSuccessRate[11])
+LOG_ADD(LOG_UINT8, rangingPerSec11, &rangingPerSec[11])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 12)
+LOG_ADD(LOG_UINT8, rangingSuccessRate12, &rangingSuccessRate[12])
+LOG_ADD(LOG_UINT8, rangingPerSec12, &rangingPerSec[12])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 13)
+LOG_ADD(LOG_UINT8, rangingSuccessRate13, &rangingSuccessRate[13])
+LOG_ADD(LOG_UINT8, rangingPerSec13, &rangingPerSec[13])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 14)
+LOG_ADD(LOG_UINT8, rangingSuccessRate14, &rangingSuccessRate[14])
+LOG_ADD(LOG_UINT8, rangingPerSec14, &rangingPerSec[14])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 15)
+LOG_ADD(LOG_UINT8, rangingSuccessRate15, &rangingSuccessRate[15])
+LOG_ADD(LOG_UINT8, rangingPerSec15, &rangingPerSec[15])
+#endif
 LOG_GROUP_STOP(twr)
 
 LOG_GROUP_START(ranging)
@@ -591,6 +827,30 @@ LOG_ADD(LOG_FLOAT, distance6, &state.distance[6])
 #if (LOCODECK_NR_OF_TWR_ANCHORS > 7)
 LOG_ADD(LOG_FLOAT, distance7, &state.distance[7])
 #endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 8)
+LOG_ADD(LOG_FLOAT, distance8, &state.distance[8])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 9)
+LOG_ADD(LOG_FLOAT, distance9, &state.distance[9])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 10)
+LOG_ADD(LOG_FLOAT, distance10, &state.distance[10])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 11)
+LOG_ADD(LOG_FLOAT, distance11, &state.distance[11])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 12)
+LOG_ADD(LOG_FLOAT, distance12, &state.distance[12])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 13)
+LOG_ADD(LOG_FLOAT, distance13, &state.distance[13])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 14)
+LOG_ADD(LOG_FLOAT, distance14, &state.distance[14])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 15)
+LOG_ADD(LOG_FLOAT, distance15, &state.distance[15])
+#endif
 #if (LOCODECK_NR_OF_TWR_ANCHORS > 0)
 LOG_ADD(LOG_FLOAT, pressure0, &state.pressures[0])
 #endif
@@ -615,4 +875,32 @@ LOG_ADD(LOG_FLOAT, pressure6, &state.pressures[6])
 #if (LOCODECK_NR_OF_TWR_ANCHORS > 7)
 LOG_ADD(LOG_FLOAT, pressure7, &state.pressures[7])
 #endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 8)
+LOG_ADD(LOG_FLOAT, pressure8, &state.pressures[8])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 9)
+LOG_ADD(LOG_FLOAT, pressure9, &state.pressures[9])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 10)
+LOG_ADD(LOG_FLOAT, pressure10, &state.pressures[10])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 11)
+LOG_ADD(LOG_FLOAT, pressure11, &state.pressures[11])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 12)
+LOG_ADD(LOG_FLOAT, pressure12, &state.pressures[12])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 13)
+LOG_ADD(LOG_FLOAT, pressure13, &state.pressures[13])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 14)
+LOG_ADD(LOG_FLOAT, pressure14, &state.pressures[14])
+#endif
+#if (LOCODECK_NR_OF_TWR_ANCHORS > 15)
+LOG_ADD(LOG_FLOAT, pressure15, &state.pressures[15])
+#endif
 LOG_GROUP_STOP(ranging)
+
+PARAM_GROUP_START(twr)
+PARAM_ADD(PARAM_UINT8, adaptive, &useAdaptiveScheduling)
+PARAM_GROUP_STOP(twr)
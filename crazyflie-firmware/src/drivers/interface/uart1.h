@@ -44,6 +44,15 @@
 #define UART1_DMA_CH           DMA_Channel_4
 #define UART1_DMA_FLAG_TCIF    DMA_FLAG_TCIF3
 
+#define UART1_RX_DMA_IRQ       DMA1_Stream1_IRQn
+#define UART1_RX_DMA_STREAM    DMA1_Stream1
+#define UART1_RX_DMA_CH        DMA_Channel_4
+#define UART1_RX_DMA_IT_HTIF   DMA_IT_HTIF1
+#define UART1_RX_DMA_IT_TCIF   DMA_IT_TCIF1
+
+// Size of the circular RX DMA buffer, the reader is woken up at every half
+#define UART1_RX_DMA_BUFFER_SIZE 256
+
 #define UART1_GPIO_PERIF       RCC_AHB1Periph_GPIOC
 #define UART1_GPIO_PORT        GPIOC
 #define UART1_GPIO_TX_PIN      GPIO_Pin_10
@@ -115,6 +124,29 @@ void uart1Getchar(char * ch);
  */
 bool uart1DidOverrun();
 
+/**
+ * Switch the reception to circular DMA. The received bytes are written by the
+ * DMA into a ring buffer and read in blocks with uart1DmaRxRead(), the byte
+ * queue and the per byte interrupt are not used anymore. uart1Getchar() and
+ * uart1GetDataWithTimout() must not be used after this call.
+ * Must be called after uart1Init().
+ */
+void uart1DmaRxInit(void);
+
+/**
+ * Read the bytes received by the DMA since the last call. Blocks until at
+ * least one byte is available, the buffer is half full or the line goes
+ * idle, or until the timeout expires.
+ * If the reader has not kept up with the DMA the overrun flag is set, see
+ * uart1DidOverrun(), and the data read is not contiguous with the previous read.
+ *
+ * @param[out] data  Buffer to write the received bytes to
+ * @param[in] maxSize  Size of the buffer
+ * @param[in] timeout  Max number of ticks to wait for data
+ * @return Number of bytes read
+ */
+uint32_t uart1DmaRxRead(uint8_t* data, uint32_t maxSize, uint32_t timeout);
+
 /**
  * Uart printf macro that uses eprintf
  * @param[in] FMT String format
@@ -54,6 +54,12 @@ STATIC_MEM_QUEUE_ALLOC(uart1queue, 64, sizeof(uint8_t));
 static bool isInit = false;
 static bool hasOverrun = false;
 
+static bool isRxDma = false;
+static xSemaphoreHandle rxDmaData;
+static StaticSemaphore_t rxDmaDataBuffer;
+static uint8_t rxDmaBuffer[UART1_RX_DMA_BUFFER_SIZE];
+static volatile uint32_t rxDmaReadIndex;
+
 #ifdef ENABLE_UART1_DMA
 static xSemaphoreHandle uartBusy;
 static StaticSemaphore_t uartBusyBuffer;
@@ -181,6 +187,89 @@ void uart1InitWithParity(const uint32_t baudrate, const uart1Parity_t parity)
   isInit = true;
 }
 
+void uart1DmaRxInit(void)
+{
+  DMA_InitTypeDef DMA_InitStructure;
+  NVIC_InitTypeDef NVIC_InitStructure;
+
+  ASSERT(isInit);
+
+  rxDmaData = xSemaphoreCreateBinaryStatic(&rxDmaDataBuffer);
+  rxDmaReadIndex = 0;
+
+  RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1, ENABLE);
+
+  // Stop byte by byte reception
+  USART_ITConfig(UART1_TYPE, USART_IT_RXNE, DISABLE);
+
+  DMA_DeInit(UART1_RX_DMA_STREAM);
+  DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&UART1_TYPE->DR;
+  DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)rxDmaBuffer;
+  DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+  DMA_InitStructure.DMA_MemoryBurst = DMA_MemoryBurst_Single;
+  DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+  DMA_InitStructure.DMA_BufferSize = UART1_RX_DMA_BUFFER_SIZE;
+  DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+  DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+  DMA_InitStructure.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
+  DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralToMemory;
+  DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+  DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+  DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Disable;
+  DMA_InitStructure.DMA_FIFOThreshold = DMA_FIFOThreshold_1QuarterFull;
+  DMA_InitStructure.DMA_Channel = UART1_RX_DMA_CH;
+  DMA_Init(UART1_RX_DMA_STREAM, &DMA_InitStructure);
+
+  NVIC_InitStructure.NVIC_IRQChannel = UART1_RX_DMA_IRQ;
+  NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = NVIC_MID_PRI;
+  NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+  NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+  NVIC_Init(&NVIC_InitStructure);
+
+  isRxDma = true;
+
+  DMA_ITConfig(UART1_RX_DMA_STREAM, DMA_IT_HT | DMA_IT_TC, ENABLE);
+  USART_DMACmd(UART1_TYPE, USART_DMAReq_Rx, ENABLE);
+  DMA_Cmd(UART1_RX_DMA_STREAM, ENABLE);
+
+  // Wake up the reader when the line goes idle, for data arriving in short bursts
+  USART_ITConfig(UART1_TYPE, USART_IT_IDLE, ENABLE);
+}
+
+uint32_t uart1DmaRxRead(uint8_t* data, uint32_t maxSize, uint32_t timeout)
+{
+  uint32_t writeIndex = UART1_RX_DMA_BUFFER_SIZE - DMA_GetCurrDataCounter(UART1_RX_DMA_STREAM);
+  uint32_t readIndex = rxDmaReadIndex;
+
+  if (writeIndex == readIndex)
+  {
+    xSemaphoreTake(rxDmaData, timeout);
+    writeIndex = UART1_RX_DMA_BUFFER_SIZE - DMA_GetCurrDataCounter(UART1_RX_DMA_STREAM);
+  }
+
+  // NDTR reads as 0 for an instant before it is reloaded
+  writeIndex %= UART1_RX_DMA_BUFFER_SIZE;
+
+  uint32_t length = 0;
+  while (readIndex != writeIndex && length < maxSize)
+  {
+    uint32_t end = (writeIndex > readIndex) ? writeIndex : UART1_RX_DMA_BUFFER_SIZE;
+    uint32_t chunk = end - readIndex;
+    if (chunk > maxSize - length)
+    {
+      chunk = maxSize - length;
+    }
+
+    memcpy(&data[length], &rxDmaBuffer[readIndex], chunk);
+    length += chunk;
+    readIndex = (readIndex + chunk) % UART1_RX_DMA_BUFFER_SIZE;
+  }
+
+  rxDmaReadIndex = readIndex;
+
+  return length;
+}
+
 bool uart1Test(void)
 {
   return isInit;
@@ -259,6 +348,35 @@ bool uart1DidOverrun()
   return result;
 }
 
+void __attribute__((used)) DMA1_Stream1_IRQHandler(void)
+{
+  portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
+  uint32_t nextHalfStart;
+
+  if (DMA_GetITStatus(UART1_RX_DMA_STREAM, UART1_RX_DMA_IT_HTIF))
+  {
+    DMA_ClearITPendingBit(UART1_RX_DMA_STREAM, UART1_RX_DMA_IT_HTIF);
+    nextHalfStart = UART1_RX_DMA_BUFFER_SIZE / 2;
+  }
+  else
+  {
+    DMA_ClearITPendingBit(UART1_RX_DMA_STREAM, UART1_RX_DMA_IT_TCIF);
+    nextHalfStart = 0;
+  }
+
+  // If the reader is still in the half that the DMA is about to fill, it is
+  // lagging more than half a buffer and unread data is being overwritten.
+  // A reader at the very start of the half has read everything.
+  uint32_t readIndex = rxDmaReadIndex;
+  if (readIndex > nextHalfStart && readIndex < nextHalfStart + UART1_RX_DMA_BUFFER_SIZE / 2)
+  {
+    hasOverrun = true;
+  }
+
+  xSemaphoreGiveFromISR(rxDmaData, &xHigherPriorityTaskWoken);
+  portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
 #ifdef ENABLE_UART1_DMA
 void __attribute__((used)) DMA1_Stream3_IRQHandler(void)
 {
@@ -279,7 +397,21 @@ void __attribute__((used)) USART3_IRQHandler(void)
   uint8_t rxData;
   portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
 
-  if (USART_GetITStatus(UART1_TYPE, USART_IT_RXNE))
+  if (isRxDma)
+  {
+    // IDLE, and any error flag, are cleared by reading SR followed by DR
+    uint16_t status = UART1_TYPE->SR;
+    asm volatile ("" : "=m" (UART1_TYPE->DR) : "r" (UART1_TYPE->DR));
+
+    if (status & USART_FLAG_ORE)
+    {
+      hasOverrun = true;
+    }
+
+    xSemaphoreGiveFromISR(rxDmaData, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+  }
+  else if (USART_GetITStatus(UART1_TYPE, USART_IT_RXNE))
   {
     rxData = USART_ReceiveData(UART1_TYPE) & 0x00FF;
     xQueueSendFromISR(uart1queue, &rxData, &xHigherPriorityTaskWoken);
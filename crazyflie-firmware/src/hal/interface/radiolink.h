@@ -37,6 +37,7 @@ typedef struct _P2PPacket
 {
   uint8_t size;                         //< Size of data
   uint8_t rssi;                         //< Received Signal Strength Intensity
+  uint64_t timestamp;                   //< Reception time in us, set on received packets
   union {
     struct {
       uint8_t port;                 //< Header selecting channel and port
@@ -57,7 +58,23 @@ void radiolinkSetPowerDbm(int8_t powerDbm);
 void radiolinkSyslinkDispatch(SyslinkPacket *slp);
 struct crtpLinkOperations * radiolinkGetLink();
 bool radiolinkSendP2PPacketBroadcast(P2PPacket *p2pp);
+
+/**
+ * Register the callback called for every received P2P packet, whatever its
+ * port. Only one such callback can be registered, the last one registered is
+ * the one called.
+ *
+ * Callbacks are called from the P2P task, not from the syslink task.
+ */
 void p2pRegisterCB(P2PCallback cb);
 
+/**
+ * Register a callback called for the received P2P packets on one port.
+ * Several callbacks can be registered, on the same or different ports.
+ *
+ * @return false if no more callbacks can be registered
+ */
+bool p2pRegisterPortCB(uint8_t port, P2PCallback cb);
+
 
 #endif //__RADIO_H__
@@ -43,24 +43,36 @@
 #include "ledseq.h"
 #include "queuemonitor.h"
 #include "static_mem.h"
+#include "usec_time.h"
+#include "statsCnt.h"
 
 #define RADIOLINK_TX_QUEUE_SIZE (1)
 #define RADIOLINK_CTRP_QUEUE_SIZE (5)
 #define RADIO_ACTIVITY_TIMEOUT_MS (1000)
 
 #define RADIOLINK_P2P_QUEUE_SIZE (5)
+#define RADIOLINK_P2P_MAX_HANDLERS (4)
 
+// Holds CRTP TX pool packets by pointer, they are framed as syslink packets
+// only when sent
 static xQueueHandle  txQueue;
-STATIC_MEM_QUEUE_ALLOC(txQueue, RADIOLINK_TX_QUEUE_SIZE, sizeof(SyslinkPacket));
+STATIC_MEM_QUEUE_ALLOC(txQueue, RADIOLINK_TX_QUEUE_SIZE, sizeof(CRTPPacket*));
 
 static xQueueHandle crtpPacketDelivery;
 STATIC_MEM_QUEUE_ALLOC(crtpPacketDelivery, RADIOLINK_CTRP_QUEUE_SIZE, sizeof(CRTPPacket));
 
+// Received P2P packets, handed from the syslink task to the P2P task
+static xQueueHandle p2pPacketDelivery;
+STATIC_MEM_QUEUE_ALLOC(p2pPacketDelivery, RADIOLINK_P2P_QUEUE_SIZE, sizeof(P2PPacket));
+
+STATIC_MEM_TASK_ALLOC(p2pTask, P2P_TASK_STACKSIZE);
+
 static bool isInit;
 
 static int radiolinkSendCRTPPacket(CRTPPacket *p);
 static int radiolinkSetEnable(bool enable);
 static int radiolinkReceiveCRTPPacket(CRTPPacket *p);
+static int radiolinkReset(void);
 
 //Local RSSI variable used to enable logging of RSSI values from Radio
 static uint8_t rssi;
@@ -69,6 +81,27 @@ static uint32_t lastPacketTick;
 
 static volatile P2PCallback p2p_callback;
 
+static struct {
+  uint8_t port;
+  P2PCallback callback;
+} p2pHandlers[RADIOLINK_P2P_MAX_HANDLERS];
+static int p2pHandlerCount;
+
+static uint32_t p2pRxCount;
+static uint32_t p2pRxDrop;
+
+#define LINK_STATS_INTERVAL_MS 1000
+static STATS_CNT_RATE_DEFINE(rxRate, LINK_STATS_INTERVAL_MS);
+static STATS_CNT_RATE_DEFINE(rxBcRate, LINK_STATS_INTERVAL_MS);
+static STATS_CNT_RATE_DEFINE(txRate, LINK_STATS_INTERVAL_MS);
+// Uplink packets that found nothing to send back, i.e. unused downlink slots
+static STATS_CNT_RATE_DEFINE(txIdleRate, LINK_STATS_INTERVAL_MS);
+static STATS_CNT_RATE_DEFINE(p2pRxRate, LINK_STATS_INTERVAL_MS);
+static STATS_CNT_RATE_DEFINE(p2pDropRate, LINK_STATS_INTERVAL_MS);
+static STATS_CNT_RATE_DEFINE(p2pTxRate, LINK_STATS_INTERVAL_MS);
+
+static void p2pTask(void *param);
+
 static bool radiolinkIsConnected(void) {
   return (xTaskGetTickCount() - lastPacketTick) < M2T(RADIO_ACTIVITY_TIMEOUT_MS);
 }
@@ -76,9 +109,10 @@ static bool radiolinkIsConnected(void) {
 static struct crtpLinkOperations radiolinkOp =
 {
   .setEnable         = radiolinkSetEnable,
-  .sendPacket        = radiolinkSendCRTPPacket,
+  .sendTxPacket      = radiolinkSendCRTPPacket,
   .receivePacket     = radiolinkReceiveCRTPPacket,
-  .isConnected       = radiolinkIsConnected
+  .isConnected       = radiolinkIsConnected,
+  .reset             = radiolinkReset,
 };
 
 void radiolinkInit(void)
@@ -90,9 +124,13 @@ void radiolinkInit(void)
   DEBUG_QUEUE_MONITOR_REGISTER(txQueue);
   crtpPacketDelivery = STATIC_MEM_QUEUE_CREATE(crtpPacketDelivery);
   DEBUG_QUEUE_MONITOR_REGISTER(crtpPacketDelivery);
+  p2pPacketDelivery = STATIC_MEM_QUEUE_CREATE(p2pPacketDelivery);
+  DEBUG_QUEUE_MONITOR_REGISTER(p2pPacketDelivery);
 
   ASSERT(crtpPacketDelivery);
 
+  STATIC_MEM_TASK_CREATE(p2pTask, p2pTask, P2P_TASK_NAME, NULL, P2P_TASK_PRI);
+
   syslinkInit();
 
   radiolinkSetChannel(configblockGetRadioChannel());
@@ -151,6 +189,7 @@ void radiolinkSetPowerDbm(int8_t powerDbm)
 void radiolinkSyslinkDispatch(SyslinkPacket *slp)
 {
   static SyslinkPacket txPacket;
+  CRTPPacket *txCrtp;
 
   if (slp->type == SYSLINK_RADIO_RAW || slp->type == SYSLINK_RADIO_RAW_BROADCAST) {
     lastPacketTick = xTaskGetTickCount();
@@ -161,17 +200,28 @@ void radiolinkSyslinkDispatch(SyslinkPacket *slp)
     slp->length--; // Decrease to get CRTP size.
     xQueueSend(crtpPacketDelivery, &slp->length, 0);
     ledseqRun(LINK_LED, seq_linkup);
+    STATS_CNT_RATE_EVENT(&rxRate);
     // If a radio packet is received, one can be sent
-    if (xQueueReceive(txQueue, &txPacket, 0) == pdTRUE)
+    if (xQueueReceive(txQueue, &txCrtp, 0) == pdTRUE)
     {
+      txPacket.type = SYSLINK_RADIO_RAW;
+      txPacket.length = txCrtp->size + 1; // Include the CRTP header
+      memcpy(txPacket.data, txCrtp->raw, txPacket.length);
+      crtpFreeTxPacket(txCrtp);
       ledseqRun(LINK_DOWN_LED, seq_linkup);
       syslinkSendPacket(&txPacket);
+      STATS_CNT_RATE_EVENT(&txRate);
+    }
+    else
+    {
+      STATS_CNT_RATE_EVENT(&txIdleRate);
     }
   } else if (slp->type == SYSLINK_RADIO_RAW_BROADCAST)
   {
     slp->length--; // Decrease to get CRTP size.
     xQueueSend(crtpPacketDelivery, &slp->length, 0);
     ledseqRun(LINK_LED, seq_linkup);
+    STATS_CNT_RATE_EVENT(&rxBcRate);
     // no ack for broadcasts
   } else if (slp->type == SYSLINK_RADIO_RSSI)
   {
@@ -179,14 +229,25 @@ void radiolinkSyslinkDispatch(SyslinkPacket *slp)
     memcpy(&rssi, slp->data, sizeof(uint8_t)); //rssi will not change on disconnect
   } else if (slp->type == SYSLINK_RADIO_P2P_BROADCAST)
   {
+    // The packet is only queued here, the handlers are called from the P2P
+    // task so that a slow handler does not stall the syslink task
+    static P2PPacket p2pp;
     ledseqRun(LINK_LED, seq_linkup);
-    P2PPacket p2pp;
+    p2pp.timestamp = usecTimestamp();
     p2pp.port=slp->data[0];
     p2pp.rssi = slp->data[1];
     memcpy(&p2pp.data[0], &slp->data[2],slp->length-2);
-    p2pp.size=slp->length;
-    if (p2p_callback)
-        p2p_callback(&p2pp);
+    p2pp.size=slp->length-2;
+    if (xQueueSend(p2pPacketDelivery, &p2pp, 0) == pdTRUE)
+    {
+      p2pRxCount++;
+      STATS_CNT_RATE_EVENT(&p2pRxRate);
+    }
+    else
+    {
+      p2pRxDrop++;
+      STATS_CNT_RATE_EVENT(&p2pDropRate);
+    }
   }
 
   isConnected = radiolinkIsConnected();
@@ -207,17 +268,49 @@ void p2pRegisterCB(P2PCallback cb)
     p2p_callback = cb;
 }
 
-static int radiolinkSendCRTPPacket(CRTPPacket *p)
+bool p2pRegisterPortCB(uint8_t port, P2PCallback cb)
 {
-  static SyslinkPacket slp;
+  if (p2pHandlerCount >= RADIOLINK_P2P_MAX_HANDLERS)
+  {
+    return false;
+  }
 
-  ASSERT(p->size <= CRTP_MAX_DATA_SIZE);
+  p2pHandlers[p2pHandlerCount].port = port;
+  p2pHandlers[p2pHandlerCount].callback = cb;
+  p2pHandlerCount++;
 
-  slp.type = SYSLINK_RADIO_RAW;
-  slp.length = p->size + 1;
-  memcpy(slp.data, &p->header, p->size + 1);
+  return true;
+}
+
+static void p2pTask(void *param)
+{
+  P2PPacket p2pp;
 
-  if (xQueueSend(txQueue, &slp, M2T(100)) == pdTRUE)
+  while (1)
+  {
+    xQueueReceive(p2pPacketDelivery, &p2pp, portMAX_DELAY);
+
+    for (int i = 0; i < p2pHandlerCount; i++)
+    {
+      if (p2pHandlers[i].port == p2pp.port)
+      {
+        p2pHandlers[i].callback(&p2pp);
+      }
+    }
+
+    if (p2p_callback)
+    {
+      p2p_callback(&p2pp);
+    }
+  }
+}
+
+// Takes over the TX pool packet, it is freed when sent to the radio
+static int radiolinkSendCRTPPacket(CRTPPacket *p)
+{
+  ASSERT(p->size <= CRTP_MAX_DATA_SIZE);
+
+  if (xQueueSend(txQueue, &p, M2T(100)) == pdTRUE)
   {
     return true;
   }
@@ -227,7 +320,8 @@ static int radiolinkSendCRTPPacket(CRTPPacket *p)
 
 bool radiolinkSendP2PPacketBroadcast(P2PPacket *p)
 {
-  static SyslinkPacket slp;
+  // on the stack, broadcasts can be sent from several tasks
+  SyslinkPacket slp;
 
   ASSERT(p->size <= P2P_MAX_DATA_SIZE);
 
@@ -237,6 +331,7 @@ bool radiolinkSendP2PPacketBroadcast(P2PPacket *p)
 
   syslinkSendPacket(&slp);
   ledseqRun(LINK_DOWN_LED, seq_linkup);
+  STATS_CNT_RATE_EVENT(&p2pTxRate);
 
   return true;
 }
@@ -252,7 +347,37 @@ static int radiolinkSetEnable(bool enable)
   return 0;
 }
 
+static int radiolinkReset(void)
+{
+  CRTPPacket *p;
+
+  // Return the packet waiting for an uplink packet to the pool
+  while (xQueueReceive(txQueue, &p, 0) == pdTRUE)
+  {
+    crtpFreeTxPacket(p);
+  }
+
+  return 0;
+}
+
+static uint8_t txQueueOccupancy(uint32_t timestamp, void* data)
+{
+  return uxQueueMessagesWaiting(txQueue);
+}
+
+static logByFunction_t txQueueLogger = {.acquireUInt8 = txQueueOccupancy, .data = 0};
+
 LOG_GROUP_START(radio)
 LOG_ADD(LOG_UINT8, rssi, &rssi)
 LOG_ADD(LOG_UINT8, isConnected, &isConnected)
+LOG_ADD(LOG_UINT32, p2pRx, &p2pRxCount)
+LOG_ADD(LOG_UINT32, p2pRxDrop, &p2pRxDrop)
+STATS_CNT_RATE_LOG_ADD(rxRate, &rxRate)
+STATS_CNT_RATE_LOG_ADD(rxBcRate, &rxBcRate)
+STATS_CNT_RATE_LOG_ADD(txRate, &txRate)
+STATS_CNT_RATE_LOG_ADD(txIdleRate, &txIdleRate)
+STATS_CNT_RATE_LOG_ADD(p2pRxRate, &p2pRxRate)
+STATS_CNT_RATE_LOG_ADD(p2pDropRate, &p2pDropRate)
+STATS_CNT_RATE_LOG_ADD(p2pTxRate, &p2pTxRate)
+LOG_ADD_BY_FUNCTION(LOG_UINT8, txQueue, &txQueueLogger)
 LOG_GROUP_STOP(radio)
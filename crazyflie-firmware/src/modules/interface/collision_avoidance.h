@@ -0,0 +1,71 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * collision_avoidance.h - Buffered Voronoi cells for the high-level commander
+ */
+#ifndef __COLLISION_AVOIDANCE_H__
+#define __COLLISION_AVOIDANCE_H__
+
+#include <stdbool.h>
+
+#include "math3d.h"
+#include "pptraj.h"
+#include "stabilizer_types.h"
+
+/**
+ * Project a point onto the buffered Voronoi cell of a Crazyflie.
+ *
+ * The cell contains the points that are closer to the Crazyflie than to any
+ * of its peers, shrunk so that the cells of two Crazyflies keep their centers
+ * out of an ellipsoid with the given radii around each other. As long as every
+ * Crazyflie stays in its own cell, they cannot collide.
+ *
+ * The cost is bounded: the projection takes at most a fixed number of passes
+ * over the peers. If these do not converge, the point is moved towards the
+ * Crazyflie until it is inside the cell, which is always possible while the
+ * Crazyflie is inside its cell itself.
+ *
+ * @param self Position of the Crazyflie
+ * @param peers Positions of the peers
+ * @param nPeers Number of peers
+ * @param radii Radii of the collision ellipsoid, e.g. taller than wide for downwash
+ * @param goal Point to project
+ * @param result The projected point, the goal if it is inside the cell
+ * @return true if the goal is outside the cell
+ */
+bool collisionAvoidanceProject(struct vec self, const struct vec* peers, int nPeers,
+  struct vec radii, struct vec goal, struct vec* result);
+
+/**
+ * Constrain a setpoint of the high-level commander to the buffered Voronoi
+ * cell computed from the peer positions, if enabled (param colAv.enable).
+ * A setpoint that is moved to the boundary of the cell is held there at rest,
+ * the high-level commander does not advance its plan while it is held.
+ *
+ * @param self The state estimate of the Crazyflie
+ * @param ev The setpoint to constrain
+ * @return true if the setpoint has been moved
+ */
+bool collisionAvoidanceConstrain(const point_t* self, struct traj_eval* ev);
+
+#endif //__COLLISION_AVOIDANCE_H__
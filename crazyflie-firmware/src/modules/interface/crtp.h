@@ -76,6 +76,14 @@ typedef struct _CRTPPacket
 
 typedef void (*CrtpCallback)(CRTPPacket *);
 
+/**
+ * Packet to drop when the RX queue of a port is full
+ */
+typedef enum {
+  crtpDropNewest = 0, //< Keep the queued packets, drop the received one
+  crtpDropOldest,     //< Drop the oldest queued packet to make room
+} crtpDropPolicy_t;
+
 /**
  * Initialize the CRTP stack
  */
@@ -90,6 +98,15 @@ bool crtpTest(void);
  */
 void crtpInitTaskQueue(CRTPPort taskId);
 
+/**
+ * Set what to drop when the RX queue of a port overflows. Dropped packets are
+ * counted per port in the crtpRx log group.
+ *
+ * @param[in] portId The CRTP port
+ * @param[in] policy The drop policy
+ */
+void crtpSetRxDropPolicy(CRTPPort portId, crtpDropPolicy_t policy);
+
 /**
  * Register a callback to be called for a particular port.
  *
@@ -105,7 +122,9 @@ void crtpRegisterPortCB(int port, CrtpCallback cb);
 /**
  * Put a packet in the TX task
  *
- * If the TX stack is full, the oldest lowest priority packet is dropped
+ * If the TX pool of the packet's traffic class is full the packet is dropped.
+ * Console and log packets have their own part of the pool, so they can not
+ * block replies on the other ports.
  *
  * @param[in] p CRTPPacket to send
  */
@@ -118,6 +137,34 @@ int crtpSendPacket(CRTPPacket *p);
  */
 int crtpSendPacketBlock(CRTPPacket *p);
 
+/**
+ * Get a packet buffer from the TX pool. The packet can be filled in place and
+ * handed to the TX task with crtpSendTxPacket(), without the copy done by
+ * crtpSendPacket().
+ *
+ * @param[in] port Port the packet will be sent on, selects the TX class the
+ *                 buffer is taken from
+ * @param[in] wait Time to wait for a free buffer in milisecond, portMAX_DELAY
+ *                 to wait forever
+ * @return Pointer to the packet buffer or NULL if the pool is empty
+ */
+CRTPPacket* crtpAllocTxPacket(CRTPPort port, int wait);
+
+/**
+ * Hand a packet buffer from crtpAllocTxPacket() to the TX task. The TX task
+ * takes over the buffer and returns it to the pool once sent.
+ *
+ * @param[in] p Packet buffer to send
+ */
+int crtpSendTxPacket(CRTPPacket *p);
+
+/**
+ * Return an unused packet buffer from crtpAllocTxPacket() to the TX pool.
+ *
+ * @param[in] p Packet buffer to release
+ */
+void crtpFreeTxPacket(CRTPPacket *p);
+
 /**
  * Fetch a packet with a specidied task ID.
  *
@@ -140,11 +187,12 @@ int crtpReceivePacket(CRTPPort taskId, CRTPPacket *p);
 int crtpReceivePacketWait(CRTPPort taskId, CRTPPacket *p, int wait);
 
 /**
- * Get the number of free tx packets in the queue
+ * Get the number of free tx packets in the pool of a port's traffic class
  *
+ * @param[in] port Crtp port the packets would be sent on
  * @return Number of free packets
  */
-int crtpGetFreeTxQueuePackets(void);
+int crtpGetFreeTxQueuePackets(CRTPPort port);
 
 /**
  * Wait for a packet to arrive for the specified taskID
@@ -164,6 +212,10 @@ struct crtpLinkOperations
 {
   int (*setEnable)(bool enable);
   int (*sendPacket)(CRTPPacket *pk);
+  // Optional, used instead of sendPacket. Takes over a buffer of the TX pool
+  // and returns it with crtpFreeTxPacket() once sent, so the link can queue
+  // the pointer instead of a copy of the packet.
+  int (*sendTxPacket)(CRTPPacket *pk);
   int (*receivePacket)(CRTPPacket *pk);
   bool (*isConnected)(void);
   int (*reset)(void);
@@ -48,7 +48,7 @@ Header file for high-level commander that computes smooth setpoints based on hig
 
 // allocate memory to store trajectories
 // 4k allows us to store 31 poly4d pieces
-// other (compressed) formats might be added in the future
+// or considerably more in the compressed formats
 #define TRAJECTORY_MEMORY_SIZE 4096
 extern uint8_t trajectories_memory[TRAJECTORY_MEMORY_SIZE];
 
@@ -67,4 +67,14 @@ void crtpCommanderHighLevelStop();
 // True if we have landed or emergency-stopped.
 bool crtpCommanderHighLevelIsStopped();
 
+// Fly through up to PP_MINSNAP_MAX_WAYPOINTS waypoints on a minimum snap
+// trajectory planned on-board, then hover at the last one. The planned pieces
+// are written to trajectories_memory at piecesOffset.
+int crtpCommanderHighLevelGoToWaypoints(const struct vec* waypoints, const float* yaws, uint8_t n_waypoints,
+  float duration, bool relative, uint32_t piecesOffset);
+
+// False if the given range of trajectories_memory holds pieces of a streamed
+// trajectory that have not been played back yet, i.e. must not be overwritten.
+bool crtpCommanderHighLevelIsTrajectoryMemoryWritable(uint32_t offset, uint32_t length);
+
 #endif /* CRTP_COMMANDER_HIGH_LEVEL_H_ */
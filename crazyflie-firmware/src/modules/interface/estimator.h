@@ -52,5 +52,6 @@ bool estimatorEnqueueAbsoluteHeight(const heightMeasurement_t *height);
 bool estimatorEnqueueFlow(const flowMeasurement_t *flow);
 bool estimatorEnqueueYawError(const yawErrorMeasurement_t *error);
 bool estimatorEnqueueSweepAngles(const sweepAngleMeasurement_t *angles);
+bool estimatorEnqueueSweepAngleBatch(const sweepAngleBatchMeasurement_t *batch);
 
 #endif //__ESTIMATOR_H__
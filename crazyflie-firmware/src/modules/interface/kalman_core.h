@@ -131,6 +131,9 @@ void kalmanCoreUpdateWithYawError(kalmanCoreData_t *this, yawErrorMeasurement_t
 // Measurement of sweep angles from a Lighthouse base station
 void kalmanCoreUpdateWithSweepAngles(kalmanCoreData_t *this, sweepAngleMeasurement_t *angles, const uint32_t tick);
 
+// Measurement of the sweep angles of all sensors from one Lighthouse base station frame
+void kalmanCoreUpdateWithSweepAngleBatch(kalmanCoreData_t *this, sweepAngleBatchMeasurement_t *batch, const uint32_t tick);
+
 /**
  * Primary Kalman filter functions
  *
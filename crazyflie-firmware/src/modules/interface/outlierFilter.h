@@ -29,6 +29,16 @@
 
 bool outlierFilterValidateTdoaSimple(const tdoaMeasurement_t* tdoa);
 bool outlierFilterValidateTdoaSteps(const tdoaMeasurement_t* tdoa, const float error, const vector_t* jacobian, const point_t* estPos);
+bool outlierFilterValidateTdoaInnovation(const tdoaMeasurement_t* tdoa, const float error, const float HPH, float* stdDev);
+
+/**
+ * Validate a TDoA measurement with the filter selected by the outlierf.tdoaMode parameter.
+ *
+ * @param HPH The innovation variance of the measurement without the measurement noise, HPH'
+ * @param stdDev (in/out) The measurement noise. The gate uses the value passed in, it may be
+ *               increased on return for the update with unreliable anchors
+ */
+bool outlierFilterValidateTdoa(const tdoaMeasurement_t* tdoa, const float error, const vector_t* jacobian, const point_t* estPos, const float HPH, float* stdDev);
 
 typedef struct {
     uint32_t openingTime;
@@ -0,0 +1,71 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * peer_localization.h - Positions of the other Crazyflies of a swarm
+ */
+#ifndef __PEER_LOCALIZATION_H__
+#define __PEER_LOCALIZATION_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stabilizer_types.h"
+
+/**
+ * P2P port of the position broadcasts
+ */
+#define PEER_LOCALIZATION_P2P_PORT 0x0E
+
+/**
+ * Maximum number of peers whose positions are kept
+ */
+#define PEER_LOCALIZATION_MAX_NEIGHBORS 10
+
+typedef struct {
+  uint8_t id;
+  point_t pos; // the timestamp is the tick count at reception
+} peerLocalizationOtherPosition_t;
+
+/**
+ * Every Crazyflie with an id (param peerloc.id) broadcasts its position in
+ * P2P packets, and keeps the last position heard from each of its peers.
+ */
+void peerLocalizationInit(void);
+bool peerLocalizationTest(void);
+
+/**
+ * Set the position of this Crazyflie, sent in the next broadcast. Called by
+ * the stabilizer with every state estimate, whatever commander is in use.
+ */
+void peerLocalizationSetOwnPosition(const point_t* pos);
+
+/**
+ * Copy the positions of the peers heard from recently
+ *
+ * @param positions Array of PEER_LOCALIZATION_MAX_NEIGHBORS positions
+ * @param maxAge Maximum age of the positions [ticks]
+ * @return The number of positions copied
+ */
+uint8_t peerLocalizationGetPositions(peerLocalizationOtherPosition_t* positions, uint32_t maxAge);
+
+#endif //__PEER_LOCALIZATION_H__
@@ -52,7 +52,9 @@ enum trajectory_state
 enum trajectory_type
 {
 	TRAJECTORY_TYPE_PIECEWISE            = 0,
-	TRAJECTORY_TYPE_PIECEWISE_COMPRESSED = 1
+	TRAJECTORY_TYPE_PIECEWISE_COMPRESSED = 1,
+	TRAJECTORY_TYPE_PIECEWISE_STREAM     = 2,
+	TRAJECTORY_TYPE_PIECEWISE_COMPRESSED_V2 = 3
 };
 
 struct planner
@@ -62,12 +64,15 @@ struct planner
 	bool reversed;					// true, if trajectory should be evaluated in reverse
 
 	union {
-		const struct piecewise_traj* trajectory; // pointer to trajectory
+		struct piecewise_traj* trajectory; // pointer to trajectory
 		struct piecewise_traj_compressed* compressed_trajectory; // pointer to compressed trajectory
+		struct piecewise_traj_stream* stream_trajectory; // pointer to streamed trajectory
+		struct piecewise_traj_compressed_v2* compressed_v2_trajectory; // pointer to v2 compressed trajectory
 	};
 
 	struct piecewise_traj planned_trajectory; // trajectory for on-board planning
 	struct poly4d pieces[1]; // the on-board planner requires a single piece, only
+	struct piecewise_traj waypoint_trajectory; // on-board planned trajectory through waypoints
 };
 
 // initialize the planner
@@ -83,9 +88,16 @@ void plan_stop(struct planner *p);
 // and also after an emergency stop.
 bool plan_is_stopped(struct planner *p);
 
+// query if the current trajectory has been flown completely at time t.
+bool plan_is_finished(struct planner *p, float t);
+
 // get the planner's current goal.
 struct traj_eval plan_current_goal(struct planner *p, float t);
 
+// move the origin of the plan time forward by dt, the current trajectory
+// keeps flying as before. lets the caller keep t small, and thus precise.
+void plan_shift_time(struct planner *p, float dt);
+
 // start a takeoff trajectory.
 int plan_takeoff(struct planner *p, struct vec curr_pos, float curr_yaw, float hover_height, float hover_yaw, float duration, float t);
 
@@ -95,8 +107,22 @@ int plan_land(struct planner *p, struct vec curr_pos, float curr_yaw, float hove
 // move to a given position, then hover there.
 int plan_go_to(struct planner *p, bool relative, struct vec hover_pos, float hover_yaw, float duration, float t);
 
+// move through up to PP_MINSNAP_MAX_WAYPOINTS waypoints on a minimum snap
+// trajectory, then hover at the last one. the duration is split over the
+// pieces in proportion to their length, short pieces next to long ones get
+// more time to keep the plan well conditioned; the pieces are written to the
+// given buffer, which must stay valid while the trajectory is flown.
+int plan_go_to_waypoints(struct planner *p, bool relative, struct vec const *waypoints, float const *yaws,
+	int n_waypoints, float duration, float t, struct poly4d *pieces);
+
 // start trajectory
-int plan_start_trajectory(struct planner *p, const struct piecewise_traj* trajectory, bool reversed);
+int plan_start_trajectory(struct planner *p, struct piecewise_traj* trajectory, bool reversed);
 
 // start compressed trajectory
 int plan_start_compressed_trajectory(struct planner *p, struct piecewise_traj_compressed* trajectory);
+
+// start v2 compressed trajectory
+int plan_start_compressed_v2_trajectory(struct planner *p, struct piecewise_traj_compressed_v2* trajectory);
+
+// start streamed trajectory
+int plan_start_stream_trajectory(struct planner *p, struct piecewise_traj_stream* trajectory);
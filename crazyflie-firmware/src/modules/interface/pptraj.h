@@ -38,6 +38,8 @@ Header file for piecewise polynomial trajectories
 
 #pragma once
 
+#include <stdint.h>
+
 #include "math3d.h"
 
 #define PP_DEGREE (7)
@@ -133,12 +135,48 @@ bool is_traj_eval_valid(struct traj_eval const *ev);
 // evaluate a single polynomial piece
 struct traj_eval poly4d_eval(struct poly4d const *p, float t);
 
+// a single polynomial piece prepared for repeated evaluation.
+// holds the coefficients of the piece and its 1st to 3rd derivatives,
+// interleaved such that one Horner step updates all of them at once:
+// coef[k][4 * d + axis] is the k-th coefficient of the d-th derivative
+// of axis (x, y, z, yaw).
+#define POLY4D_PREPARED_LANES 16
+struct poly4d_prepared
+{
+	float coef[PP_SIZE][POLY4D_PREPARED_LANES];
+};
+
+// prepare a polynomial piece for repeated evaluation.
+void poly4d_prepare(struct poly4d_prepared *out, struct poly4d const *p);
+
+// evaluate a prepared polynomial piece, same result as poly4d_eval.
+struct traj_eval poly4d_eval_prepared(struct poly4d_prepared const *p, float t);
+
 
 
 // ----------------------------------//
 // piecewise polynomial trajectories //
 // ----------------------------------//
 
+// playhead of a piecewise trajectory, maintained by piecewise_eval.
+// it remembers the current piece with the shift and timescale applied,
+// so evaluating the trajectory does not need to search the pieces
+// or rebuild the polynomials at every call.
+struct piecewise_cursor
+{
+	// the trajectory parameters the cursor is valid for
+	struct poly4d const *pieces;
+	float t_begin;
+	float timescale;
+	struct vec shift;
+	bool reversed;
+
+	int index; // current piece, in playback order
+	float t_piece_begin; // start of the current piece, relative to t_begin
+	int prepared_index; // piece in the prepared cache, -1 if none
+	struct poly4d_prepared prepared;
+};
+
 struct piecewise_traj
 {
 	float t_begin;
@@ -146,6 +184,7 @@ struct piecewise_traj
 	struct vec shift;
 	unsigned char n_pieces;
 	struct poly4d* pieces;
+	struct piecewise_cursor cursor;
 };
 
 static inline float piecewise_duration(struct piecewise_traj const *pp)
@@ -165,14 +204,97 @@ void piecewise_plan_7th_order_no_jerk(struct piecewise_traj *p, float duration,
 	struct vec p0, float y0, struct vec v0, float dy0, struct vec a0,
 	struct vec p1, float y1, struct vec v1, float dy1, struct vec a1);
 
+// maximum number of waypoints of piecewise_plan_minimum_snap
+#define PP_MINSNAP_MAX_WAYPOINTS 8
+// maximum ratio of the durations of neighbouring pieces. a piece next to a
+// much shorter one starts with large derivatives, which cancel in its float
+// coefficients: at a ratio of 10 the waypoints are missed by centimeters.
+#define PP_MINSNAP_MAX_DURATION_RATIO 4.0f
+
+// plan a minimum snap trajectory from the start state through the given
+// waypoints, coming to rest at the last one. there is one piece per waypoint:
+// durations[i] is the time to fly from the previous waypoint (or the start)
+// to waypoint i. the pieces are written to pieces[0 .. n_waypoints - 1],
+// t_begin is left to the caller.
+// returns false if the number of waypoints or a duration is invalid, or if
+// neighbouring durations differ by more than PP_MINSNAP_MAX_DURATION_RATIO.
+bool piecewise_plan_minimum_snap(struct piecewise_traj *p, struct poly4d *pieces,
+	struct traj_eval const *start, struct vec const *positions, float const *yaws,
+	float const *durations, int n_waypoints);
+
+// forget the playhead, e.g. after the pieces were modified in place.
+// changes to t_begin, timescale, shift or pieces are detected automatically.
+void piecewise_reset_cursor(struct piecewise_traj *traj);
+
 struct traj_eval piecewise_eval(
-	struct piecewise_traj const *traj, float t);
+	struct piecewise_traj *traj, float t);
 
 struct traj_eval piecewise_eval_reversed(
-	struct piecewise_traj const *traj, float t);
+	struct piecewise_traj *traj, float t);
 
 
 static inline bool piecewise_is_finished(struct piecewise_traj const *traj, float t)
 {
 	return (t - traj->t_begin) >= piecewise_duration(traj);
 }
+
+
+// -------------------------------------------//
+// streamed piecewise polynomial trajectories //
+// -------------------------------------------//
+
+// a piecewise trajectory whose pieces are appended to a ring buffer while
+// it is flying. pieces are played back in the order they were appended;
+// the slot of a piece becomes free again once playback has moved past it.
+// running out of pieces before the stream is complete is an underrun:
+// the trajectory then holds the end of the last piece and accepts no more pieces.
+struct piecewise_traj_stream
+{
+	float t_begin;
+	float timescale;
+	struct vec shift;
+	struct poly4d* pieces; // ring buffer
+	uint8_t capacity; // number of pieces in the ring buffer
+
+	uint32_t appended; // total number of pieces appended
+	uint32_t consumed; // total number of pieces played back completely
+	float t_consumed; // start of the oldest piece in the ring, relative to t_begin
+	bool complete; // the producer appended the last piece
+	bool underrun;
+
+	struct traj_eval hold; // end of the last available piece
+	uint32_t prepared_seq; // piece in the prepared cache
+	bool prepared_valid;
+	struct poly4d_prepared prepared;
+};
+
+// start an empty stream using the given ring buffer.
+void piecewise_stream_init(struct piecewise_traj_stream *stream,
+	struct poly4d* pieces, uint8_t capacity);
+
+// number of slots that can be appended to.
+static inline uint8_t piecewise_stream_free(struct piecewise_traj_stream const *stream)
+{
+	return stream->capacity - (uint8_t)(stream->appended - stream->consumed);
+}
+
+// ring buffer slot of the n-th appended piece.
+static inline uint8_t piecewise_stream_slot(struct piecewise_traj_stream const *stream, uint32_t seq)
+{
+	return seq % stream->capacity;
+}
+
+// mark the next count slots as appended, i.e. the pieces have been written
+// to piecewise_stream_slot(stream, stream->appended) onwards.
+// returns false (and appends nothing) if there is not enough room
+// or the stream has ended.
+bool piecewise_stream_append(struct piecewise_traj_stream *stream, uint8_t count, bool last);
+
+struct traj_eval piecewise_stream_eval(
+	struct piecewise_traj_stream *stream, float t);
+
+static inline bool piecewise_stream_is_finished(struct piecewise_traj_stream const *stream, float t)
+{
+	return stream->underrun
+		|| (stream->complete && stream->consumed == stream->appended);
+}
@@ -83,3 +83,112 @@ struct traj_eval piecewise_compressed_eval(
 // Loads the compressed trajectory at the given pointer
 void piecewise_compressed_load(
 	struct piecewise_traj_compressed *traj, const void* data);
+
+// ------------------------------------------------//
+// compressed piecewise polynomial trajectories, v2 //
+// ------------------------------------------------//
+
+// Layout of the v2 format:
+//
+// - version (uint8, 2)
+// - flags (uint8, see PPTRAJ_V2_FLAG_*)
+// - distance unit [m], angle unit [rad] and duration unit [s] (float32 each)
+// - the start point: x, y, z, yaw (signed numbers)
+// - the pieces, each consisting of
+//   - the storage types (uint8, same layout as in the v1 format)
+//   - the duration (unsigned number), zero marks the end of the trajectory
+//   - the control points of x, y, z and yaw, as many as in the v1 format.
+//     Each one is stored as the difference to the previous control point of
+//     the same axis, so smooth trajectories mostly need small numbers.
+//
+// All quantities are integer multiples of the units, which the encoder picks
+// per trajectory. Numbers are little endian base-128 varints, signed numbers
+// zigzag encoded, unless the data is Rice coded.
+#define PPTRAJ_V2_VERSION 2
+
+// Numbers after the header are Rice coded: the bits are read starting at the
+// least significant bit of each byte; a number n with parameter k is stored
+// as (n >> k) one bits, a zero bit and the k low bits of n. 16 one bits are
+// followed by the number in 32 bits instead. The storage types are 8 plain
+// bits. The parameter of a number is the bit length of m / 2, where m is
+// the running mean of the previous numbers of its kind (durations, or the
+// control points of one axis): m = acc / 16, with acc starting at zero and
+// updated by acc += min(n, 0xffff) - acc / 16 after each number.
+#define PPTRAJ_V2_FLAG_RICE 0x01
+
+// number kinds with their own Rice parameter: the four axes and durations
+#define PPTRAJ_V2_CONTEXTS 5
+
+struct piecewise_traj_compressed_v2_reader
+{
+	const uint8_t* ptr;
+	const uint8_t* end;
+	uint8_t bit;	// next bit in *ptr
+	bool rice;
+	bool overrun;	// tried to read past the end
+	uint32_t acc[PPTRAJ_V2_CONTEXTS];
+};
+
+struct piecewise_traj_compressed_v2
+{
+	float t_begin;
+	float duration;
+	float timescale;
+	struct vec shift;
+	const uint8_t* data;
+	const uint8_t* data_end;
+
+	// units, from the header
+	float distance_unit;
+	float angle_unit;
+	float duration_unit;
+
+	// mutable part of the data structure. The current piece is played back
+	// from pieces[current], the following one is decoded into the other slot
+	// step by step while the current piece is being played.
+	struct piecewise_traj_compressed_v2_reader reader;
+	int32_t control_point[4];	// last decoded control point of each axis [units]
+
+	struct {
+		float t_begin_relative;
+		float duration;
+		struct poly4d_prepared prepared;
+	} pieces[2];
+	uint8_t current;
+
+	// progress of decoding the next piece, see pptraj_compressed.c
+	uint8_t prefetch;
+	uint8_t storage_types;
+	struct poly4d next;
+};
+
+// Returns the total duration of a compressed trajectory, with the timescale
+// applied
+static inline float piecewise_compressed_v2_duration(struct piecewise_traj_compressed_v2 const *traj) {
+	return traj->duration;
+}
+
+// Returns whether we have finished flying the trajectory
+static inline bool piecewise_compressed_v2_is_finished(
+	struct piecewise_traj_compressed_v2 const *traj, float t)
+{
+	return (t - traj->t_begin) >= piecewise_compressed_v2_duration(traj);
+}
+
+// Evaluates the trajectory at the given time instant. Also does a step of
+// the decoding of the next piece.
+struct traj_eval piecewise_compressed_v2_eval(
+	struct piecewise_traj_compressed_v2 *traj, float t);
+
+// Checks the v2 compressed trajectory stored in data[0..size) by walking
+// through all of it. Returns its duration without timescale [s], or a
+// negative value if the data is not a valid v2 trajectory. As this reads the
+// whole trajectory, it should not be called from the stabilizer loop.
+float piecewise_compressed_v2_validate(const void* data, uint32_t size);
+
+// Loads the v2 compressed trajectory stored in data[0..size), with the
+// duration returned by piecewise_compressed_v2_validate and the given
+// timescale, and decodes its first two pieces. Returns false if the header
+// is not a valid v2 header.
+bool piecewise_compressed_v2_load(
+	struct piecewise_traj_compressed_v2 *traj, const void* data, uint32_t size, float timescale, float duration);
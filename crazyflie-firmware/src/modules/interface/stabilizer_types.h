@@ -80,6 +80,7 @@ typedef struct quaternion_s {
 
 typedef struct tdoaMeasurement_s {
   point_t anchorPosition[2];
+  uint8_t anchorId[2];
   float distanceDiff;
   float stdDev;
 } tdoaMeasurement_t;
@@ -253,6 +254,23 @@ typedef struct {
   vec3d* sensorPos;
 } sweepAngleMeasurement_t;
 
+#define SWEEP_ANGLE_BATCH_MAX_SENSORS 4
+
+/** Sweep angles of all sensors seen by one base station in one frame */
+typedef struct {
+  uint32_t timestamp;
+  vec3d* baseStationPos;
+  mat3d* baseStationRot;     // Base station rotation matrix
+  mat3d* baseStationRotInv;  // Inverted base station rotation matrix
+  float stdDev;
+  uint8_t sensorCount;
+  struct {
+    vec3d* sensorPos;
+    float angleX;
+    float angleY;
+  } sensors[SWEEP_ANGLE_BATCH_MAX_SENSORS];
+} sweepAngleBatchMeasurement_t;
+
 // Frequencies to bo used with the RATE_DO_EXECUTE_HZ macro. Do NOT use an arbitrary number.
 #define RATE_1000_HZ 1000
 #define RATE_500_HZ 500
@@ -0,0 +1,66 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * swarm_time.h - Clock shared by the Crazyflies of a swarm
+ */
+#ifndef __SWARM_TIME_H__
+#define __SWARM_TIME_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * P2P port of the swarm time beacons
+ */
+#define SWARM_TIME_P2P_PORT 0x0F
+
+/**
+ * The swarm time is a clock in microseconds shared by the Crazyflies of a
+ * swarm. One Crazyflie, the master (param swarmtime.master), broadcasts its
+ * clock in P2P beacons and the others follow it, compensating for the offset
+ * and the drift of their own clock. Until a beacon has been received the
+ * swarm time is the local time.
+ */
+void swarmTimeInit(void);
+bool swarmTimeTest(void);
+
+/**
+ * @return The current swarm time [us]
+ */
+uint64_t swarmTimeUsec(void);
+
+/**
+ * Convert a swarm time to the time base of usecTimestamp()
+ *
+ * @param swarmTime Swarm time [us]
+ * @return The local time [us]
+ */
+uint64_t swarmTimeToLocalUsec(uint64_t swarmTime);
+
+/**
+ * @return true if this Crazyflie is the master or follows a master that has
+ *         been heard from recently
+ */
+bool swarmTimeIsSynchronized(void);
+
+#endif //__SWARM_TIME_H__
@@ -0,0 +1,164 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * collision_avoidance.c - Buffered Voronoi cells for the high-level commander
+ *
+ * The computations are done in a space scaled by the collision ellipsoid,
+ * where it is the unit sphere. The cell is then the intersection of a half
+ * space per peer, bounded by the bisecting plane moved half a unit towards
+ * the Crazyflie. The projection onto the cell uses Dykstra's algorithm.
+ */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "collision_avoidance.h"
+#include "peer_localization.h"
+#include "log.h"
+#include "param.h"
+
+#define PROJECTION_ITERATIONS 20
+#define FEASIBILITY_TOLERANCE 1e-4f
+// peers closer than this in the scaled space are ignored, there is no plane
+#define MIN_PEER_DISTANCE 1e-3f
+
+static uint8_t enable = 0;
+static struct vec ellipsoidRadii = {0.2f, 0.2f, 0.5f};
+static uint16_t maxPeerAgeMs = 500;
+
+static uint8_t isConstrained;
+static uint8_t peerCount;
+
+// half spaces n * x <= b, in the scaled space
+static struct vec normals[PEER_LOCALIZATION_MAX_NEIGHBORS];
+static float offsets[PEER_LOCALIZATION_MAX_NEIGHBORS];
+static struct vec corrections[PEER_LOCALIZATION_MAX_NEIGHBORS];
+
+static float maxViolation(const struct vec x, int n)
+{
+  float violation = 0;
+  for (int i = 0; i < n; i++) {
+    violation = fmaxf(violation, vdot(normals[i], x) - offsets[i]);
+  }
+  return violation;
+}
+
+bool collisionAvoidanceProject(struct vec self, const struct vec* peers, int nPeers,
+  struct vec radii, struct vec goal, struct vec* result)
+{
+  struct vec s = veltdiv(self, radii);
+  struct vec x = veltdiv(goal, radii);
+  int n = 0;
+
+  if (nPeers > PEER_LOCALIZATION_MAX_NEIGHBORS) {
+    nPeers = PEER_LOCALIZATION_MAX_NEIGHBORS;
+  }
+  for (int i = 0; i < nPeers; i++) {
+    struct vec q = veltdiv(peers[i], radii);
+    struct vec d = vsub(q, s);
+    float distance = vmag(d);
+    if (distance > MIN_PEER_DISTANCE) {
+      normals[n] = vdiv(d, distance);
+      offsets[n] = vdot(normals[n], vscl(0.5f, vadd(s, q))) - 0.5f;
+      n++;
+    }
+  }
+
+  *result = goal;
+  if (maxViolation(x, n) <= FEASIBILITY_TOLERANCE) {
+    return false;
+  }
+
+  for (int i = 0; i < n; i++) {
+    corrections[i] = vzero();
+  }
+  for (int iteration = 0; iteration < PROJECTION_ITERATIONS; iteration++) {
+    struct vec previous = x;
+    for (int i = 0; i < n; i++) {
+      struct vec z = vadd(x, corrections[i]);
+      float violation = vdot(normals[i], z) - offsets[i];
+      x = violation > 0 ? vsub(z, vscl(violation, normals[i])) : z;
+      corrections[i] = vsub(z, x);
+    }
+    // the iterates can be feasible long before they reach the projection
+    if (vdist2(x, previous) <= fsqr(FEASIBILITY_TOLERANCE)
+        && maxViolation(x, n) <= FEASIBILITY_TOLERANCE) {
+      break;
+    }
+  }
+
+  // not converged yet: the segment from the Crazyflie to x leaves the cell
+  // where the first plane is crossed
+  if (maxViolation(x, n) > FEASIBILITY_TOLERANCE && maxViolation(s, n) <= 0) {
+    float scale = 1;
+    struct vec step = vsub(x, s);
+    for (int i = 0; i < n; i++) {
+      float rate = vdot(normals[i], step);
+      if (rate > 0) {
+        scale = fminf(scale, (offsets[i] - vdot(normals[i], s)) / rate);
+      }
+    }
+    x = vadd(s, vscl(scale, step));
+  }
+
+  *result = veltmul(x, radii);
+  return true;
+}
+
+bool collisionAvoidanceConstrain(const point_t* self, struct traj_eval* ev)
+{
+  static peerLocalizationOtherPosition_t others[PEER_LOCALIZATION_MAX_NEIGHBORS];
+  static struct vec peers[PEER_LOCALIZATION_MAX_NEIGHBORS];
+
+  if (!enable) {
+    isConstrained = false;
+    return false;
+  }
+
+  peerCount = peerLocalizationGetPositions(others, M2T(maxPeerAgeMs));
+  for (int i = 0; i < peerCount; i++) {
+    peers[i] = mkvec(others[i].pos.x, others[i].pos.y, others[i].pos.z);
+  }
+
+  struct vec constrained;
+  isConstrained = collisionAvoidanceProject(mkvec(self->x, self->y, self->z), peers, peerCount,
+    ellipsoidRadii, ev->pos, &constrained);
+  if (isConstrained) {
+    ev->pos = constrained;
+    ev->vel = vzero();
+    ev->acc = vzero();
+  }
+  return isConstrained;
+}
+
+LOG_GROUP_START(colAv)
+LOG_ADD(LOG_UINT8, active, &isConstrained)
+LOG_ADD(LOG_UINT8, peers, &peerCount)
+LOG_GROUP_STOP(colAv)
+
+PARAM_GROUP_START(colAv)
+PARAM_ADD(PARAM_UINT8, enable, &enable)
+PARAM_ADD(PARAM_FLOAT, ellipsoidX, &ellipsoidRadii.x)
+PARAM_ADD(PARAM_FLOAT, ellipsoidY, &ellipsoidRadii.y)
+PARAM_ADD(PARAM_FLOAT, ellipsoidZ, &ellipsoidRadii.z)
+PARAM_ADD(PARAM_UINT16, maxPeerAge, &maxPeerAgeMs)
+PARAM_GROUP_STOP(colAv)
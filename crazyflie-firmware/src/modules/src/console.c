@@ -42,8 +42,8 @@
 #endif
 #endif
 
-static CRTPPacket messageToPrint;
-static bool messageSendingIsPending = false;
+// TX pool buffer the message is written into, NULL if the pool was empty
+static CRTPPacket *messageToPrint;
 static xSemaphoreHandle synch = NULL;
 
 static const char bufferFullMsg[] = "<F>\n";
@@ -53,21 +53,41 @@ static void addBufferFullMarker();
 
 
 /**
- * Send the data to the client
- * returns TRUE if successful otherwise FALSE
+ * Take a TX pool buffer for the message if there is none. The characters are
+ * dropped while the pool is empty.
+ * returns TRUE if there is a buffer otherwise FALSE
  */
-static bool consoleSendMessage(void)
+static bool consoleAllocMessage(void)
 {
-  if (crtpSendPacket(&messageToPrint) == pdTRUE)
+  if (messageToPrint == NULL)
   {
-    messageToPrint.size = 0;
-    messageSendingIsPending = false;
+    messageToPrint = crtpAllocTxPacket(CRTP_PORT_CONSOLE, 0);
+    if (messageToPrint != NULL)
+    {
+      messageToPrint->size = 0;
+      messageToPrint->header = CRTP_HEADER(CRTP_PORT_CONSOLE, 0);
+    }
   }
-  else
+
+  return messageToPrint != NULL;
+}
+
+/**
+ * Send the data to the client, the buffer is handed to the TX task as is
+ * returns TRUE if successful otherwise FALSE
+ */
+static bool consoleSendMessage(void)
+{
+  if (messageToPrint == NULL)
   {
     return false;
   }
 
+  crtpSendTxPacket(messageToPrint);
+  messageToPrint = NULL;
+  // Have a buffer ready for consolePutcharFromISR()
+  consoleAllocMessage();
+
   return true;
 }
 
@@ -76,10 +96,8 @@ void consoleInit()
   if (isInit)
     return;
 
-  messageToPrint.size = 0;
-  messageToPrint.header = CRTP_HEADER(CRTP_PORT_CONSOLE, 0);
   vSemaphoreCreateBinary(synch);
-  messageSendingIsPending = false;
+  consoleAllocMessage();
 
   isInit = true;
 }
@@ -103,27 +121,21 @@ int consolePutchar(int ch)
 
   if (xSemaphoreTake(synch, portMAX_DELAY) == pdTRUE)
   {
-    // Try to send if we already have a pending message
-    if (messageSendingIsPending) 
-    {
-      consoleSendMessage();
-    }
-
-    if (! messageSendingIsPending) 
+    if (consoleAllocMessage())
     {
-      if (messageToPrint.size < CRTP_MAX_DATA_SIZE)
+      if (messageToPrint->size < CRTP_MAX_DATA_SIZE)
       {
-        messageToPrint.data[messageToPrint.size] = (unsigned char)ch;
-        messageToPrint.size++;
+        messageToPrint->data[messageToPrint->size] = (unsigned char)ch;
+        messageToPrint->size++;
       }
 
-      if (ch == '\n' || messageToPrint.size >= CRTP_MAX_DATA_SIZE)
+      if (ch == '\n' || messageToPrint->size >= CRTP_MAX_DATA_SIZE)
       {
-        if (crtpGetFreeTxQueuePackets() == 1)
+        // This is the last buffer of the pool
+        if (crtpGetFreeTxQueuePackets(CRTP_PORT_CONSOLE) == 0)
         {
           addBufferFullMarker();
         }
-        messageSendingIsPending = true;
         consoleSendMessage();
       }
     }
@@ -137,10 +149,10 @@ int consolePutcharFromISR(int ch) {
   BaseType_t higherPriorityTaskWoken;
 
   if (xSemaphoreTakeFromISR(synch, &higherPriorityTaskWoken) == pdTRUE) {
-    if (messageToPrint.size < CRTP_MAX_DATA_SIZE)
+    if (messageToPrint != NULL && messageToPrint->size < CRTP_MAX_DATA_SIZE)
     {
-      messageToPrint.data[messageToPrint.size] = (unsigned char)ch;
-      messageToPrint.size++;
+      messageToPrint->data[messageToPrint->size] = (unsigned char)ch;
+      messageToPrint->size++;
     }
     xSemaphoreGiveFromISR(synch, &higherPriorityTaskWoken);
   }
@@ -170,10 +182,10 @@ void consoleFlush(void)
 
 static int findMarkerStart()
 {
-  int start = messageToPrint.size;
+  int start = messageToPrint->size;
   
   // If last char is new line, rewind one char since the marker contains a new line.
-  if (start > 0 && messageToPrint.data[start - 1] == '\n')
+  if (start > 0 && messageToPrint->data[start - 1] == '\n')
   {
     start -= 1;
   }
@@ -191,6 +203,6 @@ static void addBufferFullMarker()
   }
 
   int startMarker = endMarker - sizeof(bufferFullMsg);
-  memcpy(&messageToPrint.data[startMarker], bufferFullMsg, sizeof(bufferFullMsg));
-  messageToPrint.size = startMarker + sizeof(bufferFullMsg);
+  memcpy(&messageToPrint->data[startMarker], bufferFullMsg, sizeof(bufferFullMsg));
+  messageToPrint->size = startMarker + sizeof(bufferFullMsg);
 }
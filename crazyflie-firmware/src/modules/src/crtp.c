@@ -26,6 +26,7 @@
 
 #include <stdbool.h>
 #include <errno.h>
+#include <string.h>
 
 /*FreeRtos includes*/
 #include "FreeRTOS.h"
@@ -42,6 +43,9 @@
 #include "static_mem.h"
 
 #include "log.h"
+#include "param.h"
+#include "statsCnt.h"
+#include "usec_time.h"
 
 
 static bool isInit;
@@ -67,17 +71,94 @@ static struct {
   uint32_t previousStatisticsTime;
 } stats;
 
-static xQueueHandle  txQueue;
-
 #define CRTP_NBR_OF_PORTS 16
-#define CRTP_TX_QUEUE_SIZE 120
 #define CRTP_RX_QUEUE_SIZE 16
 
+/* TX traffic classes. Each class owns a part of the TX packet pool, so a
+ * saturated class can never starve the others of buffers, and its own TX
+ * queue. The TX task picks the next packet with a deficit round robin over
+ * the classes, the quantum of a class being the number of packets it may
+ * send in a row. */
+typedef enum {
+  crtpTxClassControl = 0,   // Replies and commands: param, mem, localization...
+  crtpTxClassConsole,
+  crtpTxClassTelemetry,     // Log blocks
+  CRTP_TX_NBR_OF_CLASSES,
+} crtpTxClass_t;
+
+#define CRTP_TX_POOL_SIZE_CONTROL   16
+#define CRTP_TX_POOL_SIZE_CONSOLE   8
+#define CRTP_TX_POOL_SIZE_TELEMETRY 40
+#define CRTP_TX_POOL_SIZE (CRTP_TX_POOL_SIZE_CONTROL + CRTP_TX_POOL_SIZE_CONSOLE + CRTP_TX_POOL_SIZE_TELEMETRY)
+
+static const crtpTxClass_t portTxClass[CRTP_NBR_OF_PORTS] = {
+  [CRTP_PORT_CONSOLE] = crtpTxClassConsole,
+  [CRTP_PORT_LOG]     = crtpTxClassTelemetry,
+  // All other ports are crtpTxClassControl
+};
+
+struct crtpTxClass {
+  CRTPPacket *pool;
+  uint8_t poolSize;
+  xQueueHandle freeQueue;
+  xQueueHandle queue;
+  uint8_t quantum;
+  uint16_t deficit;
+  uint32_t dropCount;
+  // Moving average of the time from queuing to acceptance by the link, in us.
+  // Local to the Crazyflie, this is not a round trip time.
+  float queueDelay;
+};
+
+// Weight of a new sample in the TX queue delay moving average
+#define CRTP_TX_QUEUE_DELAY_ALPHA 0.05f
+
+// TX packet buffers. Packets are handed by pointer from the producer to the
+// TX task and back to the free queue, the queues only hold the pointers.
+static CRTPPacket txPool[CRTP_TX_POOL_SIZE];
+
+static struct crtpTxClass txClasses[CRTP_TX_NBR_OF_CLASSES] = {
+  [crtpTxClassControl]   = { .pool = &txPool[0],
+                             .poolSize = CRTP_TX_POOL_SIZE_CONTROL, .quantum = 4 },
+  [crtpTxClassConsole]   = { .pool = &txPool[CRTP_TX_POOL_SIZE_CONTROL],
+                             .poolSize = CRTP_TX_POOL_SIZE_CONSOLE, .quantum = 2 },
+  [crtpTxClassTelemetry] = { .pool = &txPool[CRTP_TX_POOL_SIZE_CONTROL + CRTP_TX_POOL_SIZE_CONSOLE],
+                             .poolSize = CRTP_TX_POOL_SIZE_TELEMETRY, .quantum = 1 },
+};
+
+STATIC_MEM_QUEUE_ALLOC(txControlQueue, CRTP_TX_POOL_SIZE_CONTROL, sizeof(CRTPPacket*));
+STATIC_MEM_QUEUE_ALLOC(txControlFreeQueue, CRTP_TX_POOL_SIZE_CONTROL, sizeof(CRTPPacket*));
+STATIC_MEM_QUEUE_ALLOC(txConsoleQueue, CRTP_TX_POOL_SIZE_CONSOLE, sizeof(CRTPPacket*));
+STATIC_MEM_QUEUE_ALLOC(txConsoleFreeQueue, CRTP_TX_POOL_SIZE_CONSOLE, sizeof(CRTPPacket*));
+STATIC_MEM_QUEUE_ALLOC(txTelemetryQueue, CRTP_TX_POOL_SIZE_TELEMETRY, sizeof(CRTPPacket*));
+STATIC_MEM_QUEUE_ALLOC(txTelemetryFreeQueue, CRTP_TX_POOL_SIZE_TELEMETRY, sizeof(CRTPPacket*));
+
+// Wakes up the TX task when a packet is queued in any class
+static xSemaphoreHandle txSemaphore;
+static StaticSemaphore_t txSemaphoreBuffer;
+
+static uint32_t txPortCount[CRTP_NBR_OF_PORTS];
+static uint64_t txQueuedAt[CRTP_TX_POOL_SIZE];
+
 static void crtpTxTask(void *param);
 static void crtpRxTask(void *param);
 
 static xQueueHandle queues[CRTP_NBR_OF_PORTS];
 static volatile CrtpCallback callbacks[CRTP_NBR_OF_PORTS];
+
+// What to do when the RX queue of a port is full. Only the ports read
+// through a queue can overflow, the callback ports are served synchronously
+// by the RX task. In a setpoint stream a new setpoint supersedes the ones
+// queued before it. All other ports, including the high-level commander,
+// carry one-shot commands and requests: the packets already queued are kept,
+// the newest is dropped and the client notices the missing reply or counter.
+static crtpDropPolicy_t rxDropPolicy[CRTP_NBR_OF_PORTS] = {
+  [CRTP_PORT_SETPOINT] = crtpDropOldest,
+  [CRTP_PORT_SETPOINT_GENERIC] = crtpDropOldest,
+  // All other ports are crtpDropNewest
+};
+static uint32_t rxDropCount[CRTP_NBR_OF_PORTS];
+static uint32_t rxDropTotal;
 static void updateStats();
 
 STATIC_MEM_TASK_ALLOC(crtpTxTask, CRTP_TX_TASK_STACKSIZE);
@@ -88,8 +169,26 @@ void crtpInit(void)
   if(isInit)
     return;
 
-  txQueue = xQueueCreate(CRTP_TX_QUEUE_SIZE, sizeof(CRTPPacket));
-  DEBUG_QUEUE_MONITOR_REGISTER(txQueue);
+  txClasses[crtpTxClassControl].queue = STATIC_MEM_QUEUE_CREATE(txControlQueue);
+  txClasses[crtpTxClassControl].freeQueue = STATIC_MEM_QUEUE_CREATE(txControlFreeQueue);
+  txClasses[crtpTxClassConsole].queue = STATIC_MEM_QUEUE_CREATE(txConsoleQueue);
+  txClasses[crtpTxClassConsole].freeQueue = STATIC_MEM_QUEUE_CREATE(txConsoleFreeQueue);
+  txClasses[crtpTxClassTelemetry].queue = STATIC_MEM_QUEUE_CREATE(txTelemetryQueue);
+  txClasses[crtpTxClassTelemetry].freeQueue = STATIC_MEM_QUEUE_CREATE(txTelemetryFreeQueue);
+
+  for (int c = 0; c < CRTP_TX_NBR_OF_CLASSES; c++)
+  {
+    DEBUG_QUEUE_MONITOR_REGISTER(txClasses[c].queue);
+    DEBUG_QUEUE_MONITOR_REGISTER(txClasses[c].freeQueue);
+
+    for (int i = 0; i < txClasses[c].poolSize; i++)
+    {
+      CRTPPacket *pk = &txClasses[c].pool[i];
+      xQueueSend(txClasses[c].freeQueue, &pk, 0);
+    }
+  }
+
+  txSemaphore = xSemaphoreCreateBinaryStatic(&txSemaphoreBuffer);
 
   STATIC_MEM_TASK_CREATE(crtpTxTask, crtpTxTask, CRTP_TX_TASK_NAME, NULL, CRTP_TX_TASK_PRI);
   STATIC_MEM_TASK_CREATE(crtpRxTask, crtpRxTask, CRTP_RX_TASK_NAME, NULL, CRTP_RX_TASK_PRI);
@@ -135,27 +234,147 @@ int crtpReceivePacketWait(CRTPPort portId, CRTPPacket *p, int wait)
   return xQueueReceive(queues[portId], p, M2T(wait));
 }
 
-int crtpGetFreeTxQueuePackets(void)
+int crtpGetFreeTxQueuePackets(CRTPPort port)
+{
+  return uxQueueMessagesWaiting(txClasses[portTxClass[port & 0x0F]].freeQueue);
+}
+
+static struct crtpTxClass * txClassOfPacket(CRTPPacket *p)
+{
+  for (int c = 0; c < CRTP_TX_NBR_OF_CLASSES; c++)
+  {
+    if (p >= txClasses[c].pool && p < &txClasses[c].pool[txClasses[c].poolSize])
+    {
+      return &txClasses[c];
+    }
+  }
+
+  ASSERT_FAILED(); // Not a TX pool packet
+  return NULL;
+}
+
+CRTPPacket* crtpAllocTxPacket(CRTPPort port, int wait)
+{
+  struct crtpTxClass *txClass = &txClasses[portTxClass[port & 0x0F]];
+  CRTPPacket *p;
+
+  if (xQueueReceive(txClass->freeQueue, &p, ((uint32_t)wait == portMAX_DELAY) ? portMAX_DELAY : M2T(wait)) == pdTRUE)
+  {
+    return p;
+  }
+
+  return NULL;
+}
+
+void crtpFreeTxPacket(CRTPPacket *p)
+{
+  xQueueSend(txClassOfPacket(p)->freeQueue, &p, 0);
+}
+
+int crtpSendTxPacket(CRTPPacket *p)
+{
+  int result;
+
+  ASSERT(p->size <= CRTP_MAX_DATA_SIZE);
+
+  txQueuedAt[p - txPool] = usecTimestamp();
+
+  // Can not fail, the queue is as long as the class pool
+  result = xQueueSend(txClassOfPacket(p)->queue, &p, 0);
+  xSemaphoreGive(txSemaphore);
+
+  return result;
+}
+
+/* Deficit round robin over the TX classes. Returns NULL if all the class
+ * queues are empty. */
+static CRTPPacket* crtpTxSchedule(void)
+{
+  static int current = 0;
+  CRTPPacket *p;
+
+  // Each class is visited at most twice: once to spend what is left of its
+  // deficit and once with a new quantum
+  for (int i = 0; i <= 2 * CRTP_TX_NBR_OF_CLASSES; i++)
+  {
+    struct crtpTxClass *txClass = &txClasses[current];
+
+    if (txClass->deficit > 0 && xQueueReceive(txClass->queue, &p, 0) == pdTRUE)
+    {
+      txClass->deficit--;
+      return p;
+    }
+
+    // Quantum used up or nothing to send, move on to the next class. Idle
+    // classes do not accumulate credit.
+    if (uxQueueMessagesWaiting(txClass->queue) == 0)
+    {
+      txClass->deficit = 0;
+    }
+
+    current = (current + 1) % CRTP_TX_NBR_OF_CLASSES;
+    txClasses[current].deficit += (txClasses[current].quantum > 0) ? txClasses[current].quantum : 1;
+  }
+
+  return NULL;
+}
+
+static void updateTxQueueDelay(struct crtpTxClass *txClass, uint64_t queuedAt)
 {
-  return (CRTP_TX_QUEUE_SIZE - uxQueueMessagesWaiting(txQueue));
+  float queueDelay = usecTimestamp() - queuedAt;
+
+  txClass->queueDelay += (queueDelay - txClass->queueDelay) * CRTP_TX_QUEUE_DELAY_ALPHA;
+}
+
+/* Hands a pool packet to the link. Returns false if the link can not take it
+ * yet, the packet is then still owned by the caller. */
+static bool crtpLinkSend(CRTPPacket *p)
+{
+  struct crtpLinkOperations *lk = link;
+
+  if (lk->sendTxPacket)
+  {
+    // The link frees the packet once sent
+    return lk->sendTxPacket(p);
+  }
+
+  if (lk->sendPacket(p))
+  {
+    crtpFreeTxPacket(p);
+    return true;
+  }
+
+  return false;
 }
 
 void crtpTxTask(void *param)
 {
-  CRTPPacket p;
+  CRTPPacket *p;
 
   while (true)
   {
     if (link != &nopLink)
     {
-      if (xQueueReceive(txQueue, &p, portMAX_DELAY) == pdTRUE)
+      p = crtpTxSchedule();
+      if (p == NULL)
       {
+        xSemaphoreTake(txSemaphore, M2T(10));
+      }
+      else
+      {
+        // The packet may be reused as soon as the link has sent it
+        struct crtpTxClass *txClass = txClassOfPacket(p);
+        uint64_t queuedAt = txQueuedAt[p - txPool];
+        uint8_t port = p->port;
+
         // Keep testing, if the link changes to USB it will go though
-        while (link->sendPacket(&p) == false)
+        while (crtpLinkSend(p) == false)
         {
           // Relaxation time
           vTaskDelay(M2T(10));
         }
+        txPortCount[port]++;
+        updateTxQueueDelay(txClass, queuedAt);
         stats.txCount++;
         updateStats();
       }
@@ -167,6 +386,33 @@ void crtpTxTask(void *param)
   }
 }
 
+/* Queues a received packet to its port. When the port queue is full a packet
+ * is dropped according to the port policy and accounted for, the RX task
+ * never blocks on a slow consumer. */
+static void crtpQueueRxPacket(CRTPPacket *p)
+{
+  static CRTPPacket dropped;
+  xQueueHandle queue = queues[p->port];
+
+  while (xQueueSend(queue, p, 0) == errQUEUE_FULL)
+  {
+    if (rxDropPolicy[p->port] == crtpDropNewest)
+    {
+      rxDropCount[p->port]++;
+      rxDropTotal++;
+      return;
+    }
+
+    // Make room for the new packet. If the consumer emptied the queue in the
+    // meantime nothing is dropped, the send is just retried.
+    if (xQueueReceive(queue, &dropped, 0) == pdTRUE)
+    {
+      rxDropCount[p->port]++;
+      rxDropTotal++;
+    }
+  }
+}
+
 void crtpRxTask(void *param)
 {
   CRTPPacket p;
@@ -179,11 +425,7 @@ void crtpRxTask(void *param)
       {
         if (queues[p.port])
         {
-          if (xQueueSend(queues[p.port], &p, 0) == errQUEUE_FULL)
-          {
-            // We should never drop packet
-            ASSERT(0);
-          }
+          crtpQueueRxPacket(&p);
         }
 
         if (callbacks[p.port])
@@ -202,6 +444,13 @@ void crtpRxTask(void *param)
   }
 }
 
+void crtpSetRxDropPolicy(CRTPPort portId, crtpDropPolicy_t policy)
+{
+  ASSERT(portId < CRTP_NBR_OF_PORTS);
+
+  rxDropPolicy[portId] = policy;
+}
+
 void crtpRegisterPortCB(int port, CrtpCallback cb)
 {
   if (port>CRTP_NBR_OF_PORTS)
@@ -210,25 +459,47 @@ void crtpRegisterPortCB(int port, CrtpCallback cb)
   callbacks[port] = cb;
 }
 
-int crtpSendPacket(CRTPPacket *p)
+static int crtpCopyAndSendPacket(CRTPPacket *p, int wait)
 {
+  CRTPPacket *pk;
+
   ASSERT(p);
   ASSERT(p->size <= CRTP_MAX_DATA_SIZE);
 
-  return xQueueSend(txQueue, p, 0);
+  pk = crtpAllocTxPacket(p->port, wait);
+  if (pk == NULL)
+  {
+    txClasses[portTxClass[p->port]].dropCount++;
+    return errQUEUE_FULL;
+  }
+
+  memcpy(pk, p, sizeof(CRTPPacket));
+
+  return crtpSendTxPacket(pk);
 }
 
-int crtpSendPacketBlock(CRTPPacket *p)
+int crtpSendPacket(CRTPPacket *p)
 {
-  ASSERT(p);
-  ASSERT(p->size <= CRTP_MAX_DATA_SIZE);
+  return crtpCopyAndSendPacket(p, 0);
+}
 
-  return xQueueSend(txQueue, p, portMAX_DELAY);
+int crtpSendPacketBlock(CRTPPacket *p)
+{
+  return crtpCopyAndSendPacket(p, portMAX_DELAY);
 }
 
 int crtpReset(void)
 {
-  xQueueReset(txQueue);
+  CRTPPacket *p;
+
+  // Return the queued packets to the pool
+  for (int c = 0; c < CRTP_TX_NBR_OF_CLASSES; c++)
+  {
+    while (xQueueReceive(txClasses[c].queue, &p, 0) == pdTRUE)
+    {
+      crtpFreeTxPacket(p);
+    }
+  }
   if (link->reset) {
     link->reset();
   }
@@ -285,3 +556,47 @@ LOG_GROUP_START(crtp)
 LOG_ADD(LOG_UINT16, rxRate, &stats.rxRate)
 LOG_ADD(LOG_UINT16, txRate, &stats.txRate)
 LOG_GROUP_STOP(tdoa)
+
+static uint8_t txQueueOccupancy(uint32_t timestamp, void* data)
+{
+  struct crtpTxClass *txClass = data;
+  return uxQueueMessagesWaiting(txClass->queue);
+}
+
+static logByFunction_t txControlQueueLogger = {.acquireUInt8 = txQueueOccupancy, .data = &txClasses[crtpTxClassControl]};
+static logByFunction_t txConsoleQueueLogger = {.acquireUInt8 = txQueueOccupancy, .data = &txClasses[crtpTxClassConsole]};
+static logByFunction_t txTelemetryQueueLogger = {.acquireUInt8 = txQueueOccupancy, .data = &txClasses[crtpTxClassTelemetry]};
+
+LOG_GROUP_START(crtpRx)
+LOG_ADD(LOG_UINT32, drop, &rxDropTotal)
+LOG_ADD(LOG_UINT32, paramDrop, &rxDropCount[CRTP_PORT_PARAM])
+LOG_ADD(LOG_UINT32, memDrop, &rxDropCount[CRTP_PORT_MEM])
+LOG_ADD(LOG_UINT32, logDrop, &rxDropCount[CRTP_PORT_LOG])
+LOG_ADD(LOG_UINT32, hlDrop, &rxDropCount[CRTP_PORT_SETPOINT_HL])
+LOG_GROUP_STOP(crtpRx)
+
+LOG_GROUP_START(crtpTx)
+LOG_ADD(LOG_UINT32, console, &txPortCount[CRTP_PORT_CONSOLE])
+LOG_ADD(LOG_UINT32, param, &txPortCount[CRTP_PORT_PARAM])
+LOG_ADD(LOG_UINT32, mem, &txPortCount[CRTP_PORT_MEM])
+LOG_ADD(LOG_UINT32, log, &txPortCount[CRTP_PORT_LOG])
+LOG_ADD(LOG_UINT32, loc, &txPortCount[CRTP_PORT_LOCALIZATION])
+LOG_ADD(LOG_UINT32, hl, &txPortCount[CRTP_PORT_SETPOINT_HL])
+LOG_ADD(LOG_UINT32, platform, &txPortCount[CRTP_PORT_PLATFORM])
+LOG_ADD(LOG_UINT32, link, &txPortCount[CRTP_PORT_LINK])
+LOG_ADD(LOG_UINT32, ctrlDrop, &txClasses[crtpTxClassControl].dropCount)
+LOG_ADD(LOG_UINT32, consDrop, &txClasses[crtpTxClassConsole].dropCount)
+LOG_ADD(LOG_UINT32, telDrop, &txClasses[crtpTxClassTelemetry].dropCount)
+LOG_ADD_BY_FUNCTION(LOG_UINT8, ctrlQueue, &txControlQueueLogger)
+LOG_ADD_BY_FUNCTION(LOG_UINT8, consQueue, &txConsoleQueueLogger)
+LOG_ADD_BY_FUNCTION(LOG_UINT8, telQueue, &txTelemetryQueueLogger)
+LOG_ADD(LOG_FLOAT, ctrlQDelay, &txClasses[crtpTxClassControl].queueDelay)
+LOG_ADD(LOG_FLOAT, consQDelay, &txClasses[crtpTxClassConsole].queueDelay)
+LOG_ADD(LOG_FLOAT, telQDelay, &txClasses[crtpTxClassTelemetry].queueDelay)
+LOG_GROUP_STOP(crtpTx)
+
+PARAM_GROUP_START(crtpTx)
+PARAM_ADD(PARAM_UINT8, ctrlQuantum, &txClasses[crtpTxClassControl].quantum)
+PARAM_ADD(PARAM_UINT8, consQuantum, &txClasses[crtpTxClassConsole].quantum)
+PARAM_ADD(PARAM_UINT8, telQuantum, &txClasses[crtpTxClassTelemetry].quantum)
+PARAM_GROUP_STOP(crtpTx)
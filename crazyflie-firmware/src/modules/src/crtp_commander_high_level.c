@@ -55,17 +55,21 @@ such as: take-off, landing, polynomial trajectories.
 #include "log.h"
 #include "param.h"
 #include "static_mem.h"
+#include "swarm_time.h"
+#include "collision_avoidance.h"
 
 // Local types
 enum TrajectoryLocation_e {
   TRAJECTORY_LOCATION_INVALID = 0,
   TRAJECTORY_LOCATION_MEM     = 1, // for trajectories that are uploaded dynamically
+  TRAJECTORY_LOCATION_MEM_STREAM = 2, // ring buffer in uploaded memory, pieces are appended while flying
   // Future features might include trajectories on flash or uSD card
 };
 
 enum TrajectoryType_e {
   TRAJECTORY_TYPE_POLY4D = 0, // struct poly4d, see pptraj.h
   TRAJECTORY_TYPE_POLY4D_COMPRESSED = 1, // see pptraj_compressed.h
+  TRAJECTORY_TYPE_POLY4D_COMPRESSED_V2 = 2, // v2 format, see pptraj_compressed.h
   // Future types might include versions without yaw
 };
 
@@ -77,8 +81,8 @@ struct trajectoryDescription
   {
     struct {
       uint32_t offset;  // offset in uploaded memory
-      uint8_t n_pieces;
-    } __attribute__((packed)) mem; // if trajectoryLocation is TRAJECTORY_LOCATION_MEM
+      uint8_t n_pieces; // for TRAJECTORY_LOCATION_MEM_STREAM: capacity of the ring buffer
+    } __attribute__((packed)) mem; // if trajectoryLocation is TRAJECTORY_LOCATION_MEM(_STREAM)
   } trajectoryIdentifier;
 } __attribute__((packed));
 
@@ -93,6 +97,34 @@ static struct vec pos; // last known setpoint (position [m])
 static float yaw; // last known setpoint yaw (yaw [rad])
 static struct piecewise_traj trajectory;
 static struct piecewise_traj_compressed  compressed_trajectory;
+static struct piecewise_traj_compressed_v2 compressed_v2_trajectory;
+
+// only one streamed trajectory can be defined at a time
+#define NO_STREAM_TRAJECTORY 0xff
+static struct piecewise_traj_stream stream_trajectory;
+static uint8_t streamTrajectoryId = NO_STREAM_TRAJECTORY;
+
+// last command executed by COMMAND_BROADCAST
+static uint8_t broadcastSequence = 0;
+static uint8_t broadcastResult = 0;
+
+// trajectory start scheduled by COMMAND_START_TRAJECTORY_AT
+static struct data_start_trajectory scheduledStart;
+static float scheduledStartV2Duration; // see validate_trajectory()
+static uint64_t scheduledStartTime; // local time [us]
+static bool hasScheduledStart = false;
+
+// plan time counts from planEpoch, which is moved to the start of every new
+// plan: as a float it would be down to 0.25 ms steps after an hour of uptime.
+// The plan does not advance while its setpoint is held at the boundary of the
+// buffered Voronoi cell, planEpoch moves on by the time held and the plan
+// resumes where it was held once the peers make room.
+static uint64_t planEpoch; // local time [us]
+static uint64_t lastSetpointTime; // local time [us]
+static bool isSetpointHeld = false;
+
+// updated every setpoint under lockTraj, so that the status log does not need it
+static bool isPlanFinished = false;
 
 // makes sure that we don't evaluate the trajectory while it is being changed
 static xSemaphoreHandle lockTraj;
@@ -113,6 +145,10 @@ enum TrajectoryCommand_e {
   COMMAND_DEFINE_TRAJECTORY       = 6,
   COMMAND_TAKEOFF_2               = 7,
   COMMAND_LAND_2                  = 8,
+  COMMAND_APPEND_TRAJECTORY       = 9,
+  COMMAND_GO_TO_WAYPOINTS         = 10,
+  COMMAND_START_TRAJECTORY_AT     = 11,
+  COMMAND_BROADCAST               = 12,
 };
 
 struct data_set_group_mask {
@@ -178,14 +214,61 @@ struct data_start_trajectory {
   float timescale; // time factor; 1 = original speed; >1: slower; <1: faster
 } __attribute__((packed));
 
-// starts executing a specified trajectory
+// starts executing a specified trajectory at a given swarm time, see swarm_time.h.
+// until then the current trajectory continues; if the time has passed already,
+// the trajectory is started such that it is in phase with the others.
+struct data_start_trajectory_at {
+  struct data_start_trajectory start;
+  uint64_t startTime; // swarm time [us]
+} __attribute__((packed));
+
+// defines a trajectory
 struct data_define_trajectory {
   uint8_t trajectoryId;
   struct trajectoryDescription description;
 } __attribute__((packed));
 
+// appends pieces to a streamed trajectory (TRAJECTORY_LOCATION_MEM_STREAM).
+// the pieces must have been written to the next free slots of the ring buffer
+// before; free slots and underruns are reported in the hlStream log group.
+struct data_append_trajectory {
+  uint8_t trajectoryId;
+  uint8_t count; // number of pieces written
+  uint8_t last;  // set to true, if no more pieces follow
+} __attribute__((packed));
+
+// waypoint of COMMAND_GO_TO_WAYPOINTS, as stored in trajectories_memory
+struct trajectoryWaypoint {
+  float x; // m
+  float y; // m
+  float z; // m
+  float yaw; // rad
+} __attribute__((packed));
+
+// "fly through these waypoints in this much time, then hover at the last one".
+// the minimum snap trajectory is planned on-board, see plan_go_to_waypoints
+struct data_go_to_waypoints {
+  uint8_t groupMask;        // mask for which CFs this should apply to
+  uint8_t relative;         // set to true, if waypoints are relative to current setpoint
+  uint8_t n_waypoints;      // at most PP_MINSNAP_MAX_WAYPOINTS
+  uint32_t waypointsOffset; // offset of the struct trajectoryWaypoint array in trajectories_memory
+  uint32_t piecesOffset;    // offset in trajectories_memory the planned pieces are written to
+  float duration;           // sec
+} __attribute__((packed));
+
+// wraps another command sent to many CFs at once, e.g. over a radio broadcast.
+// the command is executed once per sequence id, so it can be repeated until
+// all CFs have acknowledged it. There is no reply: the sequence id and the
+// result of the last executed command are reported in the hlStatus log group.
+struct data_broadcast {
+  uint8_t sequence; // should change with every command, 0 is reserved
+  uint8_t command;  // one of TrajectoryCommand_e, except COMMAND_BROADCAST
+  // followed by the data of the command
+} __attribute__((packed));
+
 // Private functions
 static void crtpCommanderHighLevelTask(void * prm);
+static int handle_command(uint8_t command, const uint8_t* data);
 
 static int set_group_mask(const struct data_set_group_mask* data);
 static int takeoff(const struct data_takeoff* data);
@@ -195,7 +278,13 @@ static int land2(const struct data_land_2* data);
 static int stop(const struct data_stop* data);
 static int go_to(const struct data_go_to* data);
 static int start_trajectory(const struct data_start_trajectory* data);
+static int start_trajectory_at(const struct data_start_trajectory_at* data);
+static int validate_trajectory(const struct data_start_trajectory* data, float* v2Duration);
+static int begin_trajectory(const struct data_start_trajectory* data, float t, float v2Duration);
 static int define_trajectory(const struct data_define_trajectory* data);
+static int append_trajectory(const struct data_append_trajectory* data);
+static int go_to_waypoints(const struct data_go_to_waypoints* data);
+static int broadcast(const struct data_broadcast* data);
 
 // Helper functions
 static struct vec state2vec(struct vec3_s v)
@@ -236,15 +325,39 @@ bool crtpCommanderHighLevelIsStopped()
   return plan_is_stopped(&planner);
 }
 
+// plan time of a local time [us], lockTraj must be held
+static float planTime(uint64_t localTime)
+{
+  return (int64_t)(localTime - planEpoch) / 1e6f;
+}
+
+// makes a local time [us] plan time 0, lockTraj must be held
+static void restartPlanTime(uint64_t localTime)
+{
+  plan_shift_time(&planner, planTime(localTime));
+  planEpoch = localTime;
+}
+
 void crtpCommanderHighLevelGetSetpoint(setpoint_t* setpoint, const state_t *state)
 {
   xSemaphoreTake(lockTraj, portMAX_DELAY);
-  float t = usecTimestamp() / 1e6;
+  uint64_t now = usecTimestamp();
+  if (isSetpointHeld) {
+    planEpoch += now - lastSetpointTime;
+  }
+  lastSetpointTime = now;
+  if (hasScheduledStart && now >= scheduledStartTime) {
+    hasScheduledStart = false;
+    restartPlanTime(scheduledStartTime);
+    begin_trajectory(&scheduledStart, 0, scheduledStartV2Duration);
+  }
+  float t = planTime(now);
   struct traj_eval ev = plan_current_goal(&planner, t);
   if (!is_traj_eval_valid(&ev)) {
     // programming error
     plan_stop(&planner);
   }
+  isPlanFinished = !plan_is_stopped(&planner) && plan_is_finished(&planner, t);
   xSemaphoreGive(lockTraj);
 
   // if we are on the ground, update the last setpoint with the current state estimate
@@ -253,7 +366,11 @@ void crtpCommanderHighLevelGetSetpoint(setpoint_t* setpoint, const state_t *stat
     yaw = radians(state->attitude.yaw);
   }
 
+  isSetpointHeld = false;
   if (is_traj_eval_valid(&ev)) {
+    // stay in the buffered Voronoi cell, plan time is paused while held
+    isSetpointHeld = collisionAvoidanceConstrain(&state->position, &ev);
+
     setpoint->position.x = ev.pos.x;
     setpoint->position.y = ev.pos.y;
     setpoint->position.z = ev.pos.z;
@@ -290,39 +407,11 @@ void crtpCommanderHighLevelTask(void * prm)
   while(1) {
     crtpReceivePacketBlock(CRTP_PORT_SETPOINT_HL, &p);
 
-    switch(p.data[0])
-    {
-      case COMMAND_SET_GROUP_MASK:
-        ret = set_group_mask((const struct data_set_group_mask*)&p.data[1]);
-        break;
-      case COMMAND_TAKEOFF:
-        ret = takeoff((const struct data_takeoff*)&p.data[1]);
-        break;
-      case COMMAND_LAND:
-        ret = land((const struct data_land*)&p.data[1]);
-        break;
-      case COMMAND_TAKEOFF_2:
-        ret = takeoff2((const struct data_takeoff_2*)&p.data[1]);
-        break;
-      case COMMAND_LAND_2:
-        ret = land2((const struct data_land_2*)&p.data[1]);
-        break;
-      case COMMAND_STOP:
-        ret = stop((const struct data_stop*)&p.data[1]);
-        break;
-      case COMMAND_GO_TO:
-        ret = go_to((const struct data_go_to*)&p.data[1]);
-        break;
-      case COMMAND_START_TRAJECTORY:
-        ret = start_trajectory((const struct data_start_trajectory*)&p.data[1]);
-        break;
-      case COMMAND_DEFINE_TRAJECTORY:
-        ret = define_trajectory((const struct data_define_trajectory*)&p.data[1]);
-        break;
-      default:
-        ret = ENOEXEC;
-        break;
+    if (p.data[0] == COMMAND_BROADCAST) {
+      broadcast((const struct data_broadcast*)&p.data[1]);
+      continue;
     }
+    ret = handle_command(p.data[0], &p.data[1]);
 
     //answer
     p.data[3] = ret;
@@ -331,6 +420,49 @@ void crtpCommanderHighLevelTask(void * prm)
   }
 }
 
+int handle_command(uint8_t command, const uint8_t* data)
+{
+  switch(command)
+  {
+    case COMMAND_SET_GROUP_MASK:
+      return set_group_mask((const struct data_set_group_mask*)data);
+    case COMMAND_TAKEOFF:
+      return takeoff((const struct data_takeoff*)data);
+    case COMMAND_LAND:
+      return land((const struct data_land*)data);
+    case COMMAND_TAKEOFF_2:
+      return takeoff2((const struct data_takeoff_2*)data);
+    case COMMAND_LAND_2:
+      return land2((const struct data_land_2*)data);
+    case COMMAND_STOP:
+      return stop((const struct data_stop*)data);
+    case COMMAND_GO_TO:
+      return go_to((const struct data_go_to*)data);
+    case COMMAND_START_TRAJECTORY:
+      return start_trajectory((const struct data_start_trajectory*)data);
+    case COMMAND_START_TRAJECTORY_AT:
+      return start_trajectory_at((const struct data_start_trajectory_at*)data);
+    case COMMAND_DEFINE_TRAJECTORY:
+      return define_trajectory((const struct data_define_trajectory*)data);
+    case COMMAND_APPEND_TRAJECTORY:
+      return append_trajectory((const struct data_append_trajectory*)data);
+    case COMMAND_GO_TO_WAYPOINTS:
+      return go_to_waypoints((const struct data_go_to_waypoints*)data);
+    default:
+      return ENOEXEC;
+  }
+}
+
+int broadcast(const struct data_broadcast* data)
+{
+  // the command is repeated until all CFs have executed it, but only runs once
+  if (data->sequence != broadcastSequence) {
+    broadcastResult = handle_command(data->command, (const uint8_t*)(data + 1));
+    broadcastSequence = data->sequence;
+  }
+  return broadcastResult;
+}
+
 int set_group_mask(const struct data_set_group_mask* data)
 {
   group_mask = data->groupMask;
@@ -343,7 +475,8 @@ int takeoff(const struct data_takeoff* data)
   int result = 0;
   if (isInGroup(data->groupMask)) {
     xSemaphoreTake(lockTraj, portMAX_DELAY);
-    float t = usecTimestamp() / 1e6;
+    restartPlanTime(usecTimestamp());
+    float t = 0;
     result = plan_takeoff(&planner, pos, yaw, data->height, 0.0f, data->duration, t);
     xSemaphoreGive(lockTraj);
   }
@@ -355,7 +488,8 @@ int takeoff2(const struct data_takeoff_2* data)
   int result = 0;
   if (isInGroup(data->groupMask)) {
     xSemaphoreTake(lockTraj, portMAX_DELAY);
-    float t = usecTimestamp() / 1e6;
+    restartPlanTime(usecTimestamp());
+    float t = 0;
 
     float hover_yaw = data->yaw;
     if (data->useCurrentYaw) {
@@ -373,7 +507,9 @@ int land(const struct data_land* data)
   int result = 0;
   if (isInGroup(data->groupMask)) {
     xSemaphoreTake(lockTraj, portMAX_DELAY);
-    float t = usecTimestamp() / 1e6;
+    restartPlanTime(usecTimestamp());
+    float t = 0;
+    hasScheduledStart = false;
     result = plan_land(&planner, pos, yaw, data->height, 0.0f, data->duration, t);
     xSemaphoreGive(lockTraj);
   }
@@ -385,13 +521,15 @@ int land2(const struct data_land_2* data)
   int result = 0;
   if (isInGroup(data->groupMask)) {
     xSemaphoreTake(lockTraj, portMAX_DELAY);
-    float t = usecTimestamp() / 1e6;
+    restartPlanTime(usecTimestamp());
+    float t = 0;
 
     float hover_yaw = data->yaw;
     if (data->useCurrentYaw) {
       hover_yaw = yaw;
     }
 
+    hasScheduledStart = false;
     result = plan_land(&planner, pos, yaw, data->height, hover_yaw, data->duration, t);
     xSemaphoreGive(lockTraj);
   }
@@ -403,6 +541,7 @@ int stop(const struct data_stop* data)
   int result = 0;
   if (isInGroup(data->groupMask)) {
     xSemaphoreTake(lockTraj, portMAX_DELAY);
+    hasScheduledStart = false;
     plan_stop(&planner);
     xSemaphoreGive(lockTraj);
   }
@@ -415,80 +554,341 @@ int go_to(const struct data_go_to* data)
   if (isInGroup(data->groupMask)) {
     struct vec hover_pos = mkvec(data->x, data->y, data->z);
     xSemaphoreTake(lockTraj, portMAX_DELAY);
-    float t = usecTimestamp() / 1e6;
+    restartPlanTime(usecTimestamp());
+    float t = 0;
     result = plan_go_to(&planner, data->relative, hover_pos, data->yaw, data->duration, t);
     xSemaphoreGive(lockTraj);
   }
   return result;
 }
 
-int start_trajectory(const struct data_start_trajectory* data)
+int crtpCommanderHighLevelGoToWaypoints(const struct vec* waypoints, const float* yaws, uint8_t n_waypoints,
+  float duration, bool relative, uint32_t piecesOffset)
+{
+  uint32_t size = n_waypoints * sizeof(struct poly4d);
+  if (n_waypoints == 0 || n_waypoints > PP_MINSNAP_MAX_WAYPOINTS
+      || piecesOffset > TRAJECTORY_MEMORY_SIZE || size > TRAJECTORY_MEMORY_SIZE - piecesOffset
+      || !crtpCommanderHighLevelIsTrajectoryMemoryWritable(piecesOffset, size)) {
+    return ENOEXEC;
+  }
+
+  xSemaphoreTake(lockTraj, portMAX_DELAY);
+  restartPlanTime(usecTimestamp());
+  float t = 0;
+  int result = plan_go_to_waypoints(&planner, relative, waypoints, yaws, n_waypoints, duration, t,
+    (struct poly4d*)&trajectories_memory[piecesOffset]);
+  xSemaphoreGive(lockTraj);
+  return result;
+}
+
+int go_to_waypoints(const struct data_go_to_waypoints* data)
 {
   int result = 0;
   if (isInGroup(data->groupMask)) {
-    if (data->trajectoryId < NUM_TRAJECTORY_DEFINITIONS) {
-      struct trajectoryDescription* trajDesc = &trajectory_descriptions[data->trajectoryId];
-      if (   trajDesc->trajectoryLocation == TRAJECTORY_LOCATION_MEM
-          && trajDesc->trajectoryType == TRAJECTORY_TYPE_POLY4D) {
-        xSemaphoreTake(lockTraj, portMAX_DELAY);
-        float t = usecTimestamp() / 1e6;
-        trajectory.t_begin = t;
-        trajectory.timescale = data->timescale;
-        trajectory.n_pieces = trajDesc->trajectoryIdentifier.mem.n_pieces;
-        trajectory.pieces = (struct poly4d*)&trajectories_memory[trajDesc->trajectoryIdentifier.mem.offset];
+    uint32_t size = data->n_waypoints * sizeof(struct trajectoryWaypoint);
+    if (data->n_waypoints == 0 || data->n_waypoints > PP_MINSNAP_MAX_WAYPOINTS
+        || data->waypointsOffset > TRAJECTORY_MEMORY_SIZE || size > TRAJECTORY_MEMORY_SIZE - data->waypointsOffset) {
+      return ENOEXEC;
+    }
+
+    // copy the waypoints first, the planned pieces may overwrite them
+    struct vec waypoints[PP_MINSNAP_MAX_WAYPOINTS];
+    float yaws[PP_MINSNAP_MAX_WAYPOINTS];
+    const struct trajectoryWaypoint* uploaded = (const struct trajectoryWaypoint*)&trajectories_memory[data->waypointsOffset];
+    for (int i = 0; i < data->n_waypoints; i++) {
+      waypoints[i] = mkvec(uploaded[i].x, uploaded[i].y, uploaded[i].z);
+      yaws[i] = uploaded[i].yaw;
+    }
+
+    result = crtpCommanderHighLevelGoToWaypoints(waypoints, yaws, data->n_waypoints, data->duration,
+      data->relative, data->piecesOffset);
+  }
+  return result;
+}
+
+// checks a trajectory before it is started, in the high level commander task.
+// A v2 compressed trajectory is walked through to check it and get its
+// duration. This reads up to all of the trajectory memory, which must not
+// happen in begin_trajectory() as scheduled starts begin in the stabilizer
+// loop, nor while holding lockTraj.
+int validate_trajectory(const struct data_start_trajectory* data, float* v2Duration)
+{
+  *v2Duration = 0;
+  if (data->trajectoryId >= NUM_TRAJECTORY_DEFINITIONS) {
+    return ENOEXEC;
+  }
+
+  const struct trajectoryDescription* trajDesc = &trajectory_descriptions[data->trajectoryId];
+  if (   trajDesc->trajectoryLocation == TRAJECTORY_LOCATION_MEM
+      && trajDesc->trajectoryType == TRAJECTORY_TYPE_POLY4D_COMPRESSED_V2) {
+    uint32_t offset = trajDesc->trajectoryIdentifier.mem.offset;
+    if (data->reversed || offset >= TRAJECTORY_MEMORY_SIZE) {
+      return ENOEXEC;
+    }
+    *v2Duration = piecewise_compressed_v2_validate(&trajectories_memory[offset], TRAJECTORY_MEMORY_SIZE - offset);
+    if (*v2Duration < 0) {
+      return ENOEXEC;
+    }
+  }
+  return 0;
+}
+
+// starts the trajectory with the given start time, lockTraj must be held.
+// v2Duration is the duration of a v2 compressed trajectory, from
+// validate_trajectory(), which only needs to be rewound here.
+int begin_trajectory(const struct data_start_trajectory* data, float t, float v2Duration)
+{
+  int result = 0;
+  if (data->trajectoryId < NUM_TRAJECTORY_DEFINITIONS) {
+    struct trajectoryDescription* trajDesc = &trajectory_descriptions[data->trajectoryId];
+    if (   trajDesc->trajectoryLocation == TRAJECTORY_LOCATION_MEM
+        && trajDesc->trajectoryType == TRAJECTORY_TYPE_POLY4D) {
+      trajectory.t_begin = t;
+      trajectory.timescale = data->timescale;
+      trajectory.n_pieces = trajDesc->trajectoryIdentifier.mem.n_pieces;
+      trajectory.pieces = (struct poly4d*)&trajectories_memory[trajDesc->trajectoryIdentifier.mem.offset];
+      if (data->relative) {
+        trajectory.shift = vzero();
+        struct traj_eval traj_init;
+        if (data->reversed) {
+          traj_init = piecewise_eval_reversed(&trajectory, trajectory.t_begin);
+        }
+        else {
+          traj_init = piecewise_eval(&trajectory, trajectory.t_begin);
+        }
+        struct vec shift_pos = vsub(pos, traj_init.pos);
+        trajectory.shift = shift_pos;
+      } else {
+        trajectory.shift = vzero();
+      }
+      result = plan_start_trajectory(&planner, &trajectory, data->reversed);
+    } else if (trajDesc->trajectoryLocation == TRAJECTORY_LOCATION_MEM
+        && trajDesc->trajectoryType == TRAJECTORY_TYPE_POLY4D_COMPRESSED) {
+
+      if (data->timescale != 1 || data->reversed) {
+        result = ENOEXEC;
+      } else {
+        piecewise_compressed_load(
+          &compressed_trajectory,
+          &trajectories_memory[trajDesc->trajectoryIdentifier.mem.offset]
+        );
+        compressed_trajectory.t_begin = t;
         if (data->relative) {
-          trajectory.shift = vzero();
-          struct traj_eval traj_init;
-          if (data->reversed) {
-            traj_init = piecewise_eval_reversed(&trajectory, trajectory.t_begin);
-          }
-          else {
-            traj_init = piecewise_eval(&trajectory, trajectory.t_begin);
-          }
+          struct traj_eval traj_init = piecewise_compressed_eval(
+            &compressed_trajectory, compressed_trajectory.t_begin
+          );
           struct vec shift_pos = vsub(pos, traj_init.pos);
-          trajectory.shift = shift_pos;
+          compressed_trajectory.shift = shift_pos;
         } else {
-          trajectory.shift = vzero();
+          compressed_trajectory.shift = vzero();
         }
-        result = plan_start_trajectory(&planner, &trajectory, data->reversed);
-        xSemaphoreGive(lockTraj);
-      } else if (trajDesc->trajectoryLocation == TRAJECTORY_LOCATION_MEM
-          && trajDesc->trajectoryType == TRAJECTORY_TYPE_POLY4D_COMPRESSED) {
+        result = plan_start_compressed_trajectory(&planner, &compressed_trajectory);
+      }
 
-        if (data->timescale != 1 || data->reversed) {
-          result = ENOEXEC;
-        } else {
-          xSemaphoreTake(lockTraj, portMAX_DELAY);
-          float t = usecTimestamp() / 1e6;
-          piecewise_compressed_load(
-            &compressed_trajectory,
-            &trajectories_memory[trajDesc->trajectoryIdentifier.mem.offset]
+    } else if (trajDesc->trajectoryLocation == TRAJECTORY_LOCATION_MEM
+        && trajDesc->trajectoryType == TRAJECTORY_TYPE_POLY4D_COMPRESSED_V2) {
+
+      uint32_t offset = trajDesc->trajectoryIdentifier.mem.offset;
+      if (data->reversed || offset >= TRAJECTORY_MEMORY_SIZE
+          || !piecewise_compressed_v2_load(&compressed_v2_trajectory,
+            &trajectories_memory[offset], TRAJECTORY_MEMORY_SIZE - offset, data->timescale, v2Duration)) {
+        result = ENOEXEC;
+      } else {
+        compressed_v2_trajectory.t_begin = t;
+        if (data->relative) {
+          struct traj_eval traj_init = piecewise_compressed_v2_eval(
+            &compressed_v2_trajectory, compressed_v2_trajectory.t_begin
           );
-          compressed_trajectory.t_begin = t;
-          if (data->relative) {
-            struct traj_eval traj_init = piecewise_compressed_eval(
-              &compressed_trajectory, compressed_trajectory.t_begin
-            );
-            struct vec shift_pos = vsub(pos, traj_init.pos);
-            compressed_trajectory.shift = shift_pos;
-          } else {
-            compressed_trajectory.shift = vzero();
-          }
-          result = plan_start_compressed_trajectory(&planner, &compressed_trajectory);
-          xSemaphoreGive(lockTraj);
+          compressed_v2_trajectory.shift = vsub(pos, traj_init.pos);
         }
+        result = plan_start_compressed_v2_trajectory(&planner, &compressed_v2_trajectory);
+      }
 
+    } else if (trajDesc->trajectoryLocation == TRAJECTORY_LOCATION_MEM_STREAM
+        && data->trajectoryId == streamTrajectoryId) {
+
+      // played back pieces are gone, so a stream can only be started once
+      if (data->reversed || data->timescale <= 0) {
+        result = ENOEXEC;
+      } else if (stream_trajectory.appended == 0 || stream_trajectory.consumed > 0
+          || stream_trajectory.underrun) {
+        result = ENODATA;
+      } else {
+        stream_trajectory.t_begin = t;
+        stream_trajectory.timescale = data->timescale;
+        if (data->relative) {
+          struct traj_eval traj_init = poly4d_eval(&stream_trajectory.pieces[0], 0);
+          stream_trajectory.shift = vsub(pos, traj_init.pos);
+        } else {
+          stream_trajectory.shift = vzero();
+        }
+        result = plan_start_stream_trajectory(&planner, &stream_trajectory);
       }
     }
   }
   return result;
 }
 
+int start_trajectory(const struct data_start_trajectory* data)
+{
+  int result = 0;
+  if (isInGroup(data->groupMask)) {
+    float v2Duration;
+    result = validate_trajectory(data, &v2Duration);
+    if (result == 0) {
+      xSemaphoreTake(lockTraj, portMAX_DELAY);
+      hasScheduledStart = false;
+      restartPlanTime(usecTimestamp());
+      float t = 0;
+      result = begin_trajectory(data, t, v2Duration);
+      xSemaphoreGive(lockTraj);
+    }
+  }
+  return result;
+}
+
+int start_trajectory_at(const struct data_start_trajectory_at* data)
+{
+  int result = 0;
+  if (isInGroup(data->start.groupMask)) {
+    float v2Duration;
+    result = validate_trajectory(&data->start, &v2Duration);
+    if (result != 0) {
+      return result;
+    }
+    if (!swarmTimeIsSynchronized()) {
+      return EAGAIN;
+    }
+
+    xSemaphoreTake(lockTraj, portMAX_DELAY);
+    scheduledStart = data->start;
+    scheduledStartV2Duration = v2Duration;
+    scheduledStartTime = swarmTimeToLocalUsec(data->startTime);
+    hasScheduledStart = true;
+    xSemaphoreGive(lockTraj);
+  }
+  return result;
+}
+
 int define_trajectory(const struct data_define_trajectory* data)
 {
   if (data->trajectoryId >= NUM_TRAJECTORY_DEFINITIONS) {
     return ENOEXEC;
   }
-  trajectory_descriptions[data->trajectoryId] = data->description;
-  return 0;
+
+  const struct trajectoryDescription* desc = &data->description;
+  if (desc->trajectoryLocation == TRAJECTORY_LOCATION_MEM_STREAM) {
+    uint32_t size = desc->trajectoryIdentifier.mem.n_pieces * sizeof(struct poly4d);
+    if (desc->trajectoryType != TRAJECTORY_TYPE_POLY4D
+        || desc->trajectoryIdentifier.mem.n_pieces == 0
+        || desc->trajectoryIdentifier.mem.offset > TRAJECTORY_MEMORY_SIZE
+        || size > TRAJECTORY_MEMORY_SIZE - desc->trajectoryIdentifier.mem.offset) {
+      return ENOEXEC;
+    }
+  }
+
+  int result = 0;
+  xSemaphoreTake(lockTraj, portMAX_DELAY);
+  bool streaming = !plan_is_stopped(&planner) && planner.type == TRAJECTORY_TYPE_PIECEWISE_STREAM;
+  if (streaming && data->trajectoryId == streamTrajectoryId) {
+    result = EBUSY;
+  } else if (desc->trajectoryLocation == TRAJECTORY_LOCATION_MEM_STREAM && streaming) {
+    result = EBUSY;
+  } else {
+    trajectory_descriptions[data->trajectoryId] = *desc;
+    if (desc->trajectoryLocation == TRAJECTORY_LOCATION_MEM_STREAM) {
+      piecewise_stream_init(&stream_trajectory,
+        (struct poly4d*)&trajectories_memory[desc->trajectoryIdentifier.mem.offset],
+        desc->trajectoryIdentifier.mem.n_pieces);
+      streamTrajectoryId = data->trajectoryId;
+    } else if (data->trajectoryId == streamTrajectoryId) {
+      streamTrajectoryId = NO_STREAM_TRAJECTORY;
+    }
+  }
+  xSemaphoreGive(lockTraj);
+  return result;
+}
+
+int append_trajectory(const struct data_append_trajectory* data)
+{
+  if (data->trajectoryId != streamTrajectoryId) {
+    return ENOEXEC;
+  }
+
+  int result = 0;
+  xSemaphoreTake(lockTraj, portMAX_DELAY);
+  if (stream_trajectory.underrun || stream_trajectory.complete) {
+    result = EPIPE;
+  } else if (!piecewise_stream_append(&stream_trajectory, data->count, data->last)) {
+    result = ENOMEM;
+  }
+  xSemaphoreGive(lockTraj);
+  return result;
+}
+
+bool crtpCommanderHighLevelIsTrajectoryMemoryWritable(uint32_t offset, uint32_t length)
+{
+  if (streamTrajectoryId == NO_STREAM_TRAJECTORY) {
+    return true;
+  }
+
+  bool writable = true;
+  xSemaphoreTake(lockTraj, portMAX_DELAY);
+  // the slots of pieces that are appended but not played back yet are read-only
+  uint32_t ringBegin = (uint8_t*)stream_trajectory.pieces - trajectories_memory;
+  for (uint32_t seq = stream_trajectory.consumed; seq < stream_trajectory.appended; seq++) {
+    uint32_t slotBegin = ringBegin + piecewise_stream_slot(&stream_trajectory, seq) * sizeof(struct poly4d);
+    uint32_t slotEnd = slotBegin + sizeof(struct poly4d);
+    if (offset < slotEnd && slotBegin < offset + length) {
+      writable = false;
+      break;
+    }
+  }
+  xSemaphoreGive(lockTraj);
+  return writable;
 }
+
+static uint8_t streamFreeSlots(uint32_t timestamp, void* data)
+{
+  const struct piecewise_traj_stream* stream = (const struct piecewise_traj_stream*)data;
+  if (stream->capacity == 0) {
+    return 0;
+  }
+  return piecewise_stream_free(stream);
+}
+
+static logByFunction_t streamFreeLogger = {.acquireUInt8 = streamFreeSlots, .data = &stream_trajectory};
+
+// status of the high-level commander in a single word, so that it fits into
+// the log block that is streamed anyway:
+//  bits  0-7:  sequence id of the last command executed by COMMAND_BROADCAST
+//  bits  8-15: its result (errno, 0 on success)
+//  bits 16-23: group mask
+//  bits 24-25: planner state, see enum trajectory_state
+//  bit  26:    the current trajectory is finished, as of the last setpoint
+//  bit  27:    a trajectory start is scheduled
+//  bit  28:    the swarm time is synchronized
+// Called from the log task: only reads byte and bool fields, without lockTraj.
+static uint32_t hlStatusWord(uint32_t timestamp, void* data)
+{
+  return broadcastSequence
+    | (uint32_t)broadcastResult << 8
+    | (uint32_t)group_mask << 16
+    | (uint32_t)(planner.state & 0x03) << 24
+    | (uint32_t)isPlanFinished << 26
+    | (uint32_t)hasScheduledStart << 27
+    | (uint32_t)swarmTimeIsSynchronized() << 28;
+}
+
+static logByFunction_t hlStatusLogger = {.acquireUInt32 = hlStatusWord, .data = 0};
+
+LOG_GROUP_START(hlStatus)
+LOG_ADD_BY_FUNCTION(LOG_UINT32, status, &hlStatusLogger)
+LOG_GROUP_STOP(hlStatus)
+
+LOG_GROUP_START(hlStream)
+LOG_ADD_BY_FUNCTION(LOG_UINT8, free, &streamFreeLogger)
+LOG_ADD(LOG_UINT32, appended, &stream_trajectory.appended)
+LOG_ADD(LOG_UINT32, consumed, &stream_trajectory.consumed)
+LOG_ADD(LOG_UINT8, underrun, &stream_trajectory.underrun)
+LOG_GROUP_STOP(hlStream)
@@ -27,6 +27,7 @@ typedef struct {
   bool (*estimatorEnqueueFlow)(const flowMeasurement_t *flow);
   bool (*estimatorEnqueueYawError)(const yawErrorMeasurement_t *error);
   bool (*estimatorEnqueueSweepAngles)(const sweepAngleMeasurement_t *angles);
+  bool (*estimatorEnqueueSweepAngleBatch)(const sweepAngleBatchMeasurement_t *batch);
 } EstimatorFcns;
 
 #define NOT_IMPLEMENTED ((void*)0)
@@ -47,6 +48,7 @@ static EstimatorFcns estimatorFunctions[] = {
         .estimatorEnqueueFlow = NOT_IMPLEMENTED,
         .estimatorEnqueueYawError = NOT_IMPLEMENTED,
         .estimatorEnqueueSweepAngles = NOT_IMPLEMENTED,
+        .estimatorEnqueueSweepAngleBatch = NOT_IMPLEMENTED,
     }, // Any estimator
     {
         .init = estimatorComplementaryInit,
@@ -63,6 +65,7 @@ static EstimatorFcns estimatorFunctions[] = {
         .estimatorEnqueueFlow = NOT_IMPLEMENTED,
         .estimatorEnqueueYawError = NOT_IMPLEMENTED,
         .estimatorEnqueueSweepAngles = NOT_IMPLEMENTED,
+        .estimatorEnqueueSweepAngleBatch = NOT_IMPLEMENTED,
     },
     {
         .init = estimatorKalmanInit,
@@ -79,6 +82,7 @@ static EstimatorFcns estimatorFunctions[] = {
         .estimatorEnqueueFlow = estimatorKalmanEnqueueFlow,
         .estimatorEnqueueYawError = estimatorKalmanEnqueueYawError,
         .estimatorEnqueueSweepAngles = estimatorKalmanEnqueueSweepAngles,
+        .estimatorEnqueueSweepAngleBatch = estimatorKalmanEnqueueSweepAngleBatch,
     },
 };
 
@@ -211,3 +215,11 @@ bool estimatorEnqueueSweepAngles(const sweepAngleMeasurement_t *angles) {
 
   return false;
 }
+
+bool estimatorEnqueueSweepAngleBatch(const sweepAngleBatchMeasurement_t *batch) {
+  if (estimatorFunctions[currentEstimator].estimatorEnqueueSweepAngleBatch) {
+    return estimatorFunctions[currentEstimator].estimatorEnqueueSweepAngleBatch(batch);
+  }
+
+  return false;
+}
@@ -167,6 +167,14 @@ static inline bool stateEstimatorHasSweepAnglesPacket(sweepAngleMeasurement_t *a
   return (pdTRUE == xQueueReceive(sweepAnglesDataQueue, angles, 0));
 }
 
+static xQueueHandle sweepAngleBatchDataQueue;
+STATIC_MEM_QUEUE_ALLOC(sweepAngleBatchDataQueue, 4, sizeof(sweepAngleBatchMeasurement_t));
+
+static inline bool stateEstimatorHasSweepAngleBatchPacket(sweepAngleBatchMeasurement_t *batch)
+{
+  return (pdTRUE == xQueueReceive(sweepAngleBatchDataQueue, batch, 0));
+}
+
 // Semaphore to signal that we got data from the stabilzer loop to process
 static SemaphoreHandle_t runTaskSemaphore;
 
@@ -285,6 +293,7 @@ void estimatorKalmanTaskInit() {
   heightDataQueue = STATIC_MEM_QUEUE_CREATE(heightDataQueue);
   yawErrorDataQueue = STATIC_MEM_QUEUE_CREATE(yawErrorDataQueue);
   sweepAnglesDataQueue = STATIC_MEM_QUEUE_CREATE(sweepAnglesDataQueue);
+  sweepAngleBatchDataQueue = STATIC_MEM_QUEUE_CREATE(sweepAngleBatchDataQueue);
 
   vSemaphoreCreateBinary(runTaskSemaphore);
 
@@ -574,6 +583,13 @@ static bool updateQueuedMeasurments(const Axis3f *gyro, const uint32_t tick) {
     doneUpdate = true;
   }
 
+  static sweepAngleBatchMeasurement_t sweepBatch;
+  while (stateEstimatorHasSweepAngleBatchPacket(&sweepBatch))
+  {
+    kalmanCoreUpdateWithSweepAngleBatch(&coreData, &sweepBatch, tick);
+    doneUpdate = true;
+  }
+
   return doneUpdate;
 }
 
@@ -683,6 +699,12 @@ bool estimatorKalmanEnqueueSweepAngles(const sweepAngleMeasurement_t *angles)
   return appendMeasurement(sweepAnglesDataQueue, (void *)angles);
 }
 
+bool estimatorKalmanEnqueueSweepAngleBatch(const sweepAngleBatchMeasurement_t *batch)
+{
+  ASSERT(isInit);
+  return appendMeasurement(sweepAngleBatchDataQueue, (void *)batch);
+}
+
 bool estimatorKalmanTest(void)
 {
   return isInit;
@@ -448,9 +448,18 @@ void kalmanCoreUpdateWithTDOA(kalmanCoreData_t* this, tdoaMeasurement_t *tdoa)
         .z = this->S[KC_STATE_Z],
       };
 
-      bool sampleIsGood = outlierFilterValidateTdoaSteps(tdoa, error, &jacobian, &estimatedPosition);
+      // HPH' only involves the position block since H is zero elsewhere
+      float HPH = 0.0f;
+      for (int i = KC_STATE_X; i <= KC_STATE_Z; i++) {
+        for (int j = KC_STATE_X; j <= KC_STATE_Z; j++) {
+          HPH += h[i] * this->P[i][j] * h[j];
+        }
+      }
+
+      float stdDev = tdoa->stdDev;
+      bool sampleIsGood = outlierFilterValidateTdoa(tdoa, error, &jacobian, &estimatedPosition, HPH, &stdDev);
       if (sampleIsGood) {
-        scalarUpdate(this, &H, error, tdoa->stdDev);
+        scalarUpdate(this, &H, error, stdDev);
       }
     }
   }
@@ -570,27 +579,32 @@ void kalmanCoreUpdateWithYawError(kalmanCoreData_t *this, yawErrorMeasurement_t
     scalarUpdate(this, &H, this->S[KC_STATE_D2] - error->yawError, error->stdDev);
 }
 
+// Jacobian of a sweep angle with respect to the global position, dp is the
+// distance along the sweep axis and dx the distance along the base station x axis
+static void sweepAngleJacobian(float dp, float dx, kalmanCoreStateIdx_t state_p, arm_matrix_instance_f32* R, vec3d h_g) {
+  float n = (dx * dx + dp * dp);
+
+  // Rotate back to global coordinate system
+  vec3d h_b = {0, 0, 0};
+  arm_matrix_instance_f32 H_B = {3, 1, h_b};
+  h_b[KC_STATE_X] = -dp / n;
+  h_b[state_p] = dx / n;
+
+  arm_matrix_instance_f32 H_G = {3, 1, h_g};
+  mat_mult(R, &H_B, &H_G);
+}
+
 static void scalarUpdateForSweep(kalmanCoreData_t *this, float measuredSweepAngle, float dp, float dx, kalmanCoreStateIdx_t state_p, float stdDev, arm_matrix_instance_f32* R, float distanceToBs, const uint32_t tick) {
   if(dx != 0) {
     float predictedSweepAngle = atan2(dp, dx);
 
     float angleError = measuredSweepAngle - predictedSweepAngle;
     if (outlierFilterValidateLighthouseSweep(&sweepOutlierFilterState, distanceToBs, angleError, tick)) {
-      float n = (dx * dx + dp * dp);
-
       float h[KC_STATE_DIM] = {0};
       arm_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
 
-      // Rotate back to global coordinate system
-      vec3d h_b = {0, 0, 0};
-      arm_matrix_instance_f32 H_B = {3, 1, h_b};
-      h_b[KC_STATE_X] = -dp / n;
-      h_b[state_p] = dx / n;
-
       vec3d h_g = {0, 0, 0};
-      arm_matrix_instance_f32 H_G = {3, 1, h_g};
-
-      mat_mult(R, &H_B, &H_G);
+      sweepAngleJacobian(dp, dx, state_p, R, h_g);
 
       h[KC_STATE_X] = h_g[0];
       h[KC_STATE_Y] = h_g[1];
@@ -601,36 +615,35 @@ static void scalarUpdateForSweep(kalmanCoreData_t *this, float measuredSweepAngl
   }
 }
 
-void kalmanCoreUpdateWithSweepAngles(kalmanCoreData_t *this, sweepAngleMeasurement_t *angles, const uint32_t tick)
-{
-  // Get rotation matrix and invert it (to get the global to local rotation matrix)
-  arm_matrix_instance_f32 basestation_rotation_matrix = {3, 3, (float32_t *)(*angles->baseStationRot)};
-  arm_matrix_instance_f32 basestation_rotation_matrix_inv = {3, 3, (float32_t *)(*angles->baseStationRotInv)};
-
+// Position of a sensor relative to a base station, in the global (diff) and in the base station (diffRotated) frame
+static void sensorPositionFromBaseStation(const kalmanCoreData_t *this, const vec3d* sensorPos, const float* baseStationPos, arm_matrix_instance_f32* baseStationRotInv, vec3d diff, vec3d diffRotated) {
   // Rotate the sensor position using the CF roatation matrix, to rotate it to global coordinates
   arm_matrix_instance_f32 CF_ROT_MATRIX = {3, 3, (float32_t *)this->R};
-  arm_matrix_instance_f32 SENSOR_RELATVIVE_POS = {3, 1, *angles->sensorPos};
+  arm_matrix_instance_f32 SENSOR_RELATVIVE_POS = {3, 1, (float32_t *)*sensorPos};
   vec3d sensor_relative_pos_glob = {0};
   arm_matrix_instance_f32 SENSOR_RELATVIVE_POS_GLOB = {3, 1, sensor_relative_pos_glob};
   mat_mult(&CF_ROT_MATRIX, &SENSOR_RELATVIVE_POS, &SENSOR_RELATVIVE_POS_GLOB);
 
-  // Get the current state values of the position of the crazyflie and add the relative sensor pos
-  float pos_x = this->S[KC_STATE_X] + sensor_relative_pos_glob[0];
-  float pos_y = this->S[KC_STATE_Y] + sensor_relative_pos_glob[1];
-  float pos_z = this->S[KC_STATE_Z] + sensor_relative_pos_glob[2];
-
-  // Calculate the difference between the base stations and the sensor on the CF.
-  const float* baseStationPos = *angles->baseStationPos;
-  float dx = pos_x - baseStationPos[0];
-  float dy = pos_y - baseStationPos[1];
-  float dz = pos_z - baseStationPos[2];
+  // Difference between the base station and the sensor on the CF
+  diff[0] = this->S[KC_STATE_X] + sensor_relative_pos_glob[0] - baseStationPos[0];
+  diff[1] = this->S[KC_STATE_Y] + sensor_relative_pos_glob[1] - baseStationPos[1];
+  diff[2] = this->S[KC_STATE_Z] + sensor_relative_pos_glob[2] - baseStationPos[2];
 
   // Rotate the difference in position to be relative to the basestation
-  vec3d position_diff = {dx, dy, dz};
+  arm_matrix_instance_f32 vec_pos_diff = {3, 1, diff};
+  arm_matrix_instance_f32 vec_pos_diff_rot = {3, 1, diffRotated};
+  mat_mult(baseStationRotInv, &vec_pos_diff, &vec_pos_diff_rot);
+}
+
+void kalmanCoreUpdateWithSweepAngles(kalmanCoreData_t *this, sweepAngleMeasurement_t *angles, const uint32_t tick)
+{
+  // Get rotation matrix and invert it (to get the global to local rotation matrix)
+  arm_matrix_instance_f32 basestation_rotation_matrix = {3, 3, (float32_t *)(*angles->baseStationRot)};
+  arm_matrix_instance_f32 basestation_rotation_matrix_inv = {3, 3, (float32_t *)(*angles->baseStationRotInv)};
+
+  vec3d position_diff = {0, 0, 0};
   vec3d position_diff_rotated = {0, 0, 0};
-  arm_matrix_instance_f32 vec_pos_diff = {3, 1, position_diff};
-  arm_matrix_instance_f32 vec_pos_diff_rot = {3, 1, position_diff_rotated};
-  mat_mult(&basestation_rotation_matrix_inv, &vec_pos_diff, &vec_pos_diff_rot);
+  sensorPositionFromBaseStation(this, angles->sensorPos, *angles->baseStationPos, &basestation_rotation_matrix_inv, position_diff, position_diff_rotated);
 
   float dx_rot = position_diff_rotated[0];
   float dy_rot = position_diff_rotated[1];
@@ -640,12 +653,69 @@ void kalmanCoreUpdateWithSweepAngles(kalmanCoreData_t *this, sweepAngleMeasureme
   float measuredSweepAngleHorizontal = angles->angleX;
   float measuredSweepAngleVertical = angles->angleY;
 
-  float distanceToBs = arm_sqrt(dx * dx + dy * dy + dz * dz);
+  float distanceToBs = arm_sqrt(position_diff[0] * position_diff[0] + position_diff[1] * position_diff[1] + position_diff[2] * position_diff[2]);
 
   scalarUpdateForSweep(this, measuredSweepAngleHorizontal, dy_rot, dx_rot, KC_STATE_Y, angles->stdDevX, &basestation_rotation_matrix, distanceToBs, tick);
   scalarUpdateForSweep(this, measuredSweepAngleVertical, dz_rot, dx_rot, KC_STATE_Z, angles->stdDevY, &basestation_rotation_matrix, distanceToBs, tick);
 }
 
+void kalmanCoreUpdateWithSweepAngleBatch(kalmanCoreData_t *this, sweepAngleBatchMeasurement_t *batch, const uint32_t tick)
+{
+  arm_matrix_instance_f32 basestation_rotation_matrix = {3, 3, (float32_t *)(*batch->baseStationRot)};
+  arm_matrix_instance_f32 basestation_rotation_matrix_inv = {3, 3, (float32_t *)(*batch->baseStationRotInv)};
+
+  // All angles are gated and linearized around the state before the update, as
+  // in a vector update. The scalar updates below then correct each innovation
+  // for the position change made by the previous ones, which for independent
+  // measurement noise gives the vector update without inverting its covariance.
+  static vec3d h_g[SWEEP_ANGLE_BATCH_MAX_SENSORS * 2];
+  static float angleErrors[SWEEP_ANGLE_BATCH_MAX_SENSORS * 2];
+  int count = 0;
+
+  const vec3d priorPos = {this->S[KC_STATE_X], this->S[KC_STATE_Y], this->S[KC_STATE_Z]};
+
+  for (int sensor = 0; sensor < batch->sensorCount; sensor++) {
+    vec3d position_diff = {0, 0, 0};
+    vec3d position_diff_rotated = {0, 0, 0};
+    sensorPositionFromBaseStation(this, batch->sensors[sensor].sensorPos, *batch->baseStationPos, &basestation_rotation_matrix_inv, position_diff, position_diff_rotated);
+
+    float dx_rot = position_diff_rotated[0];
+    if (dx_rot == 0) {
+      continue;
+    }
+
+    float distanceToBs = arm_sqrt(position_diff[0] * position_diff[0] + position_diff[1] * position_diff[1] + position_diff[2] * position_diff[2]);
+
+    const float measured[2] = {batch->sensors[sensor].angleX, batch->sensors[sensor].angleY};
+    const float dp[2] = {position_diff_rotated[1], position_diff_rotated[2]};
+    const kalmanCoreStateIdx_t state_p[2] = {KC_STATE_Y, KC_STATE_Z};
+
+    for (int axis = 0; axis < 2; axis++) {
+      float angleError = measured[axis] - atan2f(dp[axis], dx_rot);
+      if (outlierFilterValidateLighthouseSweep(&sweepOutlierFilterState, distanceToBs, angleError, tick)) {
+        sweepAngleJacobian(dp[axis], dx_rot, state_p[axis], &basestation_rotation_matrix, h_g[count]);
+        angleErrors[count] = angleError;
+        count++;
+      }
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    float h[KC_STATE_DIM] = {0};
+    arm_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
+
+    h[KC_STATE_X] = h_g[i][0];
+    h[KC_STATE_Y] = h_g[i][1];
+    h[KC_STATE_Z] = h_g[i][2];
+
+    float correction = h_g[i][0] * (this->S[KC_STATE_X] - priorPos[0]) +
+                       h_g[i][1] * (this->S[KC_STATE_Y] - priorPos[1]) +
+                       h_g[i][2] * (this->S[KC_STATE_Z] - priorPos[2]);
+
+    scalarUpdate(this, &H, angleErrors[i] - correction, batch->stdDev);
+  }
+}
+
 void kalmanCorePredict(kalmanCoreData_t* this, float cmdThrust, Axis3f *acc, Axis3f *gyro, float dt, bool quadIsFlying)
 {
   /* Here we discretize (euler forward) and linearise the quadrocopter dynamics in order
@@ -42,13 +42,13 @@
 #include "crtp.h"
 #include "log.h"
 #include "crc.h"
-#include "worker.h"
 #include "num.h"
 
 #include "console.h"
 #include "cfassert.h"
 #include "debug.h"
 #include "static_mem.h"
+#include "statsCnt.h"
 
 #if 0
 #define LOG_DEBUG(fmt, ...) DEBUG_PRINT("D/log " fmt, ## __VA_ARGS__)
@@ -83,6 +83,15 @@ typedef enum {
 /* Log packet parameters storage */
 #define LOG_MAX_OPS 128
 #define LOG_MAX_BLOCKS 16
+
+/* Number of captured samples each block can hold while waiting for the
+ * stream task to hand them to CRTP. Samples captured while the ring is full
+ * are dropped and counted. Must be a power of two. */
+#define LOG_BLOCK_RING_SIZE 4
+
+/* Block flags, set with CONTROL_START_BLOCK_V2 */
+#define LOG_BLOCK_FLAG_SEQUENCE 0x01 // 8 bit sequence number after the timestamp
+
 struct log_ops {
   struct log_ops * next;
   uint8_t storageType : 4;
@@ -91,11 +100,26 @@ struct log_ops {
   acquisitionType_t acquisitionType;
 };
 
+struct log_sample {
+  CRTPPacket pk;
+  unsigned int timestamp; // passed to the acquire callbacks
+  uint8_t valuesStart;    // offset of the first variable in pk.data
+};
+
 struct log_block {
   int id;
   xTimerHandle timer;
   StaticTimer_t timerBuffer;
   struct log_ops * ops;
+  uint8_t flags;
+  uint8_t sequence;
+  uint8_t ringHead;
+  uint8_t ringReady;  // samples before it have their acquire callbacks run
+  uint8_t ringTail;
+  volatile uint8_t captureRequests;      // samples the block timer could not take
+  volatile unsigned int requestTimestamp; // time of the last of these requests
+  uint8_t captureServed;                  // requests handled by the stream task
+  struct log_sample ring[LOG_BLOCK_RING_SIZE];
 };
 
 static struct log_ops logOps[LOG_MAX_OPS];
@@ -131,15 +155,18 @@ struct ops_setting_v2 {
 #define CONTROL_RESET           5
 #define CONTROL_CREATE_BLOCK_V2 6
 #define CONTROL_APPEND_BLOCK_V2 7
+#define CONTROL_START_BLOCK_V2  8 // Period in ms (16 bit) and optional flags
 
 #define BLOCK_ID_FREE -1
 
 //Private functions
 static void logTask(void * prm);
+static void logStreamTask(void * prm);
 static void logTOCProcess(int command);
 static void logControlProcess(void);
 
-void logRunBlock(void * arg);
+static void logCaptureBlock(struct log_block * blk, unsigned int timestamp);
+static void logAcquireFunctions(struct log_sample * sample, struct log_ops * ops);
 void logBlockTimed(xTimerHandle timer);
 
 //These are set by the Linker
@@ -156,18 +183,31 @@ static CRTPPacket p;
 
 static bool isInit = false;
 
+// Signals the stream task that at least one block has pending samples
+static xSemaphoreHandle streamSemaphore;
+static StaticSemaphore_t streamSemaphoreBuffer;
+
+static struct {
+  uint32_t captured;
+  uint32_t sent;
+  uint32_t dropped;
+} streamStats;
+
+static STATS_CNT_RATE_DEFINE(streamSendRate, 1000);
+
 /* Log management functions */
 static int logAppendBlock(int id, struct ops_setting * settings, int len);
 static int logAppendBlockV2(int id, struct ops_setting_v2 * settings, int len);
 static int logCreateBlock(unsigned char id, struct ops_setting * settings, int len);
 static int logCreateBlockV2(unsigned char id, struct ops_setting_v2 * settings, int len);
 static int logDeleteBlock(int id);
-static int logStartBlock(int id, unsigned int period);
+static int logStartBlock(int id, unsigned int period, uint8_t flags);
 static int logStopBlock(int id);
 static void logReset();
 static acquisitionType_t acquisitionTypeFromLogType(uint8_t logType);
 
 STATIC_MEM_TASK_ALLOC(logTask, LOG_TASK_STACKSIZE);
+STATIC_MEM_TASK_ALLOC(logStreamTask, LOG_STREAM_TASK_STACKSIZE);
 
 void logInit(void)
 {
@@ -210,6 +250,7 @@ void logInit(void)
 
   // Big lock that protects the log datastructures
   logLock = xSemaphoreCreateMutexStatic(&logLockBuffer);
+  streamSemaphore = xSemaphoreCreateBinaryStatic(&streamSemaphoreBuffer);
 
   for (i=0; i<logsLen; i++)
   {
@@ -226,6 +267,7 @@ void logInit(void)
 
   //Start the log task
   STATIC_MEM_TASK_CREATE(logTask, logTask, LOG_TASK_NAME, NULL, LOG_TASK_PRI);
+  STATIC_MEM_TASK_CREATE(logStreamTask, logStreamTask, LOG_STREAM_TASK_NAME, NULL, LOG_STREAM_TASK_PRI);
 
   isInit = true;
 }
@@ -393,7 +435,7 @@ void logControlProcess()
       ret = logDeleteBlock( p.data[1] );
       break;
     case CONTROL_START_BLOCK:
-      ret = logStartBlock( p.data[1], p.data[2]*10);
+      ret = logStartBlock( p.data[1], p.data[2]*10, 0);
       break;
     case CONTROL_STOP_BLOCK:
       ret = logStopBlock( p.data[1] );
@@ -412,6 +454,15 @@ void logControlProcess()
                             (struct ops_setting_v2*)&p.data[2],
                             (p.size-2)/sizeof(struct ops_setting_v2) );
       break;
+    case CONTROL_START_BLOCK_V2:
+      if (p.size < 4)
+      {
+        ret = EINVAL;
+        break;
+      }
+      ret = logStartBlock( p.data[1], p.data[2] | (p.data[3] << 8),
+                           (p.size > 4) ? p.data[4] : 0);
+      break;
   }
 
   //Commands answer
@@ -437,6 +488,13 @@ static int logCreateBlock(unsigned char id, struct ops_setting * settings, int l
   logBlocks[i].timer = xTimerCreateStatic("logTimer", M2T(1000), pdTRUE,
     &logBlocks[i], logBlockTimed, &logBlocks[i].timerBuffer);
   logBlocks[i].ops = NULL;
+  logBlocks[i].flags = 0;
+  logBlocks[i].sequence = 0;
+  logBlocks[i].ringHead = 0;
+  logBlocks[i].ringReady = 0;
+  logBlocks[i].ringTail = 0;
+  logBlocks[i].captureRequests = 0;
+  logBlocks[i].captureServed = 0;
 
   if (logBlocks[i].timer == NULL)
   {
@@ -466,6 +524,13 @@ static int logCreateBlockV2(unsigned char id, struct ops_setting_v2 * settings,
   logBlocks[i].timer = xTimerCreateStatic("logTimer", M2T(1000), pdTRUE,
     &logBlocks[i], logBlockTimed, &logBlocks[i].timerBuffer);
   logBlocks[i].ops = NULL;
+  logBlocks[i].flags = 0;
+  logBlocks[i].sequence = 0;
+  logBlocks[i].ringHead = 0;
+  logBlocks[i].ringReady = 0;
+  logBlocks[i].ringTail = 0;
+  logBlocks[i].captureRequests = 0;
+  logBlocks[i].captureServed = 0;
 
   if (logBlocks[i].timer == NULL)
   {
@@ -479,6 +544,7 @@ static int logCreateBlockV2(unsigned char id, struct ops_setting_v2 * settings,
 }
 
 static int blockCalcLength(struct log_block * block);
+static int blockMaxLength(struct log_block * block);
 static struct log_ops * opsMalloc();
 static void opsFree(struct log_ops * ops);
 static void blockAppendOps(struct log_block * block, struct log_ops * ops);
@@ -507,7 +573,7 @@ static int logAppendBlock(int id, struct ops_setting * settings, int len)
     struct log_ops * ops;
     int varId;
 
-    if ((currentLength + typeLength[settings[i].logType & TYPE_MASK])>LOG_MAX_LEN) {
+    if ((currentLength + typeLength[settings[i].logType & TYPE_MASK])>blockMaxLength(block)) {
       LOG_ERROR("Trying to append a full block. Block id %d.\n", id);
       return E2BIG;
     }
@@ -575,7 +641,7 @@ static int logAppendBlockV2(int id, struct ops_setting_v2 * settings, int len)
     struct log_ops * ops;
     int varId;
 
-    if ((currentLength + typeLength[settings[i].logType & TYPE_MASK])>LOG_MAX_LEN) {
+    if ((currentLength + typeLength[settings[i].logType & TYPE_MASK])>blockMaxLength(block)) {
       LOG_ERROR("Trying to append a full block. Block id %d.\n", id);
       return E2BIG;
     }
@@ -652,7 +718,7 @@ static int logDeleteBlock(int id)
   return 0;
 }
 
-static int logStartBlock(int id, unsigned int period)
+static int logStartBlock(int id, unsigned int period, uint8_t flags)
 {
   int i;
 
@@ -664,15 +730,22 @@ static int logStartBlock(int id, unsigned int period)
     return ENOENT;
   }
 
+  if ((flags & LOG_BLOCK_FLAG_SEQUENCE) && blockCalcLength(&logBlocks[i]) >= LOG_MAX_LEN) {
+    LOG_ERROR("No room for a sequence number in block id %d.\n", id);
+    return E2BIG;
+  }
+
   LOG_DEBUG("Starting block %d with period %dms\n", id, period);
 
+  logBlocks[i].flags = flags;
+
   if (period>0)
   {
     xTimerChangePeriod(logBlocks[i].timer, M2T(period), 100);
     xTimerStart(logBlocks[i].timer, 100);
   } else {
-    // single-shoot run
-    workerSchedule(logRunBlock, &logBlocks[i]);
+    // single-shoot run, the log lock is already held by the log task
+    logCaptureBlock(&logBlocks[i], ((long long)xTaskGetTickCount())/portTICK_RATE_MS);
   }
 
   return 0;
@@ -695,10 +768,60 @@ static int logStopBlock(int id)
   return 0;
 }
 
-/* This function is called by the timer subsystem */
+/* This function is called by the timer subsystem at the period of the block.
+ * The block variables are sampled right here so that they are taken at their
+ * period even when the stream task falls behind. The timer service task must
+ * not block, nor run the acquire callbacks of the variables, these are left to
+ * the stream task. If the log lock is busy the sample is requested from the
+ * stream task instead, stamped with the time of the request. */
 void logBlockTimed(xTimerHandle timer)
 {
-  workerSchedule(logRunBlock, pvTimerGetTimerID(timer));
+  struct log_block *blk = pvTimerGetTimerID(timer);
+  unsigned int timestamp = ((long long)xTaskGetTickCount())/portTICK_RATE_MS;
+
+  if (xSemaphoreTake(logLock, 0) == pdTRUE)
+  {
+    logCaptureBlock(blk, timestamp);
+    xSemaphoreGive(logLock);
+  }
+  else
+  {
+    blk->requestTimestamp = timestamp;
+    blk->captureRequests++;
+    xSemaphoreGive(streamSemaphore);
+  }
+}
+
+/* Captures the samples the block timers could not take themselves, then runs
+ * the acquire callbacks of the captured samples. If several requests of a
+ * block piled up, only one sample is taken and the sequence number is
+ * advanced over the missed ones to make the gap visible. */
+static void logCapturePending(void)
+{
+  xSemaphoreTake(logLock, portMAX_DELAY);
+  for (int i = 0; i < LOG_MAX_BLOCKS; i++)
+  {
+    struct log_block *blk = &logBlocks[i];
+    uint8_t pending = blk->captureRequests - blk->captureServed;
+
+    if (pending > 0)
+    {
+      blk->captureServed += pending;
+      if (blk->id != BLOCK_ID_FREE)
+      {
+        blk->sequence += pending - 1;
+        streamStats.dropped += pending - 1;
+      }
+      logCaptureBlock(blk, blk->requestTimestamp);
+    }
+
+    while (blk->id != BLOCK_ID_FREE && blk->ringReady != blk->ringHead)
+    {
+      logAcquireFunctions(&blk->ring[blk->ringReady % LOG_BLOCK_RING_SIZE], blk->ops);
+      blk->ringReady++;
+    }
+  }
+  xSemaphoreGive(logLock);
 }
 
 /* Appends data to a packet if space is available; returns false on failure. */
@@ -712,160 +835,297 @@ static bool appendToPacket(CRTPPacket * pk, const void * data, size_t n) {
   else return false;
 }
 
-/* This function is usually called by the worker subsystem */
-void logRunBlock(void * arg)
+/* Reads a variable and appends it to a packet in its log type; returns false
+ * if it does not fit. */
+static bool appendVariable(CRTPPacket * pk, struct log_ops * ops, unsigned int timestamp)
 {
-  struct log_block *blk = arg;
-  struct log_ops *ops = blk->ops;
-  static CRTPPacket pk;
-  unsigned int timestamp;
-
-  xSemaphoreTake(logLock, portMAX_DELAY);
-
-  timestamp = ((long long)xTaskGetTickCount())/portTICK_RATE_MS;
-
-  pk.header = CRTP_HEADER(CRTP_PORT_LOG, LOG_CH);
-  pk.size = 4;
-  pk.data[0] = blk->id;
-  pk.data[1] = timestamp&0x0ff;
-  pk.data[2] = (timestamp>>8)&0x0ff;
-  pk.data[3] = (timestamp>>16)&0x0ff;
+  int valuei = 0;
+  float valuef = 0;
 
-  while (ops)
+  // FPU instructions must run on aligned data.
+  // We first copy the data to an (aligned) local variable, before assigning it
+  switch(ops->storageType)
   {
-    int valuei = 0;
-    float valuef = 0;
-
-    // FPU instructions must run on aligned data.
-    // We first copy the data to an (aligned) local variable, before assigning it
-    switch(ops->storageType)
+    case LOG_UINT8:
     {
-      case LOG_UINT8:
-      {
-        uint8_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireUInt8(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
+      uint8_t v;
+      if (ops->acquisitionType == acqType_function) {
+        logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
+        v = logByFunction->acquireUInt8(timestamp, logByFunction->data);
+      } else {
+        memcpy(&v, ops->variable, sizeof(v));
       }
-      case LOG_INT8:
-      {
-        int8_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireInt8(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
+      valuei = v;
+      break;
+    }
+    case LOG_INT8:
+    {
+      int8_t v;
+      if (ops->acquisitionType == acqType_function) {
+        logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
+        v = logByFunction->acquireInt8(timestamp, logByFunction->data);
+      } else {
+        memcpy(&v, ops->variable, sizeof(v));
       }
-      case LOG_UINT16:
-      {
-        uint16_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireUInt16(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
+      valuei = v;
+      break;
+    }
+    case LOG_UINT16:
+    {
+      uint16_t v;
+      if (ops->acquisitionType == acqType_function) {
+        logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
+        v = logByFunction->acquireUInt16(timestamp, logByFunction->data);
+      } else {
+        memcpy(&v, ops->variable, sizeof(v));
       }
-      case LOG_INT16:
-      {
-        int16_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireInt16(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
+      valuei = v;
+      break;
+    }
+    case LOG_INT16:
+    {
+      int16_t v;
+      if (ops->acquisitionType == acqType_function) {
+        logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
+        v = logByFunction->acquireInt16(timestamp, logByFunction->data);
+      } else {
+        memcpy(&v, ops->variable, sizeof(v));
       }
-      case LOG_UINT32:
-      {
-        uint32_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireUInt32(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
+      valuei = v;
+      break;
+    }
+    case LOG_UINT32:
+    {
+      uint32_t v;
+      if (ops->acquisitionType == acqType_function) {
+        logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
+        v = logByFunction->acquireUInt32(timestamp, logByFunction->data);
+      } else {
+        memcpy(&v, ops->variable, sizeof(v));
       }
-      case LOG_INT32:
-      {
-        int32_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireInt32(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
+      valuei = v;
+      break;
+    }
+    case LOG_INT32:
+    {
+      int32_t v;
+      if (ops->acquisitionType == acqType_function) {
+        logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
+        v = logByFunction->acquireInt32(timestamp, logByFunction->data);
+      } else {
+        memcpy(&v, ops->variable, sizeof(v));
       }
-      case LOG_FLOAT:
-      {
-        float v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->aquireFloat(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(valuef));
-        }
-        valuei = v;
-        valuef = v;
-        break;
+      valuei = v;
+      break;
+    }
+    case LOG_FLOAT:
+    {
+      float v;
+      if (ops->acquisitionType == acqType_function) {
+        logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
+        v = logByFunction->aquireFloat(timestamp, logByFunction->data);
+      } else {
+        memcpy(&v, ops->variable, sizeof(valuef));
       }
+      valuei = v;
+      valuef = v;
+      break;
     }
+  }
 
-    if (ops->logType == LOG_FLOAT || ops->logType == LOG_FP16)
+  if (ops->logType == LOG_FLOAT || ops->logType == LOG_FP16)
+  {
+    if (ops->storageType != LOG_FLOAT)
     {
-      if (ops->storageType != LOG_FLOAT)
-      {
-        valuef = valuei;
-      }
+      valuef = valuei;
+    }
 
-      // Try to append the next item to the packet.  If we run out of space,
-      // drop this and subsequent items.
-      if (ops->logType == LOG_FLOAT)
-      {
-        if (!appendToPacket(&pk, &valuef, 4)) break;
-      }
-      else
-      {
-        valuei = single2half(valuef);
-        if (!appendToPacket(&pk, &valuei, 2)) break;
-      }
+    if (ops->logType == LOG_FLOAT)
+    {
+      return appendToPacket(pk, &valuef, 4);
+    }
+    else
+    {
+      valuei = single2half(valuef);
+      return appendToPacket(pk, &valuei, 2);
+    }
+  }
+  else  //logType is an integer
+  {
+    return appendToPacket(pk, &valuei, typeLength[ops->logType]);
+  }
+}
+
+/* Samples the block variables into the block ring. The variables acquired by
+ * function only get their room in the packet, they are filled in later by
+ * logAcquireFunctions() in the stream task. Must be called with the log lock
+ * held. */
+static void logCaptureBlock(struct log_block * blk, unsigned int timestamp)
+{
+  static const uint8_t placeholder[4];
+  struct log_ops *ops = blk->ops;
+  struct log_sample *sample;
+  CRTPPacket *pk;
+  uint8_t sequence;
+
+  if (blk->id == BLOCK_ID_FREE)
+  {
+    // Block deleted while its timer was still pending
+    return;
+  }
+
+  sequence = blk->sequence++;
+
+  if ((uint8_t)(blk->ringHead - blk->ringTail) >= LOG_BLOCK_RING_SIZE)
+  {
+    streamStats.dropped++;
+    return;
+  }
+
+  sample = &blk->ring[blk->ringHead % LOG_BLOCK_RING_SIZE];
+  sample->timestamp = timestamp;
+  pk = &sample->pk;
+
+  pk->header = CRTP_HEADER(CRTP_PORT_LOG, LOG_CH);
+  pk->size = 4;
+  pk->data[0] = blk->id;
+  pk->data[1] = timestamp&0x0ff;
+  pk->data[2] = (timestamp>>8)&0x0ff;
+  pk->data[3] = (timestamp>>16)&0x0ff;
+
+  if (blk->flags & LOG_BLOCK_FLAG_SEQUENCE)
+  {
+    pk->data[pk->size++] = sequence;
+  }
+  sample->valuesStart = pk->size;
+
+  // Try to append the next item to the packet.  If we run out of space,
+  // drop this and subsequent items.
+  while (ops)
+  {
+    if (ops->acquisitionType == acqType_function)
+    {
+      if (!appendToPacket(pk, placeholder, typeLength[ops->logType])) break;
+    }
+    else
+    {
+      if (!appendVariable(pk, ops, timestamp)) break;
+    }
+
+    ops = ops->next;
+  }
+
+  blk->ringHead++;
+  streamStats.captured++;
+
+  xSemaphoreGive(streamSemaphore);
+}
+
+/* Runs the acquire callbacks of a captured sample and writes their values at
+ * the room logCaptureBlock() left for them. Variables appended to the block
+ * after the capture are not part of the sample. */
+static void logAcquireFunctions(struct log_sample * sample, struct log_ops * ops)
+{
+  CRTPPacket *pk = &sample->pk;
+  uint8_t size = pk->size;
+
+  pk->size = sample->valuesStart;
+  while (ops && pk->size < size)
+  {
+    if (ops->acquisitionType == acqType_function)
+    {
+      appendVariable(pk, ops, sample->timestamp);
     }
-    else  //logType is an integer
+    else
     {
-      if (!appendToPacket(&pk, &valuei, typeLength[ops->logType])) break;
+      pk->size += typeLength[ops->logType];
     }
 
     ops = ops->next;
   }
+  pk->size = size;
+}
+
+/* Pops the oldest sample of the next block that has pending data. Blocks are
+ * visited round robin so that a fast block can not starve the others. */
+static bool logStreamPop(CRTPPacket * pk)
+{
+  static int next = 0;
+  bool found = false;
+
+  xSemaphoreTake(logLock, portMAX_DELAY);
+  for (int n = 0; n < LOG_MAX_BLOCKS && !found; n++)
+  {
+    struct log_block *blk = &logBlocks[next];
+    next = (next + 1) % LOG_MAX_BLOCKS;
 
+    if (blk->id != BLOCK_ID_FREE && blk->ringReady != blk->ringTail)
+    {
+      memcpy(pk, &blk->ring[blk->ringTail % LOG_BLOCK_RING_SIZE].pk, sizeof(CRTPPacket));
+      blk->ringTail++;
+      found = true;
+    }
+  }
   xSemaphoreGive(logLock);
 
-  // Check if the connection is still up, oherwise disable
-  // all the logging and flush all the CRTP queues.
-  if (!crtpIsConnected())
+  return found;
+}
+
+/* Gets a buffer from the CRTP TX pool, waiting for one to be released as
+ * long as the link is up. Returns NULL if the connection was lost. */
+static CRTPPacket* logStreamAllocPacket(void)
+{
+  CRTPPacket *pk;
+
+  while (crtpIsConnected())
   {
-    logReset();
-    crtpReset();
+    // While the pool is empty the block rings absorb the samples
+    logCapturePending();
+    pk = crtpAllocTxPacket(CRTP_PORT_LOG, 1);
+    if (pk)
+    {
+      return pk;
+    }
   }
-  else
+
+  return NULL;
+}
+
+/* Packetizes the samples captured by the block timers. Samples are popped
+ * straight into CRTP TX buffers that are then handed over without copy. */
+static void logStreamTask(void * prm)
+{
+  CRTPPacket *pk;
+
+  while (1)
   {
-    crtpSendPacket(&pk);
+    xSemaphoreTake(streamSemaphore, portMAX_DELAY);
+    logCapturePending();
+
+    while (1)
+    {
+      // Check if the connection is still up, oherwise disable
+      // all the logging and flush all the CRTP queues.
+      pk = logStreamAllocPacket();
+      if (pk == NULL)
+      {
+        xSemaphoreTake(logLock, portMAX_DELAY);
+        logReset();
+        xSemaphoreGive(logLock);
+        crtpReset();
+        break;
+      }
+
+      if (!logStreamPop(pk))
+      {
+        crtpFreeTxPacket(pk);
+        break;
+      }
+
+      crtpSendTxPacket(pk);
+      streamStats.sent++;
+      STATS_CNT_RATE_EVENT(&streamSendRate);
+    }
   }
 }
 
@@ -919,6 +1179,14 @@ static int blockCalcLength(struct log_block * block)
   return len;
 }
 
+static int blockMaxLength(struct log_block * block)
+{
+  if (block->flags & LOG_BLOCK_FLAG_SEQUENCE)
+    return LOG_MAX_LEN - 1;
+
+  return LOG_MAX_LEN;
+}
+
 void blockAppendOps(struct log_block * block, struct log_ops * ops)
 {
   struct log_ops * o;
@@ -1069,3 +1337,10 @@ static acquisitionType_t acquisitionTypeFromLogType(uint8_t logType) {
 
   return acqType_memory;
 }
+
+LOG_GROUP_START(log)
+LOG_ADD(LOG_UINT32, captured, &streamStats.captured)
+LOG_ADD(LOG_UINT32, sent, &streamStats.sent)
+LOG_ADD(LOG_UINT32, dropped, &streamStats.dropped)
+STATS_CNT_RATE_LOG_ADD(sendRate, &streamSendRate)
+LOG_GROUP_STOP(log)
@@ -567,7 +567,8 @@ static uint8_t handleTrajectoryMemRead(uint32_t memAddr, uint8_t readLen, uint8_
 static uint8_t handleTrajectoryMemWrite(uint32_t memAddr, uint8_t writeLen, uint8_t* startOfData) {
   uint8_t status = EIO;
 
-  if ((memAddr + writeLen) <= sizeof(trajectories_memory)) {
+  if ((memAddr + writeLen) <= sizeof(trajectories_memory) &&
+      crtpCommanderHighLevelIsTrajectoryMemoryWritable(memAddr, writeLen)) {
     memcpy(&(trajectories_memory[memAddr]), startOfData, writeLen);
     status = STATUS_OK;
   }
@@ -28,6 +28,7 @@
 #include "outlierFilter.h"
 #include "stabilizer_types.h"
 #include "log.h"
+#include "param.h"
 #include "debug.h"
 
 #define BUCKET_ACCEPTANCE_LEVEL 2
@@ -55,7 +56,26 @@ filterLevel_t filterLevels[FILTER_LEVELS] = {
 };
 
 
+#define TDOA_MODE_STEPS 0
+#define TDOA_MODE_INNOVATION 1
+static uint8_t tdoaMode = TDOA_MODE_STEPS;
+
+// Innovation gate, on the normalized innovation squared (1 degree of freedom)
+static float tdoaChi2Threshold = 9.0f; // 3 sigma
+#define TDOA_MAX_CONSECUTIVE_REJECTS 50
+static float tdoaNis;
+static int tdoaConsecutiveRejects = 0;
+static uint32_t tdoaRejectCount = 0;
+
+// Per anchor unreliability, the rate of measurements that fail the gate. The
+// gate always uses the nominal measurement noise, the noise of anchors with low
+// reliability is only increased for the kalman update of accepted samples.
+#define TDOA_RELIABILITY_ALPHA 0.02f
+#define TDOA_MIN_RELIABILITY 0.25f
+static float anchorUnreliability[256];
+
 static bool isDistanceDiffSmallerThanDistanceBetweenAnchors(const tdoaMeasurement_t* tdoa);
+static void updateAnchorReliability(const uint8_t anchorId, const bool isInlier);
 static float distanceSq(const point_t* a, const point_t* b);
 static float sq(float a) {return a * a;}
 static void addToBucket(filterLevel_t* filter);
@@ -102,6 +122,45 @@ bool outlierFilterValidateTdoaSteps(const tdoaMeasurement_t* tdoa, const float e
   return sampleIsGood;
 }
 
+bool outlierFilterValidateTdoaInnovation(const tdoaMeasurement_t* tdoa, const float error, const float HPH, float* stdDev) {
+  if (!isDistanceDiffSmallerThanDistanceBetweenAnchors(tdoa)) {
+    return false;
+  }
+
+  const float nominalR = (*stdDev) * (*stdDev);
+  tdoaNis = error * error / (HPH + nominalR);
+
+  bool sampleIsGood = (tdoaNis < tdoaChi2Threshold);
+  updateAnchorReliability(tdoa->anchorId[0], sampleIsGood);
+  updateAnchorReliability(tdoa->anchorId[1], sampleIsGood);
+  if (sampleIsGood) {
+    tdoaConsecutiveRejects = 0;
+  } else {
+    tdoaRejectCount++;
+    tdoaConsecutiveRejects++;
+    if (tdoaConsecutiveRejects > TDOA_MAX_CONSECUTIVE_REJECTS) {
+      // The estimate is probably off and the covariance too small for it to
+      // recover through the gate, open up to let the kalman filter converge
+      sampleIsGood = true;
+    }
+  }
+
+  float reliability = 1.0f - 0.5f * (anchorUnreliability[tdoa->anchorId[0]] + anchorUnreliability[tdoa->anchorId[1]]);
+  if (reliability < TDOA_MIN_RELIABILITY) {
+    reliability = TDOA_MIN_RELIABILITY;
+  }
+  *stdDev = sqrtf(nominalR / reliability);
+  return sampleIsGood;
+}
+
+bool outlierFilterValidateTdoa(const tdoaMeasurement_t* tdoa, const float error, const vector_t* jacobian, const point_t* estPos, const float HPH, float* stdDev) {
+  if (tdoaMode == TDOA_MODE_STEPS) {
+    return outlierFilterValidateTdoaSteps(tdoa, error, jacobian, estPos);
+  }
+
+  return outlierFilterValidateTdoaInnovation(tdoa, error, HPH, stdDev);
+}
+
 
 #define LH_TICKS_PER_FRAME (1000 / 120)
 static const int32_t lhMinWindowTime = -2 * LH_TICKS_PER_FRAME;
@@ -156,6 +215,11 @@ static float distanceSq(const point_t* a, const point_t* b) {
   return sq(a->x - b->x) + sq(a->y - b->y) + sq(a->z - b->z);
 }
 
+static void updateAnchorReliability(const uint8_t anchorId, const bool isInlier) {
+  const float target = isInlier ? 0.0f : 1.0f;
+  anchorUnreliability[anchorId] += TDOA_RELIABILITY_ALPHA * (target - anchorUnreliability[anchorId]);
+}
+
 
 static void addToBucket(filterLevel_t* filter) {
   if (filter->bucket < MAX_BUCKET_FILL) {
@@ -197,4 +261,11 @@ LOG_GROUP_START(outlierf)
   LOG_ADD(LOG_INT32, bucket4, &filterLevels[4].bucket)
   LOG_ADD(LOG_FLOAT, accLev, &acceptanceLevel)
   LOG_ADD(LOG_FLOAT, errD, &errorDistance)
+  LOG_ADD(LOG_FLOAT, nis, &tdoaNis)
+  LOG_ADD(LOG_UINT32, tdoaRej, &tdoaRejectCount)
 LOG_GROUP_STOP(outlierf)
+
+PARAM_GROUP_START(outlierf)
+  PARAM_ADD(PARAM_UINT8, tdoaMode, &tdoaMode)
+  PARAM_ADD(PARAM_FLOAT, tdoaChi2, &tdoaChi2Threshold)
+PARAM_GROUP_STOP(outlierf)
@@ -96,7 +96,16 @@ static uint16_t paramsCount = 0;
 // This is set to true, if a client uses TOC_CH in V2
 static bool useV2 = false;
 
-static CRTPPacket p;
+// Packet being processed. The request is received into a TX pool buffer and
+// the reply is built in place, so it is sent without a copy.
+static CRTPPacket *p;
+static bool replySent;
+
+static void paramSendReply(void)
+{
+  crtpSendTxPacket(p);
+  replySent = true;
+}
 
 static bool isInit = false;
 
@@ -107,6 +116,7 @@ void paramInit(void)
   int i;
   const char* group = NULL;
   int groupLength = 0;
+  CRTPPacket crcBuffer;
 
   if(isInit)
     return;
@@ -115,13 +125,13 @@ void paramInit(void)
   paramsLen = &_param_stop - &_param_start;
 
   // Calculate a hash of the toc by chaining description of each elements
-  // Using the CRTP packet as temporary buffer
+  // Using a CRTP packet as temporary buffer
   paramsCrc = 0;
   for (int i=0; i<paramsLen; i++)
   {
     int len = 5;
-    memcpy(&p.data[0], &paramsCrc, 4);
-    p.data[4] = params[i].type;
+    memcpy(&crcBuffer.data[0], &paramsCrc, 4);
+    crcBuffer.data[4] = params[i].type;
     if (params[i].type & PARAM_GROUP) {
       if (params[i].type & PARAM_START) {
         group = params[i].name;
@@ -136,10 +146,10 @@ void paramInit(void)
     }
 
     if (params[i].name) {
-      memcpy(&p.data[5], params[i].name, strlen(params[i].name));
+      memcpy(&crcBuffer.data[5], params[i].name, strlen(params[i].name));
       len += strlen(params[i].name);
     }
-    paramsCrc = crcSlow(p.data, len);
+    paramsCrc = crcSlow(crcBuffer.data, len);
   }
 
   for (i=0; i<paramsLen; i++)
@@ -167,16 +177,18 @@ void paramTask(void * prm)
 	crtpInitTaskQueue(CRTP_PORT_PARAM);
 
 	while(1) {
-		crtpReceivePacketBlock(CRTP_PORT_PARAM, &p);
+		p = crtpAllocTxPacket(CRTP_PORT_PARAM, portMAX_DELAY);
+		crtpReceivePacketBlock(CRTP_PORT_PARAM, p);
+		replySent = false;
 
-		if (p.channel==TOC_CH)
-		  paramTOCProcess(p.data[0]);
-	  else if (p.channel==READ_CH)
+		if (p->channel==TOC_CH)
+		  paramTOCProcess(p->data[0]);
+	  else if (p->channel==READ_CH)
 		  paramReadProcess();
-		else if (p.channel==WRITE_CH)
+		else if (p->channel==WRITE_CH)
 		  paramWriteProcess();
-    else if (p.channel==MISC_CH) {
-      if (p.data[0] == MISC_SETBYNAME) {
+    else if (p->channel==MISC_CH) {
+      if (p->data[0] == MISC_SETBYNAME) {
         int i, nzero = 0;
         char *group;
         char *name;
@@ -187,23 +199,27 @@ void paramTask(void * prm)
         // If the packet contains at least 2 zeros in the first 28 bytes
         // The packet decoding algorithm will not crash
         for (i=0; i<CRTP_MAX_DATA_SIZE; i++) {
-          if (p.data[i] == '\0') nzero++;
+          if (p->data[i] == '\0') nzero++;
         }
 
         if (nzero < 2) return;
 
-        group = (char*)&p.data[1];
-        name = (char*)&p.data[1+strlen(group)+1];
-        type = p.data[1+strlen(group)+1+strlen(name)+1];
-        valPtr = &p.data[1+strlen(group)+1+strlen(name)+2];
+        group = (char*)&p->data[1];
+        name = (char*)&p->data[1+strlen(group)+1];
+        type = p->data[1+strlen(group)+1+strlen(name)+1];
+        valPtr = &p->data[1+strlen(group)+1+strlen(name)+2];
 
         error = paramWriteByNameProcess(group, name, type, valPtr);
 
-        p.data[1+strlen(group)+1+strlen(name)+1] = error;
-        p.size = 1+strlen(group)+1+strlen(name)+1+1;
-        crtpSendPacket(&p);
+        p->data[1+strlen(group)+1+strlen(name)+1] = error;
+        p->size = 1+strlen(group)+1+strlen(name)+1+1;
+        paramSendReply();
       }
     }
+
+		// Requests that are not answered give the buffer back
+		if (!replySent)
+		  crtpFreeTxPacket(p);
 	}
 }
 
@@ -220,16 +236,16 @@ void paramTOCProcess(int command)
     DEBUG_PRINT("Client uses old param API!\n");
     ptr = 0;
     group = "";
-    p.header=CRTP_HEADER(CRTP_PORT_PARAM, TOC_CH);
-    p.size=6;
-    p.data[0]=CMD_GET_INFO;
+    p->header=CRTP_HEADER(CRTP_PORT_PARAM, TOC_CH);
+    p->size=6;
+    p->data[0]=CMD_GET_INFO;
     if (paramsCount < 255) {
-      p.data[1]=paramsCount;
+      p->data[1]=paramsCount;
     } else {
-      p.data[1]=255;
+      p->data[1]=255;
     }
-    memcpy(&p.data[2], &paramsCrc, 4);
-    crtpSendPacket(&p);
+    memcpy(&p->data[2], &paramsCrc, 4);
+    paramSendReply();
     break;
   case CMD_GET_ITEM:  //Get param variable
     for (ptr=0; ptr<paramsLen; ptr++) //Ptr points a group
@@ -243,7 +259,7 @@ void paramTOCProcess(int command)
       }
       else                          //Ptr points a variable
       {
-        if (n==p.data[1])
+        if (n==p->data[1])
           break;
         n++;
       }
@@ -251,35 +267,35 @@ void paramTOCProcess(int command)
 
     if (ptr<paramsLen)
     {
-      p.header=CRTP_HEADER(CRTP_PORT_PARAM, TOC_CH);
-      p.data[0]=CMD_GET_ITEM;
-      p.data[1]=n;
-      p.data[2]=params[ptr].type;
-      p.size=3+2+strlen(group)+strlen(params[ptr].name);
-      ASSERT(p.size <= CRTP_MAX_DATA_SIZE); // Too long! The name of the group or the parameter may be too long.
-      memcpy(p.data+3, group, strlen(group)+1);
-      memcpy(p.data+3+strlen(group)+1, params[ptr].name, strlen(params[ptr].name)+1);
-      crtpSendPacket(&p);
+      p->header=CRTP_HEADER(CRTP_PORT_PARAM, TOC_CH);
+      p->data[0]=CMD_GET_ITEM;
+      p->data[1]=n;
+      p->data[2]=params[ptr].type;
+      p->size=3+2+strlen(group)+strlen(params[ptr].name);
+      ASSERT(p->size <= CRTP_MAX_DATA_SIZE); // Too long! The name of the group or the parameter may be too long.
+      memcpy(p->data+3, group, strlen(group)+1);
+      memcpy(p->data+3+strlen(group)+1, params[ptr].name, strlen(params[ptr].name)+1);
+      paramSendReply();
     } else {
-      p.header=CRTP_HEADER(CRTP_PORT_PARAM, TOC_CH);
-      p.data[0]=CMD_GET_ITEM;
-      p.size=1;
-      crtpSendPacket(&p);
+      p->header=CRTP_HEADER(CRTP_PORT_PARAM, TOC_CH);
+      p->data[0]=CMD_GET_ITEM;
+      p->size=1;
+      paramSendReply();
     }
     break;
   case CMD_GET_INFO_V2: //Get info packet about the param implementation
     ptr = 0;
     group = "";
-    p.header=CRTP_HEADER(CRTP_PORT_PARAM, TOC_CH);
-    p.size=7;
-    p.data[0]=CMD_GET_INFO_V2;
-    memcpy(&p.data[1], &paramsCount, 2);
-    memcpy(&p.data[3], &paramsCrc, 4);
-    crtpSendPacket(&p);
+    p->header=CRTP_HEADER(CRTP_PORT_PARAM, TOC_CH);
+    p->size=7;
+    p->data[0]=CMD_GET_INFO_V2;
+    memcpy(&p->data[1], &paramsCount, 2);
+    memcpy(&p->data[3], &paramsCrc, 4);
+    paramSendReply();
     useV2 = true;
     break;
   case CMD_GET_ITEM_V2:  //Get param variable
-    memcpy(&paramId, &p.data[1], 2);
+    memcpy(&paramId, &p->data[1], 2);
     for (ptr=0; ptr<paramsLen; ptr++) //Ptr points a group
     {
       if (params[ptr].type & PARAM_GROUP)
@@ -299,20 +315,20 @@ void paramTOCProcess(int command)
 
     if (ptr<paramsLen)
     {
-      p.header=CRTP_HEADER(CRTP_PORT_PARAM, TOC_CH);
-      p.data[0]=CMD_GET_ITEM_V2;
-      memcpy(&p.data[1], &paramId, 2);
-      p.data[3]=params[ptr].type;
-      p.size=4+2+strlen(group)+strlen(params[ptr].name);
-      ASSERT(p.size <= CRTP_MAX_DATA_SIZE); // Too long! The name of the group or the parameter may be too long.
-      memcpy(p.data+4, group, strlen(group)+1);
-      memcpy(p.data+4+strlen(group)+1, params[ptr].name, strlen(params[ptr].name)+1);
-      crtpSendPacket(&p);
+      p->header=CRTP_HEADER(CRTP_PORT_PARAM, TOC_CH);
+      p->data[0]=CMD_GET_ITEM_V2;
+      memcpy(&p->data[1], &paramId, 2);
+      p->data[3]=params[ptr].type;
+      p->size=4+2+strlen(group)+strlen(params[ptr].name);
+      ASSERT(p->size <= CRTP_MAX_DATA_SIZE); // Too long! The name of the group or the parameter may be too long.
+      memcpy(p->data+4, group, strlen(group)+1);
+      memcpy(p->data+4+strlen(group)+1, params[ptr].name, strlen(params[ptr].name)+1);
+      paramSendReply();
     } else {
-      p.header=CRTP_HEADER(CRTP_PORT_PARAM, TOC_CH);
-      p.data[0]=CMD_GET_ITEM_V2;
-      p.size=1;
-      crtpSendPacket(&p);
+      p->header=CRTP_HEADER(CRTP_PORT_PARAM, TOC_CH);
+      p->data[0]=CMD_GET_ITEM_V2;
+      p->size=1;
+      paramSendReply();
     }
     break;
   }
@@ -322,18 +338,18 @@ static void paramWriteProcess()
 {
   if (useV2) {
     uint16_t ident;
-    memcpy(&ident, &p.data[0], 2);
+    memcpy(&ident, &p->data[0], 2);
 
-    void* valptr = &p.data[2];
+    void* valptr = &p->data[2];
     int id;
 
     id = variableGetIndex(ident);
 
     if (id<0) {
-      p.data[2] = ENOENT;
-      p.size = 3;
+      p->data[2] = ENOENT;
+      p->size = 3;
 
-      crtpSendPacket(&p);
+      paramSendReply();
       return;
     }
 
@@ -356,21 +372,21 @@ static void paramWriteProcess()
         break;
     }
 
-    crtpSendPacket(&p);
+    paramSendReply();
   } else {
-    int ident = p.data[0];
-    void* valptr = &p.data[1];
+    int ident = p->data[0];
+    void* valptr = &p->data[1];
     int id;
 
     id = variableGetIndex(ident);
 
     if (id<0) {
-      p.data[0] = -1;
-      p.data[1] = ident;
-      p.data[2] = ENOENT;
-      p.size = 3;
+      p->data[0] = -1;
+      p->data[1] = ident;
+      p->data[2] = ENOENT;
+      p->size = 3;
 
-      crtpSendPacket(&p);
+      paramSendReply();
       return;
     }
 
@@ -393,7 +409,7 @@ static void paramWriteProcess()
         break;
     }
 
-    crtpSendPacket(&p);
+    paramSendReply();
   }
 }
 
@@ -452,75 +468,75 @@ static void paramReadProcess()
 {
   if (useV2) {
     uint16_t ident;
-    memcpy(&ident, &p.data[0], 2);
+    memcpy(&ident, &p->data[0], 2);
     int id = variableGetIndex(ident);
 
     if (id<0) {
-      p.data[2] = ENOENT;
-      p.size = 3;
+      p->data[2] = ENOENT;
+      p->size = 3;
 
-      crtpSendPacket(&p);
+      paramSendReply();
       return;
     }
 
-    p.data[2] = 0;
+    p->data[2] = 0;
     switch (params[id].type & PARAM_BYTES_MASK)
     {
     case PARAM_1BYTE:
-        memcpy(&p.data[3], params[id].address, sizeof(uint8_t));
-        p.size = 3+sizeof(uint8_t);
+        memcpy(&p->data[3], params[id].address, sizeof(uint8_t));
+        p->size = 3+sizeof(uint8_t);
         break;
       break;
       case PARAM_2BYTES:
-        memcpy(&p.data[3], params[id].address, sizeof(uint16_t));
-        p.size = 3+sizeof(uint16_t);
+        memcpy(&p->data[3], params[id].address, sizeof(uint16_t));
+        p->size = 3+sizeof(uint16_t);
         break;
       case PARAM_4BYTES:
-        memcpy(&p.data[3], params[id].address, sizeof(uint32_t));
-        p.size = 3+sizeof(uint32_t);
+        memcpy(&p->data[3], params[id].address, sizeof(uint32_t));
+        p->size = 3+sizeof(uint32_t);
         break;
       case PARAM_8BYTES:
-        memcpy(&p.data[3], params[id].address, sizeof(uint64_t));
-        p.size = 3+sizeof(uint64_t);
+        memcpy(&p->data[3], params[id].address, sizeof(uint64_t));
+        p->size = 3+sizeof(uint64_t);
         break;
     }
   } else {
-    uint8_t ident = p.data[0];
+    uint8_t ident = p->data[0];
     int id = variableGetIndex(ident);
 
     if (id<0) {
-      p.data[0] = -1;
-      p.data[1] = ident;
-      p.data[2] = ENOENT;
-      p.size = 3;
+      p->data[0] = -1;
+      p->data[1] = ident;
+      p->data[2] = ENOENT;
+      p->size = 3;
 
-      crtpSendPacket(&p);
+      paramSendReply();
       return;
     }
 
     switch (params[id].type & PARAM_BYTES_MASK)
     {
    	case PARAM_1BYTE:
-     		memcpy(&p.data[1], params[id].address, sizeof(uint8_t));
-     		p.size = 1+sizeof(uint8_t);
+     		memcpy(&p->data[1], params[id].address, sizeof(uint8_t));
+     		p->size = 1+sizeof(uint8_t);
      		break;
    		break;
       case PARAM_2BYTES:
-     		memcpy(&p.data[1], params[id].address, sizeof(uint16_t));
-     		p.size = 1+sizeof(uint16_t);
+     		memcpy(&p->data[1], params[id].address, sizeof(uint16_t));
+     		p->size = 1+sizeof(uint16_t);
      		break;
       case PARAM_4BYTES:
-        memcpy(&p.data[1], params[id].address, sizeof(uint32_t));
-     		p.size = 1+sizeof(uint32_t);
+        memcpy(&p->data[1], params[id].address, sizeof(uint32_t));
+     		p->size = 1+sizeof(uint32_t);
      		break;
    	  case PARAM_8BYTES:
-        memcpy(&p.data[1], params[id].address, sizeof(uint64_t));
-     		p.size = 1+sizeof(uint64_t);
+        memcpy(&p->data[1], params[id].address, sizeof(uint64_t));
+     		p->size = 1+sizeof(uint64_t);
      		break;
     }
   }
 
-  crtpSendPacket(&p);
+  paramSendReply();
 }
 
 static int variableGetIndex(int id)
@@ -0,0 +1,181 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * peer_localization.c - Positions of the other Crazyflies of a swarm
+ */
+#define DEBUG_MODULE "PEERLOC"
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "timers.h"
+#include "task.h"
+
+#include "peer_localization.h"
+#include "radiolink.h"
+#include "worker.h"
+#include "debug.h"
+#include "log.h"
+#include "param.h"
+
+#define BROADCAST_PERIOD M2T(100)
+#define NO_ID 0xff
+
+typedef struct {
+  uint8_t version;
+  uint8_t id;
+  float x;
+  float y;
+  float z;
+} __attribute__((packed)) peerLocalizationPacket_t;
+
+#define PACKET_VERSION 1
+
+static bool isInit = false;
+static uint8_t ownId = NO_ID;
+static point_t ownPosition;
+static bool hasOwnPosition = false;
+
+// slots are taken in the order the peers are heard from, the stalest slot is
+// reused when all are taken
+static peerLocalizationOtherPosition_t others[PEER_LOCALIZATION_MAX_NEIGHBORS];
+static uint8_t othersCount;
+
+static uint32_t rxCount;
+
+static StaticTimer_t timerBuffer;
+
+static void sendPosition(void* arg)
+{
+  P2PPacket packet;
+  peerLocalizationPacket_t position;
+
+  taskENTER_CRITICAL();
+  position.x = ownPosition.x;
+  position.y = ownPosition.y;
+  position.z = ownPosition.z;
+  taskEXIT_CRITICAL();
+
+  position.version = PACKET_VERSION;
+  position.id = ownId;
+  packet.port = PEER_LOCALIZATION_P2P_PORT;
+  packet.size = sizeof(position);
+  memcpy(packet.data, &position, sizeof(position));
+  radiolinkSendP2PPacketBroadcast(&packet);
+}
+
+static void broadcastTimer(xTimerHandle timer)
+{
+  if (ownId != NO_ID && hasOwnPosition) {
+    workerSchedule(sendPosition, NULL);
+  }
+}
+
+static void handlePosition(P2PPacket *p)
+{
+  peerLocalizationPacket_t position;
+  if (p->size < sizeof(position)) {
+    return;
+  }
+  memcpy(&position, p->data, sizeof(position));
+  if (position.version != PACKET_VERSION || position.id == NO_ID || position.id == ownId) {
+    return;
+  }
+
+  const uint32_t now = xTaskGetTickCount();
+  taskENTER_CRITICAL();
+  int slot = 0;
+  while (slot < othersCount && others[slot].id != position.id) {
+    slot++;
+  }
+  if (slot == PEER_LOCALIZATION_MAX_NEIGHBORS) {
+    slot = 0;
+    for (int i = 1; i < othersCount; i++) {
+      if (now - others[i].pos.timestamp > now - others[slot].pos.timestamp) {
+        slot = i;
+      }
+    }
+  } else if (slot == othersCount) {
+    othersCount++;
+  }
+  others[slot].id = position.id;
+  others[slot].pos.timestamp = now;
+  others[slot].pos.x = position.x;
+  others[slot].pos.y = position.y;
+  others[slot].pos.z = position.z;
+  taskEXIT_CRITICAL();
+
+  rxCount++;
+}
+
+void peerLocalizationInit(void)
+{
+  if (isInit) {
+    return;
+  }
+
+  p2pRegisterPortCB(PEER_LOCALIZATION_P2P_PORT, handlePosition);
+
+  xTimerHandle timer = xTimerCreateStatic("peerLocTimer", BROADCAST_PERIOD, pdTRUE, NULL, broadcastTimer, &timerBuffer);
+  xTimerStart(timer, 100);
+
+  isInit = true;
+}
+
+bool peerLocalizationTest(void)
+{
+  return isInit;
+}
+
+void peerLocalizationSetOwnPosition(const point_t* pos)
+{
+  taskENTER_CRITICAL();
+  ownPosition = *pos;
+  hasOwnPosition = true;
+  taskEXIT_CRITICAL();
+}
+
+uint8_t peerLocalizationGetPositions(peerLocalizationOtherPosition_t* positions, uint32_t maxAge)
+{
+  uint8_t count = 0;
+  const uint32_t now = xTaskGetTickCount();
+
+  taskENTER_CRITICAL();
+  for (int i = 0; i < othersCount; i++) {
+    if (now - others[i].pos.timestamp <= maxAge) {
+      positions[count++] = others[i];
+    }
+  }
+  taskEXIT_CRITICAL();
+
+  return count;
+}
+
+LOG_GROUP_START(peerloc)
+LOG_ADD(LOG_UINT8, peers, &othersCount)
+LOG_ADD(LOG_UINT32, rxCount, &rxCount)
+LOG_GROUP_STOP(peerloc)
+
+PARAM_GROUP_START(peerloc)
+PARAM_ADD(PARAM_UINT8, id, &ownId)
+PARAM_GROUP_STOP(peerloc)
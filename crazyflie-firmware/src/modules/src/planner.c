@@ -78,6 +78,12 @@ bool plan_is_finished(struct planner *p, float t)
 		case TRAJECTORY_TYPE_PIECEWISE_COMPRESSED:
 		  return piecewise_compressed_is_finished(p->compressed_trajectory, t);
 
+		case TRAJECTORY_TYPE_PIECEWISE_STREAM:
+		  return piecewise_stream_is_finished(p->stream_trajectory, t);
+
+		case TRAJECTORY_TYPE_PIECEWISE_COMPRESSED_V2:
+		  return piecewise_compressed_v2_is_finished(p->compressed_v2_trajectory, t);
+
 		default:
 		  return 1;
 	}
@@ -104,6 +110,35 @@ struct traj_eval plan_current_goal(struct planner *p, float t)
 	}
 }
 
+void plan_shift_time(struct planner *p, float dt)
+{
+	// a stopped plan is not evaluated again, the next one sets its own start
+	if (plan_is_stopped(p)) {
+		return;
+	}
+
+	switch (p->type) {
+		case TRAJECTORY_TYPE_PIECEWISE:
+			p->trajectory->t_begin -= dt;
+			break;
+
+		case TRAJECTORY_TYPE_PIECEWISE_COMPRESSED:
+			p->compressed_trajectory->t_begin -= dt;
+			break;
+
+		case TRAJECTORY_TYPE_PIECEWISE_STREAM:
+			p->stream_trajectory->t_begin -= dt;
+			break;
+
+		case TRAJECTORY_TYPE_PIECEWISE_COMPRESSED_V2:
+			p->compressed_v2_trajectory->t_begin -= dt;
+			break;
+
+		default:
+			break;
+	}
+}
+
 struct traj_eval plan_eval(struct planner *p, float t)
 {
 	switch (p->type) {
@@ -126,6 +161,26 @@ struct traj_eval plan_eval(struct planner *p, float t)
 			}
 			break;
 
+		case TRAJECTORY_TYPE_PIECEWISE_STREAM:
+			if (p->reversed) {
+				/* not supported */
+				return traj_eval_invalid();
+			}
+			else {
+				return piecewise_stream_eval(p->stream_trajectory, t);
+			}
+			break;
+
+		case TRAJECTORY_TYPE_PIECEWISE_COMPRESSED_V2:
+			if (p->reversed) {
+				/* not supported */
+				return traj_eval_invalid();
+			}
+			else {
+				return piecewise_compressed_v2_eval(p->compressed_v2_trajectory, t);
+			}
+			break;
+
 		default:
 			return traj_eval_invalid();
 	}
@@ -185,7 +240,73 @@ int plan_go_to(struct planner *p, bool relative, struct vec hover_pos, float hov
 	return 0;
 }
 
-int plan_start_trajectory( struct planner *p, const struct piecewise_traj* trajectory, bool reversed)
+int plan_go_to_waypoints(struct planner *p, bool relative, struct vec const *waypoints, float const *yaws,
+	int n_waypoints, float duration, float t, struct poly4d *pieces)
+{
+	// allow in any state, like plan_go_to
+
+	if (n_waypoints < 1 || n_waypoints > PP_MINSNAP_MAX_WAYPOINTS || !(duration > 0)) {
+		return 1;
+	}
+
+	struct traj_eval setpoint = plan_current_goal(p, t);
+	if (!is_traj_eval_valid(&setpoint)) {
+		return 1;
+	}
+
+	struct vec positions[PP_MINSNAP_MAX_WAYPOINTS];
+	float hover_yaws[PP_MINSNAP_MAX_WAYPOINTS];
+	float durations[PP_MINSNAP_MAX_WAYPOINTS];
+
+	// split the duration by length, with a minimum share for short pieces
+	float total_length = 0;
+	struct vec prev = setpoint.pos;
+	for (int i = 0; i < n_waypoints; ++i) {
+		positions[i] = waypoints[i];
+		hover_yaws[i] = yaws[i];
+		if (relative) {
+			positions[i] = vadd(positions[i], setpoint.pos);
+			hover_yaws[i] += setpoint.yaw;
+		}
+		durations[i] = vmag(vsub(positions[i], prev));
+		total_length += durations[i];
+		prev = positions[i];
+	}
+	float min_length = 0.2f * total_length / n_waypoints + 1e-3f;
+	for (int i = 0; i < n_waypoints; ++i) {
+		durations[i] = fmaxf(durations[i], min_length);
+	}
+	// lengthen the pieces next to much longer ones, with some margin below
+	// PP_MINSNAP_MAX_DURATION_RATIO for the rounding of the scaling below
+	float const max_ratio = 0.75f * PP_MINSNAP_MAX_DURATION_RATIO;
+	for (int i = 1; i < n_waypoints; ++i) {
+		durations[i] = fmaxf(durations[i], durations[i - 1] / max_ratio);
+	}
+	for (int i = n_waypoints - 2; i >= 0; --i) {
+		durations[i] = fmaxf(durations[i], durations[i + 1] / max_ratio);
+	}
+	float total_weight = 0;
+	for (int i = 0; i < n_waypoints; ++i) {
+		total_weight += durations[i];
+	}
+	for (int i = 0; i < n_waypoints; ++i) {
+		durations[i] *= duration / total_weight;
+	}
+
+	if (!piecewise_plan_minimum_snap(&p->waypoint_trajectory, pieces,
+		&setpoint, positions, hover_yaws, durations, n_waypoints)) {
+		return 1;
+	}
+
+	p->reversed = false;
+	p->state = TRAJECTORY_STATE_FLYING;
+	p->type = TRAJECTORY_TYPE_PIECEWISE;
+	p->waypoint_trajectory.t_begin = t;
+	p->trajectory = &p->waypoint_trajectory;
+	return 0;
+}
+
+int plan_start_trajectory( struct planner *p, struct piecewise_traj* trajectory, bool reversed)
 {
 	p->reversed = reversed;
 	p->state = TRAJECTORY_STATE_FLYING;
@@ -204,3 +325,23 @@ int plan_start_compressed_trajectory( struct planner *p, struct piecewise_traj_c
 
 	return 0;
 }
+
+int plan_start_stream_trajectory( struct planner *p, struct piecewise_traj_stream* trajectory)
+{
+	p->reversed = 0;
+	p->state = TRAJECTORY_STATE_FLYING;
+	p->type = TRAJECTORY_TYPE_PIECEWISE_STREAM;
+	p->stream_trajectory = trajectory;
+
+	return 0;
+}
+
+int plan_start_compressed_v2_trajectory( struct planner *p, struct piecewise_traj_compressed_v2* trajectory)
+{
+	p->reversed = 0;
+	p->state = TRAJECTORY_STATE_FLYING;
+	p->type = TRAJECTORY_TYPE_PIECEWISE_COMPRESSED_V2;
+	p->compressed_v2_trajectory = trajectory;
+
+	return 0;
+}
@@ -37,11 +37,15 @@ implementation of piecewise polynomial trajectories
 See Daniel Mellinger, Vijay Kumar: "Minimum snap trajectory generation and control for quadrotors". ICRA 2011: 2520-2525
 */
 
+#include <stddef.h>
+#include <string.h>
+
 #include "pptraj.h"
 
 #define GRAV (9.81f)
 
 static struct poly4d poly4d_tmp;
+static struct poly4d_prepared poly4d_prepared_tmp;
 
 // polynomials are stored with ascending degree
 
@@ -239,11 +243,6 @@ static struct vec polyval_xyz(struct poly4d const *p, float t)
 	return mkvec(polyval(p->p[0], t), polyval(p->p[1], t), polyval(p->p[2], t));
 }
 
-static float polyval_yaw(struct poly4d const *p, float t)
-{
-	return polyval(p->p[3], t);
-}
-
 // compute loose maximum of acceleration -
 // uses L1 norm instead of Euclidean, evaluates polynomial instead of root-finding
 float poly4d_max_accel_approx(struct poly4d const *p)
@@ -277,27 +276,57 @@ bool is_traj_eval_valid(struct traj_eval const *ev)
 	return !visnan(ev->pos);
 }
 
-struct traj_eval poly4d_eval(struct poly4d const *p, float t)
+// poly_deriv_factor[d][k] = (k + d)! / k!, i.e. the factor of the k-th
+// coefficient of the d-th derivative; zero beyond the degree of the derivative.
+static const float poly_deriv_factor[4][PP_SIZE] = {
+	{ 1,  1,  1,   1,   1,  1, 1, 1 },
+	{ 1,  2,  3,   4,   5,  6, 7, 0 },
+	{ 2,  6, 12,  20,  30, 42, 0, 0 },
+	{ 6, 24, 60, 120, 210,  0, 0, 0 },
+};
+
+void poly4d_prepare(struct poly4d_prepared *out, struct poly4d const *p)
+{
+	for (int d = 0; d < 4; ++d) {
+		for (int axis = 0; axis < 4; ++axis) {
+			for (int k = 0; k <= PP_DEGREE - d; ++k) {
+				out->coef[k][4 * d + axis] = poly_deriv_factor[d][k] * p->p[axis][k + d];
+			}
+			for (int k = PP_DEGREE - d + 1; k <= PP_DEGREE; ++k) {
+				out->coef[k][4 * d + axis] = 0;
+			}
+		}
+	}
+}
+
+struct traj_eval poly4d_eval_prepared(struct poly4d_prepared const *p, float t)
 {
+	// Horner's scheme for all axes and derivatives in lockstep.
+	// the lanes are independent, which keeps the FPU pipeline busy.
+	float v[POLY4D_PREPARED_LANES];
+	for (int j = 0; j < POLY4D_PREPARED_LANES; ++j) {
+		v[j] = p->coef[PP_DEGREE][j];
+	}
+	for (int k = PP_DEGREE - 1; k >= 0; --k) {
+		for (int j = 0; j < POLY4D_PREPARED_LANES; ++j) {
+			v[j] = v[j] * t + p->coef[k][j];
+		}
+	}
+
 	// flat variables
 	struct traj_eval out;
-	out.pos = polyval_xyz(p, t);
-	out.yaw = polyval_yaw(p, t);
+	out.pos = mkvec(v[0], v[1], v[2]);
+	out.yaw = v[3];
 
 	// 1st derivative
-	struct poly4d* deriv = &poly4d_tmp;
-	*deriv = *p;
-	polyder4d(deriv);
-	out.vel = polyval_xyz(deriv, t);
-	float dyaw = polyval_yaw(deriv, t);
+	out.vel = mkvec(v[4], v[5], v[6]);
+	float dyaw = v[7];
 
 	// 2nd derivative
-	polyder4d(deriv);
-	out.acc = polyval_xyz(deriv, t);
+	out.acc = mkvec(v[8], v[9], v[10]);
 
 	// 3rd derivative
-	polyder4d(deriv);
-	struct vec jerk = polyval_xyz(deriv, t);
+	struct vec jerk = mkvec(v[12], v[13], v[14]);
 
 	struct vec thrust = vadd(out.acc, mkvec(0, 0, GRAV));
 	// float thrust_mag = mass * vmag(thrust);
@@ -317,30 +346,95 @@ struct traj_eval poly4d_eval(struct poly4d const *p, float t)
 	return out;
 }
 
+struct traj_eval poly4d_eval(struct poly4d const *p, float t)
+{
+	poly4d_prepare(&poly4d_prepared_tmp, p);
+	return poly4d_eval_prepared(&poly4d_prepared_tmp, t);
+}
+
 //
 // piecewise 4d polynomials
 //
 
-// piecewise eval
-struct traj_eval piecewise_eval(
-  struct piecewise_traj const *traj, float t)
+void piecewise_reset_cursor(struct piecewise_traj *traj)
+{
+	traj->cursor.pieces = NULL;
+}
+
+// rewind the cursor if the trajectory changed since it was last used
+// or if the time went backwards.
+static void piecewise_update_cursor(struct piecewise_traj *traj, float t, bool reversed)
+{
+	struct piecewise_cursor *cursor = &traj->cursor;
+	bool changed = cursor->pieces != traj->pieces
+		|| cursor->t_begin != traj->t_begin
+		|| cursor->timescale != traj->timescale
+		|| cursor->shift.x != traj->shift.x
+		|| cursor->shift.y != traj->shift.y
+		|| cursor->shift.z != traj->shift.z
+		|| cursor->reversed != reversed;
+
+	if (changed) {
+		cursor->pieces = traj->pieces;
+		cursor->t_begin = traj->t_begin;
+		cursor->timescale = traj->timescale;
+		cursor->shift = traj->shift;
+		cursor->reversed = reversed;
+		cursor->prepared_index = -1;
+	}
+
+	if (changed || t < cursor->t_piece_begin) {
+		cursor->index = 0;
+		cursor->t_piece_begin = 0;
+	}
+}
+
+// shared implementation of piecewise_eval and piecewise_eval_reversed.
+// a reversed trajectory plays the pieces from last to first, each reflected in time.
+static struct traj_eval piecewise_eval_cursor(
+  struct piecewise_traj *traj, float t, bool reversed)
 {
-	int cursor = 0;
+	struct piecewise_cursor *cursor = &traj->cursor;
 	t = t - traj->t_begin;
-	while (cursor < traj->n_pieces) {
-		struct poly4d const *piece = &(traj->pieces[cursor]);
-		if (t <= piece->duration * traj->timescale) {
-			poly4d_tmp = *piece;
-			poly4d_shift(&poly4d_tmp, traj->shift.x, traj->shift.y, traj->shift.z, 0);
-			poly4d_stretchtime(&poly4d_tmp, traj->timescale);
-			return poly4d_eval(&poly4d_tmp, t);
+	piecewise_update_cursor(traj, t, reversed);
+
+	while (cursor->index < traj->n_pieces) {
+		int piece_index = reversed ? traj->n_pieces - 1 - cursor->index : cursor->index;
+		struct poly4d const *piece = &(traj->pieces[piece_index]);
+		float duration = piece->duration * traj->timescale;
+		if (t <= cursor->t_piece_begin + duration) {
+			if (cursor->prepared_index != piece_index) {
+				struct poly4d *tmp = &poly4d_tmp;
+				*tmp = *piece;
+				poly4d_shift(tmp, traj->shift.x, traj->shift.y, traj->shift.z, 0);
+				poly4d_stretchtime(tmp, traj->timescale);
+				if (reversed) {
+					for (int i = 0; i < 4; ++i) {
+						polyreflect(tmp->p[i]);
+					}
+				}
+				poly4d_prepare(&cursor->prepared, tmp);
+				cursor->prepared_index = piece_index;
+			}
+
+			float t_piece = t - cursor->t_piece_begin;
+			if (reversed) {
+				t_piece -= duration;
+			}
+			return poly4d_eval_prepared(&cursor->prepared, t_piece);
 		}
-		t -= piece->duration * traj->timescale;
-		++cursor;
+		cursor->t_piece_begin += duration;
+		++cursor->index;
 	}
+
 	// if we get here, the trajectory has ended
-	struct poly4d const *end_piece = &(traj->pieces[traj->n_pieces - 1]);
-	struct traj_eval ev = poly4d_eval(end_piece, end_piece->duration);
+	struct traj_eval ev;
+	if (reversed) {
+		ev = poly4d_eval(&(traj->pieces[0]), 0.0f);
+	} else {
+		struct poly4d const *end_piece = &(traj->pieces[traj->n_pieces - 1]);
+		ev = poly4d_eval(end_piece, end_piece->duration);
+	}
 	ev.pos = vadd(ev.pos, traj->shift);
 	ev.vel = vzero();
 	ev.acc = vzero();
@@ -348,36 +442,99 @@ struct traj_eval piecewise_eval(
 	return ev;
 }
 
+// piecewise eval
+struct traj_eval piecewise_eval(
+  struct piecewise_traj *traj, float t)
+{
+	return piecewise_eval_cursor(traj, t, false);
+}
+
 struct traj_eval piecewise_eval_reversed(
-  struct piecewise_traj const *traj, float t)
+  struct piecewise_traj *traj, float t)
 {
-	int cursor = traj->n_pieces - 1;
-	t = t - traj->t_begin;
-	while (cursor >= 0) {
-		struct poly4d const *piece = &(traj->pieces[cursor]);
-		if (t <= piece->duration * traj->timescale) {
-			poly4d_tmp = *piece;
-			poly4d_shift(&poly4d_tmp, traj->shift.x, traj->shift.y, traj->shift.z, 0);
-			poly4d_stretchtime(&poly4d_tmp, traj->timescale);
-			for (int i = 0; i < 4; ++i) {
-				polyreflect(poly4d_tmp.p[i]);
+	return piecewise_eval_cursor(traj, t, true);
+}
+
+
+//
+// streamed piecewise 4d polynomials
+//
+
+void piecewise_stream_init(struct piecewise_traj_stream *stream,
+	struct poly4d* pieces, uint8_t capacity)
+{
+	stream->pieces = pieces;
+	stream->capacity = capacity;
+	stream->appended = 0;
+	stream->consumed = 0;
+	stream->t_consumed = 0;
+	stream->complete = false;
+	stream->underrun = false;
+	stream->prepared_valid = false;
+}
+
+bool piecewise_stream_append(struct piecewise_traj_stream *stream, uint8_t count, bool last)
+{
+	if (stream->complete || stream->underrun || count > piecewise_stream_free(stream)) {
+		return false;
+	}
+	stream->appended += count;
+	stream->complete = last;
+	return true;
+}
+
+// the n-th appended piece with shift and timescale applied
+static void piecewise_stream_piece(struct piecewise_traj_stream const *stream,
+	uint32_t seq, struct poly4d *out)
+{
+	*out = stream->pieces[piecewise_stream_slot(stream, seq)];
+	poly4d_shift(out, stream->shift.x, stream->shift.y, stream->shift.z, 0);
+	poly4d_stretchtime(out, stream->timescale);
+}
+
+struct traj_eval piecewise_stream_eval(
+	struct piecewise_traj_stream *stream, float t)
+{
+	t = t - stream->t_begin;
+
+	while (!stream->underrun && stream->consumed < stream->appended) {
+		uint32_t seq = stream->consumed;
+		struct poly4d const *piece = &stream->pieces[piecewise_stream_slot(stream, seq)];
+		float duration = piece->duration * stream->timescale;
+		if (t <= stream->t_consumed + duration) {
+			if (!stream->prepared_valid || stream->prepared_seq != seq) {
+				piecewise_stream_piece(stream, seq, &poly4d_tmp);
+				poly4d_prepare(&stream->prepared, &poly4d_tmp);
+				stream->prepared_seq = seq;
+				stream->prepared_valid = true;
 			}
-			t = t - piece->duration * traj->timescale;
-			return poly4d_eval(&poly4d_tmp, t);
+			return poly4d_eval_prepared(&stream->prepared, t - stream->t_consumed);
+		}
+
+		if (seq + 1 == stream->appended) {
+			// the slot is free once consumed, remember where this piece ends
+			piecewise_stream_piece(stream, seq, &poly4d_tmp);
+			stream->hold = poly4d_eval(&poly4d_tmp, duration);
+			stream->hold.vel = vzero();
+			stream->hold.acc = vzero();
+			stream->hold.omega = vzero();
 		}
-		t -= piece->duration * traj->timescale;
-		--cursor;
+		stream->t_consumed += duration;
+		++stream->consumed;
+	}
+
+	if (stream->consumed == 0) {
+		// nothing to fly yet
+		stream->underrun = true;
+		return traj_eval_invalid();
 	}
-	// if we get here, the trajectory has ended
-	struct poly4d const *end_piece = &(traj->pieces[0]);
-	struct traj_eval ev = poly4d_eval(end_piece, 0.0f);
-	ev.pos = vadd(ev.pos, traj->shift);
-	ev.vel = vzero();
-	ev.acc = vzero();
-	ev.omega = vzero();
-	return ev;
-}
 
+	// the stream ended, either regularly or because the producer fell behind
+	if (!stream->complete) {
+		stream->underrun = true;
+	}
+	return stream->hold;
+}
 
 // y, dy == yaw, derivative of yaw
 void piecewise_plan_5th_order(struct piecewise_traj *pp, float duration,
@@ -389,6 +546,7 @@ void piecewise_plan_5th_order(struct piecewise_traj *pp, float duration,
 	pp->timescale = 1.0;
 	pp->shift = vzero();
 	pp->n_pieces = 1;
+	piecewise_reset_cursor(pp);
 	poly5(p->p[0], duration, p0.x, v0.x, a0.x, p1.x, v1.x, a1.x);
 	poly5(p->p[1], duration, p0.y, v0.y, a0.y, p1.y, v1.y, a1.y);
 	poly5(p->p[2], duration, p0.z, v0.z, a0.z, p1.z, v1.z, a1.z);
@@ -405,9 +563,227 @@ void piecewise_plan_7th_order_no_jerk(struct piecewise_traj *pp, float duration,
 	pp->timescale = 1.0;
 	pp->shift = vzero();
 	pp->n_pieces = 1;
+	piecewise_reset_cursor(pp);
 	poly7_nojerk(p->p[0], duration, p0.x, v0.x, a0.x, p1.x, v1.x, a1.x);
 	poly7_nojerk(p->p[1], duration, p0.y, v0.y, a0.y, p1.y, v1.y, a1.y);
 	poly7_nojerk(p->p[2], duration, p0.z, v0.z, a0.z, p1.z, v1.z, a1.z);
 	poly7_nojerk(p->p[3], duration, y0, dy0, 0, y1, dy1, 0);
 }
 
+//
+// minimum snap trajectories through waypoints
+//
+// each piece is the 7th order polynomial defined by the position and the
+// 1st to 3rd derivatives at both of its ends. the snap cost of a piece is a
+// quadratic form of these end derivatives, so the derivatives at the interior
+// waypoints that minimize the total snap follow from a linear system. every
+// waypoint only couples to its neighbours, which makes the system banded.
+//
+
+// coefficients of the 7th order polynomial on [0, 1] from its end derivatives
+// (p0, v0, a0, j0, p1, v1, a1, j1)
+static const float hermite7[PP_SIZE][8] = {
+	{   1,   0,     0,         0,   0,   0,    0,         0 },
+	{   0,   1,     0,         0,   0,   0,    0,         0 },
+	{   0,   0,  0.5f,         0,   0,   0,    0,         0 },
+	{   0,   0,     0,  1.0f / 6,   0,   0,    0,         0 },
+	{ -35, -20,    -5, -2.0f / 3,  35, -15, 2.5f, -1.0f / 6 },
+	{  84,  45,    10,         1, -84,  39,   -7,      0.5f },
+	{ -70, -36, -7.5f, -2.0f / 3,  70, -34, 6.5f,     -0.5f },
+	{  20,  10,     2,  1.0f / 6, -20,  10,   -2,  1.0f / 6 },
+};
+
+// integral of the squared snap of the same polynomial as a quadratic form
+// of the end derivatives
+static const float hermite7_snap_cost[8][8] = {
+	{  100800,  50400,  10080,  840, -100800,  50400, -10080,  840 },
+	{   50400,  25920,   5400,  480,  -50400,  24480,  -4680,  360 },
+	{   10080,   5400,   1200,  120,  -10080,   4680,   -840,   60 },
+	{     840,    480,    120,   16,    -840,    360,    -60,    4 },
+	{ -100800, -50400, -10080, -840,  100800, -50400,  10080, -840 },
+	{   50400,  24480,   4680,  360,  -50400,  25920,  -5400,  480 },
+	{  -10080,  -4680,   -840,  -60,   10080,  -5400,   1200, -120 },
+	{     840,    360,     60,    4,    -840,    480,   -120,   16 },
+};
+
+// the free variables are the 1st to 3rd derivatives at the interior waypoints
+#define MINSNAP_VARS (3 * (PP_MINSNAP_MAX_WAYPOINTS - 1))
+// variables of a waypoint only couple to those of the neighbouring waypoints
+#define MINSNAP_BANDWIDTH 6
+
+static float minsnap_lower[MINSNAP_VARS][MINSNAP_BANDWIDTH]; // [i][i - j] holds H(i, j)
+static float minsnap_rhs[MINSNAP_VARS][4];
+static float minsnap_knots[PP_MINSNAP_MAX_WAYPOINTS + 1][4][4]; // [waypoint][derivative][axis]
+
+// index of the free variable for the given waypoint and derivative, -1 if fixed
+static int minsnap_var(int n_waypoints, int knot, int deriv)
+{
+	if (knot == 0 || knot == n_waypoints || deriv == 0) {
+		return -1;
+	}
+	return 3 * (knot - 1) + deriv - 1;
+}
+
+// in-place Cholesky factorization of the banded matrix
+static bool minsnap_factorize(int n)
+{
+	for (int i = 0; i < n; ++i) {
+		int first = i - MINSNAP_BANDWIDTH + 1;
+		if (first < 0) {
+			first = 0;
+		}
+		for (int k = first; k <= i; ++k) {
+			float sum = minsnap_lower[i][i - k];
+			for (int j = first; j < k; ++j) {
+				sum -= minsnap_lower[i][i - j] * minsnap_lower[k][k - j];
+			}
+			if (i == k) {
+				if (!(sum > 0)) {
+					return false;
+				}
+				minsnap_lower[i][0] = sqrtf(sum);
+			} else {
+				minsnap_lower[i][i - k] = sum / minsnap_lower[k][0];
+			}
+		}
+	}
+	return true;
+}
+
+static void minsnap_solve(int n)
+{
+	for (int axis = 0; axis < 4; ++axis) {
+		for (int i = 0; i < n; ++i) {
+			float sum = minsnap_rhs[i][axis];
+			for (int j = (i >= MINSNAP_BANDWIDTH ? i - MINSNAP_BANDWIDTH + 1 : 0); j < i; ++j) {
+				sum -= minsnap_lower[i][i - j] * minsnap_rhs[j][axis];
+			}
+			minsnap_rhs[i][axis] = sum / minsnap_lower[i][0];
+		}
+		for (int i = n - 1; i >= 0; --i) {
+			float sum = minsnap_rhs[i][axis];
+			for (int j = i + 1; j < n && j < i + MINSNAP_BANDWIDTH; ++j) {
+				sum -= minsnap_lower[j][j - i] * minsnap_rhs[j][axis];
+			}
+			minsnap_rhs[i][axis] = sum / minsnap_lower[i][0];
+		}
+	}
+}
+
+bool piecewise_plan_minimum_snap(struct piecewise_traj *pp, struct poly4d *pieces,
+	struct traj_eval const *start, struct vec const *positions, float const *yaws,
+	float const *durations, int n_waypoints)
+{
+	if (n_waypoints < 1 || n_waypoints > PP_MINSNAP_MAX_WAYPOINTS) {
+		return false;
+	}
+	for (int s = 0; s < n_waypoints; ++s) {
+		if (!(durations[s] > 0)) {
+			return false;
+		}
+		if (s > 0 && (durations[s] > PP_MINSNAP_MAX_DURATION_RATIO * durations[s - 1] ||
+		              durations[s - 1] > PP_MINSNAP_MAX_DURATION_RATIO * durations[s])) {
+			return false;
+		}
+	}
+
+	// fixed derivatives: the start state, the waypoint positions and rest at the end
+	memset(minsnap_knots, 0, sizeof(minsnap_knots));
+	float const start_knot[4][4] = {
+		{ start->pos.x, start->pos.y, start->pos.z, start->yaw },
+		{ start->vel.x, start->vel.y, start->vel.z, start->omega.z },
+		{ start->acc.x, start->acc.y, start->acc.z, 0 },
+		{ 0, 0, 0, 0 },
+	};
+	memcpy(minsnap_knots[0], start_knot, sizeof(start_knot));
+	for (int k = 1; k <= n_waypoints; ++k) {
+		minsnap_knots[k][0][0] = positions[k - 1].x;
+		minsnap_knots[k][0][1] = positions[k - 1].y;
+		minsnap_knots[k][0][2] = positions[k - 1].z;
+		minsnap_knots[k][0][3] = yaws[k - 1];
+	}
+
+	// gradient of the total snap cost w.r.t. the free variables
+	int n_vars = 3 * (n_waypoints - 1);
+	memset(minsnap_lower, 0, sizeof(minsnap_lower));
+	memset(minsnap_rhs, 0, sizeof(minsnap_rhs));
+	for (int s = 0; s < n_waypoints; ++s) {
+		float T = durations[s];
+		float scale[8];
+		for (int d = 0; d < 4; ++d) {
+			scale[d] = scale[4 + d] = powf(T, d);
+		}
+		float w = 1.0f / powf(T, 7);
+
+		for (int r = 0; r < 8; ++r) {
+			int row = minsnap_var(n_waypoints, s + r / 4, r % 4);
+			if (row < 0) {
+				continue;
+			}
+			for (int c = 0; c < 8; ++c) {
+				float h = w * scale[r] * scale[c] * hermite7_snap_cost[r][c];
+				int col = minsnap_var(n_waypoints, s + c / 4, c % 4);
+				if (col < 0) {
+					for (int axis = 0; axis < 4; ++axis) {
+						// the cost does not depend on where the piece is, taking the
+						// positions relative to its start avoids cancellation
+						float fixed = minsnap_knots[s + c / 4][c % 4][axis];
+						if (c % 4 == 0) {
+							fixed -= minsnap_knots[s][0][axis];
+						}
+						minsnap_rhs[row][axis] -= h * fixed;
+					}
+				} else if (col <= row) {
+					minsnap_lower[row][row - col] += h;
+				}
+			}
+		}
+	}
+
+	if (n_vars > 0) {
+		if (!minsnap_factorize(n_vars)) {
+			return false;
+		}
+		minsnap_solve(n_vars);
+		for (int k = 1; k < n_waypoints; ++k) {
+			for (int d = 1; d < 4; ++d) {
+				memcpy(minsnap_knots[k][d], minsnap_rhs[minsnap_var(n_waypoints, k, d)], sizeof(minsnap_knots[k][d]));
+			}
+		}
+	}
+
+	// build the pieces from their end derivatives
+	for (int s = 0; s < n_waypoints; ++s) {
+		float T = durations[s];
+		struct poly4d *piece = &pieces[s];
+		piece->duration = T;
+		for (int axis = 0; axis < 4; ++axis) {
+			float ends[8];
+			for (int d = 0; d < 4; ++d) {
+				float Td = powf(T, d);
+				ends[d] = minsnap_knots[s][d][axis] * Td;
+				ends[4 + d] = minsnap_knots[s + 1][d][axis] * Td;
+			}
+			// relative to the start position, added back to the constant term
+			ends[4] -= ends[0];
+			ends[0] = 0;
+			float Ti = 1;
+			for (int i = 0; i < PP_SIZE; ++i) {
+				float c = 0;
+				for (int j = 0; j < 8; ++j) {
+					c += hermite7[i][j] * ends[j];
+				}
+				piece->p[axis][i] = c / Ti;
+				Ti *= T;
+			}
+			piece->p[axis][0] += minsnap_knots[s][0][axis];
+		}
+	}
+
+	pp->pieces = pieces;
+	pp->n_pieces = n_waypoints;
+	pp->timescale = 1.0;
+	pp->shift = vzero();
+	piecewise_reset_cursor(pp);
+	return true;
+}
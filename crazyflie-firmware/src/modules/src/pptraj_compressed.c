@@ -296,3 +296,326 @@ static void piecewise_compressed_advance_playhead(struct piecewise_traj_compress
 
   piecewise_compressed_update_current_poly4d(traj, &end_of_previous_piece);
 }
+
+/* ************************************************************************ */
+/* v2 format, see pptraj_compressed.h                                       */
+/* ************************************************************************ */
+
+// size of the fixed part of the v2 header: version, flags and three units
+#define V2_HEADER_SIZE 14
+
+// index of the Rice context of durations; the axes use 0-3
+#define V2_CONTEXT_DURATION 4
+
+// number of one bits that introduces a 32-bit number in Rice coded data
+#define V2_RICE_ESCAPE 16
+
+// The next piece is decoded one step per evaluation, so that no evaluation
+// has to do the whole work at once
+enum v2_prefetch_step {
+  V2_PREFETCH_HEADER = 0,
+  V2_PREFETCH_AXIS = 1,    // up to V2_PREFETCH_AXIS + 3, one step per axis
+  V2_PREFETCH_PREPARE = 5,
+  V2_PREFETCH_READY = 6,   // the next piece is waiting in the other slot
+  V2_PREFETCH_END = 7,     // the current piece is the last one
+};
+
+static void v2_reader_init(struct piecewise_traj_compressed_v2_reader *reader,
+  const uint8_t* data, const uint8_t* end, bool rice)
+{
+  memset(reader, 0, sizeof(*reader));
+  reader->ptr = data + V2_HEADER_SIZE;
+  reader->end = end;
+  reader->rice = rice;
+}
+
+// Reads n <= 32 bits, least significant first
+static uint32_t v2_read_bits(struct piecewise_traj_compressed_v2_reader *reader, int n)
+{
+  uint32_t value = 0;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (reader->ptr >= reader->end) {
+      reader->overrun = true;
+      return 0;
+    }
+    value |= (uint32_t)((*reader->ptr >> reader->bit) & 1) << i;
+    if (++reader->bit == 8) {
+      reader->bit = 0;
+      reader->ptr++;
+    }
+  }
+
+  return value;
+}
+
+static uint32_t v2_read_unsigned(struct piecewise_traj_compressed_v2_reader *reader, int context)
+{
+  uint32_t value, mean, quotient;
+  int shift, k;
+
+  if (!reader->rice) {
+    value = 0;
+    for (shift = 0; shift < 35; shift += 7) {
+      uint8_t byte = v2_read_bits(reader, 8);
+      value |= (uint32_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return value;
+      }
+    }
+    // more than five bytes, the data is broken
+    reader->overrun = true;
+    return 0;
+  }
+
+  mean = reader->acc[context] >> 4;
+  for (k = 0; (mean >> 1) >> k; k++);
+
+  for (quotient = 0; quotient < V2_RICE_ESCAPE && v2_read_bits(reader, 1); quotient++);
+  if (quotient == V2_RICE_ESCAPE) {
+    value = v2_read_bits(reader, 32);
+  } else {
+    value = (quotient << k) | v2_read_bits(reader, k);
+  }
+
+  reader->acc[context] += (value < 0xffff ? value : 0xffff) - mean;
+  return value;
+}
+
+static int32_t v2_read_signed(struct piecewise_traj_compressed_v2_reader *reader, int context)
+{
+  uint32_t value = v2_read_unsigned(reader, context);
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static inline float v2_unit_of_axis(const struct piecewise_traj_compressed_v2 *traj, int axis)
+{
+  return axis < 3 ? traj->distance_unit : traj->angle_unit;
+}
+
+// Does the next step of decoding the piece that follows the current one
+static void v2_prefetch_step(struct piecewise_traj_compressed_v2 *traj)
+{
+  struct piecewise_traj_compressed_v2_reader *reader = &traj->reader;
+  struct poly4d *next = &traj->next;
+  float control_points[PP_SIZE];
+  uint8_t axis, storage_type, i, n;
+  uint32_t duration;
+
+  if (traj->prefetch == V2_PREFETCH_HEADER) {
+    traj->storage_types = v2_read_bits(reader, 8);
+    duration = v2_read_unsigned(reader, V2_CONTEXT_DURATION);
+    if (duration == 0 || reader->overrun) {
+      traj->prefetch = V2_PREFETCH_END;
+      return;
+    }
+    // the time is stretched right away, the pieces are built for the timescale
+    next->duration = duration * traj->duration_unit * traj->timescale;
+    traj->prefetch = V2_PREFETCH_AXIS;
+  } else if (traj->prefetch < V2_PREFETCH_PREPARE) {
+    axis = traj->prefetch - V2_PREFETCH_AXIS;
+    storage_type = (traj->storage_types >> (2 * axis)) & 0x03;
+    n = control_points_by_type[storage_type] + 1;
+
+    control_points[0] = traj->control_point[axis] * v2_unit_of_axis(traj, axis);
+    for (i = 1; i < n; i++) {
+      // wraps instead of overflowing on corrupt data
+      traj->control_point[axis] = (int32_t)((uint32_t)traj->control_point[axis] + (uint32_t)v2_read_signed(reader, axis));
+      control_points[i] = traj->control_point[axis] * v2_unit_of_axis(traj, axis);
+    }
+    if (reader->overrun) {
+      traj->prefetch = V2_PREFETCH_END;
+      return;
+    }
+
+    memset(next->p[axis], 0, sizeof(next->p[axis]));
+    polybezier(next->p[axis], next->duration, control_points, n);
+    traj->prefetch++;
+  } else if (traj->prefetch == V2_PREFETCH_PREPARE) {
+    uint8_t current = traj->current, other = !traj->current;
+    poly4d_prepare(&traj->pieces[other].prepared, next);
+    traj->pieces[other].duration = next->duration;
+    traj->pieces[other].t_begin_relative =
+      traj->pieces[current].t_begin_relative + traj->pieces[current].duration;
+    traj->prefetch = V2_PREFETCH_READY;
+  }
+}
+
+// Finishes decoding the next piece, if there is one
+static void v2_complete_prefetch(struct piecewise_traj_compressed_v2 *traj)
+{
+  while (traj->prefetch < V2_PREFETCH_READY) {
+    v2_prefetch_step(traj);
+  }
+}
+
+static void v2_rewind(struct piecewise_traj_compressed_v2 *traj)
+{
+  uint8_t axis;
+
+  v2_reader_init(&traj->reader, traj->data, traj->data_end, traj->data[1] & PPTRAJ_V2_FLAG_RICE);
+  for (axis = 0; axis < 4; axis++) {
+    traj->control_point[axis] = v2_read_signed(&traj->reader, axis);
+  }
+
+  // decode the first piece as if it followed an empty piece in slot 1
+  traj->current = 1;
+  traj->pieces[1].t_begin_relative = 0;
+  traj->pieces[1].duration = 0;
+  traj->prefetch = V2_PREFETCH_HEADER;
+  v2_complete_prefetch(traj);
+  traj->current = 0;
+
+  if (traj->prefetch == V2_PREFETCH_READY) {
+    traj->prefetch = V2_PREFETCH_HEADER;
+    v2_complete_prefetch(traj);
+  } else {
+    // no pieces at all, stay at the start point
+    memset(&traj->next, 0, sizeof(traj->next));
+    for (axis = 0; axis < 4; axis++) {
+      traj->next.p[axis][0] = traj->control_point[axis] * v2_unit_of_axis(traj, axis);
+    }
+    poly4d_prepare(&traj->pieces[0].prepared, &traj->next);
+    traj->pieces[0].t_begin_relative = 0;
+    traj->pieces[0].duration = 0;
+  }
+}
+
+// Walks through the whole trajectory; returns its duration in duration units,
+// or -1 if the data is broken
+static int64_t v2_validate(struct piecewise_traj_compressed_v2_reader *reader)
+{
+  uint64_t duration = 0;
+  uint32_t piece_duration;
+  uint8_t storage_types, axis, i, n;
+
+  for (axis = 0; axis < 4; axis++) {
+    v2_read_signed(reader, axis);
+  }
+
+  while (!reader->overrun) {
+    storage_types = v2_read_bits(reader, 8);
+    piece_duration = v2_read_unsigned(reader, V2_CONTEXT_DURATION);
+    if (piece_duration == 0) {
+      break;
+    }
+    duration += piece_duration;
+
+    for (axis = 0; axis < 4; axis++) {
+      n = control_points_by_type[(storage_types >> (2 * axis)) & 0x03];
+      for (i = 0; i < n; i++) {
+        v2_read_signed(reader, axis);
+      }
+    }
+  }
+
+  return reader->overrun ? -1 : (int64_t)duration;
+}
+
+static bool v2_header_is_valid(const uint8_t* bytes, uint32_t size)
+{
+  float unit;
+  uint8_t i;
+
+  if (size < V2_HEADER_SIZE || bytes[0] != PPTRAJ_V2_VERSION
+      || (bytes[1] & ~PPTRAJ_V2_FLAG_RICE)) {
+    return false;
+  }
+
+  // distance, angle and duration units
+  for (i = 0; i < 3; i++) {
+    memcpy(&unit, bytes + 2 + i * sizeof(float), sizeof(float));
+    if (!(unit > 0)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+float piecewise_compressed_v2_validate(const void* data, uint32_t size)
+{
+  struct piecewise_traj_compressed_v2_reader reader;
+  const uint8_t* bytes = data;
+  float duration_unit;
+  int64_t duration;
+
+  if (!v2_header_is_valid(bytes, size)) {
+    return -1;
+  }
+
+  v2_reader_init(&reader, bytes, bytes + size, bytes[1] & PPTRAJ_V2_FLAG_RICE);
+  duration = v2_validate(&reader);
+  if (duration < 0) {
+    return -1;
+  }
+
+  memcpy(&duration_unit, bytes + 10, sizeof(float));
+  return duration * duration_unit;
+}
+
+bool piecewise_compressed_v2_load(
+  struct piecewise_traj_compressed_v2 *traj, const void* data, uint32_t size, float timescale, float duration)
+{
+  const uint8_t* bytes = data;
+
+  // only the header is checked again, the pieces were checked by
+  // piecewise_compressed_v2_validate and the decoder stops at data_end
+  if (!v2_header_is_valid(bytes, size) || !(timescale > 0) || !(duration >= 0)) {
+    return false;
+  }
+
+  memcpy(&traj->distance_unit, bytes + 2, sizeof(float));
+  memcpy(&traj->angle_unit, bytes + 6, sizeof(float));
+  memcpy(&traj->duration_unit, bytes + 10, sizeof(float));
+
+  traj->t_begin = 0;
+  traj->timescale = timescale;
+  traj->duration = duration * timescale;
+  traj->shift = vzero();
+  traj->data = bytes;
+  traj->data_end = bytes + size;
+  v2_rewind(traj);
+
+  return true;
+}
+
+struct traj_eval piecewise_compressed_v2_eval(
+  struct piecewise_traj_compressed_v2 *traj, float t)
+{
+  struct traj_eval eval;
+  float t_begin_relative;
+
+  t -= traj->t_begin;
+
+  if (t < traj->pieces[traj->current].t_begin_relative
+      && traj->pieces[traj->current].t_begin_relative > 0) {
+    v2_rewind(traj);
+  }
+
+  while (t > traj->pieces[traj->current].t_begin_relative + traj->pieces[traj->current].duration) {
+    // normally the next piece is ready by now, unless the current one was short
+    v2_complete_prefetch(traj);
+    if (traj->prefetch != V2_PREFETCH_READY) {
+      // the trajectory has ended
+      eval = poly4d_eval_prepared(&traj->pieces[traj->current].prepared,
+        traj->pieces[traj->current].duration);
+      eval.pos = vadd(eval.pos, traj->shift);
+      eval.vel = vzero();
+      eval.acc = vzero();
+      eval.omega = vzero();
+      return eval;
+    }
+    traj->current = !traj->current;
+    traj->prefetch = V2_PREFETCH_HEADER;
+  }
+
+  t_begin_relative = traj->pieces[traj->current].t_begin_relative;
+  eval = poly4d_eval_prepared(&traj->pieces[traj->current].prepared, t - t_begin_relative);
+  eval.pos = vadd(eval.pos, traj->shift);
+
+  v2_prefetch_step(traj);
+
+  return eval;
+}
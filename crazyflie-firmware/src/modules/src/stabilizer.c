@@ -47,6 +47,7 @@
 #include "power_distribution.h"
 
 #include "estimator.h"
+#include "peer_localization.h"
 #include "usddeck.h"
 #include "quatcompress.h"
 #include "statsCnt.h"
@@ -273,6 +274,7 @@ static void stabilizerTask(void* param)
 
       stateEstimator(&state, &sensorData, &control, tick);
       compressState();
+      peerLocalizationSetOwnPosition(&state.position);
 
       commanderGetSetpoint(&setpoint, &state);
       compressSetpoint();
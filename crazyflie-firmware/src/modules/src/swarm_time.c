@@ -0,0 +1,240 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * swarm_time.c - Clock shared by the Crazyflies of a swarm
+ *
+ * The master broadcasts its clock in P2P beacons. The reception time of a
+ * beacon is taken by the radio link when the packet arrives from the nRF51,
+ * so the difference between the beacon time and the reception time is the
+ * clock offset plus the radio latency. All followers receive the same air
+ * frame, the latency is therefore mostly common to all of them; what varies
+ * is a delay added by the queues on both sides. A delay can only make a
+ * sample too small, so samples above the prediction are trusted more than
+ * samples below it.
+ */
+#define DEBUG_MODULE "SWARMTIME"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "FreeRTOS.h"
+#include "timers.h"
+#include "task.h"
+
+#include "swarm_time.h"
+#include "radiolink.h"
+#include "usec_time.h"
+#include "worker.h"
+#include "debug.h"
+#include "log.h"
+#include "param.h"
+
+#define BEACON_PERIOD M2T(100)
+// a follower is synchronized while beacons keep coming
+#define SYNC_TIMEOUT M2T(2000)
+// larger jumps are outliers, unless they persist, e.g. when the master reboots
+#define RESYNC_THRESHOLD_US 5000
+#define RESYNC_COUNT 3
+// filter gains for samples above (early) and below (late) the prediction
+#define GAIN_EARLY 0.5f
+#define GAIN_LATE 0.05f
+#define SKEW_GAIN 0.02f
+#define MAX_SKEW 200e-6f
+
+typedef struct {
+  uint8_t version;
+  uint64_t time; // swarm time of the master when sending [us]
+} __attribute__((packed)) swarmTimeBeacon_t;
+
+#define BEACON_VERSION 1
+
+static bool isInit = false;
+static uint8_t isMaster = 0;
+static uint16_t latencyUs = 0; // radio latency, added to the received beacon times
+
+// swarm time = local time + offsetRefUs + skew * (local time - localRefUs)
+static bool synchronized = false;
+static uint64_t localRefUs;
+static int64_t offsetRefUs;
+static float skew;
+static TickType_t lastBeaconTick;
+static int outlierCount;
+
+static uint32_t beaconRxCount;
+static uint32_t resyncCount;
+static float lastResidualUs;
+
+static StaticTimer_t timerBuffer;
+
+static void sendBeacon(void* arg)
+{
+  P2PPacket packet;
+  swarmTimeBeacon_t beacon;
+
+  beacon.version = BEACON_VERSION;
+  packet.port = SWARM_TIME_P2P_PORT;
+  packet.size = sizeof(beacon);
+  beacon.time = usecTimestamp();
+  memcpy(packet.data, &beacon, sizeof(beacon));
+  radiolinkSendP2PPacketBroadcast(&packet);
+}
+
+static void beaconTimer(xTimerHandle timer)
+{
+  if (isMaster) {
+    workerSchedule(sendBeacon, NULL);
+  }
+}
+
+static int64_t offsetAt(uint64_t localUs)
+{
+  return offsetRefUs + (int64_t)(skew * (float)(int64_t)(localUs - localRefUs));
+}
+
+static void handleBeacon(P2PPacket *p)
+{
+  swarmTimeBeacon_t beacon;
+  if (isMaster || p->size < sizeof(beacon)) {
+    return;
+  }
+  memcpy(&beacon, p->data, sizeof(beacon));
+  if (beacon.version != BEACON_VERSION) {
+    return;
+  }
+
+  const uint64_t rxUs = p->timestamp;
+  const int64_t sampleUs = (int64_t)(beacon.time + latencyUs) - (int64_t)rxUs;
+
+  taskENTER_CRITICAL();
+  const int64_t residualUs = sampleUs - offsetAt(rxUs);
+  const bool isOutlier = llabs(residualUs) > RESYNC_THRESHOLD_US;
+  if (swarmTimeIsSynchronized() && isOutlier && ++outlierCount < RESYNC_COUNT) {
+    taskEXIT_CRITICAL();
+    return;
+  }
+
+  if (!swarmTimeIsSynchronized() || isOutlier) {
+    offsetRefUs = sampleUs;
+    skew = 0;
+    resyncCount++;
+  } else {
+    const float residual = residualUs;
+    const float dt = (float)(int64_t)(rxUs - localRefUs);
+    const float gain = residual > 0 ? GAIN_EARLY : GAIN_LATE;
+    offsetRefUs = offsetAt(rxUs) + (int64_t)(gain * residual);
+    if (dt > 0) {
+      skew += SKEW_GAIN * gain * residual / dt;
+      if (skew > MAX_SKEW) {
+        skew = MAX_SKEW;
+      } else if (skew < -MAX_SKEW) {
+        skew = -MAX_SKEW;
+      }
+    }
+  }
+  outlierCount = 0;
+  localRefUs = rxUs;
+  lastBeaconTick = xTaskGetTickCount();
+  synchronized = true;
+  taskEXIT_CRITICAL();
+
+  lastResidualUs = residualUs;
+  beaconRxCount++;
+}
+
+void swarmTimeInit(void)
+{
+  if (isInit) {
+    return;
+  }
+
+  p2pRegisterPortCB(SWARM_TIME_P2P_PORT, handleBeacon);
+
+  xTimerHandle timer = xTimerCreateStatic("swarmTimeTimer", BEACON_PERIOD, pdTRUE, NULL, beaconTimer, &timerBuffer);
+  xTimerStart(timer, 100);
+
+  isInit = true;
+}
+
+bool swarmTimeTest(void)
+{
+  return isInit;
+}
+
+bool swarmTimeIsSynchronized(void)
+{
+  return isMaster || (synchronized && (xTaskGetTickCount() - lastBeaconTick) < SYNC_TIMEOUT);
+}
+
+uint64_t swarmTimeUsec(void)
+{
+  const uint64_t now = usecTimestamp();
+  if (isMaster || !synchronized) {
+    return now;
+  }
+
+  taskENTER_CRITICAL();
+  const uint64_t result = now + offsetAt(now);
+  taskEXIT_CRITICAL();
+  return result;
+}
+
+uint64_t swarmTimeToLocalUsec(uint64_t swarmTime)
+{
+  if (isMaster || !synchronized) {
+    return swarmTime;
+  }
+
+  // the offset hardly changes over the conversion, evaluate it at the estimate
+  taskENTER_CRITICAL();
+  const uint64_t estimate = swarmTime - offsetRefUs;
+  const uint64_t result = swarmTime - offsetAt(estimate);
+  taskEXIT_CRITICAL();
+  return result;
+}
+
+static uint32_t swarmTimeMs(uint32_t timestamp, void* data)
+{
+  return swarmTimeUsec() / 1000;
+}
+
+static uint8_t isSynchronized(uint32_t timestamp, void* data)
+{
+  return swarmTimeIsSynchronized();
+}
+
+static logByFunction_t swarmTimeMsLogger = {.acquireUInt32 = swarmTimeMs, .data = 0};
+static logByFunction_t synchronizedLogger = {.acquireUInt8 = isSynchronized, .data = 0};
+
+LOG_GROUP_START(swarmtime)
+LOG_ADD_BY_FUNCTION(LOG_UINT32, ms, &swarmTimeMsLogger)
+LOG_ADD_BY_FUNCTION(LOG_UINT8, synced, &synchronizedLogger)
+LOG_ADD(LOG_FLOAT, skew, &skew)
+LOG_ADD(LOG_FLOAT, residual, &lastResidualUs)
+LOG_ADD(LOG_UINT32, rxCount, &beaconRxCount)
+LOG_ADD(LOG_UINT32, resyncs, &resyncCount)
+LOG_GROUP_STOP(swarmtime)
+
+PARAM_GROUP_START(swarmtime)
+PARAM_ADD(PARAM_UINT8, master, &isMaster)
+PARAM_ADD(PARAM_UINT16, latency, &latencyUs)
+PARAM_GROUP_STOP(swarmtime)
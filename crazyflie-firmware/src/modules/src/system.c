@@ -65,6 +65,8 @@
 #include "deck.h"
 #include "extrx.h"
 #include "app.h"
+#include "swarm_time.h"
+#include "peer_localization.h"
 #include "static_mem.h"
 
 /* Private variable */
@@ -166,6 +168,8 @@ void systemTask(void *arg)
   systemInit();
   commInit();
   commanderInit();
+  swarmTimeInit();
+  peerLocalizationInit();
 
   StateEstimatorType estimator = anyEstimator;
   estimatorKalmanTaskInit();
@@ -188,6 +192,8 @@ void systemTask(void *arg)
   pass &= configblockTest();
   pass &= commTest();
   pass &= commanderTest();
+  pass &= swarmTimeTest();
+  pass &= peerLocalizationTest();
   pass &= stabilizerTest();
   pass &= estimatorKalmanTaskTest();
   pass &= deckTest();
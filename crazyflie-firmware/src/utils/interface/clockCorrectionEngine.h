@@ -10,6 +10,7 @@ typedef struct {
 } clockCorrectionStorage_t;
 
 double clockCorrectionEngineGet(const clockCorrectionStorage_t* storage);
+float clockCorrectionEngineGetQuality(const clockCorrectionStorage_t* storage);
 double clockCorrectionEngineCalculate(const uint64_t new_t_in_cl_reference, const uint64_t old_t_in_cl_reference, const uint64_t new_t_in_cl_x, const uint64_t old_t_in_cl_x, const uint64_t mask);
 bool clockCorrectionEngineUpdate(clockCorrectionStorage_t* storage, const double clockCorrectionCandidate);
 
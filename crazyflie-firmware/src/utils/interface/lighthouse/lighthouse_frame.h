@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LIGHTHOUSE_FRAME_LENGTH 7
+
+// Frame sent by the lighthouse deck for each pulse. Sync frames, all bytes
+// non-zero, are sent in between to allow finding the frame boundaries.
+typedef union lighthouseFrame_u {
+  struct {
+    uint32_t timestamp:29;
+    uint32_t sensor:3;
+    uint16_t width;
+    uint8_t sync;
+  } __attribute__((packed));
+  uint8_t data[LIGHTHOUSE_FRAME_LENGTH];
+} __attribute__((packed)) lighthouseFrame_t;
+
+typedef struct lighthouseFrameParser_s {
+  bool synchronized;
+  uint32_t resyncCount;
+} lighthouseFrameParser_t;
+
+/**
+ * @brief Reset the parser, the frame boundaries will be searched for again.
+ * Should be called when bytes have been lost in the stream.
+ *
+ * @param parser
+ */
+void lighthouseFrameParserReset(lighthouseFrameParser_t *parser);
+
+/**
+ * @brief Extract the next frame from a block of bytes received from the deck.
+ * Has no dependency on the OS or on the UART and can be used to replay a
+ * recorded stream.
+ *
+ * @param parser
+ * @param data Received bytes
+ * @param length Number of bytes in data
+ * @param index Position in data, updated past the consumed bytes. When no more
+ *              frames can be extracted the bytes from index and on must be kept
+ *              and prepended to the next block.
+ * @param frame (output) The frame. frame->sync is non-zero for sync frames
+ * @return true if a frame was written, false if more data is needed
+ */
+bool lighthouseFrameParse(lighthouseFrameParser_t *parser, const uint8_t *data, uint32_t length, uint32_t *index, lighthouseFrame_t *frame);
@@ -22,13 +22,14 @@ typedef struct baseStationEulerAngles_s {
 /**
  * @brief Find closest point between rays from two bases stations.
  *
- * @param baseStations - Geometry data for the two base statsions (position and orientation)
+ * @param baseStation1 - Geometry data for the first base station (position and orientation)
+ * @param baseStation2 - Geometry data for the second base station (position and orientation)
  * @param angles1 - array with 2 angles, horizontal and vertical sweep angle for base station 1
  * @param angles2 - array with 2 angles, horizontal and vertical sweep angle for base station 2
  * @param position - (output) the closest point between the rays
  * @param postion_delta - (output) the distance between the rays at the closest point
  */
-bool lighthouseGeometryGetPositionFromRayIntersection(baseStationGeometry_t baseStations[2], float angles1[2], float angles2[2], vec3d position, float *position_delta);
+bool lighthouseGeometryGetPositionFromRayIntersection(baseStationGeometry_t* baseStation1, baseStationGeometry_t* baseStation2, float angles1[2], float angles2[2], vec3d position, float *position_delta);
 
 /**
  * @brief Get the base station position from the base station geometry in world reference frame. This position can be seen as the
@@ -8,8 +8,25 @@
 #include "lighthouse_calibration.h"
 
 #define PULSE_PROCESSOR_N_SWEEPS 2
+
+// Max number of base stations and sensors handled. All per base station and
+// per sensor storage in the pulse processor, calibration, geometry and results
+// is sized from these, override them at build time to trade memory for coverage.
+#ifndef PULSE_PROCESSOR_N_BASE_STATIONS
 #define PULSE_PROCESSOR_N_BASE_STATIONS 2
+#endif
+#ifndef PULSE_PROCESSOR_N_SENSORS
 #define PULSE_PROCESSOR_N_SENSORS 4
+#endif
+
+// Lighthouse V1 identifies the base stations from the sync pulse slot, it needs two
+#if PULSE_PROCESSOR_N_BASE_STATIONS < 2
+#error "PULSE_PROCESSOR_N_BASE_STATIONS must be at least 2"
+#endif
+// The sensor id is 3 bits wide in the deck frames
+#if PULSE_PROCESSOR_N_SENSORS > 8
+#error "PULSE_PROCESSOR_N_SENSORS must be at most 8"
+#endif
 #define PULSE_PROCESSOR_HISTORY_LENGTH 8
 #define PULSE_PROCESSOR_TIMESTAMP_BITWIDTH 29
 #define PULSE_PROCESSOR_TIMESTAMP_MAX ((1<<PULSE_PROCESSOR_TIMESTAMP_BITWIDTH)-1)
@@ -50,15 +67,12 @@ typedef struct pulseProcessor_s {
   // Sync pulse timestamps
   uint32_t currentSync;   // Sync currently used for sweep phase measurement
   uint32_t currentSync0;  // Sync0 of the current frame
-  uint32_t currentSync0Width;  // Width of sync0 in the current frame
-  uint32_t currentSync1Width;  // Width of sync1 in the current frame
+  uint32_t currentSyncWidth[PULSE_PROCESSOR_N_BASE_STATIONS];  // Width of the syncs in the current frame
 
-  uint32_t currentSync0X;
-  uint32_t currentSync0Y;
-  uint32_t currentSync1X;
-  uint32_t currentSync1Y;
+  // Latest sync timestamp per base station and axis, used to measure the frame width
+  uint32_t syncTimestamps[PULSE_PROCESSOR_N_BASE_STATIONS][PULSE_PROCESSOR_N_SWEEPS];
 
-  float frameWidth[2][2];
+  float frameWidth[PULSE_PROCESSOR_N_BASE_STATIONS][PULSE_PROCESSOR_N_SWEEPS];
 
   // Base station and axis of the current frame
   int currentBaseStation;
@@ -71,8 +85,7 @@ typedef struct pulseProcessor_s {
   } sweeps[PULSE_PROCESSOR_N_SENSORS];
   bool sweepDataStored;
 
-  ootxDecoderState_t ootxDecoder0;
-  ootxDecoderState_t ootxDecoder1;
+  ootxDecoderState_t ootxDecoder[PULSE_PROCESSOR_N_BASE_STATIONS];
 
   lighthouseCalibration_t bsCalibration[PULSE_PROCESSOR_N_BASE_STATIONS];
 } pulseProcessor_t;
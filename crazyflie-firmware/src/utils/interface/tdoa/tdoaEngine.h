@@ -5,15 +5,27 @@
 #include "tdoaStats.h"
 
 typedef void (*tdoaEngineSendTdoaToEstimator)(tdoaMeasurement_t* tdoaMeasurement);
+typedef void (*tdoaEngineGetEstimatedPosition)(point_t* position);
+
+// Max number of TDoA measurements generated from one received packet
+#define TDOA_ENGINE_MAX_MEASUREMENTS_PER_PACKET 4
+
+typedef enum {
+  TdoaEngineMatchingAlgorithmRandom = 0, // Pick the first usable remote anchor, from a rotating start position (default)
+  TdoaEngineMatchingAlgorithmBest = 1,   // Pick the remote anchors with the best geometry, freshness and clock quality
+} tdoaEngineMatchingAlgorithm_t;
 
 typedef struct {
   // State
-  tdaoAnchorInfoArray_t anchorInfoArray;
+  tdoaAnchorStorage_t anchorStorage;
   tdoaStats_t stats;
 
   // Configuration
   tdoaEngineSendTdoaToEstimator sendTdoaToEstimator;
   double locodeckTsFreq;
+  tdoaEngineGetEstimatedPosition getEstimatedPosition; // Optional, used to score anchor pairs
+  uint8_t matchingAlgorithm; // tdoaEngineMatchingAlgorithm_t
+  uint8_t maxMeasurementsPerPacket;
 } tdoaEngineState_t;
 
 void tdoaEngineInit(tdoaEngineState_t* state, const uint32_t now_ms, tdoaEngineSendTdoaToEstimator sendTdoaToEstimator, const double locodeckTsFreq);
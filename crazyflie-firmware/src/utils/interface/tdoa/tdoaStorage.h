@@ -4,42 +4,102 @@
 #include "stabilizer_types.h"
 #include "clockCorrectionEngine.h"
 
-#define ANCHOR_STORAGE_COUNT 16
+#ifndef ANCHOR_STORAGE_COUNT
+#define ANCHOR_STORAGE_COUNT 64
+#endif
+
+// Max number of remote anchor data entries used by one anchor
 #define REMOTE_ANCHOR_DATA_COUNT 16
-#define TOF_PER_ANCHOR_COUNT 16
 
+// Remote anchor data entries shared by all anchors
+#ifndef REMOTE_ANCHOR_DATA_POOL_SIZE
+#define REMOTE_ANCHOR_DATA_POOL_SIZE 256
+#endif
+
+// Time of flight entries shared by all anchors, keyed by anchor pair. The
+// size is a power of two.
+// With the defaults tdoaAnchorStorage_t is 12768 bytes, the storage of 16
+// anchors with 16 remote data and tof entries each it replaced was 13440 bytes.
+#ifndef TOF_TABLE_SIZE_BITS
+#define TOF_TABLE_SIZE_BITS 8
+#endif
+#define TOF_TABLE_SIZE (1 << TOF_TABLE_SIZE_BITS)
+#define TOF_TABLE_MAX_PROBES 8
+
+// Slot index used in the id to slot map for anchors that are not in storage
+#define ANCHOR_STORAGE_NO_SLOT 0xff
+
+#if ANCHOR_STORAGE_COUNT >= ANCHOR_STORAGE_NO_SLOT
+#error "ANCHOR_STORAGE_COUNT must be smaller than ANCHOR_STORAGE_NO_SLOT"
+#endif
+
+// Index used in remote anchor data lists to mark the end of the list
+#define REMOTE_ANCHOR_DATA_NO_ENTRY 0xffff
+
+#if REMOTE_ANCHOR_DATA_POOL_SIZE >= REMOTE_ANCHOR_DATA_NO_ENTRY
+#error "REMOTE_ANCHOR_DATA_POOL_SIZE must be smaller than REMOTE_ANCHOR_DATA_NO_ENTRY"
+#endif
 
 typedef struct {
-  uint8_t id; // Id of remote remote anchor
-  uint8_t seqNr; // Sequence number of the packet received in the remote anchor (7 bits)
   int64_t rxTime; // Receive time of packet from anchor id in the remote anchor, in remote DWM clock
   uint32_t endOfLife;
+  uint16_t next; // Next entry in the list of the anchor, or in the free list
+  uint8_t id; // Id of remote remote anchor
+  uint8_t seqNr; // Sequence number of the packet received in the remote anchor (7 bits)
 } tdoaRemoteAnchorData_t;
 
 typedef struct {
-  uint8_t id;
   int64_t tof;
   uint32_t endOfLife; // Time stamp when the tof data is outdated, local system time in ms
+  uint16_t key; // Anchor id in the high byte, remote anchor id in the low byte
+  bool isUsed;
 } tdoaTimeOfFlight_t;
 
+// Members are ordered by alignment to avoid padding, there is one per anchor slot
 typedef struct {
-  bool isInitialized;
-  uint32_t lastUpdateTime; // The time when this anchor was updated the last time
-  uint8_t id; // Anchor id
-
   int64_t txTime; // Transmit time of last packet, in remote DWM clock
   int64_t rxTime; // Receive time of last packet, in local DWM clock
-  uint8_t seqNr; // Sequence nr of last packet (7 bits)
 
   clockCorrectionStorage_t clockCorrectionStorage;
 
   point_t position; // The coordinates of the anchor
 
-  tdoaTimeOfFlight_t tof[TOF_PER_ANCHOR_COUNT];
-  tdoaRemoteAnchorData_t remoteAnchorData[REMOTE_ANCHOR_DATA_COUNT];
+  uint32_t lastUpdateTime; // The time when this anchor was updated the last time
+  uint16_t remoteAnchorDataHead; // First entry in the remote anchor data pool
+  uint8_t remoteAnchorDataCount;
+  bool isInitialized;
+  uint8_t id; // Anchor id
+  uint8_t seqNr; // Sequence nr of last packet (7 bits)
 } tdoaAnchorInfo_t;
 
-typedef tdoaAnchorInfo_t tdaoAnchorInfoArray_t[ANCHOR_STORAGE_COUNT];
+typedef struct {
+  tdoaAnchorInfo_t anchorInfo[ANCHOR_STORAGE_COUNT];
+
+  // Maps an anchor id to its slot in anchorInfo, ANCHOR_STORAGE_NO_SLOT if not stored
+  uint8_t slotForId[256];
+
+  // Initialized slots are kept in a doubly linked list ordered by the time of
+  // the last rx/tx update, most recent first. The tail is the slot to evict.
+  uint8_t next[ANCHOR_STORAGE_COUNT];
+  uint8_t prev[ANCHOR_STORAGE_COUNT];
+  uint8_t mostRecent;
+  uint8_t leastRecent;
+
+  // Uninitialized slots, used before any anchor is evicted
+  uint8_t freeSlots[ANCHOR_STORAGE_COUNT];
+  uint8_t freeCount;
+
+  tdoaRemoteAnchorData_t remoteAnchorData[REMOTE_ANCHOR_DATA_POOL_SIZE];
+  uint16_t remoteAnchorDataFree; // First entry in the list of unused entries
+  uint16_t remoteAnchorDataInUse;
+
+  tdoaTimeOfFlight_t tof[TOF_TABLE_SIZE];
+
+  // Pool pressure statistics
+  uint32_t remoteAnchorDataReclaimCount; // Lists taken from other anchors when the pool is empty
+  uint32_t remoteAnchorDataDropCount; // Remote data that could not be stored
+  uint32_t tofEvictionCount; // Valid tof entries overwritten by other anchor pairs
+} tdoaAnchorStorage_t;
 
 
 // The anchor context is used to pass information about an anchor as well as
@@ -47,16 +107,17 @@ typedef tdoaAnchorInfo_t tdaoAnchorInfoArray_t[ANCHOR_STORAGE_COUNT];
 // The context should not be stored.
 typedef struct {
   tdoaAnchorInfo_t* anchorInfo;
+  tdoaAnchorStorage_t* anchorStorage;
   uint32_t currentTime_ms;
 } tdoaAnchorContext_t;
 
 
-void tdoaStorageInitialize(tdoaAnchorInfo_t anchorStorage[]);
+void tdoaStorageInitialize(tdoaAnchorStorage_t* anchorStorage);
 
-bool tdoaStorageGetCreateAnchorCtx(tdoaAnchorInfo_t anchorStorage[], const uint8_t anchor, const uint32_t currentTime_ms, tdoaAnchorContext_t* anchorCtx);
-bool tdoaStorageGetAnchorCtx(tdoaAnchorInfo_t anchorStorage[], const uint8_t anchor, const uint32_t currentTime_ms, tdoaAnchorContext_t* anchorCtx);
-uint8_t tdoaStorageGetListOfAnchorIds(tdoaAnchorInfo_t anchorStorage[], uint8_t unorderedAnchorList[], const int maxListSize);
-uint8_t tdoaStorageGetListOfActiveAnchorIds(tdoaAnchorInfo_t anchorStorage[], uint8_t unorderedAnchorList[], const int maxListSize, const uint32_t currentTime_ms);
+bool tdoaStorageGetCreateAnchorCtx(tdoaAnchorStorage_t* anchorStorage, const uint8_t anchor, const uint32_t currentTime_ms, tdoaAnchorContext_t* anchorCtx);
+bool tdoaStorageGetAnchorCtx(tdoaAnchorStorage_t* anchorStorage, const uint8_t anchor, const uint32_t currentTime_ms, tdoaAnchorContext_t* anchorCtx);
+uint8_t tdoaStorageGetListOfAnchorIds(tdoaAnchorStorage_t* anchorStorage, uint8_t unorderedAnchorList[], const int maxListSize);
+uint8_t tdoaStorageGetListOfActiveAnchorIds(tdoaAnchorStorage_t* anchorStorage, uint8_t unorderedAnchorList[], const int maxListSize, const uint32_t currentTime_ms);
 
 uint8_t tdoaStorageGetId(const tdoaAnchorContext_t* anchorCtx);
 int64_t tdoaStorageGetRxTime(const tdoaAnchorContext_t* anchorCtx);
@@ -75,6 +136,6 @@ int64_t tdoaStorageGetTimeOfFlight(const tdoaAnchorContext_t* anchorCtx, const u
 void tdoaStorageSetTimeOfFlight(tdoaAnchorContext_t* anchorCtx, const uint8_t remoteAnchor, const int64_t tof);
 
 // Mainly for test
-bool tdoaStorageIsAnchorInStorage(tdoaAnchorInfo_t anchorStorage[], const uint8_t anchor);
+bool tdoaStorageIsAnchorInStorage(tdoaAnchorStorage_t* anchorStorage, const uint8_t anchor);
 
 #endif // __TDOA_STORAGE_H__
@@ -33,6 +33,14 @@ double clockCorrectionEngineGet(const clockCorrectionStorage_t* storage) {
   return storage->clockCorrection;
 }
 
+/**
+ Obtains a measure of how well the clock correction is established, based on the fill level of the leaky bucket.
+ @return 0.0 when the clock correction was just (re)set, up to 1.0 when the last samples have been consistently within the accepted noise level
+ */
+float clockCorrectionEngineGetQuality(const clockCorrectionStorage_t* storage) {
+  return (float)storage->clockCorrectionBucket / CLOCK_CORRECTION_BUCKET_MAX;
+}
+
 /**
  Truncates a timestamp to the number of bits of the mask. This truncation ensures that the value returned is a valid time event, even if the time counter wrapped around.
  */
@@ -0,0 +1,110 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2019 Bitcraze AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * lighthouse_frame.c: parser for the pulse frame stream sent by the lighthouse deck
+ */
+
+#include <string.h>
+
+#include "lighthouse_frame.h"
+
+static bool isSyncFrame(const uint8_t *data)
+{
+  for (int i = 0; i < LIGHTHOUSE_FRAME_LENGTH; i++) {
+    if (data[i] == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns the offset of the first byte after a sync frame, or -1 if none
+static int findSync(const uint8_t *data, uint32_t length)
+{
+  int nonZeroCount = 0;
+  for (uint32_t i = 0; i < length; i++) {
+    if (data[i] != 0) {
+      nonZeroCount += 1;
+    } else {
+      nonZeroCount = 0;
+    }
+
+    if (nonZeroCount == LIGHTHOUSE_FRAME_LENGTH) {
+      return i + 1;
+    }
+  }
+  return -1;
+}
+
+void lighthouseFrameParserReset(lighthouseFrameParser_t *parser)
+{
+  parser->synchronized = false;
+}
+
+bool lighthouseFrameParse(lighthouseFrameParser_t *parser, const uint8_t *data, uint32_t length, uint32_t *index, lighthouseFrame_t *frame)
+{
+  while (*index < length) {
+    const uint8_t *start = &data[*index];
+    uint32_t remaining = length - *index;
+
+    if (!parser->synchronized) {
+      int syncOffset = findSync(start, remaining);
+      if (syncOffset < 0) {
+        // Keep the tail, it might be the beginning of a sync frame
+        if (remaining >= LIGHTHOUSE_FRAME_LENGTH) {
+          *index = length - LIGHTHOUSE_FRAME_LENGTH + 1;
+        }
+        return false;
+      }
+
+      parser->synchronized = true;
+      parser->resyncCount++;
+      *index += syncOffset;
+      memcpy(frame->data, &data[*index - LIGHTHOUSE_FRAME_LENGTH], LIGHTHOUSE_FRAME_LENGTH);
+      return true;
+    }
+
+    if (remaining < LIGHTHOUSE_FRAME_LENGTH) {
+      return false;
+    }
+
+    if (start[LIGHTHOUSE_FRAME_LENGTH - 1] != 0 && !isSyncFrame(start)) {
+      // Not a pulse frame, nor a sync frame. Scan again from the next byte
+      parser->synchronized = false;
+      *index += 1;
+      continue;
+    }
+
+    memcpy(frame->data, start, LIGHTHOUSE_FRAME_LENGTH);
+    *index += LIGHTHOUSE_FRAME_LENGTH;
+    return true;
+  }
+
+  return false;
+}
@@ -101,15 +101,15 @@ static bool intersect_lines(vec3d orig1, vec3d vec1, vec3d orig2, vec3d vec2, ve
     return true;
 }
 
-bool lighthouseGeometryGetPositionFromRayIntersection(baseStationGeometry_t baseStations[2], float angles1[2], float angles2[2], vec3d position, float *position_delta)
+bool lighthouseGeometryGetPositionFromRayIntersection(baseStationGeometry_t* baseStation1, baseStationGeometry_t* baseStation2, float angles1[2], float angles2[2], vec3d position, float *position_delta)
 {
     static vec3d ray1, ray2, origin1, origin2;
 
-    lighthouseGeometryGetRay(&baseStations[0], angles1[0], angles1[1], ray1);
-    lighthouseGeometryGetBaseStationPosition(&baseStations[0], origin1);
+    lighthouseGeometryGetRay(baseStation1, angles1[0], angles1[1], ray1);
+    lighthouseGeometryGetBaseStationPosition(baseStation1, origin1);
 
-    lighthouseGeometryGetRay(&baseStations[1], angles2[0], angles2[1], ray2);
-    lighthouseGeometryGetBaseStationPosition(&baseStations[1], origin2);
+    lighthouseGeometryGetRay(baseStation2, angles2[0], angles2[1], ray2);
+    lighthouseGeometryGetBaseStationPosition(baseStation2, origin2);
 
     return intersect_lines(origin1, ray1, origin2, ray2, position, position_delta);
 }
@@ -205,32 +205,15 @@ static bool processPreviousFrame(pulseProcessor_t *state, pulseProcessorResult_t
 }
 
 static void storeSyncData(pulseProcessor_t *state, int baseStation, unsigned int timestamp, unsigned int width) {
-  if (0 == baseStation) {
-    state->currentSync0 = timestamp;
-    state->currentSync0Width = width;
-    if (getAxis(width) == sweepDirection_x) {
-      uint32_t prevSync0X = state->currentSync0X;
-      state->currentSync0X = timestamp;
-      state->frameWidth[0][0] = TS_DIFF(state->currentSync0X, prevSync0X);
-    } else {
-      uint32_t prevSync0Y = state->currentSync0Y;
-      state->currentSync0Y = timestamp;
-      state->frameWidth[0][1] = TS_DIFF(state->currentSync0Y, prevSync0Y);
-    }
-  } else {
-    state->currentSync1Width = width;
-    if (getAxis(width) == sweepDirection_x) {
-      uint32_t prevSync1X = state->currentSync1X;
-      state->currentSync1X = timestamp;
-      state->frameWidth[1][0] = TS_DIFF(state->currentSync1X, prevSync1X);
-    } else {
-      uint32_t prevSync1Y = state->currentSync1Y;
-      state->currentSync1Y = timestamp;
-      state->frameWidth[1][1] = TS_DIFF(state->currentSync1Y, prevSync1Y);
-    }
+  SweepDirection axis = getAxis(width);
+  uint32_t prevSync = state->syncTimestamps[baseStation][axis];
 
-    state->currentSync0 = TS_DIFF(timestamp, SYNC_SEPARATION);
-  }
+  state->syncTimestamps[baseStation][axis] = timestamp;
+  state->frameWidth[baseStation][axis] = TS_DIFF(timestamp, prevSync);
+  state->currentSyncWidth[baseStation] = width;
+
+  // Syncs are sent in consecutive slots, starting with sync0
+  state->currentSync0 = TS_DIFF(timestamp, SYNC_SEPARATION * baseStation);
 
   state->lastSync = timestamp;
 
@@ -264,15 +247,17 @@ static void printBSInfo(struct ootxDataFrame_s *frame)
 }
 
 static void decodeAndApplyBaseStationCalibrationData(pulseProcessor_t *state) {
-  if (!state->bsCalibration[0].valid &&
-      ootxDecoderProcessBit(&state->ootxDecoder0, getOotxDataBit(state->currentSync0Width))) {
-    printBSInfo(&state->ootxDecoder0.frame);
-    lighthouseCalibrationInitFromFrame(&state->bsCalibration[0], &state->ootxDecoder0.frame);
-  }
-  if (!state->bsCalibration[1].valid &&
-      ootxDecoderProcessBit(&state->ootxDecoder1, getOotxDataBit(state->currentSync1Width))) {
-    printBSInfo(&state->ootxDecoder1.frame);
-    lighthouseCalibrationInitFromFrame(&state->bsCalibration[1], &state->ootxDecoder1.frame);
+  for (int bs = 0; bs < PULSE_PROCESSOR_N_BASE_STATIONS; bs++) {
+    // Skip base stations that have not been seen
+    if (state->currentSyncWidth[bs] == 0) {
+      continue;
+    }
+
+    if (!state->bsCalibration[bs].valid &&
+        ootxDecoderProcessBit(&state->ootxDecoder[bs], getOotxDataBit(state->currentSyncWidth[bs]))) {
+      printBSInfo(&state->ootxDecoder[bs].frame);
+      lighthouseCalibrationInitFromFrame(&state->bsCalibration[bs], &state->ootxDecoder[bs].frame);
+    }
   }
 }
 
@@ -289,7 +274,7 @@ static bool processSync(pulseProcessor_t *state, unsigned int timestamp, unsigne
 
       int baseStation = getBaseStationId(state, timestamp);
 
-      if (baseStation == 1 && state->basestationsSynchronizedCount < 2) {
+      if (baseStation > 0 && baseStation >= state->basestationsSynchronizedCount) {
         resetSynchronization(state);
       } else {
         storeSyncData(state, baseStation, timestamp, width);
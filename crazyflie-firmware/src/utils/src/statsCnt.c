@@ -26,7 +26,6 @@
  */
 
 #include "statsCnt.h"
-#include "debug.h"
 
 
 void statsCntRateCounterInit(statsCntRateCounter_t* counter, uint32_t averagingIntervalMs) {
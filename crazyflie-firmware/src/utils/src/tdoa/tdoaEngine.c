@@ -44,9 +44,7 @@ The implementation must handle
 */
 
 #include <string.h>
-
-#define DEBUG_MODULE "TDOA_ENGINE"
-#include "debug.h"
+#include <math.h>
 
 #include "tdoaEngine.h"
 #include "tdoaStats.h"
@@ -55,11 +53,19 @@ The implementation must handle
 
 #define MEASUREMENT_NOISE_STD 0.15f
 
+// Candidate scoring for the best matching algorithm
+#define FRESHNESS_TIME_CONSTANT_MS 10.0f
+#define MIN_ANCHOR_DISTANCE 0.01f
+
 void tdoaEngineInit(tdoaEngineState_t* engineState, const uint32_t now_ms, tdoaEngineSendTdoaToEstimator sendTdoaToEstimator, const double locodeckTsFreq) {
-  tdoaStorageInitialize(engineState->anchorInfoArray);
+  tdoaStorageInitialize(&engineState->anchorStorage);
   tdoaStatsInit(&engineState->stats, now_ms);
   engineState->sendTdoaToEstimator = sendTdoaToEstimator;
   engineState->locodeckTsFreq = locodeckTsFreq;
+
+  engineState->getEstimatedPosition = 0;
+  engineState->matchingAlgorithm = TdoaEngineMatchingAlgorithmRandom;
+  engineState->maxMeasurementsPerPacket = 1;
 }
 
 #define TRUNCATE_TO_ANCHOR_TS_BITMAP 0x00FFFFFFFF
@@ -72,7 +78,9 @@ static void enqueueTDOA(const tdoaAnchorContext_t* anchorACtx, const tdoaAnchorC
 
   tdoaMeasurement_t tdoa = {
     .stdDev = MEASUREMENT_NOISE_STD,
-    .distanceDiff = distanceDiff
+    .distanceDiff = distanceDiff,
+    .anchorId[0] = tdoaStorageGetId(anchorACtx),
+    .anchorId[1] = tdoaStorageGetId(anchorBCtx),
   };
 
   if (tdoaStorageGetAnchorPosition(anchorACtx, &tdoa.anchorPosition[0]) && tdoaStorageGetAnchorPosition(anchorBCtx, &tdoa.anchorPosition[1])) {
@@ -131,40 +139,163 @@ static double calcDistanceDiff(const tdoaAnchorContext_t* otherAnchorCtx, const
   return SPEED_OF_LIGHT * tdoa / locodeckTsFreq;
 }
 
-static bool findSuitableAnchor(tdoaEngineState_t* engineState, tdoaAnchorContext_t* otherAnchorCtx, const tdoaAnchorContext_t* anchorCtx) {
-  static uint8_t seqNr[REMOTE_ANCHOR_DATA_COUNT];
-  static uint8_t id[REMOTE_ANCHOR_DATA_COUNT];
-  static uint8_t offset = 0;
+// Pick the first candidates that are useful.
+// An offset (updated for each call) is added to make sure we start at
+// different positions in the list and vary which candidate to choose
+static int findFirstSuitableAnchors(tdoaEngineState_t* engineState, tdoaAnchorContext_t otherAnchorCtx[], const int maxCount, const tdoaAnchorContext_t* anchorCtx, const int remoteCount, const uint8_t seqNr[], const uint8_t id[], const uint8_t offset) {
+  uint32_t now_ms = anchorCtx->currentTime_ms;
+  int count = 0;
 
-  if (tdoaStorageGetClockCorrection(anchorCtx) <= 0.0) {
-    return false;
+  for (int i = offset; i < (remoteCount + offset) && count < maxCount; i++) {
+    uint8_t index = i % remoteCount;
+    const uint8_t candidateAnchorId = id[index];
+    tdoaAnchorContext_t* candidateCtx = &otherAnchorCtx[count];
+    // Only look up candidates, creating one could evict an already selected candidate
+    if (tdoaStorageGetAnchorCtx(&engineState->anchorStorage, candidateAnchorId, now_ms, candidateCtx)) {
+      if (seqNr[index] == tdoaStorageGetSeqNr(candidateCtx) && tdoaStorageGetTimeOfFlight(anchorCtx, candidateAnchorId)) {
+        count++;
+      }
+    }
   }
 
-  offset++;
-  int remoteCount = 0;
-  tdoaStorageGetRemoteSeqNrList(anchorCtx, &remoteCount, seqNr, id);
+  return count;
+}
+
+// The information in a TDoA measurement is proportional to the squared norm
+// of its gradient with respect to the tag position, that is the difference of
+// the unit vectors from the two anchors to the tag. It is 0 when the anchors
+// are in the same direction and 4 when the tag is between them.
+static float calcGeometryScore(const point_t* anchorPosition, const point_t* otherAnchorPosition, const point_t* estimatedPosition) {
+  const float dxA = estimatedPosition->x - anchorPosition->x;
+  const float dyA = estimatedPosition->y - anchorPosition->y;
+  const float dzA = estimatedPosition->z - anchorPosition->z;
+  const float dxB = estimatedPosition->x - otherAnchorPosition->x;
+  const float dyB = estimatedPosition->y - otherAnchorPosition->y;
+  const float dzB = estimatedPosition->z - otherAnchorPosition->z;
+
+  const float distA = sqrtf(dxA * dxA + dyA * dyA + dzA * dzA);
+  const float distB = sqrtf(dxB * dxB + dyB * dyB + dzB * dzB);
+  if (distA < MIN_ANCHOR_DISTANCE || distB < MIN_ANCHOR_DISTANCE) {
+    return 1.0f;
+  }
+
+  const float gx = dxA / distA - dxB / distB;
+  const float gy = dyA / distA - dyB / distB;
+  const float gz = dzA / distA - dzB / distB;
+
+  return gx * gx + gy * gy + gz * gz;
+}
+
+static float scoreCandidate(const tdoaAnchorContext_t* anchorCtx, const point_t* anchorPosition, const tdoaAnchorContext_t* otherAnchorCtx, const point_t* otherAnchorPosition, const point_t* estimatedPosition) {
+  float geometryScore = 1.0f;
+  if (estimatedPosition) {
+    geometryScore = calcGeometryScore(anchorPosition, otherAnchorPosition, estimatedPosition);
+  }
+
+  // The remote anchor packet is older than the current one and the tag clock
+  // has drifted more the longer ago it was received
+  const uint32_t age_ms = anchorCtx->currentTime_ms - tdoaStorageGetLastUpdateTime(otherAnchorCtx);
+  const float freshnessScore = 1.0f / (1.0f + age_ms / FRESHNESS_TIME_CONSTANT_MS);
+
+  const float clockQuality = clockCorrectionEngineGetQuality(tdoaStorageGetClockCorrectionStorage(otherAnchorCtx));
+  const float clockScore = 0.5f + 0.5f * clockQuality;
+
+  return geometryScore * freshnessScore * clockScore;
+}
+
+// Pick the candidates with the highest scores, ties are resolved by the
+// rotating offset
+static int findBestSuitableAnchors(tdoaEngineState_t* engineState, tdoaAnchorContext_t otherAnchorCtx[], const int maxCount, const tdoaAnchorContext_t* anchorCtx, const int remoteCount, const uint8_t seqNr[], const uint8_t id[], const uint8_t offset) {
+  point_t anchorPosition;
+  if (!tdoaStorageGetAnchorPosition(anchorCtx, &anchorPosition)) {
+    return 0;
+  }
+
+  point_t estimatedPosition;
+  const point_t* estimatedPositionPtr = 0;
+  if (engineState->getEstimatedPosition) {
+    engineState->getEstimatedPosition(&estimatedPosition);
+    estimatedPositionPtr = &estimatedPosition;
+  }
 
   uint32_t now_ms = anchorCtx->currentTime_ms;
+  float scores[TDOA_ENGINE_MAX_MEASUREMENTS_PER_PACKET];
+  int count = 0;
 
-  // Loop over the candidates and pick the first one that is useful
-  // An offset (updated for each call) is added to make sure we start at
-  // different positions in the list and vary which candidate to choose
   for (int i = offset; i < (remoteCount + offset); i++) {
     uint8_t index = i % remoteCount;
     const uint8_t candidateAnchorId = id[index];
-    if (tdoaStorageGetCreateAnchorCtx(engineState->anchorInfoArray, candidateAnchorId, now_ms, otherAnchorCtx)) {
-      if (seqNr[index] == tdoaStorageGetSeqNr(otherAnchorCtx) && tdoaStorageGetTimeOfFlight(anchorCtx, candidateAnchorId)) {
-        return true;
+
+    // Only look up candidates, an anchor that is not in storage has no rx data
+    // and creating it could evict one of the selected candidates
+    tdoaAnchorContext_t candidateCtx;
+    if (!tdoaStorageGetAnchorCtx(&engineState->anchorStorage, candidateAnchorId, now_ms, &candidateCtx)) {
+      continue;
+    }
+
+    if (seqNr[index] != tdoaStorageGetSeqNr(&candidateCtx) || !tdoaStorageGetTimeOfFlight(anchorCtx, candidateAnchorId)) {
+      continue;
+    }
+
+    point_t candidatePosition;
+    if (!tdoaStorageGetAnchorPosition(&candidateCtx, &candidatePosition)) {
+      continue;
+    }
+
+    const float score = scoreCandidate(anchorCtx, &anchorPosition, &candidateCtx, &candidatePosition, estimatedPositionPtr);
+
+    // Insert into the list of selected candidates, sorted by score
+    int pos = count;
+    while (pos > 0 && scores[pos - 1] < score) {
+      if (pos < maxCount) {
+        scores[pos] = scores[pos - 1];
+        otherAnchorCtx[pos] = otherAnchorCtx[pos - 1];
+      }
+      pos--;
+    }
+
+    if (pos < maxCount) {
+      scores[pos] = score;
+      otherAnchorCtx[pos] = candidateCtx;
+      if (count < maxCount) {
+        count++;
       }
     }
   }
 
-  otherAnchorCtx->anchorInfo = 0;
-  return false;
+  return count;
+}
+
+static int findSuitableAnchors(tdoaEngineState_t* engineState, tdoaAnchorContext_t otherAnchorCtx[], const tdoaAnchorContext_t* anchorCtx) {
+  static uint8_t seqNr[REMOTE_ANCHOR_DATA_COUNT];
+  static uint8_t id[REMOTE_ANCHOR_DATA_COUNT];
+  static uint8_t offset = 0;
+
+  if (tdoaStorageGetClockCorrection(anchorCtx) <= 0.0) {
+    return 0;
+  }
+
+  offset++;
+  int remoteCount = 0;
+  tdoaStorageGetRemoteSeqNrList(anchorCtx, &remoteCount, seqNr, id);
+
+  int maxCount = engineState->maxMeasurementsPerPacket;
+  if (maxCount < 1) {
+    maxCount = 1;
+  }
+  if (maxCount > TDOA_ENGINE_MAX_MEASUREMENTS_PER_PACKET) {
+    maxCount = TDOA_ENGINE_MAX_MEASUREMENTS_PER_PACKET;
+  }
+
+  if (engineState->matchingAlgorithm == TdoaEngineMatchingAlgorithmBest) {
+    return findBestSuitableAnchors(engineState, otherAnchorCtx, maxCount, anchorCtx, remoteCount, seqNr, id, offset);
+  } else {
+    return findFirstSuitableAnchors(engineState, otherAnchorCtx, maxCount, anchorCtx, remoteCount, seqNr, id, offset);
+  }
 }
 
 void tdoaEngineGetAnchorCtxForPacketProcessing(tdoaEngineState_t* engineState, const uint8_t anchorId, const uint32_t currentTime_ms, tdoaAnchorContext_t* anchorCtx) {
-  if (tdoaStorageGetCreateAnchorCtx(engineState->anchorInfoArray, anchorId, currentTime_ms, anchorCtx)) {
+  if (tdoaStorageGetCreateAnchorCtx(&engineState->anchorStorage, anchorId, currentTime_ms, anchorCtx)) {
     STATS_CNT_RATE_EVENT(&engineState->stats.contextHitCount);
   } else {
     STATS_CNT_RATE_EVENT(&engineState->stats.contextMissCount);
@@ -176,11 +307,15 @@ void tdoaEngineProcessPacket(tdoaEngineState_t* engineState, tdoaAnchorContext_t
   if (timeIsGood) {
     STATS_CNT_RATE_EVENT(&engineState->stats.timeIsGood);
 
-    tdoaAnchorContext_t otherAnchorCtx;
-    if (findSuitableAnchor(engineState, &otherAnchorCtx, anchorCtx)) {
+    tdoaAnchorContext_t otherAnchorCtx[TDOA_ENGINE_MAX_MEASUREMENTS_PER_PACKET];
+    const int count = findSuitableAnchors(engineState, otherAnchorCtx, anchorCtx);
+    if (count > 0) {
       STATS_CNT_RATE_EVENT(&engineState->stats.suitableDataFound);
-      double tdoaDistDiff = calcDistanceDiff(&otherAnchorCtx, anchorCtx, txAn_in_cl_An, rxAn_by_T_in_cl_T, engineState->locodeckTsFreq);
-      enqueueTDOA(&otherAnchorCtx, anchorCtx, tdoaDistDiff, engineState);
+    }
+
+    for (int i = 0; i < count; i++) {
+      double tdoaDistDiff = calcDistanceDiff(&otherAnchorCtx[i], anchorCtx, txAn_in_cl_An, rxAn_by_T_in_cl_T, engineState->locodeckTsFreq);
+      enqueueTDOA(&otherAnchorCtx[i], anchorCtx, tdoaDistDiff, engineState);
     }
   }
 }
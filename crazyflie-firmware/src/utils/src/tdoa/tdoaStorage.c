@@ -30,9 +30,6 @@ Data storage encapsulation for the TDoA engine
 
 #include <string.h>
 
-#define DEBUG_MODULE "TDOA_STORAGE"
-#include "debug.h"
-
 #include "tdoaStorage.h"
 
 // All times in milli seconds
@@ -42,70 +39,84 @@ Data storage encapsulation for the TDoA engine
 #define ANCHOR_ACTIVE_VALIDITY_PERIOD (2 * 1000)
 
 
-static tdoaAnchorInfo_t* initializeSlot(tdoaAnchorInfo_t anchorStorage[], const uint8_t slot, const uint8_t anchor);
+static tdoaAnchorInfo_t* initializeSlot(tdoaAnchorStorage_t* anchorStorage, const uint8_t slot, const uint8_t anchor);
+static void unlinkSlot(tdoaAnchorStorage_t* anchorStorage, const uint8_t slot);
+static void linkSlotAsMostRecent(tdoaAnchorStorage_t* anchorStorage, const uint8_t slot);
+static void linkSlotAsLeastRecent(tdoaAnchorStorage_t* anchorStorage, const uint8_t slot);
+static uint16_t allocateRemoteAnchorData(tdoaAnchorStorage_t* anchorStorage, tdoaAnchorInfo_t* anchorInfo);
+static void releaseRemoteAnchorData(tdoaAnchorStorage_t* anchorStorage, tdoaAnchorInfo_t* anchorInfo);
+static tdoaTimeOfFlight_t* getTofEntry(tdoaAnchorStorage_t* anchorStorage, const uint16_t key);
 
-void tdoaStorageInitialize(tdoaAnchorInfo_t anchorStorage[]) {
-  memset(anchorStorage, 0, sizeof(tdoaAnchorInfo_t) * ANCHOR_STORAGE_COUNT);
-}
+void tdoaStorageInitialize(tdoaAnchorStorage_t* anchorStorage) {
+  memset(anchorStorage, 0, sizeof(tdoaAnchorStorage_t));
+  memset(anchorStorage->slotForId, ANCHOR_STORAGE_NO_SLOT, sizeof(anchorStorage->slotForId));
 
-bool tdoaStorageGetCreateAnchorCtx(tdoaAnchorInfo_t anchorStorage[], const uint8_t anchor, const uint32_t currentTime_ms, tdoaAnchorContext_t* anchorCtx) {
-  anchorCtx->currentTime_ms = currentTime_ms;
-  uint32_t oldestUpdateTime = currentTime_ms;
-  int firstUninitializedSlot = -1;
-  int oldestSlot = 0;
+  anchorStorage->mostRecent = ANCHOR_STORAGE_NO_SLOT;
+  anchorStorage->leastRecent = ANCHOR_STORAGE_NO_SLOT;
 
+  // Hand out the free slots in ascending order
   for (int i = 0; i < ANCHOR_STORAGE_COUNT; i++) {
-    if (anchorStorage[i].isInitialized) {
-      if (anchor == anchorStorage[i].id) {
-        anchorCtx->anchorInfo = &anchorStorage[i];
-        return true;
-      }
+    anchorStorage->freeSlots[i] = ANCHOR_STORAGE_COUNT - 1 - i;
+  }
+  anchorStorage->freeCount = ANCHOR_STORAGE_COUNT;
 
-      if (anchorStorage[i].lastUpdateTime < oldestUpdateTime) {
-        oldestUpdateTime = anchorStorage[i].lastUpdateTime;
-        oldestSlot = i;
-      }
-    } else {
-      if (firstUninitializedSlot == -1) {
-        firstUninitializedSlot = i;
-      }
-    }
+  for (int i = 0; i < ANCHOR_STORAGE_COUNT; i++) {
+    anchorStorage->anchorInfo[i].remoteAnchorDataHead = REMOTE_ANCHOR_DATA_NO_ENTRY;
   }
 
-  // The anchor was not found in storage
-  tdoaAnchorInfo_t* newAnchorInfo = 0;
-  if (firstUninitializedSlot != -1) {
-    newAnchorInfo = initializeSlot(anchorStorage, firstUninitializedSlot, anchor);
+  for (int i = 0; i < REMOTE_ANCHOR_DATA_POOL_SIZE; i++) {
+    anchorStorage->remoteAnchorData[i].next = i + 1;
+  }
+  anchorStorage->remoteAnchorData[REMOTE_ANCHOR_DATA_POOL_SIZE - 1].next = REMOTE_ANCHOR_DATA_NO_ENTRY;
+  anchorStorage->remoteAnchorDataFree = 0;
+}
+
+bool tdoaStorageGetCreateAnchorCtx(tdoaAnchorStorage_t* anchorStorage, const uint8_t anchor, const uint32_t currentTime_ms, tdoaAnchorContext_t* anchorCtx) {
+  anchorCtx->currentTime_ms = currentTime_ms;
+  anchorCtx->anchorStorage = anchorStorage;
+
+  const uint8_t slot = anchorStorage->slotForId[anchor];
+  if (slot != ANCHOR_STORAGE_NO_SLOT) {
+    anchorCtx->anchorInfo = &anchorStorage->anchorInfo[slot];
+    return true;
+  }
+
+  // The anchor was not found in storage, use a free slot if there is one,
+  // otherwise evict the anchor that was least recently updated
+  uint8_t newSlot;
+  if (anchorStorage->freeCount > 0) {
+    anchorStorage->freeCount--;
+    newSlot = anchorStorage->freeSlots[anchorStorage->freeCount];
   } else {
-    newAnchorInfo = initializeSlot(anchorStorage, oldestSlot, anchor);
+    newSlot = anchorStorage->leastRecent;
+    unlinkSlot(anchorStorage, newSlot);
+    anchorStorage->slotForId[anchorStorage->anchorInfo[newSlot].id] = ANCHOR_STORAGE_NO_SLOT;
   }
 
-  anchorCtx->anchorInfo = newAnchorInfo;
+  anchorCtx->anchorInfo = initializeSlot(anchorStorage, newSlot, anchor);
   return false;
 }
 
-bool tdoaStorageGetAnchorCtx(tdoaAnchorInfo_t anchorStorage[], const uint8_t anchor, const uint32_t currentTime_ms, tdoaAnchorContext_t* anchorCtx) {
+bool tdoaStorageGetAnchorCtx(tdoaAnchorStorage_t* anchorStorage, const uint8_t anchor, const uint32_t currentTime_ms, tdoaAnchorContext_t* anchorCtx) {
   anchorCtx->currentTime_ms = currentTime_ms;
+  anchorCtx->anchorStorage = anchorStorage;
 
-  for (int i = 0; i < ANCHOR_STORAGE_COUNT; i++) {
-    if (anchorStorage[i].isInitialized) {
-      if (anchor == anchorStorage[i].id) {
-        anchorCtx->anchorInfo = &anchorStorage[i];
-        return true;
-      }
-    }
+  const uint8_t slot = anchorStorage->slotForId[anchor];
+  if (slot != ANCHOR_STORAGE_NO_SLOT) {
+    anchorCtx->anchorInfo = &anchorStorage->anchorInfo[slot];
+    return true;
   }
 
   anchorCtx->anchorInfo = 0;
   return false;
 }
 
-uint8_t tdoaStorageGetListOfAnchorIds(tdoaAnchorInfo_t anchorStorage[], uint8_t unorderedAnchorList[], const int maxListSize) {
+uint8_t tdoaStorageGetListOfAnchorIds(tdoaAnchorStorage_t* anchorStorage, uint8_t unorderedAnchorList[], const int maxListSize) {
   int count = 0;
 
   for (int i = 0; i < ANCHOR_STORAGE_COUNT && count < maxListSize; i++) {
-    if (anchorStorage[i].isInitialized) {
-      unorderedAnchorList[count] = anchorStorage[i].id;
+    if (anchorStorage->anchorInfo[i].isInitialized) {
+      unorderedAnchorList[count] = anchorStorage->anchorInfo[i].id;
       count++;
     }
   }
@@ -113,13 +124,14 @@ uint8_t tdoaStorageGetListOfAnchorIds(tdoaAnchorInfo_t anchorStorage[], uint8_t
   return count;
 }
 
-uint8_t tdoaStorageGetListOfActiveAnchorIds(tdoaAnchorInfo_t anchorStorage[], uint8_t unorderedAnchorList[], const int maxListSize, const uint32_t currentTime_ms) {
+uint8_t tdoaStorageGetListOfActiveAnchorIds(tdoaAnchorStorage_t* anchorStorage, uint8_t unorderedAnchorList[], const int maxListSize, const uint32_t currentTime_ms) {
   int count = 0;
 
   const uint32_t expiryTime = currentTime_ms - ANCHOR_ACTIVE_VALIDITY_PERIOD;
   for (int i = 0; i < ANCHOR_STORAGE_COUNT && count < maxListSize; i++) {
-    if (anchorStorage[i].isInitialized && anchorStorage[i].lastUpdateTime > expiryTime) {
-      unorderedAnchorList[count] = anchorStorage[i].id;
+    const tdoaAnchorInfo_t* anchorInfo = &anchorStorage->anchorInfo[i];
+    if (anchorInfo->isInitialized && anchorInfo->lastUpdateTime > expiryTime) {
+      unorderedAnchorList[count] = anchorInfo->id;
       count++;
     }
   }
@@ -185,6 +197,13 @@ void tdoaStorageSetRxTxData(tdoaAnchorContext_t* anchorCtx, int64_t rxTime, int6
   anchorInfo->txTime = txTime;
   anchorInfo->seqNr = seqNr;
   anchorInfo->lastUpdateTime = now;
+
+  tdoaAnchorStorage_t* anchorStorage = anchorCtx->anchorStorage;
+  const uint8_t slot = anchorInfo - anchorStorage->anchorInfo;
+  if (anchorStorage->mostRecent != slot) {
+    unlinkSlot(anchorStorage, slot);
+    linkSlotAsMostRecent(anchorStorage, slot);
+  }
 }
 
 double tdoaStorageGetClockCorrection(const tdoaAnchorContext_t* anchorCtx) {
@@ -193,12 +212,13 @@ double tdoaStorageGetClockCorrection(const tdoaAnchorContext_t* anchorCtx) {
 
 int64_t tdoaStorageGetRemoteRxTime(const tdoaAnchorContext_t* anchorCtx, const uint8_t remoteAnchor) {
   const tdoaAnchorInfo_t* anchorInfo = anchorCtx->anchorInfo;
+  const tdoaRemoteAnchorData_t* pool = anchorCtx->anchorStorage->remoteAnchorData;
 
-  for (int i = 0; i < REMOTE_ANCHOR_DATA_COUNT; i++) {
-    if (remoteAnchor == anchorInfo->remoteAnchorData[i].id) {
+  for (uint16_t i = anchorInfo->remoteAnchorDataHead; i != REMOTE_ANCHOR_DATA_NO_ENTRY; i = pool[i].next) {
+    if (remoteAnchor == pool[i].id) {
       uint32_t now = anchorCtx->currentTime_ms;
-      if (anchorInfo->remoteAnchorData[i].endOfLife > now) {
-        return anchorInfo->remoteAnchorData[i].rxTime;
+      if (pool[i].endOfLife > now) {
+        return pool[i].rxTime;
       }
       break;
     }
@@ -209,39 +229,58 @@ int64_t tdoaStorageGetRemoteRxTime(const tdoaAnchorContext_t* anchorCtx, const u
 
 void tdoaStorageSetRemoteRxTime(tdoaAnchorContext_t* anchorCtx, const uint8_t remoteAnchor, const int64_t remoteRxTime, const uint8_t remoteSeqNr) {
   tdoaAnchorInfo_t* anchorInfo = anchorCtx->anchorInfo;
+  tdoaAnchorStorage_t* anchorStorage = anchorCtx->anchorStorage;
+  tdoaRemoteAnchorData_t* pool = anchorStorage->remoteAnchorData;
 
-  int indexToUpdate = 0;
+  uint16_t indexToUpdate = REMOTE_ANCHOR_DATA_NO_ENTRY;
+  uint16_t oldestIndex = REMOTE_ANCHOR_DATA_NO_ENTRY;
   uint32_t now = anchorCtx->currentTime_ms;
   uint32_t oldestTime = 0xFFFFFFFF;
 
-  for (int i = 0; i < REMOTE_ANCHOR_DATA_COUNT; i++) {
-    if (remoteAnchor == anchorInfo->remoteAnchorData[i].id) {
+  for (uint16_t i = anchorInfo->remoteAnchorDataHead; i != REMOTE_ANCHOR_DATA_NO_ENTRY; i = pool[i].next) {
+    if (remoteAnchor == pool[i].id) {
       indexToUpdate = i;
       break;
     }
 
-    if (anchorInfo->remoteAnchorData[i].endOfLife < oldestTime) {
-      oldestTime = anchorInfo->remoteAnchorData[i].endOfLife;
-      indexToUpdate = i;
+    if (pool[i].endOfLife < oldestTime) {
+      oldestTime = pool[i].endOfLife;
+      oldestIndex = i;
     }
   }
 
-  anchorInfo->remoteAnchorData[indexToUpdate].id = remoteAnchor;
-  anchorInfo->remoteAnchorData[indexToUpdate].rxTime = remoteRxTime;
-  anchorInfo->remoteAnchorData[indexToUpdate].seqNr = remoteSeqNr;
-  anchorInfo->remoteAnchorData[indexToUpdate].endOfLife = now + REMOTE_DATA_VALIDITY_PERIOD;
+  if (indexToUpdate == REMOTE_ANCHOR_DATA_NO_ENTRY) {
+    if (anchorInfo->remoteAnchorDataCount < REMOTE_ANCHOR_DATA_COUNT) {
+      indexToUpdate = allocateRemoteAnchorData(anchorStorage, anchorInfo);
+    }
+
+    if (indexToUpdate == REMOTE_ANCHOR_DATA_NO_ENTRY) {
+      indexToUpdate = oldestIndex;
+    }
+
+    if (indexToUpdate == REMOTE_ANCHOR_DATA_NO_ENTRY) {
+      anchorStorage->remoteAnchorDataDropCount++;
+      return;
+    }
+  }
+
+  pool[indexToUpdate].id = remoteAnchor;
+  pool[indexToUpdate].rxTime = remoteRxTime;
+  pool[indexToUpdate].seqNr = remoteSeqNr;
+  pool[indexToUpdate].endOfLife = now + REMOTE_DATA_VALIDITY_PERIOD;
 }
 
 void tdoaStorageGetRemoteSeqNrList(const tdoaAnchorContext_t* anchorCtx, int* remoteCount, uint8_t seqNr[], uint8_t id[]) {
   const tdoaAnchorInfo_t* anchorInfo = anchorCtx->anchorInfo;
+  const tdoaRemoteAnchorData_t* pool = anchorCtx->anchorStorage->remoteAnchorData;
   uint32_t now = anchorCtx->currentTime_ms;
 
   int count = 0;
 
-  for (int i = 0; i < REMOTE_ANCHOR_DATA_COUNT; i++) {
-    if (anchorInfo->remoteAnchorData[i].endOfLife > now) {
-      id[count] = anchorInfo->remoteAnchorData[i].id;
-      seqNr[count] = anchorInfo->remoteAnchorData[i].seqNr;
+  for (uint16_t i = anchorInfo->remoteAnchorDataHead; i != REMOTE_ANCHOR_DATA_NO_ENTRY; i = pool[i].next) {
+    if (pool[i].endOfLife > now) {
+      id[count] = pool[i].id;
+      seqNr[count] = pool[i].seqNr;
       count++;
     }
   }
@@ -250,15 +289,13 @@ void tdoaStorageGetRemoteSeqNrList(const tdoaAnchorContext_t* anchorCtx, int* re
 }
 
 int64_t tdoaStorageGetTimeOfFlight(const tdoaAnchorContext_t* anchorCtx, const uint8_t otherAnchor) {
-  const tdoaAnchorInfo_t* anchorInfo = anchorCtx->anchorInfo;
+  const uint16_t key = (anchorCtx->anchorInfo->id << 8) | otherAnchor;
+  const tdoaTimeOfFlight_t* entry = getTofEntry(anchorCtx->anchorStorage, key);
 
-  for (int i = 0; i < TOF_PER_ANCHOR_COUNT; i++) {
-    if (otherAnchor == anchorInfo->tof[i].id) {
-      uint32_t now = anchorCtx->currentTime_ms;
-      if (anchorInfo->tof[i].endOfLife > now) {
-        return anchorInfo->tof[i].tof;
-      }
-      break;
+  if (entry->isUsed && entry->key == key) {
+    uint32_t now = anchorCtx->currentTime_ms;
+    if (entry->endOfLife > now) {
+      return entry->tof;
     }
   }
 
@@ -266,45 +303,151 @@ int64_t tdoaStorageGetTimeOfFlight(const tdoaAnchorContext_t* anchorCtx, const u
 }
 
 void tdoaStorageSetTimeOfFlight(tdoaAnchorContext_t* anchorCtx, const uint8_t remoteAnchor, const int64_t tof) {
-  tdoaAnchorInfo_t* anchorInfo = anchorCtx->anchorInfo;
-
-  int indexToUpdate = 0;
+  tdoaAnchorStorage_t* anchorStorage = anchorCtx->anchorStorage;
+  const uint16_t key = (anchorCtx->anchorInfo->id << 8) | remoteAnchor;
   uint32_t now = anchorCtx->currentTime_ms;
-  uint32_t oldestTime = 0xFFFFFFFF;
 
-  for (int i = 0; i < TOF_PER_ANCHOR_COUNT; i++) {
-    if (remoteAnchor == anchorInfo->tof[i].id) {
-      indexToUpdate = i;
-      break;
-    }
+  tdoaTimeOfFlight_t* entry = getTofEntry(anchorStorage, key);
+  if (entry->isUsed && entry->key != key && entry->endOfLife > now) {
+    anchorStorage->tofEvictionCount++;
+  }
 
-    if (anchorInfo->tof[i].endOfLife < oldestTime) {
-      oldestTime = anchorInfo->tof[i].endOfLife;
-      indexToUpdate = i;
-    }
+  entry->key = key;
+  entry->isUsed = true;
+  entry->tof = tof;
+  entry->endOfLife = now + TOF_VALIDITY_PERIOD;
+}
+
+bool tdoaStorageIsAnchorInStorage(tdoaAnchorStorage_t* anchorStorage, const uint8_t anchor) {
+  return anchorStorage->slotForId[anchor] != ANCHOR_STORAGE_NO_SLOT;
+}
+
+static tdoaAnchorInfo_t* initializeSlot(tdoaAnchorStorage_t* anchorStorage, const uint8_t slot, const uint8_t anchor) {
+  tdoaAnchorInfo_t* anchorInfo = &anchorStorage->anchorInfo[slot];
+  releaseRemoteAnchorData(anchorStorage, anchorInfo);
+
+  memset(anchorInfo, 0, sizeof(tdoaAnchorInfo_t));
+  anchorInfo->remoteAnchorDataHead = REMOTE_ANCHOR_DATA_NO_ENTRY;
+  anchorInfo->id = anchor;
+  anchorInfo->isInitialized = true;
+
+  anchorStorage->slotForId[anchor] = slot;
+
+  // A new anchor has not been updated yet and is the first candidate for eviction
+  linkSlotAsLeastRecent(anchorStorage, slot);
+
+  return anchorInfo;
+}
+
+static void unlinkSlot(tdoaAnchorStorage_t* anchorStorage, const uint8_t slot) {
+  const uint8_t prev = anchorStorage->prev[slot];
+  const uint8_t next = anchorStorage->next[slot];
+
+  if (prev != ANCHOR_STORAGE_NO_SLOT) {
+    anchorStorage->next[prev] = next;
+  } else {
+    anchorStorage->mostRecent = next;
   }
 
-  anchorInfo->tof[indexToUpdate].id = remoteAnchor;
-  anchorInfo->tof[indexToUpdate].tof = tof;
-  anchorInfo->tof[indexToUpdate].endOfLife = now + TOF_VALIDITY_PERIOD;
+  if (next != ANCHOR_STORAGE_NO_SLOT) {
+    anchorStorage->prev[next] = prev;
+  } else {
+    anchorStorage->leastRecent = prev;
+  }
 }
 
-bool tdoaStorageIsAnchorInStorage(tdoaAnchorInfo_t anchorStorage[], const uint8_t anchor) {
-  for (int i = 0; i < ANCHOR_STORAGE_COUNT; i++) {
-    if (anchorStorage[i].isInitialized) {
-      if (anchor == anchorStorage[i].id) {
-        return true;
+static void linkSlotAsMostRecent(tdoaAnchorStorage_t* anchorStorage, const uint8_t slot) {
+  const uint8_t oldMostRecent = anchorStorage->mostRecent;
+
+  anchorStorage->prev[slot] = ANCHOR_STORAGE_NO_SLOT;
+  anchorStorage->next[slot] = oldMostRecent;
+  if (oldMostRecent != ANCHOR_STORAGE_NO_SLOT) {
+    anchorStorage->prev[oldMostRecent] = slot;
+  } else {
+    anchorStorage->leastRecent = slot;
+  }
+  anchorStorage->mostRecent = slot;
+}
+
+static void linkSlotAsLeastRecent(tdoaAnchorStorage_t* anchorStorage, const uint8_t slot) {
+  const uint8_t oldLeastRecent = anchorStorage->leastRecent;
+
+  anchorStorage->next[slot] = ANCHOR_STORAGE_NO_SLOT;
+  anchorStorage->prev[slot] = oldLeastRecent;
+  if (oldLeastRecent != ANCHOR_STORAGE_NO_SLOT) {
+    anchorStorage->next[oldLeastRecent] = slot;
+  } else {
+    anchorStorage->mostRecent = slot;
+  }
+  anchorStorage->leastRecent = slot;
+}
+
+static uint16_t allocateRemoteAnchorData(tdoaAnchorStorage_t* anchorStorage, tdoaAnchorInfo_t* anchorInfo) {
+  tdoaRemoteAnchorData_t* pool = anchorStorage->remoteAnchorData;
+
+  if (anchorStorage->remoteAnchorDataFree == REMOTE_ANCHOR_DATA_NO_ENTRY) {
+    // The pool is empty, take the entries of the least recently updated
+    // anchor that has any
+    for (uint8_t slot = anchorStorage->leastRecent; slot != ANCHOR_STORAGE_NO_SLOT; slot = anchorStorage->prev[slot]) {
+      tdoaAnchorInfo_t* candidate = &anchorStorage->anchorInfo[slot];
+      if (candidate != anchorInfo && candidate->remoteAnchorDataHead != REMOTE_ANCHOR_DATA_NO_ENTRY) {
+        releaseRemoteAnchorData(anchorStorage, candidate);
+        anchorStorage->remoteAnchorDataReclaimCount++;
+        break;
       }
     }
+
+    if (anchorStorage->remoteAnchorDataFree == REMOTE_ANCHOR_DATA_NO_ENTRY) {
+      return REMOTE_ANCHOR_DATA_NO_ENTRY;
+    }
   }
 
-  return false;
+  const uint16_t index = anchorStorage->remoteAnchorDataFree;
+  anchorStorage->remoteAnchorDataFree = pool[index].next;
+  anchorStorage->remoteAnchorDataInUse++;
+
+  memset(&pool[index], 0, sizeof(tdoaRemoteAnchorData_t));
+  pool[index].next = anchorInfo->remoteAnchorDataHead;
+  anchorInfo->remoteAnchorDataHead = index;
+  anchorInfo->remoteAnchorDataCount++;
+
+  return index;
+}
+
+static void releaseRemoteAnchorData(tdoaAnchorStorage_t* anchorStorage, tdoaAnchorInfo_t* anchorInfo) {
+  tdoaRemoteAnchorData_t* pool = anchorStorage->remoteAnchorData;
+
+  uint16_t index = anchorInfo->remoteAnchorDataHead;
+  while (index != REMOTE_ANCHOR_DATA_NO_ENTRY) {
+    const uint16_t next = pool[index].next;
+    pool[index].next = anchorStorage->remoteAnchorDataFree;
+    anchorStorage->remoteAnchorDataFree = index;
+    anchorStorage->remoteAnchorDataInUse--;
+    index = next;
+  }
+
+  anchorInfo->remoteAnchorDataHead = REMOTE_ANCHOR_DATA_NO_ENTRY;
+  anchorInfo->remoteAnchorDataCount = 0;
 }
 
-static tdoaAnchorInfo_t* initializeSlot(tdoaAnchorInfo_t anchorStorage[], const uint8_t slot, const uint8_t anchor) {
-  memset(&anchorStorage[slot], 0, sizeof(tdoaAnchorInfo_t));
-  anchorStorage[slot].id = anchor;
-  anchorStorage[slot].isInitialized = true;
+// Returns the tof entry for the anchor pair, or the entry to use for it if it
+// is not in the table. Linear probing over a bounded window; if there is
+// neither a match nor a free entry in the window, the entry that expires first
+// is reused.
+static tdoaTimeOfFlight_t* getTofEntry(tdoaAnchorStorage_t* anchorStorage, const uint16_t key) {
+  const uint32_t start = ((uint32_t)key * 2654435761u) >> (32 - TOF_TABLE_SIZE_BITS);
+
+  tdoaTimeOfFlight_t* oldest = 0;
+  for (int i = 0; i < TOF_TABLE_MAX_PROBES; i++) {
+    tdoaTimeOfFlight_t* entry = &anchorStorage->tof[(start + i) & (TOF_TABLE_SIZE - 1)];
+    if (!entry->isUsed || entry->key == key) {
+      return entry;
+    }
+
+    if (oldest == 0 || entry->endOfLife < oldest->endOfLife) {
+      oldest = entry;
+    }
+  }
 
-  return &anchorStorage[slot];
+  return oldest;
 }
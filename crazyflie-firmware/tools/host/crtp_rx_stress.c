@@ -0,0 +1,299 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * crtp_rx_stress.c - Stress test of the CRTP RX dispatch and drop policies
+ *
+ * crtp.c is built into this file so the drop counters can be checked. A fake
+ * link feeds numbered packets to crtpRxTask as fast as it can while slow
+ * consumers drain the port queues. For every port, each packet must be either
+ * delivered once, in order, or counted as dropped; drop-oldest ports must
+ * always deliver the last packet. The race where the consumer empties a full
+ * queue between the failed send and the drop is also forced deterministically.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+// Lets the race test run the consumer right before crtpQueueRxPacket drops
+static void (*beforeDrop)(xQueueHandle queue);
+
+static BaseType_t hookedQueueReceive(xQueueHandle queue, void *item, TickType_t wait)
+{
+  if (beforeDrop && item != NULL && wait == 0)
+  {
+    beforeDrop(queue);
+  }
+
+  return xQueueReceive(queue, item, wait);
+}
+
+#define xQueueReceive hookedQueueReceive
+#include "crtp.c"
+#undef xQueueReceive
+
+#define PACKETS_PER_PORT 20000
+
+static const CRTPPort testPorts[] = { CRTP_PORT_PARAM, CRTP_PORT_LOG, CRTP_PORT_SETPOINT_HL, CRTP_PORT_SETPOINT_GENERIC };
+#define N_TEST_PORTS (sizeof(testPorts) / sizeof(testPorts[0]))
+
+static volatile uint32_t sent;
+static volatile bool linkDone;
+static volatile uint32_t callbackCount;
+
+static struct {
+  uint32_t delivered;
+  uint32_t last;
+  bool gotLast;
+  bool outOfOrder;
+} results[CRTP_NBR_OF_PORTS];
+
+static void sleepUs(long us)
+{
+  struct timespec delay = { .tv_sec = 0, .tv_nsec = us * 1000 };
+  nanosleep(&delay, NULL);
+}
+
+static void setSequence(CRTPPacket *p, uint32_t sequence)
+{
+  memcpy(p->data, &sequence, sizeof(sequence));
+  p->size = sizeof(sequence);
+}
+
+static uint32_t getSequence(const CRTPPacket *p)
+{
+  uint32_t sequence;
+  memcpy(&sequence, p->data, sizeof(sequence));
+  return sequence;
+}
+
+// Round robin over the test ports plus a callback port, in bursts
+static int fakeReceivePacket(CRTPPacket *p)
+{
+  static uint32_t index;
+
+  if (index >= (N_TEST_PORTS + 1) * PACKETS_PER_PORT)
+  {
+    linkDone = true;
+    vTaskDelay(M2T(1000));
+    return -1;
+  }
+
+  uint32_t port = index % (N_TEST_PORTS + 1);
+  p->header = 0;
+  p->port = (port < N_TEST_PORTS) ? testPorts[port] : CRTP_PORT_SETPOINT;
+  setSequence(p, index / (N_TEST_PORTS + 1));
+  index++;
+  sent++;
+
+  // Bursts of 64 packets, then let the consumers catch up a little
+  if (index % 64 == 0)
+  {
+    sleepUs(50);
+  }
+
+  return 0;
+}
+
+static int fakeSendPacket(CRTPPacket *p)
+{
+  return true;
+}
+
+static int fakeSetEnable(bool enable)
+{
+  return 0;
+}
+
+static struct crtpLinkOperations fakeLink = {
+  .setEnable         = fakeSetEnable,
+  .sendPacket        = fakeSendPacket,
+  .receivePacket     = fakeReceivePacket,
+};
+
+static void setpointCallback(CRTPPacket *p)
+{
+  callbackCount++;
+}
+
+static void* consumer(void *arg)
+{
+  CRTPPort port = *(const CRTPPort*)arg;
+  CRTPPacket p;
+  unsigned int seed = port;
+  uint32_t previous = 0;
+  bool first = true;
+
+  while (true)
+  {
+    if (crtpReceivePacketWait(port, &p, 100) != pdTRUE)
+    {
+      if (linkDone)
+      {
+        return NULL;
+      }
+      continue;
+    }
+
+    uint32_t sequence = getSequence(&p);
+    if (!first && sequence <= previous)
+    {
+      results[port].outOfOrder = true;
+    }
+    first = false;
+    previous = sequence;
+    results[port].delivered++;
+    results[port].last = sequence;
+    results[port].gotLast |= (sequence == PACKETS_PER_PORT - 1);
+
+    // A consumer slower than the link
+    sleepUs(rand_r(&seed) % 40);
+  }
+}
+
+static bool checkStress(void)
+{
+  pthread_t threads[N_TEST_PORTS];
+  bool ok = true;
+
+  crtpSetLink(&fakeLink);
+  for (int i = 0; i < N_TEST_PORTS; i++)
+  {
+    pthread_create(&threads[i], NULL, consumer, (void*)&testPorts[i]);
+  }
+  for (int i = 0; i < N_TEST_PORTS; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+
+  for (int i = 0; i < N_TEST_PORTS; i++)
+  {
+    CRTPPort port = testPorts[i];
+    uint32_t accounted = results[port].delivered + rxDropCount[port];
+
+    printf("port %2d %s: delivered %5u dropped %5u%s\n", port,
+           rxDropPolicy[port] == crtpDropOldest ? "drop oldest" : "drop newest",
+           results[port].delivered, rxDropCount[port],
+           results[port].outOfOrder ? " OUT OF ORDER" : "");
+
+    if (accounted != PACKETS_PER_PORT || results[port].outOfOrder)
+    {
+      ok = false;
+    }
+    if (rxDropPolicy[port] == crtpDropOldest && !results[port].gotLast)
+    {
+      printf("port %2d: newest packet lost\n", port);
+      ok = false;
+    }
+  }
+
+  if (callbackCount != PACKETS_PER_PORT)
+  {
+    printf("callback port: %u of %u packets\n", callbackCount, PACKETS_PER_PORT);
+    ok = false;
+  }
+
+  uint32_t dropSum = 0;
+  for (int port = 0; port < CRTP_NBR_OF_PORTS; port++)
+  {
+    dropSum += rxDropCount[port];
+  }
+  if (dropSum != rxDropTotal)
+  {
+    printf("total drop count %u, sum of the ports %u\n", rxDropTotal, dropSum);
+    ok = false;
+  }
+
+  return ok;
+}
+
+static void drainQueue(xQueueHandle queue)
+{
+  CRTPPacket p;
+
+  beforeDrop = NULL;
+  while (xQueueReceive(queue, &p, 0) == pdTRUE);
+}
+
+// The consumer empties the full queue right before the drop
+static bool checkConsumerRace(void)
+{
+  const CRTPPort port = CRTP_PORT_SETPOINT_GENERIC;
+  CRTPPacket p = { .port = port };
+  CRTPPacket received;
+  uint32_t dropsBefore = rxDropCount[port];
+
+  crtpSetRxDropPolicy(port, crtpDropOldest);
+  for (uint32_t i = 0; i < CRTP_RX_QUEUE_SIZE; i++)
+  {
+    setSequence(&p, i);
+    crtpQueueRxPacket(&p);
+  }
+
+  beforeDrop = drainQueue;
+  setSequence(&p, 1000);
+  crtpQueueRxPacket(&p);
+  beforeDrop = NULL;
+
+  bool ok = rxDropCount[port] == dropsBefore
+         && uxQueueMessagesWaiting(queues[port]) == 1
+         && xQueueReceive(queues[port], &received, 0) == pdTRUE
+         && getSequence(&received) == 1000;
+
+  printf("consumer race: %s\n", ok ? "ok" : "FAILED");
+
+  return ok;
+}
+
+void assertFail(char *exp, char *file, int line)
+{
+  printf("Assert failed %s:%d %s\n", file, line, exp);
+  abort();
+}
+
+uint64_t usecTimestamp(void)
+{
+  return (uint64_t)xTaskGetTickCount() * 1000;
+}
+
+int main(void)
+{
+  bool ok;
+
+  crtpInit();
+  for (int i = 0; i < N_TEST_PORTS; i++)
+  {
+    crtpInitTaskQueue(testPorts[i]);
+  }
+  crtpRegisterPortCB(CRTP_PORT_SETPOINT, setpointCallback);
+
+  ok = checkConsumerRace();
+  ok = checkStress() && ok;
+
+  printf("%s\n", ok ? "PASS" : "FAIL");
+
+  return ok ? 0 : 1;
+}
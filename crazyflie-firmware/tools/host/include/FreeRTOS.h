@@ -0,0 +1,85 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * FreeRTOS.h - Host stand-in for the FreeRTOS kernel API used by the firmware
+ *
+ * Tasks are POSIX threads, queues and semaphores are protected by a mutex and
+ * a tick is one millisecond of the monotonic clock, see src/freertos_host.c.
+ * Scheduling priorities are not emulated.
+ */
+#ifndef __FREERTOS_HOST_H__
+#define __FREERTOS_HOST_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t StackType_t;
+
+typedef struct { void *handle; } StaticTask_t;
+typedef struct { void *handle; } StaticQueue_t;
+typedef struct { void *handle; } StaticTimer_t;
+typedef StaticQueue_t StaticSemaphore_t;
+
+typedef void* TaskHandle_t;
+typedef void* QueueHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef void* TimerHandle_t;
+typedef TaskHandle_t xTaskHandle;
+typedef QueueHandle_t xQueueHandle;
+typedef SemaphoreHandle_t xSemaphoreHandle;
+typedef TimerHandle_t xTimerHandle;
+
+#define pdTRUE  1
+#define pdFALSE 0
+#define pdPASS  1
+#define pdFAIL  0
+#define errQUEUE_FULL 0
+#define errQUEUE_EMPTY 0
+
+#define portMAX_DELAY 0xffffffffUL
+#define portTICK_RATE_MS 1
+#define portTICK_PERIOD_MS 1
+#define portBASE_TYPE long
+#define portYIELD_FROM_ISR(x) (void)(x)
+
+#define configTICK_RATE_HZ 1000
+#define configMINIMAL_STACK_SIZE 150
+#define configMAX_PRIORITIES 6
+#define configASSERT(x)
+
+#define M2T(X) ((unsigned int)(X))
+#define T2M(X) ((unsigned int)(X))
+#define F2T(X) ((unsigned int)((configTICK_RATE_HZ/(X))))
+
+void vHostEnterCritical(void);
+void vHostExitCritical(void);
+
+#define portENTER_CRITICAL() vHostEnterCritical()
+#define portEXIT_CRITICAL() vHostExitCritical()
+#define taskENTER_CRITICAL() vHostEnterCritical()
+#define taskEXIT_CRITICAL() vHostExitCritical()
+
+#endif // __FREERTOS_HOST_H__
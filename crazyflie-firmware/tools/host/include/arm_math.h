@@ -0,0 +1,141 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * arm_math.h - Host implementation of the CMSIS DSP functions used by the
+ * modules built in tools/host. Plain C, float precision.
+ */
+#ifndef __ARM_MATH_HOST_H__
+#define __ARM_MATH_HOST_H__
+
+#include <stdint.h>
+#include <math.h>
+
+typedef float float32_t;
+
+typedef enum {
+  ARM_MATH_SUCCESS = 0,
+  ARM_MATH_SIZE_MISMATCH = -3,
+  ARM_MATH_SINGULAR = -5,
+} arm_status;
+
+typedef struct {
+  uint16_t numRows;
+  uint16_t numCols;
+  float32_t *pData;
+} arm_matrix_instance_f32;
+
+#define PI 3.14159265358979f
+
+static inline arm_status arm_sqrt_f32(float32_t in, float32_t *out)
+{
+  if (in >= 0.0f) {
+    *out = sqrtf(in);
+    return ARM_MATH_SUCCESS;
+  }
+
+  *out = 0.0f;
+  return ARM_MATH_SIZE_MISMATCH;
+}
+
+static inline float32_t arm_sin_f32(float32_t x)
+{
+  return sinf(x);
+}
+
+static inline float32_t arm_cos_f32(float32_t x)
+{
+  return cosf(x);
+}
+
+static inline void arm_add_f32(const float32_t *a, const float32_t *b, float32_t *dst, uint32_t n)
+{
+  for (uint32_t i = 0; i < n; i++) {
+    dst[i] = a[i] + b[i];
+  }
+}
+
+static inline void arm_sub_f32(const float32_t *a, const float32_t *b, float32_t *dst, uint32_t n)
+{
+  for (uint32_t i = 0; i < n; i++) {
+    dst[i] = a[i] - b[i];
+  }
+}
+
+static inline void arm_scale_f32(const float32_t *src, float32_t scale, float32_t *dst, uint32_t n)
+{
+  for (uint32_t i = 0; i < n; i++) {
+    dst[i] = src[i] * scale;
+  }
+}
+
+static inline void arm_dot_prod_f32(const float32_t *a, const float32_t *b, uint32_t n, float32_t *result)
+{
+  float32_t sum = 0.0f;
+  for (uint32_t i = 0; i < n; i++) {
+    sum += a[i] * b[i];
+  }
+  *result = sum;
+}
+
+static inline void arm_mat_init_f32(arm_matrix_instance_f32 *m, uint16_t rows, uint16_t cols, float32_t *data)
+{
+  m->numRows = rows;
+  m->numCols = cols;
+  m->pData = data;
+}
+
+static inline arm_status arm_mat_mult_f32(const arm_matrix_instance_f32 *a, const arm_matrix_instance_f32 *b, arm_matrix_instance_f32 *dst)
+{
+  if (a->numCols != b->numRows || dst->numRows != a->numRows || dst->numCols != b->numCols) {
+    return ARM_MATH_SIZE_MISMATCH;
+  }
+
+  for (int i = 0; i < a->numRows; i++) {
+    for (int j = 0; j < b->numCols; j++) {
+      float32_t sum = 0.0f;
+      for (int k = 0; k < a->numCols; k++) {
+        sum += a->pData[i * a->numCols + k] * b->pData[k * b->numCols + j];
+      }
+      dst->pData[i * dst->numCols + j] = sum;
+    }
+  }
+
+  return ARM_MATH_SUCCESS;
+}
+
+static inline arm_status arm_mat_trans_f32(const arm_matrix_instance_f32 *src, arm_matrix_instance_f32 *dst)
+{
+  if (dst->numRows != src->numCols || dst->numCols != src->numRows) {
+    return ARM_MATH_SIZE_MISMATCH;
+  }
+
+  for (int i = 0; i < src->numRows; i++) {
+    for (int j = 0; j < src->numCols; j++) {
+      dst->pData[j * dst->numCols + i] = src->pData[i * src->numCols + j];
+    }
+  }
+
+  return ARM_MATH_SUCCESS;
+}
+
+#endif // __ARM_MATH_HOST_H__
@@ -0,0 +1,45 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * task.h - Host stand-in for the FreeRTOS task API
+ */
+#ifndef __TASK_HOST_H__
+#define __TASK_HOST_H__
+
+#include "FreeRTOS.h"
+
+TaskHandle_t xTaskCreateStatic(void (*task)(void*), const char *name, uint32_t stackDepth,
+                               void *parameters, UBaseType_t priority,
+                               StackType_t *stack, StaticTask_t *taskBuffer);
+BaseType_t xTaskCreate(void (*task)(void*), const char *name, uint32_t stackDepth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *handle);
+
+TickType_t xTaskGetTickCount(void);
+TickType_t xTaskGetTickCountFromISR(void);
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t *previousWakeTime, TickType_t period);
+
+void vTaskSuspendAll(void);
+BaseType_t xTaskResumeAll(void);
+
+#endif // __TASK_HOST_H__
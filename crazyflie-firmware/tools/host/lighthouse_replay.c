@@ -0,0 +1,494 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * lighthouse_replay.c - Replays a recorded lighthouse deck stream on a PC
+ *
+ * The bytes received from the deck UART are fed through the same pipeline as
+ * in the lighthouse task: frame parser, V1 pulse processor (with the OOTX
+ * calibration decoder) and the crossing beams position. Angles, positions and
+ * the processing time per pulse are reported.
+ *
+ * The tool can also write a synthetic recording of a Crazyflie hovering at a
+ * known position, with calibration data in the OOTX stream. Replaying it with
+ * -c checks the whole chain against the known position.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lighthouse_frame.h"
+#include "pulse_processor.h"
+#include "lighthouse_geometry.h"
+
+// Same default geometry and deck layout as in lighthouse.c
+static baseStationGeometry_t geometry[PULSE_PROCESSOR_N_BASE_STATIONS] = {
+{.origin = {-1.678933, -2.346900, 2.620084, }, .mat = {{0.547433, -0.821713, 0.158445, }, {0.741131, 0.563978, 0.364216, }, {-0.388641, -0.081955, 0.917737, }, }},
+{.origin = {1.693073, 2.412071, 2.668153, }, .mat = {{-0.490228, 0.843023, -0.221329, }, {-0.756728, -0.537672, -0.371848, }, {-0.432480, -0.014804, 0.901522, }, }},
+};
+
+#define SENSOR_POS_W (0.015f / 2.0f)
+#define SENSOR_POS_L (0.030f / 2.0f)
+static vec3d sensorDeckPositions[PULSE_PROCESSOR_N_SENSORS] = {
+    {-SENSOR_POS_L, SENSOR_POS_W, 0.0},
+    {-SENSOR_POS_L, -SENSOR_POS_W, 0.0},
+    {SENSOR_POS_L, SENSOR_POS_W, 0.0},
+    {SENSOR_POS_L, -SENSOR_POS_W, 0.0},
+};
+
+// Bytes are handed to the parser in blocks, as read from the UART DMA buffer
+#define RX_BLOCK_SIZE 128
+
+static struct {
+  uint32_t frames;
+  uint32_t syncFrames;
+  uint32_t angleSets[PULSE_PROCESSOR_N_BASE_STATIONS];
+  uint32_t positions;
+  uint32_t calibratedPositions;
+  double positionSum[3];
+} stats;
+
+static bool printAngles;
+static bool printPositions;
+static uint32_t dropInterval;
+
+static bool allCalibrated(const pulseProcessor_t *state)
+{
+  for (int bs = 0; bs < PULSE_PROCESSOR_N_BASE_STATIONS; bs++) {
+    if (!state->bsCalibration[bs].valid) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void estimatePosition(const pulseProcessor_t *state, pulseProcessorResult_t *angles, uint32_t timestamp)
+{
+  vec3d sum = {0};
+  int count = 0;
+
+  for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+    for (int bs1 = 0; bs1 < PULSE_PROCESSOR_N_BASE_STATIONS; bs1++) {
+      pulseProcessorBaseStationMeasuremnt_t *m1 = &angles->sensorMeasurements[sensor].baseStatonMeasurements[bs1];
+      if (m1->validCount != PULSE_PROCESSOR_N_SWEEPS) {
+        continue;
+      }
+
+      for (int bs2 = bs1 + 1; bs2 < PULSE_PROCESSOR_N_BASE_STATIONS; bs2++) {
+        pulseProcessorBaseStationMeasuremnt_t *m2 = &angles->sensorMeasurements[sensor].baseStatonMeasurements[bs2];
+        if (m2->validCount != PULSE_PROCESSOR_N_SWEEPS) {
+          continue;
+        }
+
+        vec3d position;
+        float delta;
+        lighthouseGeometryGetPositionFromRayIntersection(&geometry[bs1], &geometry[bs2], m1->correctedAngles, m2->correctedAngles, position, &delta);
+        for (int i = 0; i < 3; i++) {
+          sum[i] += position[i];
+        }
+        count++;
+      }
+    }
+  }
+
+  if (count == 0) {
+    return;
+  }
+
+  stats.positions++;
+  if (allCalibrated(state)) {
+    stats.calibratedPositions++;
+    for (int i = 0; i < 3; i++) {
+      stats.positionSum[i] += sum[i] / count;
+    }
+  }
+
+  if (printPositions) {
+    printf("position,%u,%f,%f,%f\n", timestamp, (double)(sum[0] / count), (double)(sum[1] / count), (double)(sum[2] / count));
+  }
+}
+
+// A cycle is complete when the y sweep of the last base station is done,
+// as for the crossing beams method in lighthouse.c
+static void useCycle(pulseProcessor_t *state, pulseProcessorResult_t *angles, uint32_t timestamp)
+{
+  for (int bs = 0; bs < PULSE_PROCESSOR_N_BASE_STATIONS; bs++) {
+    pulseProcessorApplyCalibration(state, angles, bs);
+
+    for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+      pulseProcessorBaseStationMeasuremnt_t *m = &angles->sensorMeasurements[sensor].baseStatonMeasurements[bs];
+      if (printAngles && m->validCount == PULSE_PROCESSOR_N_SWEEPS) {
+        printf("angles,%u,%d,%d,%f,%f,%f,%f\n", timestamp, bs, sensor,
+               (double)m->angles[0], (double)m->angles[1], (double)m->correctedAngles[0], (double)m->correctedAngles[1]);
+      }
+    }
+  }
+
+  estimatePosition(state, angles, timestamp);
+
+  for (int bs = 0; bs < PULSE_PROCESSOR_N_BASE_STATIONS; bs++) {
+    pulseProcessorClear(angles, bs);
+  }
+}
+
+static uint32_t replay(const uint8_t *data, size_t size, lighthouseFrameParser_t *parser, pulseProcessor_t *state)
+{
+  static uint8_t rxBuffer[RX_BLOCK_SIZE + LIGHTHOUSE_FRAME_LENGTH];
+  static pulseProcessorResult_t angles;
+  uint32_t rxBufferLength = 0;
+  lighthouseFrame_t frame;
+  int basestation;
+  int axis;
+
+  for (size_t position = 0; position < size; ) {
+    uint32_t length = 0;
+    while (length < RX_BLOCK_SIZE && position < size) {
+      // Lose a byte, as on a UART overrun
+      if (dropInterval > 0 && position % dropInterval == dropInterval - 1) {
+        lighthouseFrameParserReset(parser);
+        position++;
+        continue;
+      }
+      rxBuffer[rxBufferLength + length++] = data[position++];
+    }
+    rxBufferLength += length;
+
+    uint32_t index = 0;
+    while (lighthouseFrameParse(parser, rxBuffer, rxBufferLength, &index, &frame)) {
+      if (frame.sync != 0) {
+        stats.syncFrames++;
+        continue;
+      }
+
+      stats.frames++;
+      if (pulseProcessorProcessPulse(state, frame.sensor, frame.timestamp, frame.width, &angles, &basestation, &axis)) {
+        stats.angleSets[basestation]++;
+        if (basestation == PULSE_PROCESSOR_N_BASE_STATIONS - 1 && axis == sweepDirection_y) {
+          useCycle(state, &angles, frame.timestamp);
+        }
+      }
+    }
+
+    memmove(rxBuffer, &rxBuffer[index], rxBufferLength - index);
+    rxBufferLength -= index;
+  }
+
+  return stats.frames;
+}
+
+// Synthetic recording
+
+#define TICKS_PER_SECOND 48000000
+#define FRAME_TICKS 400000     // One V1 frame, 8.333 ms at 48 MHz
+#define SYNC_SPACING 20000     // Between the syncs of consecutive base stations
+#define CYCLE_TICKS (2 * FRAME_TICKS)  // Between two sweeps of the same axis
+#define SYNC_WIDTH(code) (2900 + 500 * (code))
+#define SWEEP_WIDTH 300
+#define TIMESTAMP_MASK ((1u << PULSE_PROCESSOR_TIMESTAMP_BITWIDTH) - 1)
+
+// Calibration sent by the synthetic base stations. Only the phase is used by
+// the simple calibration in lighthouse_calibration.c.
+static const float syntheticPhase[PULSE_PROCESSOR_N_BASE_STATIONS][PULSE_PROCESSOR_N_SWEEPS] = {
+  {0.004f, -0.003f},
+  {-0.002f, 0.005f},
+};
+
+struct ootxStream {
+  uint8_t bits[1024];
+  int length;
+  int position;
+};
+
+static uint32_t crc32(const uint8_t *data, int length)
+{
+  uint32_t crc = 0xffffffff;
+  for (int i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; b++) {
+      crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+static void ootxAddByte(struct ootxStream *stream, uint8_t byte)
+{
+  for (int b = 7; b >= 0; b--) {
+    stream->bits[stream->length++] = (byte >> b) & 1;
+  }
+}
+
+// 16 bit words sent as two bytes, each followed by a stuffing bit
+static void ootxAddWord(struct ootxStream *stream, uint8_t first, uint8_t second)
+{
+  ootxAddByte(stream, first);
+  ootxAddByte(stream, second);
+  stream->bits[stream->length++] = 1;
+}
+
+static void ootxBuild(struct ootxStream *stream, int bs)
+{
+  uint8_t payload[sizeof(struct ootxDataFrame_s) + 1] = {0};
+  struct ootxDataFrame_s *frame = (struct ootxDataFrame_s *)payload;
+  const int length = sizeof(struct ootxDataFrame_s);
+
+  frame->protocolVersion = 6;
+  frame->id = 0x5eed0000 + bs;
+  frame->phase0 = syntheticPhase[bs][0];
+  frame->phase1 = syntheticPhase[bs][1];
+
+  uint32_t crc = crc32(payload, length);
+
+  stream->length = 0;
+  stream->position = 0;
+  for (int i = 0; i < 17; i++) {
+    stream->bits[stream->length++] = 0;
+  }
+  stream->bits[stream->length++] = 1;
+
+  ootxAddWord(stream, length & 0xff, length >> 8);
+  for (int i = 0; i < length; i += 2) {
+    ootxAddWord(stream, payload[i], payload[i + 1]);
+  }
+  ootxAddWord(stream, crc & 0xff, (crc >> 8) & 0xff);
+  ootxAddWord(stream, (crc >> 16) & 0xff, crc >> 24);
+}
+
+static int ootxNextBit(struct ootxStream *stream)
+{
+  int bit = stream->bits[stream->position];
+  stream->position = (stream->position + 1) % stream->length;
+  return bit;
+}
+
+static void writePulse(FILE *file, int sensor, uint32_t timestamp, int width)
+{
+  static int pulseCount;
+  lighthouseFrame_t frame = {.timestamp = timestamp & TIMESTAMP_MASK, .sensor = sensor, .width = width, .sync = 0};
+
+  // The deck sends sync frames in between pulses to mark the frame boundaries
+  if (pulseCount++ % 16 == 0) {
+    static const uint8_t syncFrame[LIGHTHOUSE_FRAME_LENGTH] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    fwrite(syncFrame, 1, sizeof(syncFrame), file);
+  }
+
+  fwrite(frame.data, 1, sizeof(frame.data), file);
+}
+
+// Raw sweep angles of a point, inverse of lighthouseGeometryGetRay()
+static void sweepAngles(const baseStationGeometry_t *bs, const vec3d point, float angles[2])
+{
+  double d[3];
+  double local[3] = {0};
+
+  for (int i = 0; i < 3; i++) {
+    d[i] = point[i] - bs->origin[i];
+  }
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      local[i] += bs->mat[j][i] * d[j];
+    }
+  }
+
+  angles[0] = atan2(local[1], local[0]);
+  angles[1] = atan2(local[2], local[0]);
+}
+
+static int writeSynthetic(const char *fileName, const vec3d position, float seconds)
+{
+  FILE *file = fopen(fileName, "wb");
+  if (!file) {
+    perror(fileName);
+    return 1;
+  }
+
+  struct ootxStream ootx[PULSE_PROCESSOR_N_BASE_STATIONS];
+  for (int bs = 0; bs < PULSE_PROCESSOR_N_BASE_STATIONS; bs++) {
+    ootxBuild(&ootx[bs], bs);
+  }
+
+  uint32_t sweepTicks[PULSE_PROCESSOR_N_BASE_STATIONS][PULSE_PROCESSOR_N_SWEEPS][PULSE_PROCESSOR_N_SENSORS];
+  for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+    vec3d sensorPosition;
+    for (int i = 0; i < 3; i++) {
+      sensorPosition[i] = position[i] + sensorDeckPositions[sensor][i];
+    }
+
+    for (int bs = 0; bs < PULSE_PROCESSOR_N_BASE_STATIONS; bs++) {
+      float angles[2];
+      sweepAngles(&geometry[bs], sensorPosition, angles);
+      for (int axis = 0; axis < PULSE_PROCESSOR_N_SWEEPS; axis++) {
+        // The calibration is added back by the pulse processing
+        float raw = angles[axis] - syntheticPhase[bs][axis];
+        sweepTicks[bs][axis][sensor] = CYCLE_TICKS / 4 + lroundf(raw * CYCLE_TICKS / (2 * (float)M_PI));
+      }
+    }
+  }
+
+  // Base stations take turns to sweep x then y, all of them send a sync in
+  // every frame. The sync width encodes the axis, the OOTX bit and whether
+  // the base station skips the sweep.
+  uint32_t start = TICKS_PER_SECOND;
+  int frames = seconds * TICKS_PER_SECOND / FRAME_TICKS;
+  for (int f = 0; f < frames; f++) {
+    uint32_t frameStart = start + f * FRAME_TICKS;
+    int axis = f % 2;
+    int active = (f / 2) % PULSE_PROCESSOR_N_BASE_STATIONS;
+
+    for (int bs = 0; bs < PULSE_PROCESSOR_N_BASE_STATIONS; bs++) {
+      int code = axis | (ootxNextBit(&ootx[bs]) << 1) | ((bs != active) << 2);
+      for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+        writePulse(file, sensor, frameStart + bs * SYNC_SPACING + sensor, SYNC_WIDTH(code));
+      }
+    }
+
+    // Sweeps in time order
+    bool written[PULSE_PROCESSOR_N_SENSORS] = {false};
+    for (int n = 0; n < PULSE_PROCESSOR_N_SENSORS; n++) {
+      int next = -1;
+      for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+        if (!written[sensor] && (next < 0 || sweepTicks[active][axis][sensor] < sweepTicks[active][axis][next])) {
+          next = sensor;
+        }
+      }
+      written[next] = true;
+      writePulse(file, next, frameStart + active * SYNC_SPACING + sweepTicks[active][axis][next], SWEEP_WIDTH);
+    }
+  }
+
+  fclose(file);
+  printf("Wrote %d frames (%.1f s) of a Crazyflie at (%.3f, %.3f, %.3f) to %s\n",
+         frames, (double)seconds, (double)position[0], (double)position[1], (double)position[2], fileName);
+
+  return 0;
+}
+
+static bool parseVector(const char *text, vec3d v)
+{
+  return sscanf(text, "%f,%f,%f", &v[0], &v[1], &v[2]) == 3;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [-a] [-p] [-d n] [-c x,y,z] <recording>\n"
+          "       %s -g <recording> [-x x,y,z] [-t seconds]\n"
+          "\n"
+          "  <recording>  Bytes received from the lighthouse deck UART\n"
+          "  -a           Print the angles of every cycle (csv)\n"
+          "  -p           Print the positions (csv)\n"
+          "  -d n         Lose one byte every n bytes, as on UART overruns\n"
+          "  -c x,y,z     Fail unless the mean calibrated position is within 1 cm of x,y,z\n"
+          "  -g           Write a synthetic recording instead of replaying\n"
+          "  -x x,y,z     Position of the synthetic Crazyflie, default 0,0,1\n"
+          "  -t seconds   Length of the synthetic recording, default 8\n",
+          name, name);
+}
+
+int main(int argc, char *argv[])
+{
+  bool generate = false;
+  bool check = false;
+  vec3d expected = {0};
+  vec3d syntheticPosition = {0.0f, 0.0f, 1.0f};
+  float seconds = 8.0f;
+  int option;
+
+  while ((option = getopt(argc, argv, "apd:c:gx:t:")) != -1) {
+    switch (option) {
+      case 'a': printAngles = true; break;
+      case 'p': printPositions = true; break;
+      case 'd': dropInterval = atoi(optarg); break;
+      case 'c': check = parseVector(optarg, expected); if (!check) { usage(argv[0]); return 1; } break;
+      case 'g': generate = true; break;
+      case 'x': if (!parseVector(optarg, syntheticPosition)) { usage(argv[0]); return 1; } break;
+      case 't': seconds = atof(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (generate) {
+    return writeSynthetic(argv[optind], syntheticPosition, seconds);
+  }
+
+  FILE *file = fopen(argv[optind], "rb");
+  if (!file) {
+    perror(argv[optind]);
+    return 1;
+  }
+  fseek(file, 0, SEEK_END);
+  size_t size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  uint8_t *data = malloc(size);
+  if (fread(data, 1, size, file) != size) {
+    perror(argv[optind]);
+    return 1;
+  }
+  fclose(file);
+
+  static lighthouseFrameParser_t parser;
+  static pulseProcessor_t state;
+
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  replay(data, size, &parser, &state);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double ns = (end.tv_sec - begin.tv_sec) * 1e9 + (end.tv_nsec - begin.tv_nsec);
+
+  printf("bytes %zu, pulse frames %u, sync frames %u, resyncs %u\n", size, stats.frames, stats.syncFrames, parser.resyncCount);
+  for (int bs = 0; bs < PULSE_PROCESSOR_N_BASE_STATIONS; bs++) {
+    printf("base station %d: %u sweeps, calibration %s", bs, stats.angleSets[bs], state.bsCalibration[bs].valid ? "decoded" : "not received");
+    if (state.bsCalibration[bs].valid) {
+      printf(" (phase %f %f)", (double)state.bsCalibration[bs].axis[0].phase, (double)state.bsCalibration[bs].axis[1].phase);
+    }
+    printf("\n");
+  }
+  printf("positions %u, %u with calibration\n", stats.positions, stats.calibratedPositions);
+  printf("%.0f ns/pulse (parser, pulse processor and geometry)\n", stats.frames ? ns / stats.frames : 0.0);
+
+  if (stats.calibratedPositions > 0) {
+    vec3d mean;
+    for (int i = 0; i < 3; i++) {
+      mean[i] = stats.positionSum[i] / stats.calibratedPositions;
+    }
+    printf("mean calibrated position (%.4f, %.4f, %.4f)\n", (double)mean[0], (double)mean[1], (double)mean[2]);
+
+    if (check) {
+      float error = sqrtf(powf(mean[0] - expected[0], 2) + powf(mean[1] - expected[1], 2) + powf(mean[2] - expected[2], 2));
+      printf("error %.4f m: %s\n", (double)error, error < 0.01f ? "PASS" : "FAIL");
+      return error < 0.01f ? 0 : 1;
+    }
+  } else if (check) {
+    printf("no calibrated position: FAIL\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,239 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2019 Bitcraze AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * pulse_processor_v2.c: lighthouse V2 (LFSR modulated beams) pulse processing
+ *
+ * Not part of the firmware: the lighthouse deck bitstream does not report the
+ * LFSR offset and channel of the pulses yet. Until it does the engine is built
+ * and tested on the host only, by lighthouse_v2_replay.
+ */
+
+#include "pulse_processor_v2.h"
+
+#include <string.h>
+#include <math.h>
+
+#ifndef M_PI_F
+#define M_PI_F ((float)M_PI)
+#endif
+
+// Times are expressed in a 48MHz clock
+
+// Max time for a beam to sweep over all the sensors of the deck. The deck is a
+// few centimeters wide, at 50 Hz this leaves a good margin down to ~10 cm from
+// the base station.
+#define BLOCK_MAX_SPREAD 20000
+
+// Rotation period of the base station rotor, per channel
+static const uint32_t cyclePeriods[PULSE_PROCESSOR_V2_N_CHANNELS] = {
+  959000, 957000, 953000, 949000, 947000, 943000, 941000, 939000,
+  937000, 929000, 919000, 911000, 907000, 901000, 893000, 887000,
+};
+
+// The two beams are tilted +/- 30 degrees
+static const float beamTilt = M_PI_F / 6.0f;
+
+static uint32_t TS_DIFF(uint32_t x, uint32_t y) {
+  const uint32_t bitmask = (1 << PULSE_PROCESSOR_TIMESTAMP_BITWIDTH) - 1;
+  return (x - y) & bitmask;
+}
+
+// Signed difference for timestamps known to be close to each other
+static int32_t tsDiffSigned(uint32_t x, uint32_t y) {
+  int32_t diff = TS_DIFF(x, y);
+  if (diff > (PULSE_PROCESSOR_TIMESTAMP_MAX / 2)) {
+    diff -= (1 << PULSE_PROCESSOR_TIMESTAMP_BITWIDTH);
+  }
+  return diff;
+}
+
+static const pulseProcessorV2Pulse_t* findReferencePulse(const pulseProcessorV2_t *state) {
+  for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+    const pulseProcessorV2Pulse_t* pulse = &state->blockPulses[sensor];
+    if ((state->blockSensorMask & (1 << sensor)) && pulse->channelFound) {
+      return pulse;
+    }
+  }
+  return 0;
+}
+
+// Only some of the pulses have a decoded offset, the offset of the other sensors
+// is derived from the time elapsed since a decoded pulse of the same passage
+static bool buildSweepBlock(const pulseProcessorV2_t *state, pulseProcessorV2SweepBlock_t *block) {
+  const pulseProcessorV2Pulse_t* reference = findReferencePulse(state);
+  if (!reference) {
+    return false;
+  }
+
+  // The channel comes from the deck, do not index the periods with a bad one
+  if (reference->channel >= PULSE_PROCESSOR_V2_N_CHANNELS) {
+    return false;
+  }
+
+  block->channel = reference->channel;
+  block->timestamp = state->blockStart;
+  block->sensorMask = state->blockSensorMask;
+
+  const int32_t period = cyclePeriods[block->channel];
+  for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+    const pulseProcessorV2Pulse_t* pulse = &state->blockPulses[sensor];
+    if ((block->sensorMask & (1 << sensor)) == 0) {
+      continue;
+    }
+
+    int32_t offset;
+    if (pulse->channelFound && pulse->channel == block->channel) {
+      offset = pulse->offset;
+    } else {
+      offset = reference->offset + tsDiffSigned(pulse->timestamp, reference->timestamp);
+    }
+
+    block->offset[sensor] = (offset + period) % period;
+  }
+
+  return true;
+}
+
+static bool isFirstBeam(const pulseProcessorV2SweepBlock_t *block, int sensor) {
+  return block->offset[sensor] < (cyclePeriods[block->channel] / 2);
+}
+
+static int firstSensor(uint8_t sensorMask) {
+  for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+    if (sensorMask & (1 << sensor)) {
+      return sensor;
+    }
+  }
+  return -1;
+}
+
+static bool calculateAngles(const pulseProcessorV2SweepBlock_t *firstBeam, const pulseProcessorV2SweepBlock_t *secondBeam, pulseProcessorResult_t* angles) {
+  bool anglesMeasured = false;
+  const float period = cyclePeriods[secondBeam->channel];
+  const int baseStation = secondBeam->channel;
+
+  for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+    const uint8_t sensorBit = (1 << sensor);
+    if ((firstBeam->sensorMask & sensorBit) && (secondBeam->sensorMask & sensorBit)) {
+      float firstAngle = (firstBeam->offset[sensor] * 2.0f * M_PI_F / period) - M_PI_F + M_PI_F / 3.0f;
+      float secondAngle = (secondBeam->offset[sensor] * 2.0f * M_PI_F / period) - M_PI_F - M_PI_F / 3.0f;
+
+      pulseProcessorBaseStationMeasuremnt_t* bsMeasurement = &angles->sensorMeasurements[sensor].baseStatonMeasurements[baseStation];
+      pulseProcessorV2ConvertToV1Angles(firstAngle, secondAngle, bsMeasurement->angles);
+      bsMeasurement->validCount = PULSE_PROCESSOR_N_SWEEPS;
+
+      anglesMeasured = true;
+    }
+  }
+
+  return anglesMeasured;
+}
+
+static bool processBlock(pulseProcessorV2_t *state, pulseProcessorResult_t* angles, int *baseStation, int *axis) {
+  pulseProcessorV2SweepBlock_t block;
+  if (!buildSweepBlock(state, &block)) {
+    return false;
+  }
+
+  const int channel = block.channel;
+  if (channel >= PULSE_PROCESSOR_N_BASE_STATIONS) {
+    return false;
+  }
+
+  if (isFirstBeam(&block, firstSensor(block.sensorMask))) {
+    state->firstBeam[channel] = block;
+    state->firstBeamValid[channel] = true;
+    return false;
+  }
+
+  // Second beam, pair it with the first beam of the same rotation
+  bool anglesMeasured = false;
+  const pulseProcessorV2SweepBlock_t* firstBeam = &state->firstBeam[channel];
+  if (state->firstBeamValid[channel] && TS_DIFF(block.timestamp, firstBeam->timestamp) < cyclePeriods[channel]) {
+    anglesMeasured = calculateAngles(firstBeam, &block, angles);
+    if (anglesMeasured) {
+      *baseStation = channel;
+      *axis = sweepDirection_y;
+    }
+  }
+  state->firstBeamValid[channel] = false;
+
+  return anglesMeasured;
+}
+
+bool pulseProcessorV2ProcessPulse(pulseProcessorV2_t *state, const pulseProcessorV2Pulse_t *pulse, pulseProcessorResult_t* angles, int *baseStation, int *axis)
+{
+  bool anglesMeasured = false;
+
+  if (pulse->sensor >= PULSE_PROCESSOR_N_SENSORS) {
+    return false;
+  }
+
+  // A pulse outside of the current passage completes it, as does a decoded
+  // pulse from another base station sweeping the deck at the same time
+  const pulseProcessorV2Pulse_t* reference = findReferencePulse(state);
+  const bool otherChannel = pulse->channelFound && reference && reference->channel != pulse->channel;
+  if (state->blockSensorMask != 0 && (TS_DIFF(pulse->timestamp, state->blockStart) > BLOCK_MAX_SPREAD || otherChannel)) {
+    anglesMeasured = processBlock(state, angles, baseStation, axis);
+    state->blockSensorMask = 0;
+  }
+
+  if (state->blockSensorMask == 0) {
+    state->blockStart = pulse->timestamp;
+  }
+
+  // Later pulses on the same sensor in one passage are reflections
+  const uint8_t sensorBit = (1 << pulse->sensor);
+  if ((state->blockSensorMask & sensorBit) == 0) {
+    state->blockPulses[pulse->sensor] = *pulse;
+    state->blockSensorMask |= sensorBit;
+  }
+
+  return anglesMeasured;
+}
+
+void pulseProcessorV2ApplyCalibration(pulseProcessorResult_t* angles, int baseStation)
+{
+  for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+    pulseProcessorBaseStationMeasuremnt_t* bsMeasurement = &angles->sensorMeasurements[sensor].baseStatonMeasurements[baseStation];
+    memcpy(bsMeasurement->correctedAngles, bsMeasurement->angles, sizeof(bsMeasurement->correctedAngles));
+  }
+}
+
+void pulseProcessorV2ConvertToV1Angles(const float v2Angle1, const float v2Angle2, float v1Angles[PULSE_PROCESSOR_N_SWEEPS])
+{
+  const float tanTilt = tanf(beamTilt);
+
+  // Point on the intersection of the two beam planes, at unit distance along x
+  const float y = tanf((v2Angle2 + v2Angle1) / 2.0f);
+  const float z = sinf(v2Angle2 - v2Angle1) / (tanTilt * (cosf(v2Angle2) + cosf(v2Angle1)));
+
+  v1Angles[0] = atanf(y);
+  v1Angles[1] = atanf(z);
+}
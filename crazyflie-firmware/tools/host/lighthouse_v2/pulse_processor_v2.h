@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pulse_processor.h"
+
+// The deck bitstream does not report the LFSR offset and channel yet, so the
+// engine is not built into the firmware. It is exercised on the host by
+// tools/host/lighthouse_v2_replay.
+
+// Number of channels a Lighthouse V2 base station can be configured on. The
+// channel is used as base station index, base stations must be configured on
+// channels below PULSE_PROCESSOR_N_BASE_STATIONS to be used.
+#define PULSE_PROCESSOR_V2_N_CHANNELS 16
+
+/**
+ * Lighthouse V2 pulse, as demodulated by the deck. Times are expressed in a
+ * 48MHz clock, as for V1.
+ */
+typedef struct {
+  uint8_t sensor;
+  uint32_t timestamp;
+  // Rotor position when the beam hit the sensor, from the position in the LFSR
+  // sequence. Time since the start of the rotation.
+  uint32_t offset;
+  uint8_t channel;
+  // False if the deck could not identify the LFSR, offset and channel are not valid
+  bool channelFound;
+} pulseProcessorV2Pulse_t;
+
+// Rotor positions of the sensors hit by one beam passage
+typedef struct {
+  uint32_t offset[PULSE_PROCESSOR_N_SENSORS];
+  uint8_t sensorMask;
+  uint8_t channel;
+  uint32_t timestamp;
+} pulseProcessorV2SweepBlock_t;
+
+typedef struct pulseProcessorV2_s {
+  // Pulses of the beam passage being collected, first pulse of each sensor
+  pulseProcessorV2Pulse_t blockPulses[PULSE_PROCESSOR_N_SENSORS];
+  uint8_t blockSensorMask;
+  uint32_t blockStart;
+
+  // First beam of the current rotation, per base station, waiting for the second beam
+  pulseProcessorV2SweepBlock_t firstBeam[PULSE_PROCESSOR_N_BASE_STATIONS];
+  bool firstBeamValid[PULSE_PROCESSOR_N_BASE_STATIONS];
+} pulseProcessorV2_t;
+
+/**
+ * @brief Process a Lighthouse V2 pulse. Angles are produced when the second
+ * beam of a rotation has been received, and are converted to the V1 angle
+ * convention so that they can be used with the same geometry and estimator code.
+ *
+ * @param state
+ * @param pulse
+ * @param angles
+ * @param baseStation
+ * @param axis Always sweepDirection_y when a result is produced, both angles are measured at once
+ * @return true, angles, base station and axis are written
+ * @return false, no valid result
+ */
+bool pulseProcessorV2ProcessPulse(pulseProcessorV2_t *state, const pulseProcessorV2Pulse_t *pulse, pulseProcessorResult_t* angles, int *baseStation, int *axis);
+
+/**
+ * @brief Apply calibration correction to all angles of all sensors for a particular baseStation.
+ * V2 calibration data is not decoded yet, the raw angles are used as is.
+ *
+ * @param angles
+ * @param baseStation
+ */
+void pulseProcessorV2ApplyCalibration(pulseProcessorResult_t* angles, int baseStation);
+
+/**
+ * @brief Convert the angles of the two tilted Lighthouse V2 beams to the
+ * horizontal and vertical angles of a V1 base station
+ *
+ * @param v2Angle1 Angle of the first beam
+ * @param v2Angle2 Angle of the second beam
+ * @param v1Angles (output) Horizontal and vertical angles
+ */
+void pulseProcessorV2ConvertToV1Angles(const float v2Angle1, const float v2Angle2, float v1Angles[PULSE_PROCESSOR_N_SWEEPS]);
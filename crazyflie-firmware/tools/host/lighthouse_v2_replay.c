@@ -0,0 +1,417 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * lighthouse_v2_replay.c - Replays Lighthouse V2 pulses through pulse_processor_v2
+ *
+ * Pulses are read from a csv file (sensor,timestamp,offset,channel,found, one
+ * per line) or synthesized for a Crazyflie hovering in a room with base
+ * stations on channels 0 to PULSE_PROCESSOR_N_BASE_STATIONS - 1. The
+ * synthetic stream has timing jitter, and only part of the pulses have a
+ * decoded LFSR offset and channel, as from the deck. The angles produced by
+ * the engine are compared with the true angles and the crossing beams
+ * position with the true position.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pulse_processor_v2.h"
+#include "lighthouse_geometry.h"
+
+#define TICKS_PER_SECOND 48000000
+#define TIMESTAMP_MASK ((1u << PULSE_PROCESSOR_TIMESTAMP_BITWIDTH) - 1)
+
+// Rotor periods of the channels, as in pulse_processor_v2.c
+static const uint32_t cyclePeriods[PULSE_PROCESSOR_V2_N_CHANNELS] = {
+  959000, 957000, 953000, 949000, 947000, 943000, 941000, 939000,
+  937000, 929000, 919000, 911000, 907000, 901000, 893000, 887000,
+};
+
+static const float beamTilt = (float)M_PI / 6.0f;
+
+#define SENSOR_POS_W (0.015f / 2.0f)
+#define SENSOR_POS_L (0.030f / 2.0f)
+static vec3d sensorDeckPositions[PULSE_PROCESSOR_N_SENSORS] = {
+    {-SENSOR_POS_L, SENSOR_POS_W, 0.0},
+    {-SENSOR_POS_L, -SENSOR_POS_W, 0.0},
+    {SENSOR_POS_L, SENSOR_POS_W, 0.0},
+    {SENSOR_POS_L, -SENSOR_POS_W, 0.0},
+};
+
+static baseStationGeometry_t geometry[PULSE_PROCESSOR_N_BASE_STATIONS];
+
+// True V1 angles per base station and sensor, for synthetic streams
+static float trueAngles[PULSE_PROCESSOR_N_BASE_STATIONS][PULSE_PROCESSOR_N_SENSORS][PULSE_PROCESSOR_N_SWEEPS];
+
+static pulseProcessorV2Pulse_t *pulses;
+static int pulseCount;
+
+// Base stations in the top corners of a 4 x 4 x 2.5 m room, looking at the center
+static void buildRoom(void)
+{
+  const float corners[4][2] = {{-2, -2}, {2, 2}, {2, -2}, {-2, 2}};
+  const vec3d target = {0, 0, 0.5f};
+
+  for (int bs = 0; bs < PULSE_PROCESSOR_N_BASE_STATIONS; bs++) {
+    float *origin = geometry[bs].origin;
+    origin[0] = corners[bs % 4][0] * (1.0f + 0.1f * (bs / 4));
+    origin[1] = corners[bs % 4][1];
+    origin[2] = 2.5f;
+
+    vec3d forward, left, up;
+    float length = 0;
+    for (int i = 0; i < 3; i++) {
+      forward[i] = target[i] - origin[i];
+      length += forward[i] * forward[i];
+    }
+    for (int i = 0; i < 3; i++) {
+      forward[i] /= sqrtf(length);
+    }
+    // left = z x forward, up = forward x left
+    length = sqrtf(forward[0] * forward[0] + forward[1] * forward[1]);
+    left[0] = -forward[1] / length;
+    left[1] = forward[0] / length;
+    left[2] = 0;
+    up[0] = forward[1] * left[2] - forward[2] * left[1];
+    up[1] = forward[2] * left[0] - forward[0] * left[2];
+    up[2] = forward[0] * left[1] - forward[1] * left[0];
+
+    // The columns are the base station axes in the world
+    for (int i = 0; i < 3; i++) {
+      geometry[bs].mat[i][0] = forward[i];
+      geometry[bs].mat[i][1] = left[i];
+      geometry[bs].mat[i][2] = up[i];
+    }
+  }
+}
+
+static void toBaseStation(const baseStationGeometry_t *bs, const vec3d point, double local[3])
+{
+  for (int i = 0; i < 3; i++) {
+    local[i] = 0;
+    for (int j = 0; j < 3; j++) {
+      local[i] += bs->mat[j][i] * (point[j] - bs->origin[j]);
+    }
+  }
+}
+
+static double gaussian(void)
+{
+  double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+  double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+  return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+static int compareTimestamps(const void *a, const void *b)
+{
+  const pulseProcessorV2Pulse_t *pa = a;
+  const pulseProcessorV2Pulse_t *pb = b;
+  return (pa->timestamp > pb->timestamp) - (pa->timestamp < pb->timestamp);
+}
+
+// Sweeps of all base stations for a number of seconds, the rotors of the
+// base stations start at random phases
+static void synthesize(const vec3d position, float seconds, float foundRatio, float jitter)
+{
+  int maxPulses = PULSE_PROCESSOR_N_BASE_STATIONS * (seconds * TICKS_PER_SECOND / cyclePeriods[15] + 1) * 2 * PULSE_PROCESSOR_N_SENSORS;
+  pulses = calloc(maxPulses, sizeof(pulseProcessorV2Pulse_t));
+  pulseCount = 0;
+
+  for (int bs = 0; bs < PULSE_PROCESSOR_N_BASE_STATIONS; bs++) {
+    const uint32_t period = cyclePeriods[bs];
+    uint32_t offsets[2][PULSE_PROCESSOR_N_SENSORS];
+
+    for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+      vec3d sensorPosition;
+      double local[3];
+      for (int i = 0; i < 3; i++) {
+        sensorPosition[i] = position[i] + sensorDeckPositions[sensor][i];
+      }
+      toBaseStation(&geometry[bs], sensorPosition, local);
+
+      trueAngles[bs][sensor][0] = atan2(local[1], local[0]);
+      trueAngles[bs][sensor][1] = atan2(local[2], local[0]);
+
+      // The beam planes are tilted +/- 30 degrees around the rotor axis
+      double alpha = atan2(local[1], local[0]);
+      double delta = asin(local[2] * tan(beamTilt) / sqrt(local[0] * local[0] + local[1] * local[1]));
+      double firstAngle = alpha - delta;
+      double secondAngle = alpha + delta;
+      offsets[0][sensor] = lround((firstAngle + M_PI - M_PI / 3) * period / (2 * M_PI));
+      offsets[1][sensor] = lround((secondAngle + M_PI + M_PI / 3) * period / (2 * M_PI));
+    }
+
+    uint32_t start = TICKS_PER_SECOND / 10 + rand() % period;
+    for (uint32_t cycleStart = start; cycleStart + period < seconds * TICKS_PER_SECOND; cycleStart += period) {
+      for (int beam = 0; beam < 2; beam++) {
+        for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+          int32_t noise = lround(gaussian() * jitter);
+          pulseProcessorV2Pulse_t *pulse = &pulses[pulseCount++];
+          pulse->sensor = sensor;
+          pulse->timestamp = cycleStart + offsets[beam][sensor] + noise;
+          pulse->channelFound = (rand() / (RAND_MAX + 1.0)) < foundRatio;
+          pulse->channel = pulse->channelFound ? bs : 0;
+          pulse->offset = pulse->channelFound ? offsets[beam][sensor] + noise : 0;
+        }
+      }
+    }
+  }
+
+  qsort(pulses, pulseCount, sizeof(pulseProcessorV2Pulse_t), compareTimestamps);
+  for (int i = 0; i < pulseCount; i++) {
+    pulses[i].timestamp &= TIMESTAMP_MASK;
+  }
+}
+
+static bool readPulses(const char *fileName)
+{
+  FILE *file = fopen(fileName, "r");
+  if (!file) {
+    perror(fileName);
+    return false;
+  }
+
+  int capacity = 1024;
+  unsigned int sensor, timestamp, offset, channel, found;
+  pulses = malloc(capacity * sizeof(pulseProcessorV2Pulse_t));
+  while (fscanf(file, "%u,%u,%u,%u,%u", &sensor, &timestamp, &offset, &channel, &found) == 5) {
+    if (pulseCount == capacity) {
+      capacity *= 2;
+      pulses = realloc(pulses, capacity * sizeof(pulseProcessorV2Pulse_t));
+    }
+    pulses[pulseCount++] = (pulseProcessorV2Pulse_t){.sensor = sensor, .timestamp = timestamp, .offset = offset, .channel = channel, .channelFound = found};
+  }
+  fclose(file);
+
+  return true;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [-a] [-c x,y,z] <pulses.csv>\n"
+          "       %s -s [-a] [-x x,y,z] [-f ratio] [-j ticks] [-t seconds] [-w pulses.csv]\n"
+          "\n"
+          "  <pulses.csv>  sensor,timestamp,offset,channel,found per line\n"
+          "  -a            Print the angles (csv)\n"
+          "  -c x,y,z      Fail unless the mean position is within 1 cm of x,y,z\n"
+          "  -s            Replay a synthetic stream, and check its angles\n"
+          "  -x x,y,z      Position of the synthetic Crazyflie, default 0.5,-0.3,0.8\n"
+          "  -f ratio      Part of the pulses with a decoded LFSR, default 0.5\n"
+          "  -j ticks      Standard deviation of the timing jitter, default 2\n"
+          "  -t seconds    Length of the synthetic stream, default 4\n"
+          "  -w file       Write the synthetic stream to a file\n",
+          name, name);
+}
+
+static bool parseVector(const char *text, vec3d v)
+{
+  return sscanf(text, "%f,%f,%f", &v[0], &v[1], &v[2]) == 3;
+}
+
+int main(int argc, char *argv[])
+{
+  bool synthetic = false;
+  bool printAngles = false;
+  bool check = false;
+  vec3d expected = {0};
+  vec3d position = {0.5f, -0.3f, 0.8f};
+  float foundRatio = 0.5f;
+  float jitter = 2.0f;
+  float seconds = 4.0f;
+  const char *writeFile = NULL;
+  int option;
+
+  while ((option = getopt(argc, argv, "ac:sx:f:j:t:w:")) != -1) {
+    switch (option) {
+      case 'a': printAngles = true; break;
+      case 'c': check = parseVector(optarg, expected); if (!check) { usage(argv[0]); return 1; } break;
+      case 's': synthetic = true; break;
+      case 'x': if (!parseVector(optarg, position)) { usage(argv[0]); return 1; } break;
+      case 'f': foundRatio = atof(optarg); break;
+      case 'j': jitter = atof(optarg); break;
+      case 't': seconds = atof(optarg); break;
+      case 'w': writeFile = optarg; break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  buildRoom();
+
+  if (synthetic) {
+    srand(1);
+    synthesize(position, seconds, foundRatio, jitter);
+    if (check == false) {
+      check = true;
+      memcpy(expected, position, sizeof(vec3d));
+    }
+    if (writeFile) {
+      FILE *file = fopen(writeFile, "w");
+      for (int i = 0; file && i < pulseCount; i++) {
+        fprintf(file, "%u,%u,%u,%u,%u\n", pulses[i].sensor, pulses[i].timestamp, pulses[i].offset, pulses[i].channel, pulses[i].channelFound);
+      }
+      if (file) {
+        fclose(file);
+      }
+    }
+  } else if (optind == argc - 1) {
+    if (!readPulses(argv[optind])) {
+      return 1;
+    }
+  } else {
+    usage(argv[0]);
+    return 1;
+  }
+
+  static pulseProcessorV2_t state;
+  static pulseProcessorResult_t angles;
+  static pulseProcessorResult_t results[4096];
+  static int resultBs[4096];
+  int resultCount = 0;
+  int baseStation;
+  int axis;
+
+  // Channels out of range must be dropped, not used to look up a rotor period
+  for (int i = 0; i < 64; i++) {
+    pulseProcessorV2Pulse_t bad = {.sensor = i % PULSE_PROCESSOR_N_SENSORS, .timestamp = 1000 + 100000 * (i / PULSE_PROCESSOR_N_SENSORS) + i,
+                                   .offset = 1000, .channel = PULSE_PROCESSOR_V2_N_CHANNELS + i * 3, .channelFound = true};
+    if (pulseProcessorV2ProcessPulse(&state, &bad, &angles, &baseStation, &axis)) {
+      printf("FAIL: angles from channel %d\n", bad.channel);
+      return 1;
+    }
+  }
+  memset(&state, 0, sizeof(state));
+
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (int i = 0; i < pulseCount; i++) {
+    if (pulseProcessorV2ProcessPulse(&state, &pulses[i], &angles, &baseStation, &axis)) {
+      pulseProcessorV2ApplyCalibration(&angles, baseStation);
+      if (resultCount < 4096) {
+        results[resultCount] = angles;
+        resultBs[resultCount] = baseStation;
+        resultCount++;
+      }
+      pulseProcessorClear(&angles, baseStation);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double ns = (end.tv_sec - begin.tv_sec) * 1e9 + (end.tv_nsec - begin.tv_nsec);
+
+  // Angle errors, and positions from the latest angles of each base station pair
+  int setsPerBs[PULSE_PROCESSOR_N_BASE_STATIONS] = {0};
+  int outliers = 0;
+  double maxError = 0;
+  double errorSum = 0;
+  int angleCount = 0;
+  static pulseProcessorResult_t latest;
+  double positionSum[3] = {0};
+  int positionCount = 0;
+
+  for (int r = 0; r < resultCount; r++) {
+    int bs = resultBs[r];
+    setsPerBs[bs]++;
+
+    for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+      pulseProcessorBaseStationMeasuremnt_t *m = &results[r].sensorMeasurements[sensor].baseStatonMeasurements[bs];
+      if (m->validCount != PULSE_PROCESSOR_N_SWEEPS) {
+        continue;
+      }
+
+      if (printAngles) {
+        printf("angles,%d,%d,%d,%f,%f\n", r, bs, sensor, (double)m->correctedAngles[0], (double)m->correctedAngles[1]);
+      }
+
+      if (synthetic) {
+        for (int a = 0; a < PULSE_PROCESSOR_N_SWEEPS; a++) {
+          double error = fabs(m->correctedAngles[a] - trueAngles[bs][sensor][a]);
+          errorSum += error;
+          angleCount++;
+          if (error > maxError) {
+            maxError = error;
+          }
+          if (error > 0.001) {
+            outliers++;
+          }
+        }
+      }
+
+      latest.sensorMeasurements[sensor].baseStatonMeasurements[bs] = *m;
+      for (int other = 0; other < PULSE_PROCESSOR_N_BASE_STATIONS; other++) {
+        pulseProcessorBaseStationMeasuremnt_t *o = &latest.sensorMeasurements[sensor].baseStatonMeasurements[other];
+        if (other == bs || o->validCount != PULSE_PROCESSOR_N_SWEEPS) {
+          continue;
+        }
+
+        vec3d sensorPosition;
+        float delta;
+        if (lighthouseGeometryGetPositionFromRayIntersection(&geometry[bs], &geometry[other], m->correctedAngles, o->correctedAngles, sensorPosition, &delta)) {
+          for (int i = 0; i < 3; i++) {
+            positionSum[i] += sensorPosition[i] - sensorDeckPositions[sensor][i];
+          }
+          positionCount++;
+        }
+      }
+    }
+  }
+
+  printf("pulses %d, angle sets %d (", pulseCount, resultCount);
+  for (int bs = 0; bs < PULSE_PROCESSOR_N_BASE_STATIONS; bs++) {
+    printf("%sbs%d %d", bs ? ", " : "", bs, setsPerBs[bs]);
+  }
+  printf("), %.0f ns/pulse\n", pulseCount ? ns / pulseCount : 0.0);
+
+  bool ok = true;
+  if (synthetic) {
+    printf("angle error: mean %.6f rad, max %.6f rad, %d of %d above 1 mrad\n",
+           angleCount ? errorSum / angleCount : 0.0, maxError, outliers, angleCount);
+    for (int bs = 0; bs < PULSE_PROCESSOR_N_BASE_STATIONS; bs++) {
+      ok = ok && setsPerBs[bs] > 0;
+    }
+    ok = ok && angleCount > 0 && outliers * 100 <= angleCount;
+  }
+
+  if (positionCount > 0) {
+    vec3d mean;
+    for (int i = 0; i < 3; i++) {
+      mean[i] = positionSum[i] / positionCount;
+    }
+    printf("mean position (%.4f, %.4f, %.4f) from %d base station pairs\n", (double)mean[0], (double)mean[1], (double)mean[2], positionCount);
+    if (check) {
+      float error = sqrtf(powf(mean[0] - expected[0], 2) + powf(mean[1] - expected[1], 2) + powf(mean[2] - expected[2], 2));
+      printf("position error %.4f m\n", (double)error);
+      ok = ok && error < 0.01f;
+    }
+  } else if (check) {
+    ok = false;
+  }
+
+  if (synthetic || check) {
+    printf("%s\n", ok ? "PASS" : "FAIL");
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * pptraj_bench.c - Benchmarks the evaluation of polynomial trajectory pieces
+ *
+ * Compares poly4d_eval and poly4d_eval_prepared with the evaluation that
+ * differentiates copies of the piece and runs one Horner loop per axis and
+ * derivative, checks that they agree and reports ns per evaluation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pptraj.h"
+
+#define PIECES 64
+#define TIMES 1024
+
+// As in pptraj.c
+#define GRAV (9.81f)
+
+// Evaluation of a piece before the fused evaluator
+static struct vec referencePolyvalXyz(struct poly4d const *p, float t)
+{
+  return mkvec(polyval(p->p[0], t), polyval(p->p[1], t), polyval(p->p[2], t));
+}
+
+static struct traj_eval referencePoly4dEval(struct poly4d const *p, float t)
+{
+  struct traj_eval out;
+  out.pos = referencePolyvalXyz(p, t);
+  out.yaw = polyval(p->p[3], t);
+
+  struct poly4d deriv = *p;
+  polyder4d(&deriv);
+  out.vel = referencePolyvalXyz(&deriv, t);
+  float dyaw = polyval(deriv.p[3], t);
+
+  polyder4d(&deriv);
+  out.acc = referencePolyvalXyz(&deriv, t);
+
+  polyder4d(&deriv);
+  struct vec jerk = referencePolyvalXyz(&deriv, t);
+
+  struct vec thrust = vadd(out.acc, mkvec(0, 0, GRAV));
+  struct vec z_body = vnormalize(thrust);
+  struct vec x_world = mkvec(cosf(out.yaw), sinf(out.yaw), 0);
+  struct vec y_body = vnormalize(vcross(z_body, x_world));
+  struct vec x_body = vcross(y_body, z_body);
+
+  struct vec jerk_orth_zbody = vorthunit(jerk, z_body);
+  struct vec h_w = vscl(1.0f / vmag(thrust), jerk_orth_zbody);
+
+  out.omega.x = -vdot(h_w, y_body);
+  out.omega.y = vdot(h_w, x_body);
+  out.omega.z = z_body.z * dyaw;
+
+  return out;
+}
+
+static struct poly4d pieces[PIECES];
+static struct poly4d_prepared prepared[PIECES];
+static float times[TIMES];
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static float relativeError(float value, float reference)
+{
+  return fabsf(value - reference) / fmaxf(1.0f, fabsf(reference));
+}
+
+static float maxError(const struct traj_eval *a, const struct traj_eval *b)
+{
+  const float errors[] = {
+    relativeError(a->pos.x, b->pos.x), relativeError(a->pos.y, b->pos.y), relativeError(a->pos.z, b->pos.z),
+    relativeError(a->vel.x, b->vel.x), relativeError(a->vel.y, b->vel.y), relativeError(a->vel.z, b->vel.z),
+    relativeError(a->acc.x, b->acc.x), relativeError(a->acc.y, b->acc.y), relativeError(a->acc.z, b->acc.z),
+    relativeError(a->omega.x, b->omega.x), relativeError(a->omega.y, b->omega.y), relativeError(a->omega.z, b->omega.z),
+    relativeError(a->yaw, b->yaw),
+  };
+
+  float max = 0;
+  for (unsigned i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+    max = fmaxf(max, errors[i]);
+  }
+  return max;
+}
+
+int main(int argc, char *argv[])
+{
+  long evaluations = 2000000;
+  int option;
+
+  while ((option = getopt(argc, argv, "n:")) != -1) {
+    switch (option) {
+      case 'n': evaluations = atol(optarg); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n evaluations]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  // Pieces of a few seconds with moderate coefficients, like uploaded trajectories
+  srand(3);
+  for (int i = 0; i < PIECES; i++) {
+    pieces[i].duration = 1.0f + (rand() % 100) / 50.0f;
+    for (int axis = 0; axis < 4; axis++) {
+      for (int k = 0; k < PP_SIZE; k++) {
+        pieces[i].p[axis][k] = (rand() % 200 - 100) / (100.0f * (k + 1) * (k + 1));
+      }
+    }
+    poly4d_prepare(&prepared[i], &pieces[i]);
+  }
+  for (int i = 0; i < TIMES; i++) {
+    times[i] = (rand() % 1000) / 1000.0f;
+  }
+
+  float error = 0;
+  for (int i = 0; i < PIECES; i++) {
+    for (int j = 0; j < TIMES; j += 7) {
+      const float t = times[j] * pieces[i].duration;
+      const struct traj_eval reference = referencePoly4dEval(&pieces[i], t);
+      const struct traj_eval fused = poly4d_eval(&pieces[i], t);
+      const struct traj_eval fusedPrepared = poly4d_eval_prepared(&prepared[i], t);
+      error = fmaxf(error, fmaxf(maxError(&fused, &reference), maxError(&fusedPrepared, &reference)));
+    }
+  }
+
+  volatile float sink = 0;
+  double start = now();
+  for (long i = 0; i < evaluations; i++) {
+    sink += referencePoly4dEval(&pieces[i % PIECES], times[i % TIMES]).pos.x;
+  }
+  const double referenceNs = (now() - start) / evaluations * 1e9;
+
+  start = now();
+  for (long i = 0; i < evaluations; i++) {
+    sink += poly4d_eval(&pieces[i % PIECES], times[i % TIMES]).pos.x;
+  }
+  const double fusedNs = (now() - start) / evaluations * 1e9;
+
+  start = now();
+  for (long i = 0; i < evaluations; i++) {
+    sink += poly4d_eval_prepared(&prepared[i % PIECES], times[i % TIMES]).pos.x;
+  }
+  const double preparedNs = (now() - start) / evaluations * 1e9;
+
+  printf("previous poly4d_eval          %6.1f ns\n", referenceNs);
+  printf("poly4d_eval (prepare + eval)  %6.1f ns\n", fusedNs);
+  printf("eval of a prepared piece      %6.1f ns\n", preparedNs);
+  printf("max relative difference %g\n", (double)error);
+
+  const bool ok = error < 1e-4f;
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,357 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * pptraj_minsnap.c - Checks the on-board minimum snap planner
+ *
+ * Plans random waypoint lists with piecewise_plan_minimum_snap, with short,
+ * typical, long and mixed piece durations, and checks in double precision
+ * that the trajectory starts in the start state, passes the waypoints, comes
+ * to rest at the last one and is continuous up to the jerk. The snap cost is
+ * rebuilt from the end derivatives of the pieces, independently of the
+ * planner, and its gradient w.r.t. the free derivatives at the interior
+ * waypoints must be zero.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "pptraj.h"
+
+// Largest errors, relative to the scale of each quantity, see checkPlan(). The
+// jerk at the end of a short piece comes out of the float coefficients with
+// the rounding amplified some 1e4 times, hence the looser jump tolerance.
+// The waypoints are also looked up with piecewise_eval() as the commander
+// does, in float; on 30 s pieces that alone misses them by a few millimeters.
+#define STATE_TOLERANCE 1e-3
+#define WAYPOINT_TOLERANCE 5e-3
+#define JUMP_TOLERANCE 5e-2
+#define OPTIMUM_TOLERANCE 1e-3
+
+typedef struct {
+  const char *name;
+  double minDuration, maxDuration;
+  bool mixed; // each piece is either minDuration or maxDuration long, the
+              // largest ratio the planner accepts
+} regime_t;
+
+static const regime_t regimes[] = {
+  { "short",   0.1, 0.3, false },
+  { "typical", 1.0, 3.0, false },
+  { "long",   10.0, 30.0, false },
+  { "mixed",   0.5, 2.0, true },
+};
+
+typedef struct {
+  double state;    // start state, waypoints and rest at the end
+  double waypoint; // waypoints missed by piecewise_eval, in float
+  double jump;     // discontinuity at the waypoints
+  double optimum;  // distance to the minimum of the snap cost
+  int failed;      // plans that were rejected or malformed
+} errors_t;
+
+// Coefficients of a 7th order polynomial on [0, 1] from its end derivatives
+// (p0, v0, a0, j0, p1, v1, a1, j1)
+static double endsToCoefficients[8][8];
+
+static double uniform(double min, double max)
+{
+  return min + (max - min) * rand() / (double)RAND_MAX;
+}
+
+static double factorialRatio(int i, int d)
+{
+  double r = 1;
+  for (int k = i - d + 1; k <= i; k++) {
+    r *= k;
+  }
+  return r;
+}
+
+// Inverts the matrix that maps the coefficients to the end derivatives
+static void initEndsToCoefficients(void)
+{
+  double a[8][16] = {{ 0 }};
+
+  for (int d = 0; d < 4; d++) {
+    a[d][d] = factorialRatio(d, d);
+    for (int i = d; i < 8; i++) {
+      a[4 + d][i] = factorialRatio(i, d);
+    }
+  }
+  for (int r = 0; r < 8; r++) {
+    a[r][8 + r] = 1;
+  }
+
+  for (int c = 0; c < 8; c++) {
+    int pivot = c;
+    for (int r = c + 1; r < 8; r++) {
+      if (fabs(a[r][c]) > fabs(a[pivot][c])) {
+        pivot = r;
+      }
+    }
+    for (int k = 0; k < 16; k++) {
+      const double swap = a[c][k];
+      a[c][k] = a[pivot][k];
+      a[pivot][k] = swap;
+    }
+    const double scale = a[c][c];
+    for (int k = 0; k < 16; k++) {
+      a[c][k] /= scale;
+    }
+    for (int r = 0; r < 8; r++) {
+      if (r != c) {
+        const double f = a[r][c];
+        for (int k = 0; k < 16; k++) {
+          a[r][k] -= f * a[c][k];
+        }
+      }
+    }
+  }
+
+  for (int r = 0; r < 8; r++) {
+    memcpy(endsToCoefficients[r], &a[r][8], sizeof(endsToCoefficients[r]));
+  }
+}
+
+// Sum of the absolute terms of the d-th derivative at time t, the rounding of
+// the float coefficients shows relative to it
+static double magnitude(const struct poly4d *piece, int axis, int d, double t)
+{
+  double value = 0;
+  for (int i = PP_SIZE - 1; i >= d; i--) {
+    value = value * t + fabs(piece->p[axis][i]) * factorialRatio(i, d);
+  }
+  return value;
+}
+
+// d-th derivative of an axis of a planned piece at time t
+static double derivative(const struct poly4d *piece, int axis, int d, double t)
+{
+  double value = 0;
+  for (int i = PP_SIZE - 1; i >= d; i--) {
+    value = value * t + piece->p[axis][i] * factorialRatio(i, d);
+  }
+  return value;
+}
+
+// Integral of the squared snap of the piece of duration T with the given end
+// derivatives
+static double snapCost(const double ends[8], double T)
+{
+  double scaled[8], a[8], cost = 0;
+
+  for (int d = 0; d < 4; d++) {
+    scaled[d] = ends[d] * pow(T, d);
+    scaled[4 + d] = ends[4 + d] * pow(T, d);
+  }
+  for (int i = 0; i < 8; i++) {
+    a[i] = 0;
+    for (int j = 0; j < 8; j++) {
+      a[i] += endsToCoefficients[i][j] * scaled[j];
+    }
+  }
+  for (int i = 4; i < 8; i++) {
+    for (int j = 4; j < 8; j++) {
+      cost += factorialRatio(i, 4) * factorialRatio(j, 4) * a[i] * a[j] / (i + j - 7);
+    }
+  }
+  return cost / pow(T, 7);
+}
+
+// Snap cost of one axis of the whole trajectory, from the derivatives at the
+// waypoints: knots[k][d] for waypoint k, the start being waypoint 0
+static double totalSnapCost(double knots[][4], const double *durations, int n)
+{
+  double cost = 0;
+
+  for (int s = 0; s < n; s++) {
+    double ends[8];
+    memcpy(ends, knots[s], 4 * sizeof(double));
+    memcpy(ends + 4, knots[s + 1], 4 * sizeof(double));
+    cost += snapCost(ends, durations[s]);
+  }
+  return cost;
+}
+
+static void checkPlan(const regime_t *regime, int n, errors_t *errors)
+{
+  struct piecewise_traj traj;
+  struct poly4d pieces[PP_MINSNAP_MAX_WAYPOINTS];
+  struct traj_eval start = { 0 };
+  struct vec positions[PP_MINSNAP_MAX_WAYPOINTS];
+  float yaws[PP_MINSNAP_MAX_WAYPOINTS];
+  float durations[PP_MINSNAP_MAX_WAYPOINTS];
+  double durationsDouble[PP_MINSNAP_MAX_WAYPOINTS];
+
+  start.pos = mkvec(uniform(-2, 2), uniform(-2, 2), uniform(0, 2));
+  start.vel = mkvec(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1));
+  start.acc = mkvec(uniform(-2, 2), uniform(-2, 2), uniform(-2, 2));
+  start.yaw = uniform(-M_PI, M_PI);
+  start.omega.z = uniform(-1, 1);
+
+  // largest coordinate, the rounding of the positions is relative to it
+  double size = fmax(1, fmax(fabs(start.yaw), vmaxelt(vabs(start.pos))));
+  for (int k = 0; k < n; k++) {
+    positions[k] = mkvec(uniform(-2, 2), uniform(-2, 2), uniform(0, 2));
+    yaws[k] = uniform(-M_PI, M_PI);
+    if (regime->mixed) {
+      durations[k] = (rand() % 2) ? regime->minDuration : regime->maxDuration;
+    } else {
+      durations[k] = uniform(regime->minDuration, regime->maxDuration);
+    }
+    durationsDouble[k] = durations[k];
+    size = fmax(size, fmax(vmaxelt(vabs(positions[k])), fabs(yaws[k])));
+  }
+
+  bool isPlanned = piecewise_plan_minimum_snap(&traj, pieces, &start, positions, yaws, durations, n) &&
+                   traj.pieces == pieces && traj.n_pieces == n && traj.timescale == 1;
+  for (int k = 0; k < n && isPlanned; k++) {
+    isPlanned = pieces[k].duration == durations[k];
+  }
+  if (!isPlanned) {
+    errors->failed++;
+    return;
+  }
+
+  // the waypoints as the high-level commander evaluates the trajectory
+  float t = 0;
+  traj.t_begin = 0;
+  for (int k = 0; k < n; k++) {
+    t += durations[k];
+    const struct traj_eval ev = piecewise_eval(&traj, t);
+    errors->waypoint = fmax(errors->waypoint, vmag(vsub(ev.pos, positions[k])) / size);
+  }
+
+  for (int axis = 0; axis < 4; axis++) {
+    // derivatives at the waypoints as the planner has to meet them, the
+    // interior ones are taken from the plan
+    double knots[PP_MINSNAP_MAX_WAYPOINTS + 1][4] = {{ 0 }};
+    const float startState[4][4] = {
+      { start.pos.x, start.pos.y, start.pos.z, start.yaw },
+      { start.vel.x, start.vel.y, start.vel.z, start.omega.z },
+      { start.acc.x, start.acc.y, start.acc.z, 0 },
+      { 0, 0, 0, 0 },
+    };
+    for (int d = 0; d < 4; d++) {
+      knots[0][d] = startState[d][axis];
+    }
+    for (int k = 1; k <= n; k++) {
+      const float waypoint[4] = { positions[k - 1].x, positions[k - 1].y, positions[k - 1].z, yaws[k - 1] };
+      knots[k][0] = waypoint[axis];
+      for (int d = 1; d < 4 && k < n; d++) {
+        knots[k][d] = derivative(&pieces[k], axis, d, 0);
+      }
+    }
+
+    // both ends of every piece, relative to the scale of the derivative over
+    // the piece and to the size of the terms it is evaluated from
+    for (int s = 0; s < n; s++) {
+      const double T = durationsDouble[s];
+      for (int d = 0; d < 4; d++) {
+        const double scale = size / pow(T, d) + magnitude(&pieces[s], axis, d, T);
+        const double begin = derivative(&pieces[s], axis, d, 0);
+        const double end = derivative(&pieces[s], axis, d, T);
+        if (s == 0) {
+          errors->state = fmax(errors->state, fabs(begin - knots[0][d]) / scale);
+        }
+        if (d == 0 || s == n - 1) {
+          errors->state = fmax(errors->state, fabs(end - knots[s + 1][d]) / scale);
+        } else {
+          // the next piece starts with the derivatives of knots[s + 1]
+          errors->jump = fmax(errors->jump, fabs(end - knots[s + 1][d]) / scale);
+        }
+      }
+    }
+
+    // the cost is quadratic in each free derivative: the central differences
+    // with a step of its scale give how far it is from the minimum, in units
+    // of the scale. The shorter piece sets the scale, its cost dominates.
+    const double cost = totalSnapCost(knots, durationsDouble, n);
+    for (int k = 1; k < n; k++) {
+      const double shortest = fmin(durationsDouble[k - 1], durationsDouble[k]);
+      for (int d = 1; d < 4; d++) {
+        const double x = knots[k][d], h = fabs(x) + size / pow(shortest, d);
+        knots[k][d] = x + h;
+        const double plus = totalSnapCost(knots, durationsDouble, n);
+        knots[k][d] = x - h;
+        const double minus = totalSnapCost(knots, durationsDouble, n);
+        knots[k][d] = x;
+        const double offset = (plus - minus) / (2 * (plus + minus - 2 * cost));
+        errors->optimum = fmax(errors->optimum, fabs(offset));
+      }
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int cases = 500;
+  int option;
+
+  while ((option = getopt(argc, argv, "n:")) != -1) {
+    switch (option) {
+      case 'n': cases = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n cases per duration range]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  initEndsToCoefficients();
+  srand(7);
+
+  bool ok = true;
+  printf("durations          state  waypoint      jump   optimum  failed\n");
+  for (unsigned r = 0; r < sizeof(regimes) / sizeof(regimes[0]); r++) {
+    const regime_t *regime = &regimes[r];
+    errors_t errors = { 0 };
+    for (int i = 0; i < cases; i++) {
+      checkPlan(regime, 1 + i % PP_MINSNAP_MAX_WAYPOINTS, &errors);
+    }
+    printf("%-7s %4.1f-%4.1f s  %8.2g  %8.2g  %8.2g  %8.2g  %6d\n", regime->name, regime->minDuration,
+           regime->maxDuration, errors.state, errors.waypoint, errors.jump, errors.optimum, errors.failed);
+    ok = ok && errors.state < STATE_TOLERANCE && errors.waypoint < WAYPOINT_TOLERANCE && errors.jump < JUMP_TOLERANCE &&
+         errors.optimum < OPTIMUM_TOLERANCE && errors.failed == 0;
+  }
+
+  // invalid input is rejected
+  struct piecewise_traj traj;
+  struct poly4d pieces[PP_MINSNAP_MAX_WAYPOINTS + 1];
+  struct traj_eval start = { 0 };
+  struct vec positions[PP_MINSNAP_MAX_WAYPOINTS + 1] = {{ 0 }};
+  float yaws[PP_MINSNAP_MAX_WAYPOINTS + 1] = { 0 };
+  float durations[PP_MINSNAP_MAX_WAYPOINTS + 1] = { 1, 1, 0, 1, 1, 1, 1, 1, 1 };
+  const float unbalanced[2] = { 1, 1.01f * PP_MINSNAP_MAX_DURATION_RATIO };
+  const bool rejected = !piecewise_plan_minimum_snap(&traj, pieces, &start, positions, yaws, durations, 0) &&
+                        !piecewise_plan_minimum_snap(&traj, pieces, &start, positions, yaws, durations, 3) &&
+                        !piecewise_plan_minimum_snap(&traj, pieces, &start, positions, yaws, durations + 3,
+                                                     PP_MINSNAP_MAX_WAYPOINTS + 1) &&
+                        !piecewise_plan_minimum_snap(&traj, pieces, &start, positions, yaws, unbalanced, 2);
+  printf("invalid input: %s\n", rejected ? "rejected" : "accepted");
+  ok = ok && rejected;
+
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
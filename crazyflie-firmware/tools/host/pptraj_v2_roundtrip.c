@@ -0,0 +1,526 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * pptraj_v2_roundtrip.c - Reference encoder and round trip test of the v2
+ *                         compressed trajectory format
+ *
+ * A random trajectory is written in the v1 format and, with the reference
+ * encoder below, in the v2 format with varints and with Rice codes. All
+ * three are decoded by pptraj_compressed.c and must evaluate the same, also
+ * right before and after each piece boundary and with a timescale. Truncated
+ * and corrupted v2 data must be rejected by piecewise_compressed_v2_validate
+ * or at least be decoded without reading past the end of the data, which is
+ * checked by building with the address sanitizer. Reports the sizes of the
+ * encodings.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "pptraj_compressed.h"
+
+// As in pptraj_compressed.c
+static const uint8_t controlPointsByType[] = { 0, 1, 3, 7 };
+#define STORED_ANGLE_SCALE 0.1
+
+#define RICE_ESCAPE 16
+#define CONTEXT_DURATION 4
+
+// Evaluations of the forward pass, as the high-level commander does
+#define STEP 0.002f
+
+// Tolerances of the comparison with v1, see maxError()
+#define POSITION_TOLERANCE 1e-4f
+#define DERIVATIVE_TOLERANCE 1e-2f
+#define ANGLE_TOLERANCE 1e-3f
+
+typedef struct {
+  uint8_t types;
+  uint16_t durationMs;
+  int16_t points[4][7];
+} piece_t;
+
+typedef struct {
+  int16_t start[4];
+  piece_t *pieces;
+  int count;
+} trajectory_t;
+
+typedef struct {
+  uint8_t *data;
+  uint32_t size;
+  uint32_t capacity;
+  int bit;
+  bool rice;
+  uint32_t acc[PPTRAJ_V2_CONTEXTS];
+  int escapes;
+} writer_t;
+
+static void writeByte(writer_t *w, uint8_t byte)
+{
+  if (w->size == w->capacity) {
+    w->capacity = w->capacity ? 2 * w->capacity : 256;
+    w->data = realloc(w->data, w->capacity);
+  }
+  w->data[w->size++] = byte;
+}
+
+static void writeInt16(writer_t *w, int16_t value)
+{
+  writeByte(w, (uint16_t)value & 0xff);
+  writeByte(w, (uint16_t)value >> 8);
+}
+
+// Writes n <= 32 bits, least significant first
+static void writeBits(writer_t *w, uint32_t value, int n)
+{
+  for (int i = 0; i < n; i++) {
+    if (w->bit == 0) {
+      writeByte(w, 0);
+    }
+    w->data[w->size - 1] |= ((value >> i) & 1) << w->bit;
+    w->bit = (w->bit + 1) % 8;
+  }
+}
+
+static void writeUnsigned(writer_t *w, uint32_t value, int context)
+{
+  if (!w->rice) {
+    do {
+      uint8_t byte = value & 0x7f;
+      value >>= 7;
+      writeBits(w, byte | (value ? 0x80 : 0), 8);
+    } while (value);
+    return;
+  }
+
+  const uint32_t mean = w->acc[context] >> 4;
+  int k;
+  for (k = 0; (mean >> 1) >> k; k++);
+
+  const uint32_t quotient = value >> k;
+  if (quotient >= RICE_ESCAPE) {
+    writeBits(w, (1u << RICE_ESCAPE) - 1, RICE_ESCAPE);
+    writeBits(w, value, 32);
+    w->escapes++;
+  } else {
+    writeBits(w, (1u << quotient) - 1, quotient);
+    writeBits(w, 0, 1);
+    writeBits(w, value & ((1u << k) - 1), k);
+  }
+
+  w->acc[context] += (value < 0xffff ? value : 0xffff) - mean;
+}
+
+static void writeSigned(writer_t *w, int32_t value, int context)
+{
+  writeUnsigned(w, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31), context);
+}
+
+static void writeFloat(writer_t *w, float value)
+{
+  uint8_t bytes[sizeof(float)];
+  memcpy(bytes, &value, sizeof(bytes));
+  for (unsigned i = 0; i < sizeof(bytes); i++) {
+    writeByte(w, bytes[i]);
+  }
+}
+
+static void encodeV1(const trajectory_t *traj, writer_t *w)
+{
+  memset(w, 0, sizeof(*w));
+  for (int axis = 0; axis < 4; axis++) {
+    writeInt16(w, traj->start[axis]);
+  }
+  for (int i = 0; i < traj->count; i++) {
+    const piece_t *piece = &traj->pieces[i];
+    writeByte(w, piece->types);
+    writeInt16(w, piece->durationMs);
+    for (int axis = 0; axis < 4; axis++) {
+      for (int j = 0; j < controlPointsByType[(piece->types >> (2 * axis)) & 0x03]; j++) {
+        writeInt16(w, piece->points[axis][j]);
+      }
+    }
+  }
+  writeByte(w, 0);
+  writeInt16(w, 0);
+}
+
+// The reference encoder of the v2 format, see pptraj_compressed.h. The units
+// are the ones of the v1 format so that both decode to the same trajectory.
+static void encodeV2(const trajectory_t *traj, bool rice, writer_t *w)
+{
+  int32_t previous[4];
+
+  memset(w, 0, sizeof(*w));
+  w->rice = rice;
+  writeByte(w, PPTRAJ_V2_VERSION);
+  writeByte(w, rice ? PPTRAJ_V2_FLAG_RICE : 0);
+  writeFloat(w, 0.001f);
+  writeFloat(w, 1.0f / STORED_ANGLE_SCALE);
+  writeFloat(w, 0.001f);
+
+  for (int axis = 0; axis < 4; axis++) {
+    writeSigned(w, traj->start[axis], axis);
+    previous[axis] = traj->start[axis];
+  }
+  for (int i = 0; i < traj->count; i++) {
+    const piece_t *piece = &traj->pieces[i];
+    writeBits(w, piece->types, 8);
+    writeUnsigned(w, piece->durationMs, CONTEXT_DURATION);
+    for (int axis = 0; axis < 4; axis++) {
+      for (int j = 0; j < controlPointsByType[(piece->types >> (2 * axis)) & 0x03]; j++) {
+        writeSigned(w, piece->points[axis][j] - previous[axis], axis);
+        previous[axis] = piece->points[axis][j];
+      }
+    }
+  }
+  writeBits(w, 0, 8);
+  writeUnsigned(w, 0, CONTEXT_DURATION);
+}
+
+static int16_t clampInt16(int32_t value)
+{
+  return value < -30000 ? -30000 : value > 30000 ? 30000 : value;
+}
+
+// Pieces of 0.2 to 1 s with random storage types. Some pieces of 1 to 2 s
+// jump by 0.6 m, which the Rice coder has to escape, and some pieces of a few
+// ms with small steps test the synchronous decoding.
+static void generate(trajectory_t *traj, int count)
+{
+  static const int16_t steps[4] = { 100, 100, 50, 1 };
+  int32_t position[4];
+
+  traj->count = count;
+  traj->pieces = calloc(count, sizeof(piece_t));
+  for (int axis = 0; axis < 4; axis++) {
+    traj->start[axis] = axis < 3 ? rand() % 2000 - 1000 : 0;
+    position[axis] = traj->start[axis];
+  }
+
+  for (int i = 0; i < count; i++) {
+    piece_t *piece = &traj->pieces[i];
+    const int kind = rand() % 20;
+    const bool isShort = kind < 2, isJump = kind == 2;
+    piece->types = rand() & 0xff;
+    piece->durationMs = isShort ? 1 + rand() % 10 : isJump ? 1000 + rand() % 1000 : 200 + rand() % 800;
+    for (int axis = 0; axis < 4; axis++) {
+      for (int j = 0; j < controlPointsByType[(piece->types >> (2 * axis)) & 0x03]; j++) {
+        const int16_t maxStep = isShort ? steps[axis] / 100 : steps[axis];
+        int32_t step = rand() % (2 * maxStep + 1) - maxStep;
+        if (isJump && axis < 3 && j == 0) {
+          step = (rand() % 2) ? 600 : -600;
+        }
+        position[axis] = clampInt16(position[axis] + step);
+        if (axis == 3) {
+          position[axis] = position[axis] < -1 ? -1 : position[axis] > 1 ? 1 : position[axis];
+        }
+        piece->points[axis][j] = position[axis];
+      }
+    }
+  }
+}
+
+// Duration of the piece at time t [s], as v1 places the pieces
+static float pieceDuration(const trajectory_t *traj, float t)
+{
+  float end = 0;
+  for (int i = 0; i < traj->count; i++) {
+    end += (float)(traj->pieces[i].durationMs / 1000.0);
+    if (t < end) {
+      return traj->pieces[i].durationMs / 1000.0f;
+    }
+  }
+  return 1.0f;
+}
+
+static float relativeError(float value, float reference, float floor)
+{
+  return fabsf(value - reference) / fmaxf(floor, fabsf(reference));
+}
+
+// Compares what the decoded pieces define. omega is left out, it is derived
+// from these by the same code and is ill conditioned where the thrust is close
+// to zero. v1 starts each piece at a float evaluation of the end of the
+// previous one, so its position drifts by some um over the trajectory while
+// v2 joins the pieces exactly. This shows in the derivatives divided by the
+// duration of the piece, hence the floors of the relative errors. A decoding
+// error, like a wrong piece or control point, is much larger. Returns the
+// largest error in units of its tolerance. Yaw is stored in units of
+// 1 / STORED_ANGLE_SCALE, which is its floor, so the drift of the yaw is
+// that much larger than the one of the position.
+static float maxError(const struct traj_eval *a, const struct traj_eval *b, float timescale, float duration)
+{
+  const float s = timescale, s2 = timescale * timescale;
+  const float v = fmaxf(1.0f, 1.0f / duration), acc = fmaxf(1.0f, 1.0f / (duration * duration));
+  const float p = 1.0f / POSITION_TOLERANCE, d = 1.0f / DERIVATIVE_TOLERANCE;
+  const float errors[] = {
+    p * relativeError(a->pos.x, b->pos.x, 1), p * relativeError(a->pos.y, b->pos.y, 1), p * relativeError(a->pos.z, b->pos.z, 1),
+    d * relativeError(a->vel.x * s, b->vel.x, v), d * relativeError(a->vel.y * s, b->vel.y, v), d * relativeError(a->vel.z * s, b->vel.z, v),
+    d * relativeError(a->acc.x * s2, b->acc.x, acc), d * relativeError(a->acc.y * s2, b->acc.y, acc), d * relativeError(a->acc.z * s2, b->acc.z, acc),
+    relativeError(a->yaw, b->yaw, 1.0f / STORED_ANGLE_SCALE) / ANGLE_TOLERANCE,
+  };
+
+  float max = 0;
+  for (unsigned i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+    max = fmaxf(max, errors[i]);
+  }
+  return max;
+}
+
+// Copies data into a buffer of exactly size bytes, so that the address
+// sanitizer catches any read past the end
+static uint8_t *exactCopy(const uint8_t *data, uint32_t size)
+{
+  uint8_t *copy = malloc(size ? size : 1);
+  memcpy(copy, data, size);
+  return copy;
+}
+
+// Compares v2 with v1 on a forward pass, around the piece boundaries and at
+// random times. Returns the largest difference in units of its tolerance.
+static float compare(const trajectory_t *traj, const uint8_t *v1, const writer_t *v2, float timescale)
+{
+  struct piecewise_traj_compressed a;
+  struct piecewise_traj_compressed_v2 b;
+  float error = 0;
+
+  piecewise_compressed_load(&a, v1);
+  const float duration = piecewise_compressed_v2_validate(v2->data, v2->size);
+  if (!piecewise_compressed_v2_load(&b, v2->data, v2->size, timescale, duration)) {
+    return INFINITY;
+  }
+  error = fmaxf(error, relativeError(b.duration, a.duration * timescale, 1) / POSITION_TOLERANCE);
+
+  // Forward pass at the rate of the commander. The decoders sum the piece
+  // durations in float, so they may place a boundary a few us apart, the
+  // evaluations keep half a ms away from them.
+  float boundary = 0;
+  for (int i = 0; i <= traj->count; i++) {
+    const float begin = boundary;
+    boundary = i < traj->count ? begin + (float)(traj->pieces[i].durationMs / 1000.0) : begin + 1.0f;
+    for (float t = begin + 0.0005f; t < boundary - 0.0004f; t += STEP) {
+      struct traj_eval ea = piecewise_compressed_eval(&a, t);
+      struct traj_eval eb = piecewise_compressed_v2_eval(&b, t * timescale);
+      error = fmaxf(error, maxError(&eb, &ea, timescale, boundary - begin));
+    }
+  }
+
+  // The pieces are not C1 at their boundaries, so an evaluation in the wrong
+  // piece shows in the velocity
+  boundary = 0;
+  for (int i = 0; i < traj->count; i++) {
+    boundary += (float)(traj->pieces[i].durationMs / 1000.0);
+    for (int side = -1; side <= 1; side += 2) {
+      const float t = boundary + side * 0.0005f;
+      struct traj_eval ea = piecewise_compressed_eval(&a, t);
+      struct traj_eval eb = piecewise_compressed_v2_eval(&b, t * timescale);
+      error = fmaxf(error, maxError(&eb, &ea, timescale, pieceDuration(traj, t)));
+    }
+    // On the boundary itself only the position is defined
+    struct traj_eval ea = piecewise_compressed_eval(&a, boundary);
+    struct traj_eval eb = piecewise_compressed_v2_eval(&b, boundary * timescale);
+    error = fmaxf(error, fmaxf(relativeError(eb.pos.x, ea.pos.x, 1),
+                               fmaxf(relativeError(eb.pos.y, ea.pos.y, 1), relativeError(eb.pos.z, ea.pos.z, 1))) / POSITION_TOLERANCE);
+  }
+
+  // Jumps back and forth, which rewind the decoders
+  for (int i = 0; i < 1000; i++) {
+    const float t = (rand() % (int)(a.duration * 1000) + 0.5f) / 1000.0f;
+    struct traj_eval ea = piecewise_compressed_eval(&a, t);
+    struct traj_eval eb = piecewise_compressed_v2_eval(&b, t * timescale);
+    error = fmaxf(error, maxError(&eb, &ea, timescale, pieceDuration(traj, t)));
+  }
+
+  return error;
+}
+
+// Decodes possibly broken data over its whole duration
+static void decodeAll(const uint8_t *data, uint32_t size, float duration)
+{
+  struct piecewise_traj_compressed_v2 traj;
+
+  if (piecewise_compressed_v2_load(&traj, data, size, 1.0f, duration)) {
+    for (float t = 0; t < duration + 0.1f; t += 0.05f) {
+      piecewise_compressed_v2_eval(&traj, t);
+    }
+  }
+}
+
+// Every strict prefix of the data misses at least the end marker
+static bool checkTruncated(const writer_t *v2)
+{
+  const float duration = piecewise_compressed_v2_validate(v2->data, v2->size);
+  int accepted = 0;
+
+  for (uint32_t size = 0; size < v2->size; size++) {
+    uint8_t *copy = exactCopy(v2->data, size);
+    if (piecewise_compressed_v2_validate(copy, size) >= 0) {
+      accepted++;
+    }
+    decodeAll(copy, size, duration);
+    free(copy);
+  }
+
+  printf("  truncated: %d of %u prefixes accepted\n", accepted, (unsigned)v2->size);
+  return accepted == 0;
+}
+
+// The loader only checks the header again, the pieces are checked by
+// piecewise_compressed_v2_validate alone
+static bool expectRejected(const char *what, const uint8_t *data, uint32_t size, bool isHeader)
+{
+  struct piecewise_traj_compressed_v2 traj;
+  uint8_t *copy = exactCopy(data, size);
+  const bool rejected = piecewise_compressed_v2_validate(copy, size) < 0
+                        && !(isHeader && piecewise_compressed_v2_load(&traj, copy, size, 1.0f, 1.0f));
+  free(copy);
+
+  if (!rejected) {
+    printf("  %s: accepted\n", what);
+  }
+  return rejected;
+}
+
+static bool checkCorrupt(const writer_t *v2, int trials)
+{
+  uint8_t *data = malloc(v2->size);
+  const float nan = NAN, negative = -0.001f, zero = 0;
+  bool ok = true;
+
+  // Broken headers
+  memcpy(data, v2->data, v2->size);
+  data[0] = 1;
+  ok = expectRejected("version 1", data, v2->size, true) && ok;
+  data[0] = 3;
+  ok = expectRejected("version 3", data, v2->size, true) && ok;
+  memcpy(data, v2->data, v2->size);
+  data[1] |= 0x02;
+  ok = expectRejected("unknown flag", data, v2->size, true) && ok;
+  for (int unit = 0; unit < 3; unit++) {
+    memcpy(data, v2->data, v2->size);
+    memcpy(data + 2 + unit * sizeof(float), &zero, sizeof(float));
+    ok = expectRejected("zero unit", data, v2->size, true) && ok;
+    memcpy(data + 2 + unit * sizeof(float), &negative, sizeof(float));
+    ok = expectRejected("negative unit", data, v2->size, true) && ok;
+    memcpy(data + 2 + unit * sizeof(float), &nan, sizeof(float));
+    ok = expectRejected("NaN unit", data, v2->size, true) && ok;
+  }
+
+  // A varint longer than 32 bits
+  memcpy(data, v2->data, 2 + 3 * sizeof(float));
+  data[1] = 0;
+  memset(data + 2 + 3 * sizeof(float), 0x80, 6);
+  ok = expectRejected("long varint", data, 2 + 3 * sizeof(float) + 6, false) && ok;
+
+  // Random bit flips after the header must not make the decoder misbehave
+  int accepted = 0;
+  for (int i = 0; i < trials; i++) {
+    memcpy(data, v2->data, v2->size);
+    for (int flips = 1 + rand() % 3; flips > 0; flips--) {
+      const uint32_t byte = 2 + 3 * sizeof(float) + rand() % (v2->size - 2 - 3 * sizeof(float));
+      data[byte] ^= 1 << (rand() % 8);
+    }
+    uint8_t *copy = exactCopy(data, v2->size);
+    const float duration = piecewise_compressed_v2_validate(copy, v2->size);
+    if (duration >= 0) {
+      accepted++;
+      decodeAll(copy, v2->size, fminf(duration, 100.0f));
+    }
+    free(copy);
+  }
+  printf("  corrupted: %d of %d accepted and decoded\n", accepted, trials);
+
+  free(data);
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  int pieces = 100;
+  int trials = 2000;
+  int option;
+
+  while ((option = getopt(argc, argv, "n:t:")) != -1) {
+    switch (option) {
+      case 'n': pieces = atoi(optarg); break;
+      case 't': trials = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n pieces] [-t corruption trials]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  trajectory_t traj, small;
+  writer_t v1, varint, rice, smallVarint, smallRice;
+  bool ok = true;
+
+  srand(5);
+  generate(&traj, pieces);
+  encodeV1(&traj, &v1);
+  encodeV2(&traj, false, &varint);
+  encodeV2(&traj, true, &rice);
+
+  printf("%d pieces: v1 %u bytes, v2 varint %u bytes (%+.0f%%), v2 Rice %u bytes (%+.0f%%, %d escapes)\n",
+         pieces, (unsigned)v1.size,
+         (unsigned)varint.size, 100.0 * varint.size / v1.size - 100,
+         (unsigned)rice.size, 100.0 * rice.size / v1.size - 100, rice.escapes);
+
+  const float errors[] = {
+    compare(&traj, v1.data, &varint, 1.0f),
+    compare(&traj, v1.data, &rice, 1.0f),
+    compare(&traj, v1.data, &rice, 2.0f),
+  };
+  printf("max difference to v1 in tolerances: varint %.2f, Rice %.2f, Rice with timescale 2 %.2f\n",
+         (double)errors[0], (double)errors[1], (double)errors[2]);
+  for (unsigned i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+    ok = ok && errors[i] < 1;
+  }
+  ok = ok && rice.escapes > 0;
+
+  // The broken data checks decode each case over the whole trajectory, a
+  // short one keeps them fast
+  generate(&small, 16);
+  encodeV2(&small, false, &smallVarint);
+  encodeV2(&small, true, &smallRice);
+  printf("varint:\n");
+  ok = checkTruncated(&smallVarint) && ok;
+  ok = checkCorrupt(&smallVarint, trials) && ok;
+  printf("Rice:\n");
+  ok = checkTruncated(&smallRice) && ok;
+  ok = checkCorrupt(&smallRice, trials) && ok;
+
+  free(traj.pieces);
+  free(small.pieces);
+  free(v1.data);
+  free(varint.data);
+  free(rice.data);
+  free(smallVarint.data);
+  free(smallRice.data);
+
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,401 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * freertos_host.c - FreeRTOS kernel API on POSIX threads
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+
+struct hostQueue {
+  pthread_mutex_t lock;
+  pthread_cond_t notEmpty;
+  pthread_cond_t notFull;
+  uint8_t *storage;
+  UBaseType_t length;
+  UBaseType_t itemSize;
+  UBaseType_t head;
+  UBaseType_t count;
+};
+
+static pthread_mutex_t criticalLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+void vHostEnterCritical(void)
+{
+  pthread_mutex_lock(&criticalLock);
+}
+
+void vHostExitCritical(void)
+{
+  pthread_mutex_unlock(&criticalLock);
+}
+
+static struct timespec monotonicNow(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now;
+}
+
+static struct timespec start;
+static pthread_once_t startOnce = PTHREAD_ONCE_INIT;
+
+static void startClock(void)
+{
+  start = monotonicNow();
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+  pthread_once(&startOnce, startClock);
+  struct timespec now = monotonicNow();
+
+  return (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+  return xTaskGetTickCount();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  struct timespec delay = { .tv_sec = ticks / 1000, .tv_nsec = (ticks % 1000) * 1000000L };
+
+  while (nanosleep(&delay, &delay) == -1 && errno == EINTR);
+}
+
+void vTaskDelayUntil(TickType_t *previousWakeTime, TickType_t period)
+{
+  TickType_t now = xTaskGetTickCount();
+
+  *previousWakeTime += period;
+  if ((int32_t)(*previousWakeTime - now) > 0)
+  {
+    vTaskDelay(*previousWakeTime - now);
+  }
+}
+
+void vTaskSuspendAll(void)
+{
+  vHostEnterCritical();
+}
+
+BaseType_t xTaskResumeAll(void)
+{
+  vHostExitCritical();
+  return pdFALSE;
+}
+
+struct taskStart {
+  void (*task)(void*);
+  void *parameters;
+};
+
+static void* taskEntry(void *arg)
+{
+  struct taskStart start = *(struct taskStart*)arg;
+
+  free(arg);
+  start.task(start.parameters);
+
+  return NULL;
+}
+
+BaseType_t xTaskCreate(void (*task)(void*), const char *name, uint32_t stackDepth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *handle)
+{
+  pthread_t thread;
+  struct taskStart *start = malloc(sizeof(struct taskStart));
+
+  start->task = task;
+  start->parameters = parameters;
+  if (pthread_create(&thread, NULL, taskEntry, start) != 0)
+  {
+    free(start);
+    return pdFAIL;
+  }
+  pthread_detach(thread);
+
+  if (handle)
+  {
+    *handle = (TaskHandle_t)thread;
+  }
+
+  return pdPASS;
+}
+
+TaskHandle_t xTaskCreateStatic(void (*task)(void*), const char *name, uint32_t stackDepth,
+                               void *parameters, UBaseType_t priority,
+                               StackType_t *stack, StaticTask_t *taskBuffer)
+{
+  TaskHandle_t handle = NULL;
+
+  xTaskCreate(task, name, stackDepth, parameters, priority, &handle);
+  taskBuffer->handle = handle;
+
+  return handle;
+}
+
+// Absolute deadline of a wait in ticks, NULL for portMAX_DELAY
+static const struct timespec* deadline(TickType_t wait, struct timespec *at)
+{
+  if (wait == portMAX_DELAY)
+  {
+    return NULL;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  at->tv_sec = now.tv_sec + wait / 1000;
+  at->tv_nsec = now.tv_nsec + (wait % 1000) * 1000000L;
+  if (at->tv_nsec >= 1000000000L)
+  {
+    at->tv_sec++;
+    at->tv_nsec -= 1000000000L;
+  }
+
+  return at;
+}
+
+// Waits on cond until ready() or the deadline. Called with the queue locked.
+static bool waitFor(struct hostQueue *q, pthread_cond_t *cond, bool (*ready)(struct hostQueue*), TickType_t wait)
+{
+  struct timespec at;
+  const struct timespec *until = deadline(wait, &at);
+
+  while (!ready(q))
+  {
+    if (wait == 0)
+    {
+      return false;
+    }
+
+    if (until)
+    {
+      if (pthread_cond_timedwait(cond, &q->lock, until) == ETIMEDOUT)
+      {
+        return ready(q);
+      }
+    }
+    else
+    {
+      pthread_cond_wait(cond, &q->lock);
+    }
+  }
+
+  return true;
+}
+
+static bool hasSpace(struct hostQueue *q)
+{
+  return q->count < q->length;
+}
+
+static bool hasItem(struct hostQueue *q)
+{
+  return q->count > 0;
+}
+
+static uint8_t* slot(struct hostQueue *q, UBaseType_t index)
+{
+  return &q->storage[((q->head + index) % q->length) * q->itemSize];
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+  struct hostQueue *q = calloc(1, sizeof(struct hostQueue));
+
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->notEmpty, NULL);
+  pthread_cond_init(&q->notFull, NULL);
+  q->storage = (itemSize > 0) ? calloc(length, itemSize) : NULL;
+  q->length = length;
+  q->itemSize = itemSize;
+
+  return q;
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t itemSize,
+                                 uint8_t *storage, StaticQueue_t *queueBuffer)
+{
+  queueBuffer->handle = xQueueCreate(length, itemSize);
+
+  return queueBuffer->handle;
+}
+
+static BaseType_t queueSend(QueueHandle_t queue, const void *item, TickType_t wait, bool front)
+{
+  struct hostQueue *q = queue;
+
+  pthread_mutex_lock(&q->lock);
+  if (!waitFor(q, &q->notFull, hasSpace, wait))
+  {
+    pthread_mutex_unlock(&q->lock);
+    return errQUEUE_FULL;
+  }
+
+  if (front)
+  {
+    q->head = (q->head + q->length - 1) % q->length;
+  }
+  if (q->itemSize > 0)
+  {
+    memcpy(slot(q, front ? 0 : q->count), item, q->itemSize);
+  }
+  q->count++;
+
+  pthread_cond_signal(&q->notEmpty);
+  pthread_mutex_unlock(&q->lock);
+
+  return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+  return queueSend(queue, item, wait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+  return queueSend(queue, item, wait, true);
+}
+
+static BaseType_t queueReceive(QueueHandle_t queue, void *item, TickType_t wait, bool remove)
+{
+  struct hostQueue *q = queue;
+
+  pthread_mutex_lock(&q->lock);
+  if (!waitFor(q, &q->notEmpty, hasItem, wait))
+  {
+    pthread_mutex_unlock(&q->lock);
+    return pdFALSE;
+  }
+
+  if (q->itemSize > 0 && item)
+  {
+    memcpy(item, slot(q, 0), q->itemSize);
+  }
+  if (remove)
+  {
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    pthread_cond_signal(&q->notFull);
+  }
+
+  pthread_mutex_unlock(&q->lock);
+
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+  return queueReceive(queue, item, wait, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t wait)
+{
+  return queueReceive(queue, item, wait, false);
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item)
+{
+  struct hostQueue *q = queue;
+
+  pthread_mutex_lock(&q->lock);
+  if (q->count > 0)
+  {
+    q->count = 0;
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  return queueSend(queue, item, 0, false);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+  struct hostQueue *q = queue;
+
+  pthread_mutex_lock(&q->lock);
+  q->head = 0;
+  q->count = 0;
+  pthread_cond_broadcast(&q->notFull);
+  pthread_mutex_unlock(&q->lock);
+
+  return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+  struct hostQueue *q = queue;
+
+  pthread_mutex_lock(&q->lock);
+  UBaseType_t count = q->count;
+  pthread_mutex_unlock(&q->lock);
+
+  return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+  struct hostQueue *q = queue;
+
+  return q->length - uxQueueMessagesWaiting(queue);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+  return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *semaphoreBuffer)
+{
+  semaphoreBuffer->handle = xSemaphoreCreateBinary();
+
+  return semaphoreBuffer->handle;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+  SemaphoreHandle_t mutex = xQueueCreate(1, 0);
+
+  xQueueSend(mutex, NULL, 0);
+
+  return mutex;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *semaphoreBuffer)
+{
+  semaphoreBuffer->handle = xSemaphoreCreateMutex();
+
+  return semaphoreBuffer->handle;
+}
@@ -0,0 +1,445 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * tdoa_sim.c - Simulates a TDoA3 anchor network and runs the TDoA engine on it
+ *
+ * Anchors are placed at random in a room and transmit at random intervals.
+ * Each anchor has its own drifting clock, receptions are lost at random and
+ * the tag receptions may be delayed by multipath. The packets received by the
+ * tag are handled as in lpsTdoa3Tag.c, the measurements sent to the estimator
+ * are compared with the true range differences and validated by the outlier
+ * filter. The cost per packet and the measurement yield are reported for a
+ * range of anchor counts.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tdoaEngine.h"
+#include "tdoaStorage.h"
+#include "outlierFilter.h"
+
+#define LOCODECK_TS_FREQ (499.2e6 * 128)
+#define SPEED_OF_LIGHT 299792458.0
+#define CLOCK_MASK 0xFFFFFFFFFFull // 40 bit DW1000 clock
+#define PACKET_TS_MASK 0xFFFFFFFFull // 32 bit time stamps in TDoA3 packets
+
+#define MAX_ANCHORS 254
+#define MAX_REMOTE_IN_PACKET 16
+#define ROOM_SIZE_XY 10.0
+#define ROOM_SIZE_Z 3.0
+
+typedef struct {
+  double x, y, z;
+} simPoint_t;
+
+typedef struct {
+  double rxTime; // True time of the last reception, < 0 if none
+  uint32_t rxTimeStamp; // In the clock of the receiving anchor
+  uint8_t seqNr;
+} simRemoteRx_t;
+
+typedef struct {
+  simPoint_t position;
+  double drift;
+  double clockOffset;
+  double nextTx;
+  uint8_t seqNr;
+  simRemoteRx_t remote[MAX_ANCHORS];
+} simAnchor_t;
+
+typedef struct {
+  int anchorCount;
+  double seconds;
+  double txRate; // Packets per second per anchor
+  double driftPpm;
+  double lossRatio;
+  double noise; // Standard deviation of the time stamp noise, m
+  double multipathRatio;
+  double multipathMean; // Mean extra path of multipath receptions, m
+  int maxRemote;
+  uint8_t matchingAlgorithm;
+  uint8_t maxPerPacket;
+  uint8_t gate; // outlierf.tdoaMode
+} simConfig_t;
+
+typedef struct {
+  int packets;
+  int measurements;
+  int accepted;
+  double ns;
+  double medianError;
+  double rmsAccepted;
+  uint32_t storageMisses;
+} simResult_t;
+
+static simAnchor_t anchors[MAX_ANCHORS];
+static simPoint_t tagPosition = {4.2, 5.3, 1.1};
+static double tagDrift;
+static double tagClockOffset;
+
+static tdoaEngineState_t engineState;
+
+static tdoaMeasurement_t *measurements;
+static int measurementCount;
+static int measurementCapacity;
+
+static double uniform(void)
+{
+  return rand() / (RAND_MAX + 1.0);
+}
+
+static double gaussian(void)
+{
+  double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+  double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+  return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+static double distance(const simPoint_t *a, const simPoint_t *b)
+{
+  return sqrt(pow(a->x - b->x, 2) + pow(a->y - b->y, 2) + pow(a->z - b->z, 2));
+}
+
+static double distanceToPoint(const point_t *a, const simPoint_t *b)
+{
+  return sqrt(pow(a->x - b->x, 2) + pow(a->y - b->y, 2) + pow(a->z - b->z, 2));
+}
+
+// Time stamp of a true time in a drifting clock, noise in meters
+static uint64_t clockTimeStamp(double time, double drift, double offset, double noise)
+{
+  double ticks = (time * (1.0 + drift) + offset) * LOCODECK_TS_FREQ + noise / SPEED_OF_LIGHT * LOCODECK_TS_FREQ;
+  return (uint64_t)llround(ticks) & CLOCK_MASK;
+}
+
+static void sendTdoaToEstimator(tdoaMeasurement_t *tdoa)
+{
+  if (measurementCount == measurementCapacity) {
+    measurementCapacity = measurementCapacity ? measurementCapacity * 2 : 4096;
+    measurements = realloc(measurements, measurementCapacity * sizeof(tdoaMeasurement_t));
+  }
+  measurements[measurementCount++] = *tdoa;
+}
+
+static void getEstimatedPosition(point_t *position)
+{
+  position->x = tagPosition.x;
+  position->y = tagPosition.y;
+  position->z = tagPosition.z;
+}
+
+// Packet of an anchor, as decoded from the air in lpsTdoa3Tag.c
+typedef struct {
+  uint8_t id;
+  uint8_t seqNr;
+  uint32_t txTimeStamp;
+  int remoteCount;
+  struct {
+    uint8_t id;
+    uint8_t seqNr;
+    uint32_t rxTimeStamp;
+    uint16_t tof;
+  } remote[MAX_REMOTE_IN_PACKET];
+} simPacket_t;
+
+// The remote anchors heard most recently go into the packet
+static void buildPacket(const simConfig_t *config, int id, double time, simPacket_t *packet)
+{
+  simAnchor_t *anchor = &anchors[id];
+  packet->id = id;
+  packet->seqNr = anchor->seqNr;
+  packet->txTimeStamp = clockTimeStamp(time, anchor->drift, anchor->clockOffset, 0) & PACKET_TS_MASK;
+  packet->remoteCount = 0;
+
+  for (int other = 0; other < config->anchorCount; other++) {
+    const simRemoteRx_t *rx = &anchor->remote[other];
+    if (other == id || rx->rxTime < 0) {
+      continue;
+    }
+
+    int pos = packet->remoteCount;
+    if (pos == config->maxRemote && anchor->remote[packet->remote[pos - 1].id].rxTime >= rx->rxTime) {
+      continue;
+    }
+    if (pos == config->maxRemote) {
+      pos--;
+    }
+    while (pos > 0 && anchor->remote[packet->remote[pos - 1].id].rxTime < rx->rxTime) {
+      packet->remote[pos] = packet->remote[pos - 1];
+      pos--;
+    }
+
+    const double tof = distance(&anchor->position, &anchors[other].position) / SPEED_OF_LIGHT;
+    packet->remote[pos].id = other;
+    packet->remote[pos].seqNr = rx->seqNr;
+    packet->remote[pos].rxTimeStamp = rx->rxTimeStamp;
+    packet->remote[pos].tof = (uint16_t)llround(tof * (1.0 + anchor->drift) * LOCODECK_TS_FREQ);
+    if (packet->remoteCount < config->maxRemote) {
+      packet->remoteCount++;
+    }
+  }
+}
+
+// Same sequence as rxcallback() in lpsTdoa3Tag.c
+static void tagReceive(const simPacket_t *packet, uint64_t rxTimeStamp, uint32_t now_ms)
+{
+  tdoaAnchorContext_t anchorCtx;
+
+  tdoaEngineGetAnchorCtxForPacketProcessing(&engineState, packet->id, now_ms, &anchorCtx);
+  for (int i = 0; i < packet->remoteCount; i++) {
+    tdoaStorageSetRemoteRxTime(&anchorCtx, packet->remote[i].id, packet->remote[i].rxTimeStamp, packet->remote[i].seqNr & 0x7f);
+    tdoaStorageSetTimeOfFlight(&anchorCtx, packet->remote[i].id, packet->remote[i].tof);
+  }
+  tdoaEngineProcessPacket(&engineState, &anchorCtx, packet->txTimeStamp, rxTimeStamp);
+  tdoaStorageSetRxTxData(&anchorCtx, rxTimeStamp, packet->txTimeStamp, packet->seqNr);
+
+  // Anchor positions are sent in LPP packets, about every 10th packet
+  if ((packet->seqNr % 10) == 0 || !tdoaStorageGetAnchorPosition(&anchorCtx, &(point_t){0})) {
+    const simPoint_t *position = &anchors[packet->id].position;
+    tdoaStorageSetAnchorPosition(&anchorCtx, position->x, position->y, position->z);
+  }
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+  const double da = *(const double*)a;
+  const double db = *(const double*)b;
+  return (da > db) - (da < db);
+}
+
+static void simulate(const simConfig_t *config, simResult_t *result)
+{
+  srand(config->anchorCount);
+  memset(result, 0, sizeof(*result));
+  measurementCount = 0;
+
+  for (int id = 0; id < config->anchorCount; id++) {
+    simAnchor_t *anchor = &anchors[id];
+    anchor->position = (simPoint_t){uniform() * ROOM_SIZE_XY, uniform() * ROOM_SIZE_XY, uniform() * ROOM_SIZE_Z};
+    anchor->drift = (uniform() * 2 - 1) * config->driftPpm * 1e-6;
+    anchor->clockOffset = uniform() * 10.0;
+    anchor->nextTx = uniform() / config->txRate;
+    anchor->seqNr = rand() & 0x7f;
+    for (int other = 0; other < config->anchorCount; other++) {
+      anchor->remote[other].rxTime = -1;
+    }
+  }
+  tagDrift = (uniform() * 2 - 1) * config->driftPpm * 1e-6;
+  tagClockOffset = uniform() * 10.0;
+
+  tdoaEngineInit(&engineState, 0, sendTdoaToEstimator, LOCODECK_TS_FREQ);
+  engineState.getEstimatedPosition = getEstimatedPosition;
+  engineState.matchingAlgorithm = config->matchingAlgorithm;
+  engineState.maxMeasurementsPerPacket = config->maxPerPacket;
+
+  simPacket_t packet;
+  struct timespec begin, end;
+
+  while (true) {
+    int id = 0;
+    for (int other = 1; other < config->anchorCount; other++) {
+      if (anchors[other].nextTx < anchors[id].nextTx) {
+        id = other;
+      }
+    }
+
+    simAnchor_t *anchor = &anchors[id];
+    const double time = anchor->nextTx;
+    if (time > config->seconds) {
+      break;
+    }
+    anchor->nextTx += (0.5 + uniform()) / config->txRate;
+    anchor->seqNr = (anchor->seqNr + 1) & 0x7f;
+
+    buildPacket(config, id, time, &packet);
+
+    // The other anchors store the reception, they send it in their next packets
+    for (int other = 0; other < config->anchorCount; other++) {
+      if (other == id || uniform() < config->lossRatio) {
+        continue;
+      }
+      simAnchor_t *receiver = &anchors[other];
+      const double rxTime = time + distance(&anchor->position, &receiver->position) / SPEED_OF_LIGHT;
+      receiver->remote[id].rxTime = rxTime;
+      receiver->remote[id].rxTimeStamp = clockTimeStamp(rxTime, receiver->drift, receiver->clockOffset, gaussian() * config->noise) & PACKET_TS_MASK;
+      receiver->remote[id].seqNr = anchor->seqNr;
+    }
+
+    if (uniform() < config->lossRatio) {
+      continue;
+    }
+
+    double path = distance(&anchor->position, &tagPosition) + gaussian() * config->noise;
+    if (uniform() < config->multipathRatio) {
+      path += -log(1.0 - uniform()) * config->multipathMean;
+    }
+    const double rxTime = time + path / SPEED_OF_LIGHT;
+    const uint64_t rxTimeStamp = clockTimeStamp(rxTime, tagDrift, tagClockOffset, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    tagReceive(&packet, rxTimeStamp, (uint32_t)(rxTime * 1000));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    result->ns += (end.tv_sec - begin.tv_sec) * 1e9 + (end.tv_nsec - begin.tv_nsec);
+    result->packets++;
+  }
+
+  // Errors against the true range differences, and the outlier filter verdict
+  // with the estimate at the true position
+  double *errors = malloc((measurementCount + 1) * sizeof(double));
+  double acceptedSquares = 0;
+  for (int i = 0; i < measurementCount; i++) {
+    const tdoaMeasurement_t *tdoa = &measurements[i];
+    const double d0 = distanceToPoint(&tdoa->anchorPosition[0], &tagPosition);
+    const double d1 = distanceToPoint(&tdoa->anchorPosition[1], &tagPosition);
+    const float error = tdoa->distanceDiff - (d1 - d0);
+    errors[i] = fabs(error);
+
+    vector_t jacobian = {
+      .x = (tagPosition.x - tdoa->anchorPosition[1].x) / d1 - (tagPosition.x - tdoa->anchorPosition[0].x) / d0,
+      .y = (tagPosition.y - tdoa->anchorPosition[1].y) / d1 - (tagPosition.y - tdoa->anchorPosition[0].y) / d0,
+      .z = (tagPosition.z - tdoa->anchorPosition[1].z) / d1 - (tagPosition.z - tdoa->anchorPosition[0].z) / d0,
+    };
+    point_t estimatedPosition;
+    getEstimatedPosition(&estimatedPosition);
+    float stdDev = tdoa->stdDev;
+    const float HPH = 0.01f;
+    const bool isGood = config->gate ? outlierFilterValidateTdoaInnovation(tdoa, error, HPH, &stdDev)
+                                     : outlierFilterValidateTdoaSteps(tdoa, error, &jacobian, &estimatedPosition);
+    if (isGood) {
+      result->accepted++;
+      acceptedSquares += error * error;
+    }
+  }
+
+  qsort(errors, measurementCount, sizeof(double), compareDoubles);
+  result->measurements = measurementCount;
+  result->medianError = measurementCount ? errors[measurementCount / 2] : 0;
+  result->rmsAccepted = result->accepted ? sqrt(acceptedSquares / result->accepted) : 0;
+  result->storageMisses = engineState.stats.contextMissCount.rateCounter.count;
+  free(errors);
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [-n counts] [-t seconds] [-r rate] [-d ppm] [-l ratio] [-e m]\n"
+          "          [-p ratio] [-q m] [-R count] [-m match] [-k count] [-g gate] [-c]\n"
+          "\n"
+          "  -n counts   Comma separated anchor counts, default 4,8,16,32,64,128\n"
+          "  -t seconds  Simulated time per anchor count, default 10\n"
+          "  -r rate     Packets per second per anchor, default 50\n"
+          "  -d ppm      Max clock drift of anchors and tag, default 10, the DW1000 spec\n"
+          "  -l ratio    Packet loss ratio per reception, default 0.05\n"
+          "  -e m        Standard deviation of the time stamp noise, default 0.02\n"
+          "  -p ratio    Part of the tag receptions with multipath, default 0.05\n"
+          "  -q m        Mean extra path of multipath receptions, default 0.5\n"
+          "  -R count    Remote anchors in a packet, default 8\n"
+          "  -m match    tdoa3.match, 0 = first, 1 = best, default 0\n"
+          "  -k count    tdoa3.maxPerPkt, default 1\n"
+          "  -g gate     outlierf.tdoaMode, 0 = steps, 1 = innovation, default 0\n"
+          "  -c          Fail unless the yield and accuracy are as expected\n",
+          name);
+}
+
+int main(int argc, char *argv[])
+{
+  simConfig_t config = {
+    .seconds = 10.0,
+    .txRate = 50.0,
+    .driftPpm = 10.0,
+    .lossRatio = 0.05,
+    .noise = 0.02,
+    .multipathRatio = 0.05,
+    .multipathMean = 0.5,
+    .maxRemote = 8,
+    .matchingAlgorithm = TdoaEngineMatchingAlgorithmRandom,
+    .maxPerPacket = 1,
+    .gate = 0,
+  };
+  char counts[256] = "4,8,16,32,64,128";
+  bool check = false;
+  int option;
+
+  while ((option = getopt(argc, argv, "n:t:r:d:l:e:p:q:R:m:k:g:c")) != -1) {
+    switch (option) {
+      case 'n': snprintf(counts, sizeof(counts), "%s", optarg); break;
+      case 't': config.seconds = atof(optarg); break;
+      case 'r': config.txRate = atof(optarg); break;
+      case 'd': config.driftPpm = atof(optarg); break;
+      case 'l': config.lossRatio = atof(optarg); break;
+      case 'e': config.noise = atof(optarg); break;
+      case 'p': config.multipathRatio = atof(optarg); break;
+      case 'q': config.multipathMean = atof(optarg); break;
+      case 'R': config.maxRemote = atoi(optarg); break;
+      case 'm': config.matchingAlgorithm = atoi(optarg); break;
+      case 'k': config.maxPerPacket = atoi(optarg); break;
+      case 'g': config.gate = atoi(optarg); break;
+      case 'c': check = true; break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  if (config.maxRemote < 1 || config.maxRemote > MAX_REMOTE_IN_PACKET || config.txRate < 16.0) {
+    // Below 16 Hz the 32 bit packet time stamps wrap between two packets
+    usage(argv[0]);
+    return 1;
+  }
+
+  printf("anchors  packets  meas/pkt  accepted  median err  rms accepted  ctx miss  ns/pkt\n");
+
+  bool ok = true;
+  for (char *count = strtok(counts, ","); count; count = strtok(NULL, ",")) {
+    config.anchorCount = atoi(count);
+    if (config.anchorCount < 2 || config.anchorCount > MAX_ANCHORS) {
+      usage(argv[0]);
+      return 1;
+    }
+
+    simResult_t result;
+    simulate(&config, &result);
+
+    const double yield = result.packets ? (double)result.measurements / result.packets : 0;
+    const double acceptedRatio = result.measurements ? (double)result.accepted / result.measurements : 0;
+    printf("%7d  %7d  %8.3f  %7.1f%%  %8.3f m  %10.3f m  %8u  %6.0f\n",
+           config.anchorCount, result.packets, yield, acceptedRatio * 100, result.medianError, result.rmsAccepted,
+           (unsigned)result.storageMisses, result.packets ? result.ns / result.packets : 0.0);
+
+    // Every packet should give a measurement once the clocks are corrected,
+    // except for losses, and the error should be close to the time stamp noise
+    if (check) {
+      const bool fits = config.anchorCount <= ANCHOR_STORAGE_COUNT;
+      ok = ok && (!fits || yield > 0.8) && result.medianError < 3 * config.noise + 0.01 && acceptedRatio > 0.8;
+    }
+  }
+
+  if (check) {
+    printf("%s\n", ok ? "PASS" : "FAIL");
+  }
+
+  return ok ? 0 : 1;
+}
@@ -90,6 +90,10 @@ static void communicate()
 
 void p2pCallbackHandler(P2PPacket *p)
 {
+  if (p->port != 0)  // other ports are used by the firmware, e.g. for the swarm time
+  {
+    return;
+  }
   PacketData receivedPacketData;
   memcpy(&receivedPacketData, p->data, sizeof(PacketData));
   otherPositions[receivedPacketData.id] = receivedPacketData.pos;